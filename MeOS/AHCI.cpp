@@ -5,12 +5,12 @@
 #include "kernel_stack.h"
 #include "error.h"
 #include "semaphore.h"
+#include "dma_pool.h"
 
 // private data and helper function
 #define NODE_INFO(x) ((ahci_storage_info*)x->deep_md)
 
 HBA_MEM_t* abar;		// PCI header Base address register 5 relative to the ahci controller
-uint32 AHCI_BASE = 0;
 uint32 port_ok = 0;		// bit significant variable that states if port is ok for use
 
 TCB_node* ahci_daemon = 0;
@@ -23,8 +23,14 @@ size_t ahci_fs_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtu
 size_t ahci_fs_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
 //error_t ahci_sync(int fd, vfs_node* file, uint32 start_page, uint32 end_page);
 error_t ahci_ioctl(vfs_node* node, uint32 command, ...);
+size_t ahci_fs_readv(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count);
+size_t ahci_fs_writev(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count);
 
 error_t ahci_data_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, DWORD count, physical_addr buf, bool read);
+error_t ahci_page_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, virtual_addr* pages, uint32 count, bool read);
+error_t ahci_prdt_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, physical_addr* bases, uint32* sizes, uint32 count,
+	uint32 sectors, bool read);
+size_t ahci_vec_transfer(vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count, bool read);
 
 static fs_operations AHCI_fs_operations =
 {
@@ -34,7 +40,9 @@ static fs_operations AHCI_fs_operations =
 	NULL,				// close
 	NULL,				// sync
 	NULL,				// lookup
-	ahci_ioctl			// ioctl
+	ahci_ioctl,			// ioctl
+	ahci_fs_readv,		// readv
+	ahci_fs_writev		// writev
 };
 
 #pragma region VFS API IMPLEMENTATION
@@ -87,8 +95,53 @@ size_t ahci_fs_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virt
 	return count;
 }
 
+size_t ahci_fs_readv(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	return ahci_vec_transfer(file, start, vec, vec_count, true);
+}
+
+size_t ahci_fs_writev(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	return ahci_vec_transfer(file, start, vec, vec_count, false);
+}
+
 error_t ahci_ioctl(vfs_node* node, uint32 command, ...)
 {
+	if (command == MASS_STORAGE_IOCTL_WRITE_PAGES || command == MASS_STORAGE_IOCTL_READ_PAGES)
+	{
+		va_list l;
+		va_start(l, command);
+
+		uint32 lba = va_arg(l, uint32);
+		uint32 count = va_arg(l, uint32);
+		virtual_addr* pages = va_arg(l, virtual_addr*);
+		uint32* done = va_arg(l, uint32*);
+
+		va_end(l);
+
+		if (node == 0 || (node->attributes & 0x7) != VFS_ATTRIBUTES::VFS_DEVICE || NODE_INFO(node) == 0)
+			return set_last_error(EINVAL, AHCI_BAD_NODE_STRUCTURE, EO_MASS_STORAGE_DEV);
+
+		uint8 port_num = NODE_INFO(node)->volume_port;
+		if (ahci_is_port_ok(port_num) == false)
+			return set_last_error(EBADSLT, AHCI_PORT_NOT_OK, EO_MASS_STORAGE_DEV);
+
+		bool read = command == MASS_STORAGE_IOCTL_READ_PAGES;
+
+		// a command table holds AHCI_PRDT_PER_COMMAND entries, so long runs take several commands
+		*done = 0;
+		while (*done < count)
+		{
+			uint32 chunk = min(count - *done, AHCI_PRDT_PER_COMMAND);
+			uint32 start = lba + *done * (PAGE_SIZE / 512);
+
+			if (ahci_page_transfer(&abar->ports[port_num], start, 0, pages + *done, chunk, read) != ERROR_OK)
+				return ERROR_OCCUR;
+
+			*done += chunk;
+		}
+	}
+
 	return ERROR_OK;
 }
 
@@ -111,7 +164,8 @@ int32 ahci_find_empty_slot(HBA_PORT_t* port)
 	return -1;
 }
 
-error_t ahci_data_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, DWORD count, physical_addr buf, bool read)
+// waits for a request slot and prepares its command header for prdtl entries. Returns the command table or 0
+HBA_CMD_TBL_t* ahci_prepare_command(HBA_PORT_t* port, WORD prdtl, bool read, int* slot_out)
 {
 	// wait for a request slot to be available
 	semaphore_wait(&ahci_request_sem);
@@ -122,7 +176,7 @@ error_t ahci_data_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, DWORD c
 	if (slot == -1) 
 	{
 		set_last_error(EBUSY, AHCI_NO_PORT_AVAIL, EO_MASS_STORAGE_DEV);
-		return ERROR_OCCUR;
+		return 0;
 	}
 
 	HBA_CMD_HEADER_t* cmd = (HBA_CMD_HEADER_t*)port->clb;
@@ -134,27 +188,18 @@ error_t ahci_data_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, DWORD c
 	else
 		cmd->w = 1;
 
-	cmd->prdtl = (WORD)((count - 1) >> 4) + 1;
+	cmd->prdtl = prdtl;
 
 	HBA_CMD_TBL_t* cmdtbl = (HBA_CMD_TBL_t*)cmd->ctba;
 	memset(cmdtbl, 0, sizeof(HBA_CMD_TBL_t) + (cmd->prdtl - 1) * sizeof(HBA_PRDT_ENTRY_t));
 
-	uint32 i;
-	// 8K bytes (16 sectors) per PRDT
-	for (i = 0; i < cmd->prdtl - 1; i++)
-	{
-		cmdtbl->prdt_entry[i].dba = (DWORD)buf;
-		cmdtbl->prdt_entry[i].dbc = 8 * 1024;	// 8K bytes
-		cmdtbl->prdt_entry[i].i = 1;
-		buf += 4 * 1024;	// 4K words
-		count -= 16;	// 16 sectors
-	}
-
-	// Last entry
-	cmdtbl->prdt_entry[i].dba = (DWORD)buf;
-	cmdtbl->prdt_entry[i].dbc = count << 9;	// 512 bytes per sector
-	cmdtbl->prdt_entry[i].i = 1;
+	*slot_out = slot;
+	return cmdtbl;
+}
 
+// fills the command FIS of the prepared slot, issues the command and waits for its completion
+error_t ahci_issue_command(HBA_PORT_t* port, int slot, HBA_CMD_TBL_t* cmdtbl, DWORD startl, DWORD starth, DWORD count, bool read)
+{
 	// Setup command
 	FIS_REG_H2D *cmdfis = (FIS_REG_H2D*)(&cmdtbl->cfis);
 
@@ -200,6 +245,149 @@ error_t ahci_data_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, DWORD c
 	return ERROR_OK;
 }
 
+error_t ahci_data_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, DWORD count, physical_addr buf, bool read)
+{
+	int slot;
+	uint32 prdtl = ((count - 1) >> 4) + 1;
+
+	HBA_CMD_TBL_t* cmdtbl = ahci_prepare_command(port, (WORD)prdtl, read, &slot);
+	if (cmdtbl == 0)
+		return ERROR_OCCUR;
+
+	uint32 i;
+	uint32 left = count;
+
+	// 8K bytes (16 sectors) per PRDT. The byte count field is zero based
+	for (i = 0; i < prdtl - 1; i++)
+	{
+		cmdtbl->prdt_entry[i].dba = (DWORD)buf;
+		cmdtbl->prdt_entry[i].dbc = 8 * 1024 - 1;	// 8K bytes
+		cmdtbl->prdt_entry[i].i = 1;
+		buf += 8 * 1024;
+		left -= 16;	// 16 sectors
+	}
+
+	// Last entry
+	cmdtbl->prdt_entry[i].dba = (DWORD)buf;
+	cmdtbl->prdt_entry[i].dbc = (left << 9) - 1;	// 512 bytes per sector
+	cmdtbl->prdt_entry[i].i = 1;
+
+	return ahci_issue_command(port, slot, cmdtbl, startl, starth, count, read);
+}
+
+// transfers whole pages to or from consecutive sectors with one PRDT entry per page (scatter-gather)
+error_t ahci_page_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, virtual_addr* pages, uint32 count, bool read)
+{
+	int slot;
+	HBA_CMD_TBL_t* cmdtbl = ahci_prepare_command(port, (WORD)count, read, &slot);
+	if (cmdtbl == 0)
+		return ERROR_OCCUR;
+
+	for (uint32 i = 0; i < count; i++)
+	{
+		cmdtbl->prdt_entry[i].dba = (DWORD)vmmngr_get_phys_addr(pages[i]);
+		cmdtbl->prdt_entry[i].dbc = PAGE_SIZE - 1;		// zero based
+		cmdtbl->prdt_entry[i].i = 1;
+	}
+
+	return ahci_issue_command(port, slot, cmdtbl, startl, starth, count * (PAGE_SIZE / 512), read);
+}
+
+// transfers count physical regions to or from consecutive sectors with one command (scatter-gather)
+error_t ahci_prdt_transfer(HBA_PORT_t* port, DWORD startl, DWORD starth, physical_addr* bases, uint32* sizes, uint32 count,
+	uint32 sectors, bool read)
+{
+	int slot;
+	HBA_CMD_TBL_t* cmdtbl = ahci_prepare_command(port, (WORD)count, read, &slot);
+	if (cmdtbl == 0)
+		return ERROR_OCCUR;
+
+	for (uint32 i = 0; i < count; i++)
+	{
+		cmdtbl->prdt_entry[i].dba = (DWORD)bases[i];
+		cmdtbl->prdt_entry[i].dbc = sizes[i] - 1;		// zero based
+		cmdtbl->prdt_entry[i].i = 1;
+	}
+
+	return ahci_issue_command(port, slot, cmdtbl, startl, starth, sectors, read);
+}
+
+// transfers the buffers (counts in sectors) to or from consecutive sectors starting at 'start'. Every page of every buffer
+// takes a PRDT entry, so a command carries up to AHCI_PRDT_PER_COMMAND pages whatever the number of buffers
+size_t ahci_vec_transfer(vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count, bool read)
+{
+	if (file == 0 || (file->attributes & 0x7) != VFS_ATTRIBUTES::VFS_DEVICE || NODE_INFO(file) == 0)
+	{
+		set_last_error(EINVAL, AHCI_BAD_NODE_STRUCTURE, EO_MASS_STORAGE_DEV);
+		return INVALID_IO;
+	}
+
+	HBA_PORT_t* port = &abar->ports[NODE_INFO(file)->volume_port];
+
+	if (ahci_is_port_ok(NODE_INFO(file)->volume_port) == false)
+	{
+		set_last_error(EBADSLT, AHCI_PORT_NOT_OK, EO_MASS_STORAGE_DEV);
+		return INVALID_IO;
+	}
+
+	// a command must end on a sector boundary, so the buffers must not split sectors across pages
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		if (vec[i].address % 512 != 0)
+		{
+			set_last_error(EINVAL, AHCI_BAD_ADDRESS, EO_MASS_STORAGE_DEV);
+			return INVALID_IO;
+		}
+	}
+
+	physical_addr bases[AHCI_PRDT_PER_COMMAND];
+	uint32 sizes[AHCI_PRDT_PER_COMMAND];
+	uint32 entries = 0;
+	uint32 sectors = 0;			// sectors of the entries
+	uint32 lba = start;
+
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		virtual_addr address = vec[i].address;
+		uint32 left = vec[i].count * 512;
+
+		while (left > 0)
+		{
+			// the table is full: issue it and go on with the next command
+			if (entries == AHCI_PRDT_PER_COMMAND)
+			{
+				if (ahci_prdt_transfer(port, lba, 0, bases, sizes, entries, sectors, read) != ERROR_OK)
+					return INVALID_IO;
+
+				lba += sectors;
+				entries = 0;
+				sectors = 0;
+			}
+
+			// an entry may not cross a page, as the next virtual page may lie anywhere in physical memory
+			uint32 size = min(left, PAGE_SIZE - address % PAGE_SIZE);
+
+			bases[entries] = vmmngr_get_phys_addr(address);
+			sizes[entries] = size;
+			entries++;
+
+			sectors += size / 512;
+			address += size;
+			left -= size;
+		}
+	}
+
+	if (entries != 0)
+	{
+		if (ahci_prdt_transfer(port, lba, 0, bases, sizes, entries, sectors, read) != ERROR_OK)
+			return INVALID_IO;
+
+		lba += sectors;
+	}
+
+	return lba - start;
+}
+
 bool ahci_start_cmd(HBA_PORT_t* port)
 {
 	if ((port->cmd & HBA_PxCMD_CR) != 0 || (port->cmd & HBA_PxCMD_FR) != 0 || (port->cmd & HBA_PxCMD_FRE) != 0)
@@ -269,12 +457,11 @@ void ahci_callback(registers_t* regs)
 
 //public functions
 
-error_t init_ahci(HBA_MEM_t* _abar, uint32 base)
+error_t init_ahci(HBA_MEM_t* _abar)
 {
 	if (_abar == 0)
 		PANIC("null abar");
 
-	AHCI_BASE = base;
 	abar = _abar;
 
 	if (vmmngr_alloc_page((virtual_addr)abar) != ERROR_OK)
@@ -306,11 +493,17 @@ error_t init_ahci(HBA_MEM_t* _abar, uint32 base)
 
 error_t ahci_setup_vfs_port(uint8 port_num)
 {
-	char buf[512];
+	// the identify packet is transfered by DMA, so it cannot live in the stack
+	char* buf = (char*)dma_pool_alloc(512, 2);
+	if (buf == 0)
+		return ERROR_OCCUR;
 
 	// read identify packet
 	if (ahci_send_identify(port_num, buf) != ERROR_OK)
+	{
+		dma_pool_free((virtual_addr)buf, 512);
 		return ERROR_OCCUR;
+	}
 
 	// create device node and get deep metadata
 	char name[8] = { 0 };
@@ -329,6 +522,7 @@ error_t ahci_setup_vfs_port(uint8 port_num)
 	dev_dmd->volume_port = port_num;
 
 	ahci_port_nodes[port_num] = node;
+	dma_pool_free((virtual_addr)buf, 512);
 
 	return ERROR_OK;
 }
@@ -346,35 +540,50 @@ error_t ahci_port_rebase(uint8 port_num)
 
 	// Command list entry size = 32 bytes
 	// Command list max entries = 32
-	// Command list max size per port = 32 * 32 bytes = 1 KB = 2^10
-	port->clb = AHCI_BASE + (port_num << 10);
+	// Command list max size per port = 32 * 32 bytes = 1 KB, 1 KB aligned
+	// FIS size = 256 bytes per port, 256 bytes aligned
+	// Both share a page of the port, so the small DMA pool does not limit the number of ports
+	virtual_addr clb = dma_alloc_buffer(PAGE_SIZE, PAGE_SIZE);
+	virtual_addr fb = clb + 1 KB;
+
+	// Command table size = AHCI_CMD_TBL_SIZE * 32 entries per port, 128 bytes aligned
+	virtual_addr ctba = dma_alloc_buffer(32 * AHCI_CMD_TBL_SIZE, 128);
+
+	if (clb == 0 || ctba == 0)
+	{
+		if (clb != 0)
+			dma_free_buffer(clb, PAGE_SIZE);
+		if (ctba != 0)
+			dma_free_buffer(ctba, 32 * AHCI_CMD_TBL_SIZE);
+
+		return ERROR_OCCUR;
+	}
+
+	// pool memory is identity mapped, so the addresses given are also physical
+	port->clb = clb;
 
 	if (ahci_is_64bit())
 		port->clbu = 0;
 
 	memset((VOID PTR)port->clb, 0, 1024);
 
-	// FIS offset = end_of_command_list (32 KB)
-	// FIS entry size = 256 bytes per port
-	port->fb = AHCI_BASE + (32 << 10) + (port_num << 8);
+	port->fb = fb;
 
 	if (ahci_is_64bit())
 		port->fbu = 0;
 
 	memset((VOID PTR)port->fb, 0, 256);
 
-	// Command table offset = end_of_FIS (32 KB + 8 KB = 40 KB)
-	// Command table size = 256 * 32 entries = 8 KB = 2^13 per port
 	HBA_CMD_HEADER_t* cmd = (HBA_CMD_HEADER_t*)(port->clb);
 	for (int i = 0; i < 32; i++)
 	{
-		cmd[i].prdtl = 8;	// 8 prdt entries per table => 256 bytes per command table
-		cmd[i].ctba = AHCI_BASE + (40 << 10) + (port_num << 13) + (i << 8);
+		cmd[i].prdtl = AHCI_PRDT_PER_COMMAND;
+		cmd[i].ctba = ctba + i * AHCI_CMD_TBL_SIZE;
 
 		if (ahci_is_64bit())
 			cmd[i].ctbau = 0;
 
-		memset((VOID PTR)cmd[i].ctba, 0, 256);
+		memset((VOID PTR)cmd[i].ctba, 0, AHCI_CMD_TBL_SIZE);
 	}
 
 	port->serr = (DWORD)-1;		// clear the error status register
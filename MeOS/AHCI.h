@@ -10,6 +10,9 @@
 #include "queue_mpmc.h"
 #include "process.h"
 
+#define AHCI_PRDT_PER_COMMAND	32		// PRDT entries of a command table (one page each for page transfers)
+#define AHCI_CMD_TBL_SIZE		(0x80 + AHCI_PRDT_PER_COMMAND * 16)	// header and PRDT (640 bytes, 128 bytes aligned)
+
 enum AHCI_ERROR 
 { 
 	AHCI_NONE = 0, 
@@ -48,7 +51,8 @@ struct ahci_storage_info
 	uint8 volume_port;						// ahci port for this volume
 };
 
-error_t init_ahci(HBA_MEM_t* abar, uint32 base);
+// initializes the controller. Port command lists, FIS and command tables are allocated from the DMA pool.
+error_t init_ahci(HBA_MEM_t* abar);
 
 error_t ahci_port_rebase(uint8 port_no);
 error_t ahci_send_identify(uint8 port, VOID* buf);
@@ -296,7 +296,7 @@ extern "C" {
 		DWORD dbau;	// data base address upper 32 bits
 		DWORD rsv0;
 
-		DWORD dbc : 22;	// data byte count, Max 4M
+		DWORD dbc : 22;	// data byte count minus one (zero based), Max 4M
 		DWORD rsv1 : 9;
 		DWORD i : 1;	// interrupt
 	} HBA_PRDT_ENTRY_t;
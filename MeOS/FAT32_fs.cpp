@@ -6,15 +6,21 @@
 #define NODE_DATA(n) ((fat_node_data*)n->deep_md)
 #define LAYOUT(n) ((fat_file_layout*)n->deep_md)
 
+#define FAT_MAX_RUN 32			// pages of the largest device request (one AHCI command)
+
 error_t fat_fs_open(vfs_node* node, uint32 capabilities);
 size_t fat_fs_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
 size_t fat_fs_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
 error_t fat_fs_sync(uint32 fd, vfs_node* file, uint32 start_page, uint32 end_page);
 error_t fat_fs_ioctl(vfs_node* node, uint32 command, ...);
+size_t fat_fs_readv(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count);
+size_t fat_fs_writev(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count);
 
 bool fat_fs_write_by_page(vfs_node* mount_point, vfs_node* node, uint32 file_page, virtual_addr address);
 size_t fat_node_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
 bool fat_fs_read_by_page(vfs_node* mount_point, vfs_node* node, uint32 file_page, virtual_addr address);
+bool fat_fs_read_by_data_cluster(vfs_node* mount_point, uint32 cluster, virtual_addr address);
+bool fat_fs_write_by_data_cluster(vfs_node* mount_point, uint32 cluster, virtual_addr address);
 
 // file operations
 static fs_operations fat_fs_operations =
@@ -25,7 +31,9 @@ static fs_operations fat_fs_operations =
 	NULL,				// close
 	fat_fs_sync,		// sync
 	NULL,				// lookup
-	fat_fs_ioctl		// ioctl?
+	fat_fs_ioctl,		// ioctl?
+	fat_fs_readv,		// readv
+	fat_fs_writev		// writev
 };
 
 // mount point operations
@@ -81,6 +89,100 @@ FAT_DIR_ATTRIBUTES vfs_to_fat_attributes(uint32 vfs_attrs)
 	return (FAT_DIR_ATTRIBUTES)attrs;
 }
 
+// transfers a run of pages held by consecutive clusters with one page vector request to the device
+bool fat_fs_transfer_run(vfs_node* mount_point, uint32 cluster, virtual_addr* pages, uint32 count, bool read)
+{
+	vfs_node* device = mount_point->tag;
+	uint32 lba = MOUNT_DATA(mount_point)->cluster_lba + (cluster - 2) * 8;
+	uint32 command = read ? MASS_STORAGE_IOCTL_READ_PAGES : MASS_STORAGE_IOCTL_WRITE_PAGES;
+	uint32 done = 0;
+
+	if (device->fs_ops->fs_ioctl != 0 && device->fs_ops->fs_ioctl(device, command, lba, count, pages, &done) != ERROR_OK)
+		return false;
+
+	// the device does not take page vectors
+	for (uint32 i = done; i < count; i++)
+	{
+		bool result = read ? fat_fs_read_by_data_cluster(mount_point, cluster + i, pages[i]) :
+			fat_fs_write_by_data_cluster(mount_point, cluster + i, pages[i]);
+
+		if (result == false)
+			return false;
+	}
+
+	return true;
+}
+
+// transfers the pages of the buffers from or to the file pages starting at 'start'. Pages whose clusters follow each other
+// on the volume are gathered into one device request
+size_t fat_fs_transfer_vec(vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count, bool read)
+{
+	if (NODE_DATA(file)->layout_loaded == false)
+	{
+		set_last_error(EPERM, FAT_NODE_NOT_OPEN, EO_MASS_STORAGE_FS);
+		return INVALID_IO;
+	}
+
+	if (start % FAT_FORMAT_PAGE_SIZE != 0)
+	{
+		set_last_error(EINVAL, FAT_BAD_ALIGN, EO_MASS_STORAGE_FS);
+		return INVALID_IO;
+	}
+
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		if (vec[i].count % FAT_FORMAT_PAGE_SIZE != 0)
+		{
+			set_last_error(EINVAL, FAT_BAD_ALIGN, EO_MASS_STORAGE_FS);
+			return INVALID_IO;
+		}
+	}
+
+	vfs_node* mount_point = file->tag;
+	fat_file_layout* layout = LAYOUT(file);
+	uint32 page = start / FAT_FORMAT_PAGE_SIZE;
+
+	virtual_addr run[FAT_MAX_RUN];
+	uint32 run_cluster = 0;
+	uint32 run_length = 0;
+	size_t total = 0;
+
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		for (uint32 offset = 0; offset < vec[i].count; offset += FAT_FORMAT_PAGE_SIZE, page++)
+		{
+			if (page >= layout->count)
+			{
+				set_last_error(EINVAL, FAT_BAD_LAYOUT, EO_MASS_STORAGE_FS);
+				return INVALID_IO;
+			}
+
+			uint32 cluster = vector_at(layout, page);
+
+			// the run ends at a gap in the cluster chain
+			if (run_length != 0 && (cluster != run_cluster + run_length || run_length == FAT_MAX_RUN))
+			{
+				if (fat_fs_transfer_run(mount_point, run_cluster, run, run_length, read) == false)
+					return INVALID_IO;
+
+				run_length = 0;
+			}
+
+			if (run_length == 0)
+				run_cluster = cluster;
+
+			run[run_length++] = vec[i].address + offset;
+		}
+
+		total += vec[i].count;
+	}
+
+	if (run_length != 0 && fat_fs_transfer_run(mount_point, run_cluster, run, run_length, read) == false)
+		return INVALID_IO;
+
+	return total;
+}
+
 // returns a compressed 8.3 (max 13 characters) with ALL spaces killed
 void fat_fs_retrieve_short_name(fat_dir_entry_short* entry, char buffer[13])
 {
@@ -165,59 +267,24 @@ bool fat_fs_validate_83_name(char* name, uint32 length)
 
 size_t fat_fs_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
 {
-	if (NODE_DATA(file)->layout_loaded == false)
-	{
-		set_last_error(EPERM, FAT_NODE_NOT_OPEN, EO_MASS_STORAGE_FS);
-		return INVALID_IO;
-	}
-
-	if (start % FAT_FORMAT_PAGE_SIZE != 0 || count % FAT_FORMAT_PAGE_SIZE != 0)
-	{
-		set_last_error(EINVAL, FAT_BAD_ALIGN, EO_MASS_STORAGE_FS);
-		return INVALID_IO;
-	}
-
-	uint32 start_pg = start / FAT_FORMAT_PAGE_SIZE;
-	vfs_node* mount_point = file->tag;
-	virtual_addr cache;
-	uint32 offset = start % FAT_FORMAT_PAGE_SIZE;
-
-
-	for (uint32 pg = 0; pg < ceil_division(count, FAT_FORMAT_PAGE_SIZE); pg++)
-	{
-		if (fat_fs_read_by_page(mount_point, file, start_pg + pg, address + FAT_FORMAT_PAGE_SIZE * pg) == false)
-			return INVALID_IO;
-	}
-
-	return count;
+	io_vec vec = { address, count };
+	return fat_fs_readv(fd, file, start, &vec, 1);
 }
 
 size_t fat_fs_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
 {
-	if (NODE_DATA(file)->layout_loaded == false)
-	{
-		set_last_error(EPERM, FAT_NODE_NOT_OPEN, EO_MASS_STORAGE_FS);
-		return INVALID_IO;
-	}
-
-	if (start % FAT_FORMAT_PAGE_SIZE != 0 || count % FAT_FORMAT_PAGE_SIZE != 0)
-	{
-		set_last_error(EINVAL, FAT_BAD_ALIGN, EO_MASS_STORAGE_FS);
-		return INVALID_IO;
-	}
-
-	uint32 start_pg = start / FAT_FORMAT_PAGE_SIZE;
-	vfs_node* mount_point = file->tag;
-	virtual_addr cache;
-	uint32 offset = start % FAT_FORMAT_PAGE_SIZE;
+	io_vec vec = { address, count };
+	return fat_fs_writev(fd, file, start, &vec, 1);
+}
 
-	for (uint32 pg = 0; pg < ceil_division(count, FAT_FORMAT_PAGE_SIZE); pg++)
-	{
-		if (fat_fs_write_by_page(mount_point, file, start_pg + pg, address + FAT_FORMAT_PAGE_SIZE * pg) == false)
-			return INVALID_IO;
-	}
+size_t fat_fs_readv(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	return fat_fs_transfer_vec(file, start, vec, vec_count, true);
+}
 
-	return count;
+size_t fat_fs_writev(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	return fat_fs_transfer_vec(file, start, vec, vec_count, false);
 }
 
 error_t fat_fs_open(vfs_node* node, uint32 capabilities)
@@ -276,9 +343,12 @@ error_t fat_fs_sync(uint32 fd, vfs_node* file, uint32 page_start, uint32 page_en
 
 		if (fat_fs_write_by_page(mount_point, file, pg, cache) == false)
 		{
+			page_cache_put_buffer(cache);
 			serial_printf("AN ERROR OCCURED\N");
 			return ERROR_OCCUR;
 		}
+
+		page_cache_put_buffer(cache);
 	}
 
 	return ERROR_OK;
@@ -286,12 +356,32 @@ error_t fat_fs_sync(uint32 fd, vfs_node* file, uint32 page_start, uint32 page_en
 
 error_t fat_fs_ioctl(vfs_node* node, uint32 command, ...)
 {
-	if (command == 0)	// invalidate
+	if (command == VFS_IOCTL_INVALIDATE)
 	{
 		// mount point data is the file descriptor for the root directory "file"
 		vfs_node* mount = node->tag;
 		mount->fs_ops->fs_write(MOUNT_DATA(mount)->fd, node, 0, 0, 0);
 	}
+	else if (command == VFS_IOCTL_BMAP)
+	{
+		va_list l;
+		va_start(l, command);
+
+		uint32 page = va_arg(l, uint32);
+		vfs_node** device = va_arg(l, vfs_node**);
+		uint32* lba = va_arg(l, uint32*);
+
+		va_end(l);
+
+		// pages past the layout have no cluster yet (see fat_fs_sync)
+		fat_file_layout* layout = LAYOUT(node);
+		if (NODE_DATA(node)->layout_loaded == false || page >= layout->count)
+			return set_last_error(EINVAL, FAT_BAD_LAYOUT, EO_MASS_STORAGE_FS);
+
+		vfs_node* mount_point = node->tag;
+		*device = mount_point->tag;
+		*lba = MOUNT_DATA(mount_point)->cluster_lba + (vector_at(layout, page) - 2) * 8;
+	}
 	
 	return ERROR_OK;
 }
@@ -412,13 +502,16 @@ size_t fat_node_write(uint32 fd, vfs_node* node, uint32 start, size_t count, vir
 	uint32 page = NODE_DATA(node)->metadata_cluster;
 	uint32 offset = NODE_DATA(node)->metadata_index;
 
-	fat_dir_entry_short* entry = (fat_dir_entry_short*)(page_cache_get_buffer(fd, page) + offset);
+	virtual_addr cache = page_cache_get_buffer(fd, page);
+	fat_dir_entry_short* entry = (fat_dir_entry_short*)(cache + offset);
 	entry->file_size = node->file_length;
 
 	char buffer[12];
 	fat_fs_generate_short_name(node, buffer);
 	memcpy(entry->name, buffer, 11);
 
+	page_cache_put_buffer(cache);
+
 	return sizeof(fat_dir_entry_short);
 }
 
@@ -12,6 +12,14 @@ enum MASS_STORAGE_COMMANDS
 	MASS_STORAGE_WRITE = 1
 };
 
+// ioctl commands of mass storage devices (numbered after the file system ones)
+enum MASS_STORAGE_IOCTL
+{
+	MASS_STORAGE_IOCTL_WRITE_PAGES = 0x100,	// (uint32 lba, uint32 count, virtual_addr* pages, uint32* written) writes whole
+											// pages, which need not be contiguous in memory, to consecutive sectors
+	MASS_STORAGE_IOCTL_READ_PAGES			// (uint32 lba, uint32 count, virtual_addr* pages, uint32* read) the reverse
+};
+
 //struct mass_storage_info;
 
 //typedef int(*mass_read)(mass_storage_info* info, uint32 start_low, uint32 start_high, uint32 count, physical_addr address);
@@ -71,7 +71,7 @@ int check(uint8 bus, uint8 device, uint8 function)
 	else if (cls == 0x2 && subcls == 0 && progif == 0)	// ethernet device
 	{
 		nic_dev = e1000_start(PCIReadRegister(bus, device, function, 0x10) & 0x1, PCIReadRegister(bus, device, function, 0x10) & 0xFFFFFFF0,
-			0x300000, 0x350000);
+			E1000_NUM_RX_DESC, E1000_NUM_TX_DESC);
 
 		// DO NOT remove these strings, they are useful for the PCI information given
 
@@ -6,6 +6,7 @@
 #include "types.h"
 #include "utility.h"
 #include "memory.h"
+#include "kmem_cache.h"
 
 #define DLLIST_PEEK(l) l->head->data
 
@@ -15,6 +16,10 @@ struct dl_list_node
 	T data;
 	dl_list_node* next;
 	dl_list_node* prev;
+
+	// the scheduler queues insert and remove nodes constantly, so they come from the slab size caches
+	void* operator new(uint32 size) { return kmem_alloc(size); }
+	void operator delete(void* ptr) { kmem_free(ptr); }
 };
 
 template<class T>
@@ -0,0 +1,165 @@
+#include "dma_pool.h"
+#include "mmngr_virtual.h"
+#include "error.h"
+#include "critlock.h"
+#include "page_frame.h"
+
+// private data
+
+static physical_addr dma_pool_base = 0;								// identity mapped pool start
+static uint32 dma_pool_units = 0;									// number of units in the pool
+static uint32 dma_pool_free_units = 0;
+static uint32 dma_pool_bitmap[DMA_POOL_MAX_SIZE / DMA_POOL_UNIT / 32];	// set bit => unit in use
+
+// private functions
+
+inline bool dma_pool_test(uint32 unit)
+{
+	return dma_pool_bitmap[unit / 32] & (1 << (unit % 32));
+}
+
+inline void dma_pool_set(uint32 unit, bool used)
+{
+	if (used)
+		dma_pool_bitmap[unit / 32] |= 1 << (unit % 32);
+	else
+		dma_pool_bitmap[unit / 32] &= ~(1 << (unit % 32));
+}
+
+// maps the physical range to the same virtual addresses
+error_t dma_map_identity(physical_addr base, uint32 size)
+{
+	for (physical_addr addr = base; addr < base + size; addr += PAGE_SIZE)
+	{
+		if (vmmngr_map_page(vmmngr_get_directory(), addr, addr, I86_PTE_PRESENT | I86_PTE_WRITABLE) != ERROR_OK)
+		{
+			set_last_error(ENOMEM, DMA_POOL_MAP_ERROR, EO_DMA_POOL);
+			return ERROR_OCCUR;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+// public functions
+
+error_t init_dma_pool(uint32 size)
+{
+	if (size == 0 || size > DMA_POOL_MAX_SIZE)
+	{
+		set_last_error(EINVAL, DMA_POOL_BAD_ARGUMENT, EO_DMA_POOL);
+		return ERROR_OCCUR;
+	}
+
+	size = pmmngr_get_next_align(size);
+
+	virtual_addr base = dma_alloc_buffer(size, PAGE_SIZE);
+	if (base == 0)
+		return ERROR_OCCUR;
+
+	dma_pool_base = base;
+	dma_pool_units = size / DMA_POOL_UNIT;
+	dma_pool_free_units = dma_pool_units;
+	memset(dma_pool_bitmap, 0, sizeof(dma_pool_bitmap));
+	memset((void*)dma_pool_base, 0, size);
+
+	return ERROR_OK;
+}
+
+virtual_addr dma_pool_alloc(uint32 size, uint32 align)
+{
+	if (dma_pool_base == 0)
+	{
+		set_last_error(EINVAL, DMA_POOL_NOT_INITIALIZED, EO_DMA_POOL);
+		return 0;
+	}
+
+	if (size == 0 || (align & (align - 1)) != 0)
+	{
+		set_last_error(EINVAL, DMA_POOL_BAD_ARGUMENT, EO_DMA_POOL);
+		return 0;
+	}
+
+	uint32 count = ceil_division(size, DMA_POOL_UNIT);
+	uint32 step = max(align / DMA_POOL_UNIT, 1);		// the pool base is page aligned so unit alignment implies address alignment
+
+	critlock_acquire();
+
+	for (uint32 start = 0; start + count <= dma_pool_units; start += step)
+	{
+		uint32 i = 0;
+		while (i < count && dma_pool_test(start + i) == false)
+			i++;
+
+		if (i != count)
+			continue;
+
+		for (i = 0; i < count; i++)
+			dma_pool_set(start + i, true);
+
+		dma_pool_free_units -= count;
+		critlock_release();
+
+		virtual_addr address = dma_pool_base + start * DMA_POOL_UNIT;
+		memset((void*)address, 0, count * DMA_POOL_UNIT);
+
+		return address;
+	}
+
+	critlock_release();
+
+	set_last_error(ENOMEM, DMA_POOL_OUT_OF_MEM, EO_DMA_POOL);
+	return 0;
+}
+
+void dma_pool_free(virtual_addr address, uint32 size)
+{
+	if (address < dma_pool_base || address >= dma_pool_base + dma_pool_units * DMA_POOL_UNIT)
+		return;
+
+	uint32 start = (address - dma_pool_base) / DMA_POOL_UNIT;
+	uint32 count = ceil_division(size, DMA_POOL_UNIT);
+
+	critlock_acquire();
+
+	for (uint32 i = start; i < start + count && i < dma_pool_units; i++)
+	{
+		if (dma_pool_test(i) == true)
+		{
+			dma_pool_set(i, false);
+			dma_pool_free_units++;
+		}
+	}
+
+	critlock_release();
+}
+
+virtual_addr dma_alloc_buffer(uint32 size, uint32 align)
+{
+	physical_addr base = (physical_addr)pmmngr_alloc_contiguous(size, max(align, PAGE_SIZE), PMMNGR_ZONE_DMA);
+	if (base == 0)
+		return 0;
+
+	// the mapping is left in place on free, just like the low memory identity map
+	if (dma_map_identity(base, pmmngr_get_next_align(size)) != ERROR_OK)
+	{
+		pmmngr_free_blocks((void*)base, size);
+		return 0;
+	}
+
+	// devices address these frames directly, so they must never be reclaimed
+	for (physical_addr addr = base; addr < base + size; addr += PAGE_SIZE)
+		page_frame_set_flags(addr, PAGE_FRAME_PINNED);
+
+	return base;
+}
+
+void dma_free_buffer(virtual_addr address, uint32 size)
+{
+	pmmngr_free_blocks((void*)address, size);
+}
+
+uint32 dma_pool_get_free()
+{
+	return dma_pool_free_units * DMA_POOL_UNIT;
+}
@@ -0,0 +1,44 @@
+#ifndef DMA_POOL_H_16102026
+#define DMA_POOL_H_16102026
+
+#include "types.h"
+#include "utility.h"
+#include "mmngr_phys.h"
+
+/*
+	Coherent DMA memory for device rings, command lists and buffers.
+	All memory is taken from the DMA zone and identity mapped (virtual == physical), so the returned address can be handed
+	to a device as is. x86 keeps DMA coherent with the caches so the pages are mapped with the default (write-back) policy.
+*/
+
+#define DMA_POOL_UNIT			64			// small allocation granularity in bytes
+#define DMA_POOL_MAX_SIZE		128 KB		// maximum size of the small allocations pool
+
+enum DMA_POOL_ERROR
+{
+	DMA_POOL_NONE,
+	DMA_POOL_NOT_INITIALIZED,
+	DMA_POOL_BAD_ARGUMENT,
+	DMA_POOL_OUT_OF_MEM,
+	DMA_POOL_MAP_ERROR
+};
+
+// initializes the small allocations pool with the given size (bytes)
+error_t init_dma_pool(uint32 size);
+
+// allocates size bytes aligned to align (power of two) from the pool. Returns the identity mapped address or 0.
+virtual_addr dma_pool_alloc(uint32 size, uint32 align);
+
+// returns memory allocated by dma_pool_alloc to the pool
+void dma_pool_free(virtual_addr address, uint32 size);
+
+// allocates a page granular physically contiguous buffer from the DMA zone. Returns the identity mapped address or 0.
+virtual_addr dma_alloc_buffer(uint32 size, uint32 align);
+
+// frees a buffer allocated by dma_alloc_buffer
+void dma_free_buffer(virtual_addr address, uint32 size);
+
+// returns the number of free bytes in the pool
+uint32 dma_pool_get_free();
+
+#endif
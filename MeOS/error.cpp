@@ -24,7 +24,14 @@ const char* ERROR_ORIGIN_STR[] =
 	"VM AREA",
 	"VM CONTRACT",
 	"OPEN FILE TBL",
-	"PAGE CACHE"
+	"PAGE CACHE",
+	"DMA POOL",
+	"SWAP",
+	"ZSWAP",
+	"KMEM",
+	"HEAP PROFILE",
+	"WRITEBACK",
+	"IO RING"
 };
 
 const char* BASE_ERROR_STR[] =
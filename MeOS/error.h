@@ -167,6 +167,13 @@ enum ERROR_ORIGIN
 	EO_VM_CONTRACT,			// virtual memory contract area
 	EO_OPEN_FILE_TBL,		// open file table component
 	EO_PAGE_CACHE,			// page cahce component
+	EO_DMA_POOL,			// DMA memory pool component
+	EO_SWAP,				// swap component
+	EO_ZSWAP,				// compressed swap tier component
+	EO_KMEM,				// slab allocator component
+	EO_HEAP_PROFILE,		// allocation profiler component
+	EO_WRITEBACK,			// page cache writeback component
+	EO_IO_RING,				// asynchronous I/O ring component
 };
 
 // defines the alphabetic names of the above error origins
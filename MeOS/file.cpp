@@ -3,6 +3,12 @@
 #include "print_utility.h"
 #include "atomic.h"
 #include "critlock.h"
+#include "writeback.h"
+#include "readahead.h"
+
+// private data
+
+#define FILE_SYNC_BATCH		16			// dirty pages fetched from the page cache at a time when syncing
 
 // private functions
 
@@ -11,6 +17,127 @@ inline bool file_validate_capabilities(uint32 base_caps, uint32 required_caps)
 	return (base_caps & (required_caps & VFS_CAP_MAX)) == (required_caps & VFS_CAP_MAX);
 }
 
+// segments the 'count' bytes into the file pages they touch => reads them to the page cache => copies to the buffer.
+// The first and last page may be copied in part
+size_t file_read_cached(uint32 gfd, gfe* entry, uint32 start, size_t count, virtual_addr buffer)
+{
+	uint32 length = entry->file_node->file_length;
+
+	// do not read past the end of file
+	if (start >= length)
+		return 0;
+
+	if (count > length - start)
+		count = length - start;
+
+	uint32 last_page = (start + count - 1) / PAGE_CACHE_SIZE;
+	size_t bytes_read = 0;
+
+	while (bytes_read < count)
+	{
+		uint32 page = (start + bytes_read) / PAGE_CACHE_SIZE;
+		uint32 offset = (start + bytes_read) % PAGE_CACHE_SIZE;
+		uint32 chunk = min(PAGE_CACHE_SIZE - offset, count - bytes_read);
+
+		// a missing page is read in with the pages after it
+		virtual_addr cache = readahead_get_buffer(gfd, page, last_page - page + 1);
+		if (cache == 0)
+			return bytes_read;
+
+		// convention: when address is -1 do not copy from the cache
+		if (buffer != -1)
+			memcpy((uint8*)buffer + bytes_read, (uint8*)cache + offset, chunk);
+
+		page_cache_put_buffer(cache);
+
+		// the next window may evict the page, so it is read only after the copy
+		readahead_start_async(gfd);
+		bytes_read += chunk;
+	}
+
+	return bytes_read;
+}
+
+// copies the buffer to the page cache pages of the file range and marks them dirty. The caller adjusts the file length
+size_t file_write_cached(uint32 gfd, gfe* entry, uint32 start, size_t count, virtual_addr buffer)
+{
+	size_t bytes_written = 0;
+
+	while (bytes_written < count)
+	{
+		uint32 page = (start + bytes_written) / PAGE_CACHE_SIZE;
+		uint32 offset = (start + bytes_written) % PAGE_CACHE_SIZE;
+		uint32 chunk = min(PAGE_CACHE_SIZE - offset, count - bytes_written);
+		virtual_addr cache = page_cache_get_buffer(gfd, page);
+
+		if (cache == 0)
+		{
+			cache = page_cache_reserve_buffer(gfd, page);
+			if (cache == 0)
+				return bytes_written;
+
+			// a page written in part keeps the rest of its data (read-modify-write). Pages past the end are zero padded
+			if (chunk < PAGE_CACHE_SIZE && page * PAGE_CACHE_SIZE < entry->file_node->file_length)
+			{
+				if (vfs_read_file(gfd, entry->file_node, page * PAGE_CACHE_SIZE, PAGE_CACHE_SIZE, cache) == INVALID_IO)
+				{
+					page_cache_put_buffer(cache);
+					page_cache_release_buffer(gfd, page);
+					return bytes_written;
+				}
+			}
+			else if (chunk < PAGE_CACHE_SIZE)
+				memset((void*)cache, 0, PAGE_CACHE_SIZE);
+		}
+
+		if (buffer != -1)
+			memcpy((uint8*)cache + offset, (uint8*)buffer + bytes_written, chunk);
+
+		// a new buffer holds its page only now
+		page_cache_set_uptodate(cache);
+		page_cache_put_buffer(cache);
+		bytes_written += chunk;
+
+		if (page_cache_make_dirty(gfd, page, true) != ERROR_OK)
+			return bytes_written;
+	}
+
+	return bytes_written;
+}
+
+// grows the file to 'end' after a cached write and throttles the writer
+void file_written_cached(gfe* entry, uint32 end)
+{
+	uint32 length = entry->file_node->file_length;
+
+	// adjust file length
+	if (end > length)
+		while (CAS<uint32>(&entry->file_node->file_length, length, end) == false)
+			length = entry->file_node->file_length;
+
+	// heavy writers pay for their dirty pages
+	writeback_balance_dirty();
+}
+
+// returns the bytes of the request, or INVALID_IO if they are too many
+size_t file_vec_count(io_vec* vec, uint32 vec_count)
+{
+	size_t total = 0;
+
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		if (vec[i].count > MAX_IO - total)
+		{
+			set_last_error(EINVAL, FILE_BIG_REQUEST, EO_FILE_INTERFACE);
+			return INVALID_IO;
+		}
+
+		total += vec[i].count;
+	}
+
+	return total;
+}
+
 // public functions
 
 error_t open_file(char* path, uint32* fd, uint32 capabilities)
@@ -90,68 +217,62 @@ size_t read_file_global(uint32 gfd, uint32 start, size_t count, virtual_addr buf
 	}
 
 	if (CHK_BIT(capabilities, VFS_CAP_CACHE))
+		return file_read_cached(gfd, entry, start, count, buffer);
+	else
 	{
-		// initiate caching and do 4KB chunks of data
-		// segment the 'count' bytes into 4KB regions => read them to the page cache => copy to user buffer
-
-		if (start % PAGE_CACHE_SIZE != 0)
-		{
-			set_last_error(EINVAL, FILE_UNALIGED_ADDRESS, EO_FILE_INTERFACE);
-			return INVALID_IO;
-		}
-
-		uint32 total_pages = ceil_division(count, PAGE_CACHE_SIZE);
-		size_t bytes_read = 0;
-
-		for (uint32 i = 0; i < total_pages; i++)
-		{
-			uint32 page = start / PAGE_CACHE_SIZE + i;
+		// the user requires immediate read to his buffer
+		// it is up to the driver to check count validity or do segmented data loading (in specific manageable chunks)
+		return vfs_read_file(gfd, entry->file_node, start, count, buffer);
+	}
 
-			// do not read past the end of file
-			if (page * PAGE_CACHE_SIZE >= entry->file_node->file_length)
-				break;
+	return INVALID_IO;
+}
 
-			virtual_addr cache = page_cache_get_buffer(gfd, page);
+size_t readv_file(uint32 fd, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	if (file_vec_count(vec, vec_count) == INVALID_IO)
+		return INVALID_IO;
 
-			// if the area hasn't been read => read it
-			if (cache == 0)
-			{
-				cache = page_cache_reserve_buffer(gfd, page);
+	lfe* local_entry = lft_get(&process_get_current()->lft, fd);
+	if (local_entry == 0)
+		return INVALID_IO;
 
-				if (cache == 0)
-					return bytes_read;
+	return readv_file_global(local_entry->gfd, start, vec, vec_count, local_entry->flags);
+}
 
-				if (vfs_read_file(gfd, entry->file_node, start + i * PAGE_CACHE_SIZE, PAGE_CACHE_SIZE, cache) == INVALID_IO)
-				{
-					page_cache_release_buffer(gfd, page);
-					return bytes_read;
-				}
-			}
+size_t readv_file_global(uint32 gfd, uint32 start, io_vec* vec, uint32 vec_count, uint32 capabilities)
+{
+	gfe* entry = gft_get(gfd);
+	if (!entry || gfe_is_invalid(entry))
+	{
+		set_last_error(EBADF, FILE_GFD_NOT_FOUND, EO_FILE_INTERFACE);
+		return INVALID_IO;
+	}
 
-			// convention: when address is -1 do not copy from the cache
-			if(buffer != -1)
-				memcpy((uint8*)buffer + i * PAGE_CACHE_SIZE, (void*)cache, min(count - bytes_read, PAGE_CACHE_SIZE));
+	if (!CHK_BIT(capabilities, VFS_CAP_READ))
+	{
+		set_last_error(EACCES, FILE_READ_ACCESS_DENIED, EO_FILE_INTERFACE);
+		return INVALID_IO;
+	}
 
-			if (count - bytes_read < PAGE_CACHE_SIZE)
-			{
-				serial_printf("zeroing cache for addr: %h", buffer + i * PAGE_CACHE_SIZE);
-				memset((char*)cache + count - bytes_read, 0, count - bytes_read);
+	if (CHK_BIT(capabilities, VFS_CAP_CACHE))
+	{
+		size_t bytes_read = 0;
 
-			}
+		// the read-ahead state carries over from buffer to buffer, so a vector reads like one long request
+		for (uint32 i = 0; i < vec_count; i++)
+		{
+			size_t done = file_read_cached(gfd, entry, start + bytes_read, vec[i].count, vec[i].address);
+			bytes_read += done;
 
-			bytes_read += min(count - bytes_read, PAGE_CACHE_SIZE);
+			if (done != vec[i].count)
+				break;
 		}
 
 		return bytes_read;
 	}
 	else
-	{
-		// the user requires immediate read to his buffer
-		// it is up to the driver to check count validity or do segmented data loading (in specific manageable chunks)
-		return vfs_read_file(gfd, entry->file_node, start, count, buffer);
-	}
-
-	return INVALID_IO;
+		return vfs_readv_file(gfd, entry->file_node, start, vec, vec_count);
 }
 
 size_t write_file(uint32 fd, uint32 start, size_t count, virtual_addr buffer)
@@ -188,59 +309,76 @@ size_t write_file_global(uint32 gfd, uint32 start, size_t count, virtual_addr bu
 
 	if (CHK_BIT(capabilities, VFS_CAP_CACHE))
 	{
-		if (start % PAGE_CACHE_SIZE != 0)
+		if (start / PAGE_CACHE_SIZE >= ceil_division(entry->file_node->file_length, PAGE_CACHE_SIZE) + 2)
 		{
-			set_last_error(EINVAL, FILE_UNALIGED_ADDRESS, EO_FILE_INTERFACE);
+			set_last_error(EINVAL, FILE_FAR_START, EO_FILE_INTERFACE);
 			return INVALID_IO;
 		}
 
+		size_t bytes_written = file_write_cached(gfd, entry, start, count, buffer);
+		file_written_cached(entry, start + bytes_written);
+
+		return bytes_written;
+	}
+	else
+		return vfs_write_file(gfd, entry->file_node, start, count, buffer);
+
+	return INVALID_IO;
+}
+
+size_t writev_file(uint32 fd, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	if (file_vec_count(vec, vec_count) == INVALID_IO)
+		return INVALID_IO;
+
+	lfe* local_entry = lft_get(&process_get_current()->lft, fd);
+	if (local_entry == 0)
+		return INVALID_IO;
+
+	return writev_file_global(local_entry->gfd, start, vec, vec_count, local_entry->flags);
+}
+
+size_t writev_file_global(uint32 gfd, uint32 start, io_vec* vec, uint32 vec_count, uint32 capabilities)
+{
+	gfe* entry = gft_get(gfd);
+	if (!entry || gfe_is_invalid(entry))
+	{
+		set_last_error(EBADF, FILE_GFD_NOT_FOUND, EO_FILE_INTERFACE);
+		return INVALID_IO;
+	}
+
+	if (CHK_BIT(capabilities, VFS_CAP_WRITE) == false)
+	{
+		set_last_error(EACCES, FILE_WRITE_ACCESS_DENIED, EO_FILE_INTERFACE);
+		return INVALID_IO;
+	}
+
+	if (CHK_BIT(capabilities, VFS_CAP_CACHE))
+	{
 		if (start / PAGE_CACHE_SIZE >= ceil_division(entry->file_node->file_length, PAGE_CACHE_SIZE) + 2)
 		{
 			set_last_error(EINVAL, FILE_FAR_START, EO_FILE_INTERFACE);
 			return INVALID_IO;
 		}
 
-		uint32 total_pages = ceil_division(count, PAGE_CACHE_SIZE);
 		size_t bytes_written = 0;
 
-		for (uint32 i = 0; i < total_pages; i++)
+		for (uint32 i = 0; i < vec_count; i++)
 		{
-			uint32 page = start / PAGE_CACHE_SIZE + i;
-			virtual_addr cache = page_cache_get_buffer(gfd, page);
+			size_t done = file_write_cached(gfd, entry, start + bytes_written, vec[i].count, vec[i].address);
+			bytes_written += done;
 
-			// if the area hasn't been read => write with zero pad
-			if (cache == 0)
-			{
-				cache = page_cache_reserve_buffer(gfd, page);
-				if (cache == 0)
-					return bytes_written;
-
-				if (count - bytes_written < PAGE_CACHE_SIZE)
-					memset((void*)cache, 0, PAGE_CACHE_SIZE - count % PAGE_CACHE_SIZE);
-			}
-
-			if (buffer != -1)
-				memcpy((void*)cache, (uint8*)buffer + i * PAGE_CACHE_SIZE, PAGE_CACHE_SIZE);
-
-			bytes_written += min(count - bytes_written, PAGE_CACHE_SIZE);
-
-			if (page_cache_make_dirty(gfd, page, true) != ERROR_OK)
-				return bytes_written;
+			if (done != vec[i].count)
+				break;
 		}
 
-		uint32 length = entry->file_node->file_length;
-
-		// adjust file length
-		if (start + bytes_written > length)
-			while (CAS<uint32>(&entry->file_node->file_length, length, start + bytes_written) == false)
-				length = entry->file_node->file_length;
+		// the length is adjusted and the writer throttled once for the whole vector
+		file_written_cached(entry, start + bytes_written);
 
 		return bytes_written;
 	}
 	else
-		return vfs_write_file(gfd, entry->file_node, start, count, buffer);
-
-	return INVALID_IO;
+		return vfs_writev_file(gfd, entry->file_node, start, vec, vec_count);
 }
 
 error_t sync_file(uint32 fd, uint32 start_page, uint32 end_page)
@@ -272,24 +410,34 @@ error_t sync_file(uint32 fd, uint32 start_page, uint32 end_page)
 		end_page = ceil_division(entry->file_node->file_length, PAGE_CACHE_SIZE);
 	}
 
-	for (uint32 pg = start_page; pg <= end_page; pg++)
+	uint32 pages[FILE_SYNC_BATCH];
+	virtual_addr buffers[FILE_SYNC_BATCH];
+	uint32 found;
+
+	// only the dirty pages are visited, in file order. They are cleaned and locked in the cache before the writes, so a
+	// concurrent writer, eviction or the writeback daemon cannot get between the lookup and the write
+	while ((found = page_cache_begin_writeback(global_fd, start_page, end_page, pages, buffers, FILE_SYNC_BATCH)) != 0)
 	{
-		// TODO: Consider speed-up using the page cache list primitive (to avoid searching each time from the beginning of the page list)
-		virtual_addr cache = page_cache_get_buffer(global_fd, pg);
+		for (uint32 i = 0; i < found; i++)
+		{
+			// write the page to the hardware
+			bool written = vfs_write_file(global_fd, entry->file_node, pages[i] * PAGE_CACHE_SIZE, PAGE_CACHE_SIZE, buffers[i]) == PAGE_CACHE_SIZE;
+			page_cache_end_writeback(global_fd, pages[i], buffers[i], written);
 
-		// assume page not loaded
-		if (cache == 0)
-			continue;
+			if (written == false)
+			{
+				// the rest of the batch stays dirty
+				for (uint32 j = i + 1; j < found; j++)
+					page_cache_end_writeback(global_fd, pages[j], buffers[j], false);
 
-		if (page_cache_is_page_dirty(global_fd, pg) == false)
-			continue;
+				return ERROR_OCCUR;
+			}
+		}
 
-		// write the page to the hardware
-		if (vfs_write_file(global_fd, entry->file_node, start_page * PAGE_CACHE_SIZE, PAGE_CACHE_SIZE, cache) != PAGE_CACHE_SIZE)
-			return ERROR_OCCUR;
+		if (pages[found - 1] >= end_page)
+			break;
 
-		if (page_cache_make_dirty(global_fd, pg, false) == ERROR_OCCUR)
-			return ERROR_OCCUR;
+		start_page = pages[found - 1] + 1;
 	}
 
 	return ERROR_OK;
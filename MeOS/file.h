@@ -39,13 +39,27 @@ enum FILE_ERROR
 	// reads the file, given its global file descriptor, to the given buffer
 	size_t read_file(uint32 fd, uint32 start, size_t count, virtual_addr buffer);
 
+	// cached reads (VFS_CAP_CACHE) take any start and count and stop at the end of the file
 	size_t read_file_global(uint32 gfd, uint32 start, size_t count, virtual_addr buffer, uint32 capabilities);
 
 	// writes to the file, given its global file descriptor, from the given buffer
 	size_t write_file(uint32 fd, uint32 start, size_t count, virtual_addr buffer);
 
+	// cached writes (VFS_CAP_CACHE) take any start and count. A page written in part is read in first
 	size_t write_file_global(uint32 gfd, uint32 start, size_t count, virtual_addr buffer, uint32 capabilities);
 
+	// reads consecutive file data to the buffers of vec, in order, with one descriptor lookup and capability check
+	size_t readv_file(uint32 fd, uint32 start, io_vec* vec, uint32 vec_count);
+
+	// uncached vectors go to the file system as a single request (fs_readv)
+	size_t readv_file_global(uint32 gfd, uint32 start, io_vec* vec, uint32 vec_count, uint32 capabilities);
+
+	// writes the buffers of vec, in order, to consecutive file data with one descriptor lookup and capability check
+	size_t writev_file(uint32 fd, uint32 start, io_vec* vec, uint32 vec_count);
+
+	// uncached vectors go to the file system as a single request (fs_writev)
+	size_t writev_file_global(uint32 gfd, uint32 start, io_vec* vec, uint32 vec_count, uint32 capabilities);
+
 	// syncs the file, given its global file descriptor
 	error_t sync_file(uint32 fd, uint32 start_page, uint32 end_page);
 
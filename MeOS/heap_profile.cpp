@@ -0,0 +1,324 @@
+#include "heap_profile.h"
+#include "mmngr_virtual.h"
+#include "critlock.h"
+#include "error.h"
+#include "timer.h"
+#include "SerialDebugger.h"
+
+// private data
+
+#define HEAP_PROFILE_TABLE_SIZE		(HEAP_PROFILE_RECORDS * sizeof(heap_profile_record))
+
+struct heap_profile_site
+{
+	virtual_addr caller;
+	uint32 count;
+	uint32 bytes;
+	uint32 oldest;				// time of the oldest allocation
+};
+
+static heap_profile_record* heap_profile_table = (heap_profile_record*)HEAP_PROFILE_WINDOW;
+static heap_profile_site heap_profile_sites[HEAP_PROFILE_SITES];
+static heap_profile_stats heap_profile_totals;
+static uint32 heap_profile_sequence = 0;
+static bool heap_profile_mapped = false;
+static bool heap_profile_ready = false;
+static volatile bool heap_profile_running = false;
+
+// private functions
+
+inline uint32 heap_profile_hash(virtual_addr address)
+{
+	return ((address >> 3) * 2654435761u) & (HEAP_PROFILE_RECORDS - 1);
+}
+
+// returns the record of address, or the free record where it would go. Called in the critical section
+heap_profile_record* heap_profile_lookup(virtual_addr address)
+{
+	uint32 index = heap_profile_hash(address);
+
+	while (heap_profile_table[index].address != 0 && heap_profile_table[index].address != address)
+		index = (index + 1) & (HEAP_PROFILE_RECORDS - 1);
+
+	return &heap_profile_table[index];
+}
+
+// empties the record at index and moves back the records after it that probed past it. Called in the critical section
+void heap_profile_remove(uint32 index)
+{
+	uint32 next = index;
+
+	for (;;)
+	{
+		heap_profile_table[index].address = 0;
+
+		for (;;)
+		{
+			next = (next + 1) & (HEAP_PROFILE_RECORDS - 1);
+
+			if (heap_profile_table[next].address == 0)
+				return;
+
+			// the record may fill the gap only if its home is not cyclically in (index, next]
+			uint32 home = heap_profile_hash(heap_profile_table[next].address);
+			if (index <= next ? (home <= index || home > next) : (home <= index && home > next))
+				break;
+		}
+
+		heap_profile_table[index] = heap_profile_table[next];
+		index = next;
+	}
+}
+
+// groups the live records of at least the sequence and at most the time by call site. Returns the sites used
+uint32 heap_profile_group(uint32 sequence, uint32 time)
+{
+	uint32 sites = 0;
+
+	memset(heap_profile_sites, 0, sizeof(heap_profile_sites));
+
+	critlock_acquire();
+
+	for (uint32 i = 0; i < HEAP_PROFILE_RECORDS; i++)
+	{
+		heap_profile_record* r = &heap_profile_table[i];
+
+		if (r->address == 0 || r->sequence < sequence || r->time > time)
+			continue;
+
+		// sites beyond the table are summed in the last one (caller 0)
+		uint32 s = 0;
+		while (s < sites && heap_profile_sites[s].caller != r->caller)
+			s++;
+
+		if (s == sites)
+		{
+			if (sites < HEAP_PROFILE_SITES)
+			{
+				sites++;
+				heap_profile_sites[s].caller = r->caller;
+				heap_profile_sites[s].oldest = r->time;
+			}
+			else
+			{
+				s = HEAP_PROFILE_SITES - 1;
+				heap_profile_sites[s].caller = 0;
+			}
+		}
+
+		heap_profile_sites[s].count++;
+		heap_profile_sites[s].bytes += r->size;
+		heap_profile_sites[s].oldest = min(heap_profile_sites[s].oldest, r->time);
+	}
+
+	critlock_release();
+	return sites;
+}
+
+// prints the 'top' grouped sites with the most bytes
+void heap_profile_print_sites(uint32 sites, uint32 top)
+{
+	uint32 now = millis();
+
+	for (uint32 printed = 0; printed < top; printed++)
+	{
+		uint32 best = sites;
+
+		for (uint32 s = 0; s < sites; s++)
+			if (heap_profile_sites[s].count != 0 && (best == sites || heap_profile_sites[s].bytes > heap_profile_sites[best].bytes))
+				best = s;
+
+		if (best == sites)
+			break;
+
+		heap_profile_site* site = &heap_profile_sites[best];
+		if (site->caller == 0)
+			serial_printf("  (other sites): %u bytes in %u allocations\n", site->bytes, site->count);
+		else
+			serial_printf("  site %h: %u bytes in %u allocations, oldest %u ms\n", site->caller, site->bytes, site->count,
+				now - site->oldest);
+
+		site->count = 0;
+	}
+}
+
+// public functions
+
+error_t init_heap_profile()
+{
+	pdirectory* dir = vmmngr_get_directory();
+
+	// the tables are created now, in the kernel directory, so that every address space shares them
+	for (virtual_addr addr = HEAP_PROFILE_WINDOW; addr < HEAP_PROFILE_WINDOW + HEAP_PROFILE_TABLE_SIZE; addr += LARGE_PAGE_SIZE)
+	{
+		pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, addr);
+
+		if (pd_entry_is_present(*e) == false && vmmngr_create_table(dir, addr, DEFAULT_FLAGS) != ERROR_OK)
+			return ERROR_OCCUR;
+	}
+
+	heap_profile_ready = true;
+	return ERROR_OK;
+}
+
+error_t heap_profile_start()
+{
+	if (heap_profile_ready == false)
+	{
+		set_last_error(EINVAL, HEAP_PROFILE_NOT_INITIALIZED, EO_HEAP_PROFILE);
+		return ERROR_OCCUR;
+	}
+
+	heap_profile_running = false;
+
+	if (heap_profile_mapped == false)
+	{
+		for (virtual_addr addr = HEAP_PROFILE_WINDOW; addr < HEAP_PROFILE_WINDOW + HEAP_PROFILE_TABLE_SIZE; addr += PAGE_SIZE)
+		{
+			if (vmmngr_alloc_page(addr) != ERROR_OK)
+			{
+				while (addr > HEAP_PROFILE_WINDOW)
+				{
+					addr -= PAGE_SIZE;
+					vmmngr_free_page_addr(addr);
+				}
+
+				set_last_error(ENOMEM, HEAP_PROFILE_OUT_OF_MEM, EO_HEAP_PROFILE);
+				return ERROR_OCCUR;
+			}
+		}
+
+		heap_profile_mapped = true;
+	}
+
+	critlock_acquire();
+
+	memset(heap_profile_table, 0, HEAP_PROFILE_TABLE_SIZE);
+	memset(&heap_profile_totals, 0, sizeof(heap_profile_stats));
+	heap_profile_sequence = 0;
+	heap_profile_running = true;
+
+	critlock_release();
+	return ERROR_OK;
+}
+
+void heap_profile_stop()
+{
+	heap_profile_running = false;
+}
+
+bool heap_profile_enabled()
+{
+	return heap_profile_running;
+}
+
+void heap_profile_alloc(void* address, uint32 size, void* caller)
+{
+	if (heap_profile_running == false || address == 0)
+		return;
+
+	critlock_acquire();
+
+	heap_profile_totals.total_allocs++;
+
+	// keep one record free so that lookups always end
+	if (heap_profile_totals.allocations == HEAP_PROFILE_RECORDS - 1)
+	{
+		heap_profile_totals.dropped++;
+		critlock_release();
+		return;
+	}
+
+	heap_profile_record* r = heap_profile_lookup((virtual_addr)address);
+	if (r->address == 0)
+		heap_profile_totals.allocations++;
+	else
+		heap_profile_totals.bytes -= r->size;		// reused without a reported free
+
+	r->address = (virtual_addr)address;
+	r->caller = (virtual_addr)caller;
+	r->size = size;
+	r->sequence = heap_profile_sequence++;
+	r->time = millis();
+
+	heap_profile_totals.bytes += size;
+	heap_profile_totals.peak_bytes = max(heap_profile_totals.peak_bytes, heap_profile_totals.bytes);
+
+	critlock_release();
+}
+
+void heap_profile_free(void* address)
+{
+	if (heap_profile_running == false || address == 0)
+		return;
+
+	critlock_acquire();
+
+	heap_profile_record* r = heap_profile_lookup((virtual_addr)address);
+	if (r->address != 0)
+	{
+		heap_profile_totals.allocations--;
+		heap_profile_totals.bytes -= r->size;
+		heap_profile_totals.total_frees++;
+
+		heap_profile_remove(r - heap_profile_table);
+	}
+
+	critlock_release();
+}
+
+heap_profile_stats heap_profile_get_stats()
+{
+	return heap_profile_totals;
+}
+
+heap_profile_snapshot heap_profile_take_snapshot()
+{
+	heap_profile_snapshot snapshot;
+
+	critlock_acquire();
+
+	snapshot.sequence = heap_profile_sequence;
+	snapshot.time = millis();
+	snapshot.allocations = heap_profile_totals.allocations;
+	snapshot.bytes = heap_profile_totals.bytes;
+
+	critlock_release();
+	return snapshot;
+}
+
+void heap_profile_print_top(uint32 top)
+{
+	if (heap_profile_mapped == false)
+		return;
+
+	heap_profile_stats stats = heap_profile_get_stats();
+	serial_printf("heap profile: %u bytes live in %u allocations (peak %u bytes, %u allocs, %u frees, %u untracked)\n",
+		stats.bytes, stats.allocations, stats.peak_bytes, stats.total_allocs, stats.total_frees, stats.dropped);
+
+	heap_profile_print_sites(heap_profile_group(0, 0xFFFFFFFF), top);
+}
+
+void heap_profile_print_diff(heap_profile_snapshot* since, uint32 top)
+{
+	if (heap_profile_mapped == false || since == 0)
+		return;
+
+	heap_profile_snapshot now = heap_profile_take_snapshot();
+	serial_printf("heap profile: in %u ms live allocations went from %u to %u and bytes from %u to %u\n",
+		now.time - since->time, since->allocations, now.allocations, since->bytes, now.bytes);
+	serial_printf("heap profile: live allocations made since the snapshot:\n");
+
+	heap_profile_print_sites(heap_profile_group(since->sequence, 0xFFFFFFFF), top);
+}
+
+void heap_profile_print_leaks(uint32 min_age, uint32 top)
+{
+	if (heap_profile_mapped == false)
+		return;
+
+	uint32 now = millis();
+	serial_printf("heap profile: allocations live for more than %u ms:\n", min_age);
+
+	heap_profile_print_sites(heap_profile_group(0, now >= min_age ? now - min_age : 0), top);
+}
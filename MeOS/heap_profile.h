@@ -0,0 +1,88 @@
+#ifndef HEAP_PROFILE_H_16102026
+#define HEAP_PROFILE_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Allocation profiler and leak tracker for the kernel allocators.
+
+	While profiling runs, malloc, realloc and free report every allocation with its call site (the return address of the
+	allocating call), size and time. The live allocations are kept in a side table of a private kernel window, so the
+	profiler itself does not allocate. Reports group the live allocations by call site and print them over the serial
+	port: the sites holding the most memory, the sites whose allocations made since a snapshot are still live, and the
+	sites of allocations that have lived longer than a given age (suspected leaks).
+*/
+
+#define HEAP_PROFILE_WINDOW		0xDF000000		// kernel virtual window of the allocation table
+#define HEAP_PROFILE_RECORDS	16384			// live allocations the table tracks (power of two)
+#define HEAP_PROFILE_SITES		256				// distinct call sites a report can group
+
+enum HEAP_PROFILE_ERROR
+{
+	HEAP_PROFILE_NONE,
+	HEAP_PROFILE_NOT_INITIALIZED,
+	HEAP_PROFILE_OUT_OF_MEM
+};
+
+struct heap_profile_record
+{
+	virtual_addr address;		// 0 => free record
+	virtual_addr caller;
+	uint32 size;
+	uint32 sequence;			// allocation number, orders the records against snapshots
+	uint32 time;				// millis at allocation
+};
+
+struct heap_profile_stats
+{
+	uint32 allocations;			// live allocations tracked
+	uint32 bytes;				// bytes of the live allocations
+	uint32 peak_bytes;			// most bytes live at once
+	uint32 total_allocs;		// allocations reported since profiling started
+	uint32 total_frees;			// frees of tracked allocations since profiling started
+	uint32 dropped;				// allocations not tracked because the table was full
+};
+
+struct heap_profile_snapshot
+{
+	uint32 sequence;			// allocations after the snapshot have this or a larger sequence
+	uint32 time;
+	uint32 allocations;
+	uint32 bytes;
+};
+
+// creates the page tables of the table window. Must be called once paging is ready, before any process is created
+error_t init_heap_profile();
+
+// maps the table (first time only), forgets any previous records and starts tracking allocations
+error_t heap_profile_start();
+
+// stops tracking. The records are kept for reports
+void heap_profile_stop();
+
+// returns true while allocations are tracked
+bool heap_profile_enabled();
+
+// tracks an allocation of size bytes at address made from caller
+void heap_profile_alloc(void* address, uint32 size, void* caller);
+
+// forgets the allocation at address (if tracked)
+void heap_profile_free(void* address);
+
+// returns the profiler totals
+heap_profile_stats heap_profile_get_stats();
+
+// marks the current point so that later reports can tell the allocations made after it
+heap_profile_snapshot heap_profile_take_snapshot();
+
+// prints the 'top' call sites holding the most live bytes
+void heap_profile_print_top(uint32 top);
+
+// prints the totals change since the snapshot and the 'top' sites of allocations made since then that are still live
+void heap_profile_print_diff(heap_profile_snapshot* since, uint32 top);
+
+// prints the 'top' sites of live allocations older than min_age milliseconds
+void heap_profile_print_leaks(uint32 min_age, uint32 top);
+
+#endif
@@ -8,6 +8,7 @@
 #include "queue_spsc.h"
 #include "thread_sched.h"
 #include "kernel_stack.h"
+#include "dma_pool.h"
 
 TCB_node* net_daemon = 0;
 queue_spsc<uint32> recv_queue;
@@ -101,45 +102,53 @@ bool e1000_read_mac_address(e1000* dev)
 	return true;
 }
 
-void rx_init(e1000* dev, physical_addr base_rx)
+error_t rx_init(e1000* dev)
 {
-	e1000_rx_desc* descs = (e1000_rx_desc*)base_rx;
+	dev->rx_descs = (e1000_rx_desc*)dma_pool_alloc(dev->rx_count * sizeof(e1000_rx_desc), 128);
+	dev->rx_buffers = dma_alloc_buffer(dev->rx_count * E1000_RX_BUFFER_SIZE, 16);
 
-	for (uint32 i = 0; i < E1000_NUM_RX_DESC; i++)
+	if (dev->rx_descs == 0 || dev->rx_buffers == 0)
+		return ERROR_OCCUR;
+
+	// DMA memory is identity mapped so the addresses are also physical
+	for (uint32 i = 0; i < dev->rx_count; i++)
 	{
-		dev->rx_descs[i] = (e1000_rx_desc*)(descs + i);
-		dev->rx_descs[i]->addr = 0x360000 + i * (2048 + 16);
-		dev->rx_descs[i]->status = 0;
+		dev->rx_descs[i].addr = dev->rx_buffers + i * E1000_RX_BUFFER_SIZE;
+		dev->rx_descs[i].status = 0;
 	}
 
-	e1000_write_command(dev, REG_RXDESCLO, base_rx);
+	e1000_write_command(dev, REG_RXDESCLO, (physical_addr)dev->rx_descs);
 	e1000_write_command(dev, REG_RXDESCHI, 0);
 
-	e1000_write_command(dev, REG_RXDESCLEN, E1000_NUM_RX_DESC * 16);
+	e1000_write_command(dev, REG_RXDESCLEN, dev->rx_count * sizeof(e1000_rx_desc));
 
 	e1000_write_command(dev, REG_RXDESCHEAD, 0);
-	e1000_write_command(dev, REG_RXDESCTAIL, E1000_NUM_RX_DESC - 1);
+	e1000_write_command(dev, REG_RXDESCTAIL, dev->rx_count - 1);
 	dev->rx_cur = 0;
 	e1000_write_command(dev, REG_RCTRL, RCTL_EN | RCTL_SBP | RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC | RCTL_BSIZE_2048);
+
+	return ERROR_OK;
 }
 
-void tx_init(e1000* dev, physical_addr base_tx)
+error_t tx_init(e1000* dev)
 {
-	e1000_rx_desc* descs = (e1000_rx_desc*)base_tx;
+	dev->tx_descs = (e1000_tx_desc*)dma_pool_alloc(dev->tx_count * sizeof(e1000_tx_desc), 128);
 
-	for (uint32 i = 0; i < E1000_NUM_TX_DESC; i++)
+	if (dev->tx_descs == 0)
+		return ERROR_OCCUR;
+
+	for (uint32 i = 0; i < dev->tx_count; i++)
 	{
-		dev->tx_descs[i] = (e1000_tx_desc*)((uint8*)descs + i * sizeof(e1000_tx_desc));
-		dev->tx_descs[i]->addr = 0;
-		dev->tx_descs[i]->cmd = 0;
+		dev->tx_descs[i].addr = 0;
+		dev->tx_descs[i].cmd = 0;
 	}
 
-	e1000_write_command(dev, REG_TXDESCLO, base_tx);
+	e1000_write_command(dev, REG_TXDESCLO, (physical_addr)dev->tx_descs);
 	e1000_write_command(dev, REG_TXDESCHI, 0);
-	e1000_write_command(dev, REG_TXDESCLEN, E1000_NUM_TX_DESC * sizeof(e1000_tx_desc));
+	e1000_write_command(dev, REG_TXDESCLEN, dev->tx_count * sizeof(e1000_tx_desc));
 
 	e1000_write_command(dev, REG_TXDESCHEAD, 0);
-	e1000_write_command(dev, REG_TXDESCTAIL, E1000_NUM_TX_DESC);
+	e1000_write_command(dev, REG_TXDESCTAIL, dev->tx_count);
 	dev->tx_cur = 0;
 	e1000_write_command(dev, REG_TCTRL, TCTL_EN
 		| TCTL_PSP
@@ -149,19 +158,21 @@ void tx_init(e1000* dev, physical_addr base_tx)
 
 	e1000_write_command(dev, REG_TCTRL, 0b0110000000000111111000011111010);
 	e1000_write_command(dev, REG_TIPG, 0x0060200A);
+
+	return ERROR_OK;
 }
 
 int e1000_send(e1000* dev, void* data, uint16 p_len)
 {
-	dev->tx_descs[dev->tx_cur]->addr = vmmngr_get_phys_addr((virtual_addr)data);
-	dev->tx_descs[dev->tx_cur]->length = p_len;
-	dev->tx_descs[dev->tx_cur]->cmd = CMD_EOP | CMD_IFCS | CMD_RS | CMD_RPS;
-	dev->tx_descs[dev->tx_cur]->status = 0;
-	uint8 old_cur = dev->tx_cur;
-	dev->tx_cur = (dev->tx_cur + 1) % E1000_NUM_TX_DESC;
+	dev->tx_descs[dev->tx_cur].addr = vmmngr_get_phys_addr((virtual_addr)data);
+	dev->tx_descs[dev->tx_cur].length = p_len;
+	dev->tx_descs[dev->tx_cur].cmd = CMD_EOP | CMD_IFCS | CMD_RS | CMD_RPS;
+	dev->tx_descs[dev->tx_cur].status = 0;
+	uint16 old_cur = dev->tx_cur;
+	dev->tx_cur = (dev->tx_cur + 1) % dev->tx_count;
 	e1000_write_command(dev, REG_TXDESCTAIL, dev->tx_cur);
 
-	while (!(dev->tx_descs[old_cur]->status & 0xf));
+	while (!(dev->tx_descs[old_cur].status & 0xf));
 	return 0;
 }
 
@@ -179,8 +190,8 @@ void e1000_recv_defered()
 			uint32 pkt_ind = queue_spsc_peek(&recv_queue);
 			queue_spsc_remove(&recv_queue);
 
-			uint8 *pkt = (uint8 *)nic_dev->rx_descs[pkt_ind]->addr;
-			uint16 pktlen = nic_dev->rx_descs[pkt_ind]->length;
+			uint8 *pkt = (uint8 *)nic_dev->rx_descs[pkt_ind].addr;
+			uint16 pktlen = nic_dev->rx_descs[pkt_ind].length;
 
 			sock_buf buffer;
 
@@ -268,7 +279,7 @@ void arp_receive_ipv4(arp_header* arp)
 // this is a test receive function for the driver to check the - not solved - problem of slow packet reception
 void test_recv_function(uint32 recv_index)
 {
-	eth_header* eth = (eth_header*)nic_dev->rx_descs[recv_index]->addr;
+	eth_header* eth = (eth_header*)nic_dev->rx_descs[recv_index].addr;
 
 	// check if this packet's destination is our pc
 	if (eth_cmp_mac(eth->dest_mac, nic_dev->mac) == false && eth_cmp_mac(eth->dest_mac, mac_broadcast) == false)
@@ -312,7 +323,7 @@ void e1000_recv_packet(e1000* dev)
 {
 	uint32 recv_index = dev->rx_cur;
 	// increment and write the tail to the device
-	dev->rx_cur = (dev->rx_cur + 1) % E1000_NUM_RX_DESC;
+	dev->rx_cur = (dev->rx_cur + 1) % dev->rx_count;
 	e1000_write_command(dev, REG_RXDESCTAIL, dev->rx_cur);
 
 	// insert the reception index for deferred processing
@@ -354,11 +365,17 @@ void e1000_enable_interrupts(e1000* dev)
 }
 
 
-e1000* e1000_start(uint8 bar_type, uint32 mem_base, physical_addr tx_base, physical_addr rx_base)
+e1000* e1000_start(uint8 bar_type, uint32 mem_base, uint16 rx_count, uint16 tx_count)
 {
+	// descriptor ring lengths must be 128 byte multiples
+	if (rx_count == 0 || tx_count == 0 || rx_count % 8 != 0 || tx_count % 8 != 0)
+		PANIC("e1000: bad ring size");
+
 	e1000* dev = new e1000;
 	dev->bar_type = bar_type;
 	dev->mem_base = mem_base;
+	dev->rx_count = rx_count;
+	dev->tx_count = tx_count;
 
 	serial_printf("--------eeprom detection\n");
 	e1000_detect_eeprom(dev);
@@ -373,7 +390,7 @@ e1000* e1000_start(uint8 bar_type, uint32 mem_base, physical_addr tx_base, physi
 
 	serial_printf("MAC address: %x %x %x %x %x %x\n", dev->mac[0], dev->mac[1], dev->mac[2], dev->mac[3], dev->mac[4], dev->mac[5]);
 
-	queue_spsc_init(&recv_queue, 32);
+	queue_spsc_init(&recv_queue, rx_count);
 
 	virtual_addr krnl_stack = kernel_stack_reserve();
 	if (krnl_stack == 0)
@@ -386,8 +403,11 @@ e1000* e1000_start(uint8 bar_type, uint32 mem_base, physical_addr tx_base, physi
 	e1000_enable_interrupts(dev);
 
 	serial_printf("--------initialization of tx\n");
-	rx_init(dev, 0x350000);
-	tx_init(dev, tx_base);
+	if (rx_init(dev) != ERROR_OK || tx_init(dev) != ERROR_OK)
+	{
+		serial_printf("e1000 ring allocation failed: %e\n", get_last_error());
+		PANIC("");
+	}
 	serial_printf("--------end initialization of tx\n");
 
 	return dev;
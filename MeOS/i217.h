@@ -95,8 +95,9 @@
 #define TSTA_LC                         (1 << 2)    // Late Collision
 #define LSTA_TU                         (1 << 3)    // Transmit Underrun
 
-#define E1000_NUM_RX_DESC				32
+#define E1000_NUM_RX_DESC				32		// default ring sizes (must be multiples of 8)
 #define E1000_NUM_TX_DESC				8
+#define E1000_RX_BUFFER_SIZE			2048	// matches RCTL_BSIZE_2048
 
 #pragma pack(push, 1)
 
@@ -132,8 +133,11 @@ struct e1000
 	uint32 mem_base;
 	bool eeprom_exists;
 	uint8 mac[6];
-	struct e1000_rx_desc *rx_descs[E1000_NUM_RX_DESC];
-	struct e1000_tx_desc *tx_descs[E1000_NUM_TX_DESC];
+	struct e1000_rx_desc *rx_descs;		// receive ring, allocated from the DMA pool
+	struct e1000_tx_desc *tx_descs;		// transmit ring, allocated from the DMA pool
+	virtual_addr rx_buffers;			// one E1000_RX_BUFFER_SIZE buffer per receive descriptor
+	uint16 rx_count;
+	uint16 tx_count;
 	uint16 rx_cur;
 	uint16 tx_cur;
 };
@@ -144,9 +148,9 @@ bool e1000_detect_eeprom(e1000* dev);
 uint32 e1000_eeprom_read(e1000* dev, uint8 addr);
 
 bool e1000_read_mac_address(e1000* dev);
-void rx_init(e1000* dev, physical_addr base_rx);
-void tx_init(e1000* dev, physical_addr base_tx);
-e1000* e1000_start(uint8 bar_type, uint32 mem_base, physical_addr tx_base, physical_addr rx_base);
+error_t rx_init(e1000* dev);
+error_t tx_init(e1000* dev);
+e1000* e1000_start(uint8 bar_type, uint32 mem_base, uint16 rx_count, uint16 tx_count);
 int e1000_send(e1000* dev, void* p_data, uint16 p_len);
 
 #endif
@@ -0,0 +1,216 @@
+#include "io_ring.h"
+#include "file.h"
+#include "memory.h"
+#include "thread_sched.h"
+#include "kernel_stack.h"
+#include "spinlock.h"
+
+// private data
+
+static spinlock io_ring_create_lock = 0;		// makes the check and set of a process ring atomic
+
+// private functions
+
+uint32 io_ring_cq_entries(io_ring* ring)
+{
+	return 2 * ring->entries;
+}
+
+// frees a ring that has no worker yet
+void io_ring_free(io_ring* ring)
+{
+	if (ring->sqes != 0)
+		free(ring->sqes);
+
+	if (ring->cqes != 0)
+		free(ring->cqes);
+
+	free(ring);
+}
+
+// runs the request and returns its result
+uint32 io_ring_run(io_ring_sqe* sqe)
+{
+	switch (sqe->opcode)
+	{
+	case IO_RING_OP_NOP:		return ERROR_OK;
+	case IO_RING_OP_READ:		return read_file(sqe->fd, sqe->start, sqe->count, sqe->buffer);
+	case IO_RING_OP_WRITE:		return write_file(sqe->fd, sqe->start, sqe->count, sqe->buffer);
+	case IO_RING_OP_FSYNC:		return sync_file(sqe->fd, sqe->start, sqe->count);
+	case IO_RING_OP_PREFETCH:	return vfs_madvise(sqe->start, sqe->count, MADV_WILLNEED);
+	}
+
+	return set_last_error(EINVAL, IO_RING_BAD_OPCODE, EO_IO_RING);
+}
+
+bool io_ring_failed(io_ring_sqe* sqe, uint32 result)
+{
+	if (sqe->opcode == IO_RING_OP_READ || sqe->opcode == IO_RING_OP_WRITE)
+		return result == INVALID_IO;
+
+	return result != ERROR_OK;
+}
+
+// the worker thread of a ring. It runs in the ring's process
+void io_ring_worker(io_ring* ring)
+{
+	while (true)
+	{
+		semaphore_wait(&ring->submitted);
+
+		// a batch may have been run already by the pass of an earlier signal
+		while (ring->sq_head != ring->sq_tail)
+		{
+			while (ring->cq_tail - ring->cq_head == io_ring_cq_entries(ring))
+				semaphore_wait(&ring->cq_space);
+
+			// copy the entry out, so the process can reuse its slot while the request runs
+			io_ring_sqe sqe = ring->sqes[ring->sq_head & (ring->entries - 1)];
+			ring->sq_head++;
+
+			io_ring_cqe* cqe = &ring->cqes[ring->cq_tail & (io_ring_cq_entries(ring) - 1)];
+			cqe->user_data = sqe.user_data;
+			cqe->result = io_ring_run(&sqe);
+			cqe->error = 0;
+
+			if (io_ring_failed(&sqe, cqe->result))
+			{
+				cqe->error = get_last_error();
+				ring->stats.failed++;
+			}
+
+			// publish the completion only once it is filled
+			ring->cq_tail++;
+			ring->stats.completed++;
+
+			semaphore_signal(&ring->completed);
+		}
+	}
+}
+
+// public functions
+
+io_ring* io_ring_create(uint32 entries)
+{
+	PCB* process = process_get_current();
+
+	if (process->ring != 0)
+	{
+		set_last_error(EEXIST, IO_RING_EXISTS, EO_IO_RING);
+		return 0;
+	}
+
+	if (entries == 0 || entries > IO_RING_MAX_ENTRIES)
+	{
+		set_last_error(EINVAL, IO_RING_BAD_ARGUMENT, EO_IO_RING);
+		return 0;
+	}
+
+	uint32 size = 1;
+	while (size < entries)
+		size <<= 1;
+
+	io_ring* ring = (io_ring*)malloc(sizeof(io_ring));
+	if (ring == 0)
+	{
+		set_last_error(ENOMEM, IO_RING_OUT_OF_MEM, EO_IO_RING);
+		return 0;
+	}
+
+	memset(ring, 0, sizeof(io_ring));
+	ring->entries = size;
+	ring->sqes = (io_ring_sqe*)malloc(size * sizeof(io_ring_sqe));
+	ring->cqes = (io_ring_cqe*)malloc(io_ring_cq_entries(ring) * sizeof(io_ring_cqe));
+	ring->process = process;
+
+	if (ring->sqes == 0 || ring->cqes == 0)
+	{
+		io_ring_free(ring);
+		set_last_error(ENOMEM, IO_RING_OUT_OF_MEM, EO_IO_RING);
+		return 0;
+	}
+
+	virtual_addr krnl_stack = kernel_stack_reserve();
+	if (krnl_stack == 0)
+	{
+		io_ring_free(ring);
+		set_last_error(ENOMEM, IO_RING_NO_STACK, EO_IO_RING);
+		return 0;
+	}
+
+	semaphore_init(&ring->submitted, 0);
+	semaphore_init(&ring->completed, 0);
+	semaphore_init(&ring->cq_space, 0);
+
+	// another thread of the process may have made its ring while this one was allocated
+	spinlock_acquire(&io_ring_create_lock);
+
+	if (process->ring != 0)
+	{
+		spinlock_release(&io_ring_create_lock);
+
+		kernel_stack_release(krnl_stack);
+		io_ring_free(ring);
+		set_last_error(EEXIST, IO_RING_EXISTS, EO_IO_RING);
+		return 0;
+	}
+
+	process->ring = ring;
+	spinlock_release(&io_ring_create_lock);
+
+	// the worker runs at the priority of the creating thread, so its requests are not starved by it
+	thread_insert(thread_create(process, (uint32)io_ring_worker, krnl_stack, 4 KB, thread_get_current()->base_priority, 1, (uint32)ring));
+	return ring;
+}
+
+io_ring_sqe* io_ring_get_sqe(io_ring* ring)
+{
+	// the slots between the worker and the pending end are taken
+	if (ring->sq_pending - ring->sq_head == ring->entries)
+		return 0;
+
+	io_ring_sqe* sqe = &ring->sqes[ring->sq_pending & (ring->entries - 1)];
+	ring->sq_pending++;
+
+	memset(sqe, 0, sizeof(io_ring_sqe));
+	return sqe;
+}
+
+uint32 io_ring_submit(io_ring* ring)
+{
+	uint32 count = ring->sq_pending - ring->sq_tail;
+	if (count == 0)
+		return 0;
+
+	ring->sq_tail = ring->sq_pending;
+
+	ring->stats.batches++;
+	ring->stats.submitted += count;
+
+	semaphore_signal(&ring->submitted);
+	return count;
+}
+
+io_ring_cqe* io_ring_peek_cqe(io_ring* ring)
+{
+	if (ring->cq_head == ring->cq_tail)
+		return 0;
+
+	return &ring->cqes[ring->cq_head & (io_ring_cq_entries(ring) - 1)];
+}
+
+void io_ring_cqe_seen(io_ring* ring)
+{
+	if (ring->cq_head == ring->cq_tail)
+		return;
+
+	ring->cq_head++;
+	semaphore_signal(&ring->cq_space);
+}
+
+void io_ring_wait(io_ring* ring, uint32 count)
+{
+	// the semaphore counts every completion, the reaped ones too, so the ring is checked again after each wake up
+	while (ring->cq_tail - ring->cq_head < count)
+		semaphore_wait(&ring->completed);
+}
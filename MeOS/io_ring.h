@@ -0,0 +1,112 @@
+#ifndef IO_RING_H_16102026
+#define IO_RING_H_16102026
+
+#include "types.h"
+#include "utility.h"
+#include "semaphore.h"
+
+/*
+	Asynchronous I/O through a submission and a completion ring.
+
+	A process creates one ring with io_ring_create. Both rings are circular buffers in kernel memory, which every address
+	space maps, so the process fills and reaps them directly. It takes submission entries with io_ring_get_sqe, publishes
+	all it has taken with one io_ring_submit, and reaps the results with io_ring_peek_cqe and io_ring_cqe_seen. Each ring
+	has one producer and one consumer, and the indices only grow (they are masked into the buffers), so neither side
+	takes a lock.
+
+	Requests are run by the I/O worker of the ring: a kernel thread of the process, so local file descriptors, mapped
+	addresses and buffers mean the same to it as to the submitter. The worker sleeps until a batch is submitted, then runs
+	the requests in order with the synchronous file functions and posts one completion per request. A thread keeps many
+	requests in flight by submitting them and only waiting (io_ring_wait) when it needs their results.
+
+	The completion ring has twice the entries of the submission ring. The worker takes a submission only when there is
+	room for its completion, so completions are never dropped: a process that does not reap stops its own worker.
+*/
+
+#define IO_RING_MAX_ENTRIES		256			// submission entries of the largest ring
+
+enum IO_RING_ERROR
+{
+	IO_RING_NONE,
+	IO_RING_EXISTS,
+	IO_RING_BAD_ARGUMENT,
+	IO_RING_OUT_OF_MEM,
+	IO_RING_NO_STACK,
+	IO_RING_BAD_OPCODE
+};
+
+enum IO_RING_OPCODE
+{
+	IO_RING_OP_NOP,
+	IO_RING_OP_READ,			// read_file(fd, start, count, buffer)
+	IO_RING_OP_WRITE,			// write_file(fd, start, count, buffer)
+	IO_RING_OP_FSYNC,			// sync_file(fd, start, count) (start and count are the first and last page)
+	IO_RING_OP_PREFETCH			// reads the file pages behind the mapped range [start, start + count) into the page cache
+};
+
+struct io_ring_sqe
+{
+	uint32 opcode;				// IO_RING_OPCODE
+	uint32 fd;					// local file descriptor
+	uint32 start;
+	uint32 count;
+	virtual_addr buffer;
+	uint32 user_data;			// handed back in the completion
+};
+
+struct io_ring_cqe
+{
+	uint32 user_data;
+	uint32 result;				// bytes transferred (INVALID_IO on failure) for reads and writes, else ERROR_OK or ERROR_OCCUR
+	uint32 error;				// last error of a failed request, else 0
+};
+
+struct io_ring_stats
+{
+	uint32 batches;				// io_ring_submit calls that published entries
+	uint32 submitted;			// entries published
+	uint32 completed;			// completions posted
+	uint32 failed;				// completions of failed requests
+};
+
+struct io_ring
+{
+	uint32 entries;						// submission entries (power of two)
+	io_ring_sqe* sqes;
+	io_ring_cqe* cqes;					// 2 * entries completions
+
+	volatile uint32 sq_head;			// next submission the worker runs (written by the worker)
+	volatile uint32 sq_tail;			// end of the submitted entries (written by the process)
+	uint32 sq_pending;					// end of the entries taken but not submitted yet
+	volatile uint32 cq_head;			// next completion the process reaps (written by the process)
+	volatile uint32 cq_tail;			// end of the posted completions (written by the worker)
+
+	semaphore submitted;				// signaled per submitted batch. The worker sleeps on it
+	semaphore completed;				// signaled per posted completion. io_ring_wait sleeps on it
+	semaphore cq_space;					// signaled per reaped completion. The worker sleeps on it while the ring is full
+
+	PCB* process;						// owner of the ring and of its worker
+	io_ring_stats stats;
+};
+
+// creates the ring of the current process, with entries submission entries (rounded up to a power of two), and starts
+// its worker. A process has one ring, which lives as long as the process
+io_ring* io_ring_create(uint32 entries);
+
+// returns the next free submission entry, or 0 if the submission ring is full. The worker does not see it before
+// io_ring_submit
+io_ring_sqe* io_ring_get_sqe(io_ring* ring);
+
+// publishes the entries taken since the last call in one batch, wakes the worker and returns their number
+uint32 io_ring_submit(io_ring* ring);
+
+// returns the oldest completion, or 0 if there is none. It stays in the ring until io_ring_cqe_seen
+io_ring_cqe* io_ring_peek_cqe(io_ring* ring);
+
+// releases the oldest completion
+void io_ring_cqe_seen(io_ring* ring);
+
+// blocks the caller until at least count completions can be reaped
+void io_ring_wait(io_ring* ring, uint32 count);
+
+#endif
@@ -24,6 +24,7 @@
 #include "MassStorageDefinitions.h"
 
 #include "page_cache.h"
+#include "writeback.h"
 #include "thread_sched.h"
 
 #include "pipe.h"
@@ -50,6 +51,12 @@
 #include "sock_buf.h"
 
 #include "kernel_stack.h"
+#include "dma_pool.h"
+#include "page_frame.h"
+#include "zero_pool.h"
+#include "swap.h"
+#include "kmem_cache.h"
+#include "heap_profile.h"
 
 #include "test_dev.h"
 
@@ -58,12 +65,23 @@
 #include "test/test_page_cache.h"
 #include "test/test_AHCI.h"
 #include "test/test_dl_list.h"
+#include "test/test_mmngr_phys.h"
+#include "test/test_mmngr_virtual.h"
+#include "test/test_kmem_cache.h"
+#include "test/test_mmngr_heap.h"
+#include "test/test_writeback.h"
+#include "test/test_readahead.h"
+#include "test/test_io_ring.h"
 
 #include "pe_loader.h"
 
 extern "C" uint8 canOutput = 1;
 extern "C" int _fltused = 1;
 
+#define KERNEL_HEAP_BASE		0xDD000000		// kernel virtual window of the kernel heap
+#define KERNEL_HEAP_INITIAL		16 KB			// committed at boot
+#define KERNEL_HEAP_RESERVE		32 MB			// most the kernel heap can grow to
+
 heap* kernel_heap = 0;
 HBA_MEM_t* _abar;
 
@@ -159,9 +177,14 @@ void test_print_time()
 	}
 }
 
+// refills the zero pool while there is nothing else to run
 void idle()
 {
-	while (true) _asm pause;
+	while (true)
+	{
+		if (zero_pool_refill(ZERO_POOL_BATCH) == 0)
+			_asm pause;
+	}
 }
 
 TCB* thread_test_time;
@@ -466,20 +489,20 @@ void proc_init_thread()
 	if (vfs_mmap(2 GB, INVALID_FD, 0, 1 GB + 10 MB, PROT_NONE | PROT_READ | PROT_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS) == MAP_FAILED)
 		PANIC("Could not map kernel land");
 
-	// map the kernel heap as alloc immediate (otherwise, if a page fault occurs in a vfs_mmap the memory_contract spinlock will not be available and the kernel hangs)
-	if (vfs_mmap(3 GB + 11 MB, INVALID_FD, 0, 16 KB, PROT_NONE | PROT_READ | PROT_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_ALLOC_IMMEDIATE) == MAP_FAILED)
-		PANIC("Could not map kernel land");
-
-	// memory map MMIO
-	if (vfs_mmap(0xF0000000, INVALID_FD, 0, 0x0FFFE000, PROT_NONE | PROT_READ | PROT_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_IDENTITY_MAP) == MAP_FAILED)
+	// memory map MMIO (device windows are identity mapped with 4MB pages)
+	if (vfs_mmap(0xF0000000, INVALID_FD, 0, 0x0FFFE000, PROT_NONE | PROT_READ | PROT_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_IDENTITY_MAP | MMAP_LARGE_PAGES) == MAP_FAILED)
 		PANIC("Could not map MMIO");
 
 	// write protect supervisor => cr0 bit 16 must be set to trigger page fault when kernel writes to read only page
 	// DISABLE THIS FOR LOADING PROCESSES
 	//enable_write_protection();
 
-	// create a 16KB heap
-	kernel_heap = heap_create(3 GB + 11 MB, 16 KB);
+	// create a 16KB heap that grows with its own window pages (mapped directly, so a heap page never faults into a vfs_mmap
+	// while the memory_contract spinlock is held)
+	kernel_heap = heap_create_growable(KERNEL_HEAP_BASE, KERNEL_HEAP_INITIAL, KERNEL_HEAP_RESERVE);
+	if (kernel_heap == 0)
+		PANIC("Could not create the kernel heap");
+
 	printfln("heap start: %h %h", kernel_heap->start_address, kernel_heap);
 
 	// re-init this processe's local file table against the new heap
@@ -495,11 +518,24 @@ void proc_init_thread()
 	page_cache_init(2 GB, 20);
 	init_global_file_table(16);
 
+	// device descriptor rings and small DMA buffers are allocated from the DMA pool. AHCI ports take whole pages
+	if (init_dma_pool(32 KB) != ERROR_OK)
+		PANIC("Could not initialize the DMA pool");
+
 	_abar = PCIFindAHCI();
 
-	uint32 ahci_base = 0x200000;
 	INT_OFF;
-	init_ahci(_abar, ahci_base);
+	init_ahci(_abar);
+
+	// cold user pages are compressed in memory and go to the swap file when physical memory runs out. Without the file
+	// only the compressed tier backs them
+	if (init_swap("sdc_mount/SWAP.SYS") != ERROR_OK)
+	{
+		serial_printf("swap file is not available, using compressed memory only: %e\n", get_last_error());
+
+		if (init_swap(0) != ERROR_OK)
+			serial_printf("swapping is disabled: %e\n", get_last_error());
+	}
 
 	/*init_net();
 	init_arp(NETWORK_LAYER);*/
@@ -614,8 +650,131 @@ void proc_init_thread()
 	INT_OFF;
 	init_keyboard();	
 
+	if (init_writeback() != ERROR_OK)
+		PANIC("Could not start the writeback daemon");
+
 
 #ifdef TEST_ENV
+	if (test_pmmngr_alloc_free() == false)
+	{
+		serial_printf("physical memory alloc free test failed...\n");
+		PANIC("");
+	}
+
+	if (test_pmmngr_alloc_contiguous() == false)
+	{
+		serial_printf("physical memory contiguous allocation test failed...\n");
+		PANIC("");
+	}
+
+	if (test_page_frame_refcount() == false)
+	{
+		serial_printf("page frame refcount test failed...\n");
+		PANIC("");
+	}
+
+	if (test_pmmngr_benchmark() == false)
+	{
+		serial_printf("physical memory benchmark failed...\n");
+		PANIC("");
+	}
+
+	if (test_vmmngr_large_page() == false)
+	{
+		serial_printf("virtual memory large page test failed...\n");
+		PANIC("");
+	}
+
+	if (test_vmmngr_large_page_benchmark() == false)
+	{
+		serial_printf("virtual memory large page benchmark failed...\n");
+		PANIC("");
+	}
+
+	if (test_vmmngr_global_pages() == false)
+	{
+		serial_printf("virtual memory global pages test failed...\n");
+		PANIC("");
+	}
+
+	if (test_vmmngr_context_switch_benchmark() == false)
+	{
+		serial_printf("context switch benchmark failed...\n");
+		PANIC("");
+	}
+
+	if (test_vmmngr_cow() == false)
+	{
+		serial_printf("copy on write test failed...\n");
+		PANIC("");
+	}
+
+	if (test_vm_area_readahead() == false)
+	{
+		serial_printf("vm area read-ahead test failed...\n");
+		PANIC("");
+	}
+
+	if (test_vm_contract_lookup() == false)
+	{
+		serial_printf("vm contract lookup test failed...\n");
+		PANIC("");
+	}
+
+	if (test_zero_pool() == false)
+	{
+		serial_printf("zero pool test failed...\n");
+		PANIC("");
+	}
+
+	if (test_swap_compression() == false)
+	{
+		serial_printf("swap compression test failed...\n");
+		PANIC("");
+	}
+
+	if (test_swap_tiers() == false)
+	{
+		serial_printf("swap tiers test failed...\n");
+		PANIC("");
+	}
+
+	if (test_kmem_cache() == false)
+	{
+		serial_printf("kmem cache test failed...\n");
+		PANIC("");
+	}
+
+	if (test_kmem_alloc_benchmark() == false)
+	{
+		serial_printf("kmem benchmark failed...\n");
+		PANIC("");
+	}
+
+	if (test_heap_integrity() == false)
+	{
+		serial_printf("heap integrity test failed...\n");
+		PANIC("");
+	}
+
+	if (test_heap_malloc_benchmark() == false)
+	{
+		serial_printf("heap benchmark failed...\n");
+		PANIC("");
+	}
+
+	if (test_heap_growth() == false)
+	{
+		serial_printf("heap growth test failed...\n");
+		PANIC("");
+	}
+
+	if (test_heap_profile() == false)
+	{
+		serial_printf("heap profile test failed...\n");
+		PANIC("");
+	}
+
 	if (test_open_file_table_open() == false)
 	{
 		serial_printf("test failed...\n");
@@ -652,6 +811,54 @@ void proc_init_thread()
 		PANIC("");
 	}
 
+	if (test_page_index() == false)
+	{
+		serial_printf("page index test failed");
+		PANIC("");
+	}
+
+	if (test_page_cache_eviction() == false)
+	{
+		serial_printf("page cache eviction test failed");
+		PANIC("");
+	}
+
+	if (test_writeback() == false)
+	{
+		serial_printf("writeback test failed");
+		PANIC("");
+	}
+
+	if (test_readahead() == false)
+	{
+		serial_printf("read-ahead test failed");
+		PANIC("");
+	}
+
+	if (test_file_cached_bytes() == false)
+	{
+		serial_printf("unaligned cached file test failed");
+		PANIC("");
+	}
+
+	if (test_io_ring() == false)
+	{
+		serial_printf("io ring test failed");
+		PANIC("");
+	}
+
+	if (test_file_vectored() == false)
+	{
+		serial_printf("vectored file test failed");
+		PANIC("");
+	}
+
+	if (test_ahci_page_transfer() == false)
+	{
+		serial_printf("ahci page transfer test failed");
+		PANIC("");
+	}
+
 	init_test_dev();
 
 	// do not run the three tests below simulatneously as they require pages not be cached
@@ -920,14 +1127,28 @@ int kmain(multiboot_info* _boot_info, kernel_info* k_info)
 			pmmngr_free_region(&physical_memory_region(region[i].startLo, region[i].sizeLo));
 	}
 
-	pmmngr_reserve_region(&physical_memory_region(0x100000, pmmngr_get_next_align(k_info->kernel_size + 1)));
+	// the physical memory manager structures are placed right after the kernel image, so reserve and map them together
+	uint32 kernel_footprint = pmmngr_get_next_align(k_info->kernel_size + pmmngr_get_metadata_size() + 1);
+	pmmngr_reserve_region(&physical_memory_region(0x100000, kernel_footprint));
 
-	vmmngr_initialize(pmmngr_get_next_align(k_info->kernel_size + 1) / 4096);
+	vmmngr_initialize(kernel_footprint / 4096);
 	pmmngr_paging_enable(true);
 
+	if (page_frame_db_init() != ERROR_OK)
+		PANIC("cannot create the page frame database");
+
+	if (init_zero_pool() != ERROR_OK)
+		PANIC("cannot create the zero page pool");
+
+	if (init_kmem() != ERROR_OK)
+		PANIC("cannot create the slab caches");
+
+	if (init_heap_profile() != ERROR_OK)
+		PANIC("cannot prepare the heap profiler");
+
 	// create a minimal multihtreaded environment to work with
 
-	virtual_addr space = pmmngr_get_next_align(0xC0000000 + k_info->kernel_size + 4096);
+	virtual_addr space = pmmngr_get_next_align(0xC0000000 + kernel_footprint + 4096);
 
 	if (vmmngr_is_page_present(space))
 		printfln("space: %h alloced", space);
@@ -0,0 +1,638 @@
+#include "kmem_cache.h"
+#include "mmngr_virtual.h"
+#include "critlock.h"
+#include "memory.h"
+#include "error.h"
+#include "print_utility.h"
+#include "thread_sched.h"
+#include "atomic.h"
+
+// private data
+
+#define KMEM_WINDOW_PAGES		(KMEM_WINDOW_SIZE / PAGE_SIZE)
+#define KMEM_DEFAULT_ALIGN		8
+#define KMEM_COLOR_STEP			64				// cache line size. Colors move the objects by whole lines
+
+static uint32 kmem_pages[KMEM_WINDOW_PAGES / 32];					// set bit => window page in use
+static uint32 kmem_page_cursor = 0;									// next window page to try
+static kmem_cache kmem_cache_cache;									// cache of the kmem_cache structures
+static kmem_cache* kmem_caches = 0;									// all caches
+static kmem_cache* kmem_size_caches[KMEM_SIZE_CACHES];
+static bool kmem_ready = false;
+
+static char* kmem_size_names[KMEM_SIZE_CACHES] =
+{
+	"size-16", "size-32", "size-64", "size-128", "size-256", "size-512", "size-1024"
+};
+
+// private functions
+
+inline uint32 kmem_round(uint32 value, uint32 align)
+{
+	return (value + align - 1) & ~(align - 1);
+}
+
+inline uint32 kmem_header_size(kmem_cache* c)
+{
+	return kmem_round(sizeof(kmem_slab), c->align);
+}
+
+inline uint32 kmem_color_step(kmem_cache* c)
+{
+	return max(c->align, KMEM_COLOR_STEP);
+}
+
+// the free list link is kept after the object when a constructor must find its state intact, otherwise in the object
+inline void** kmem_link(kmem_cache* c, void* object)
+{
+	return (void**)((uint8*)object + (c->ctor == 0 ? 0 : c->object_size - sizeof(void*)));
+}
+
+inline kmem_slab* kmem_object_slab(void* object)
+{
+	return (kmem_slab*)((virtual_addr)object & ~(PAGE_SIZE - 1));
+}
+
+inline bool kmem_is_slab_address(void* ptr)
+{
+	return (virtual_addr)ptr >= KMEM_WINDOW_BASE && (virtual_addr)ptr < KMEM_WINDOW_BASE + KMEM_WINDOW_SIZE;
+}
+
+// smallest size cache that fits size
+uint32 kmem_size_index(uint32 size)
+{
+	uint32 index = 0;
+
+	for (uint32 cache_size = KMEM_MIN_SIZE; cache_size < size; cache_size <<= 1)
+		index++;
+
+	return index;
+}
+
+// reserves a window page and maps a frame to it. Returns 0 if memory is out
+virtual_addr kmem_page_alloc()
+{
+	virtual_addr addr = 0;
+
+	critlock_acquire();
+
+	for (uint32 i = 0; i < KMEM_WINDOW_PAGES; i++)
+	{
+		uint32 page = (kmem_page_cursor + i) % KMEM_WINDOW_PAGES;
+
+		if ((kmem_pages[page / 32] & (1 << (page % 32))) == 0)
+		{
+			kmem_pages[page / 32] |= 1 << (page % 32);
+			kmem_page_cursor = page + 1;
+			addr = KMEM_WINDOW_BASE + page * PAGE_SIZE;
+			break;
+		}
+	}
+
+	critlock_release();
+
+	if (addr == 0)
+	{
+		set_last_error(ENOMEM, KMEM_OUT_OF_MEM, EO_KMEM);
+		return 0;
+	}
+
+	// the mapping may have to reclaim memory, so it runs outside the critical section
+	if (vmmngr_alloc_page(addr) != ERROR_OK)
+	{
+		uint32 page = (addr - KMEM_WINDOW_BASE) / PAGE_SIZE;
+
+		critlock_acquire();
+		kmem_pages[page / 32] &= ~(1 << (page % 32));
+		critlock_release();
+
+		set_last_error(ENOMEM, KMEM_OUT_OF_MEM, EO_KMEM);
+		return 0;
+	}
+
+	return addr;
+}
+
+void kmem_page_free(virtual_addr addr)
+{
+	vmmngr_free_page_addr(addr);
+	vmmngr_flush_TLB_entry(addr);
+
+	uint32 page = (addr - KMEM_WINDOW_BASE) / PAGE_SIZE;
+
+	critlock_acquire();
+	kmem_pages[page / 32] &= ~(1 << (page % 32));
+	critlock_release();
+}
+
+// returns the list the slab belongs to based on its used objects
+kmem_slab** kmem_slab_list(kmem_cache* c, kmem_slab* s)
+{
+	if (s->in_use == 0)
+		return &c->empty;
+
+	if (s->in_use == c->objects)
+		return &c->full;
+
+	return &c->partial;
+}
+
+void kmem_slab_link(kmem_cache* c, kmem_slab** list, kmem_slab* s)
+{
+	s->prev = 0;
+	s->next = *list;
+
+	if (*list != 0)
+		(*list)->prev = s;
+
+	*list = s;
+
+	if (list == &c->empty)
+		c->empty_count++;
+}
+
+void kmem_slab_unlink(kmem_cache* c, kmem_slab** list, kmem_slab* s)
+{
+	if (s->prev != 0)
+		s->prev->next = s->next;
+	else
+		*list = s->next;
+
+	if (s->next != 0)
+		s->next->prev = s->prev;
+
+	s->prev = s->next = 0;
+
+	if (list == &c->empty)
+		c->empty_count--;
+}
+
+// builds a slab with all objects free and constructed, starting them at the given color
+kmem_slab* kmem_slab_create(kmem_cache* c, uint32 color)
+{
+	virtual_addr page = kmem_page_alloc();
+	if (page == 0)
+		return 0;
+
+	kmem_slab* s = (kmem_slab*)page;
+	s->magic = KMEM_SLAB_MAGIC;
+	s->in_use = 0;
+	s->cache = c;
+	s->prev = s->next = 0;
+	s->free_list = 0;
+
+	uint8* first = (uint8*)page + kmem_header_size(c) + color * kmem_color_step(c);
+
+	// thread the free list backwards so that objects are handed out in address order
+	for (uint32 i = c->objects; i > 0; i--)
+	{
+		void* object = first + (i - 1) * c->object_size;
+
+		if (c->ctor != 0)
+			c->ctor(object);
+
+		*kmem_link(c, object) = s->free_list;
+		s->free_list = object;
+	}
+
+	return s;
+}
+
+// fills the cache structure. Returns false if the objects do not fit in a slab
+bool kmem_cache_setup(kmem_cache* c, char* name, uint32 size, uint32 align, kmem_ctor ctor)
+{
+	memset(c, 0, sizeof(kmem_cache));
+
+	c->name = name;
+	c->align = align == 0 ? KMEM_DEFAULT_ALIGN : align;
+	c->ctor = ctor;
+
+	// a constructed object keeps its state while free, so the free list link gets a word of its own
+	uint32 link = ctor == 0 ? 0 : sizeof(void*);
+	c->object_size = kmem_round(max(size, sizeof(void*)) + link, c->align);
+
+	uint32 header = kmem_header_size(c);
+	if (c->object_size > PAGE_SIZE - header)
+		return false;
+
+	c->objects = (PAGE_SIZE - header) / c->object_size;
+	c->colors = (PAGE_SIZE - header - c->objects * c->object_size) / kmem_color_step(c) + 1;
+
+	critlock_acquire();
+	c->next = kmem_caches;
+	kmem_caches = c;
+	critlock_release();
+
+	return true;
+}
+
+// detaches the empty slabs beyond 'keep' and releases their pages
+uint32 kmem_cache_release_empty(kmem_cache* c, uint32 keep)
+{
+	kmem_slab* released = 0;
+	uint32 count = 0;
+
+	critlock_acquire();
+
+	while (c->empty_count > keep)
+	{
+		kmem_slab* s = c->empty;
+		kmem_slab_unlink(c, &c->empty, s);
+
+		s->next = released;
+		released = s;
+		c->stats.slabs--;
+		count++;
+	}
+
+	critlock_release();
+
+	while (released != 0)
+	{
+		kmem_slab* next = released->next;
+
+		released->magic = 0;
+		kmem_page_free((virtual_addr)released);
+		released = next;
+	}
+
+	return count;
+}
+
+// makes sure the cache has a slab with a free object. Entered and left in the critical section, which is dropped while
+// a slab is built. Returns false if memory is out
+bool kmem_cache_reserve(kmem_cache* cache)
+{
+	while (cache->partial == 0 && cache->empty == 0)
+	{
+		uint32 color = cache->color_next;
+		cache->color_next = (color + 1) % cache->colors;
+
+		critlock_release();
+		kmem_slab* created = kmem_slab_create(cache, color);
+		critlock_acquire();
+
+		if (created == 0)
+			return false;
+
+		kmem_slab_link(cache, &cache->empty, created);
+		cache->stats.slabs++;
+	}
+
+	return true;
+}
+
+// takes a free object from a partial (or else an empty) slab. Called in the critical section
+void* kmem_slab_take(kmem_cache* cache)
+{
+	kmem_slab* s = cache->partial != 0 ? cache->partial : cache->empty;
+	kmem_slab** list = kmem_slab_list(cache, s);
+
+	void* object = s->free_list;
+	s->free_list = *kmem_link(cache, object);
+	s->in_use++;
+
+	if (kmem_slab_list(cache, s) != list)
+	{
+		kmem_slab_unlink(cache, list, s);
+		kmem_slab_link(cache, kmem_slab_list(cache, s), s);
+	}
+
+	cache->stats.allocs++;
+	cache->stats.in_use++;
+
+	return object;
+}
+
+// gives the object back to its slab s. Called in the critical section
+void kmem_slab_put(kmem_cache* cache, kmem_slab* s, void* object)
+{
+	kmem_slab** list = kmem_slab_list(cache, s);
+
+	*kmem_link(cache, object) = s->free_list;
+	s->free_list = object;
+	s->in_use--;
+
+	if (kmem_slab_list(cache, s) != list)
+	{
+		kmem_slab_unlink(cache, list, s);
+		kmem_slab_link(cache, kmem_slab_list(cache, s), s);
+	}
+
+	cache->stats.frees++;
+	cache->stats.in_use--;
+}
+
+// threads whose magazines kmem_reclaim empties
+struct kmem_reclaim_threads
+{
+	TCB* threads[KMEM_RECLAIM_THREADS];
+	uint32 count;
+};
+
+// adds the thread to the kmem_reclaim_threads list param. Called with interrupts off
+void kmem_reclaim_gather(TCB* thread, void* param)
+{
+	kmem_reclaim_threads* list = (kmem_reclaim_threads*)param;
+
+	if (list->count < KMEM_RECLAIM_THREADS)
+		list->threads[list->count++] = thread;
+}
+
+// public functions
+
+error_t init_kmem()
+{
+	pdirectory* dir = vmmngr_get_directory();
+	pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, KMEM_WINDOW_BASE);
+
+	// the table is created now, in the kernel directory, so that every address space shares it
+	if (pd_entry_is_present(*e) == false && vmmngr_create_table(dir, KMEM_WINDOW_BASE, DEFAULT_FLAGS) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	memset(kmem_pages, 0, sizeof(kmem_pages));
+	kmem_cache_setup(&kmem_cache_cache, "kmem_cache", sizeof(kmem_cache), 0, 0);
+	kmem_ready = true;
+
+	for (uint32 i = 0; i < KMEM_SIZE_CACHES; i++)
+	{
+		kmem_size_caches[i] = kmem_cache_create(kmem_size_names[i], KMEM_MIN_SIZE << i, 0, 0);
+
+		if (kmem_size_caches[i] == 0)
+		{
+			kmem_ready = false;
+			return ERROR_OCCUR;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+kmem_cache* kmem_cache_create(char* name, uint32 size, uint32 align, kmem_ctor ctor)
+{
+	if (kmem_ready == false)
+	{
+		set_last_error(EINVAL, KMEM_NOT_INITIALIZED, EO_KMEM);
+		return 0;
+	}
+
+	if (size == 0 || (align & (align - 1)) != 0 || align > PAGE_SIZE / 2)
+	{
+		set_last_error(EINVAL, KMEM_BAD_ARGUMENT, EO_KMEM);
+		return 0;
+	}
+
+	kmem_cache* c = (kmem_cache*)kmem_cache_alloc(&kmem_cache_cache);
+	if (c == 0)
+		return 0;
+
+	if (kmem_cache_setup(c, name, size, align, ctor) == false)
+	{
+		kmem_cache_free(&kmem_cache_cache, c);
+		set_last_error(EINVAL, KMEM_BAD_ARGUMENT, EO_KMEM);
+		return 0;
+	}
+
+	return c;
+}
+
+error_t kmem_cache_destroy(kmem_cache* cache)
+{
+	if (cache == 0 || cache == &kmem_cache_cache || cache->partial != 0 || cache->full != 0)
+	{
+		set_last_error(EINVAL, KMEM_BAD_ARGUMENT, EO_KMEM);
+		return ERROR_OCCUR;
+	}
+
+	kmem_cache_release_empty(cache, 0);
+
+	critlock_acquire();
+
+	for (kmem_cache** link = &kmem_caches; *link != 0; link = &(*link)->next)
+	{
+		if (*link == cache)
+		{
+			*link = cache->next;
+			break;
+		}
+	}
+
+	critlock_release();
+
+	kmem_cache_free(&kmem_cache_cache, cache);
+	return ERROR_OK;
+}
+
+void* kmem_cache_alloc(kmem_cache* cache)
+{
+	void* object = 0;
+
+	if (kmem_cache_alloc_batch(cache, &object, 1) == 0)
+		return 0;
+
+	return object;
+}
+
+void kmem_cache_free(kmem_cache* cache, void* object)
+{
+	if (object == 0)
+		return;
+
+	kmem_cache_free_batch(cache, &object, 1);
+}
+
+uint32 kmem_cache_alloc_batch(kmem_cache* cache, void** objects, uint32 count)
+{
+	if (cache == 0)
+	{
+		set_last_error(EINVAL, KMEM_BAD_ARGUMENT, EO_KMEM);
+		return 0;
+	}
+
+	uint32 taken = 0;
+
+	critlock_acquire();
+
+	for (; taken < count; taken++)
+	{
+		if (kmem_cache_reserve(cache) == false)
+			break;
+
+		objects[taken] = kmem_slab_take(cache);
+	}
+
+	critlock_release();
+	return taken;
+}
+
+void kmem_cache_free_batch(kmem_cache* cache, void** objects, uint32 count)
+{
+	for (uint32 i = 0; i < count; i++)
+	{
+		kmem_slab* s = kmem_object_slab(objects[i]);
+
+		if (kmem_is_slab_address(objects[i]) == false || s->magic != KMEM_SLAB_MAGIC || s->cache != cache)
+		{
+			set_last_error(EINVAL, KMEM_BAD_ARGUMENT, EO_KMEM);
+			return;
+		}
+	}
+
+	critlock_acquire();
+
+	for (uint32 i = 0; i < count; i++)
+		kmem_slab_put(cache, kmem_object_slab(objects[i]), objects[i]);
+
+	bool shrink = cache->empty_count > KMEM_MAX_EMPTY;
+
+	critlock_release();
+
+	if (shrink)
+		kmem_cache_release_empty(cache, KMEM_MAX_EMPTY);
+}
+
+uint32 kmem_cache_shrink(kmem_cache* cache)
+{
+	if (cache == 0)
+		return 0;
+
+	return kmem_cache_release_empty(cache, 0);
+}
+
+kmem_cache_stats kmem_cache_get_stats(kmem_cache* cache)
+{
+	return cache->stats;
+}
+
+void* kmem_alloc(uint32 size)
+{
+	// malloc serves the size caches through the magazines before it turns to the heap
+	return malloc_from(size, _ReturnAddress());
+}
+
+void kmem_free(void* ptr)
+{
+	free(ptr);
+}
+
+void* kmem_magazine_alloc(uint32 size)
+{
+	if (kmem_ready == false || size == 0 || size > KMEM_MAX_SIZE)
+		return 0;
+
+	uint32 index = kmem_size_index(size);
+	TCB* thread = thread_get_current();
+
+	if (thread == 0)
+		return kmem_cache_alloc(kmem_size_caches[index]);
+
+	// a reclaiming thread is emptying the magazines (or we reclaim from inside a refill)
+	if (CAS<uint32>(&thread->magazines.busy, 0, 1) == false)
+		return kmem_cache_alloc(kmem_size_caches[index]);
+
+	kmem_magazine* m = &thread->magazines.size_classes[index];
+	void* object = 0;
+
+	if (m->count == 0)
+		m->count = kmem_cache_alloc_batch(kmem_size_caches[index], m->objects, KMEM_MAGAZINE_BATCH);
+
+	if (m->count != 0)
+		object = m->objects[--m->count];
+
+	thread->magazines.busy = 0;
+	return object;
+}
+
+void kmem_magazine_free(void* object)
+{
+	if (kmem_object_size(object) == 0)
+	{
+		set_last_error(EINVAL, KMEM_BAD_ARGUMENT, EO_KMEM);
+		return;
+	}
+
+	kmem_cache* cache = kmem_object_slab(object)->cache;
+	uint32 index = kmem_size_index(cache->object_size);
+	TCB* thread = thread_get_current();
+
+	// objects of the named caches, frees before the scheduler starts and frees while the magazines are emptied go straight
+	// to the cache
+	if (thread == 0 || index >= KMEM_SIZE_CACHES || kmem_size_caches[index] != cache ||
+		CAS<uint32>(&thread->magazines.busy, 0, 1) == false)
+	{
+		kmem_cache_free(cache, object);
+		return;
+	}
+
+	kmem_magazine* m = &thread->magazines.size_classes[index];
+
+	if (m->count == KMEM_MAGAZINE_SIZE)
+	{
+		m->count -= KMEM_MAGAZINE_BATCH;
+		kmem_cache_free_batch(cache, m->objects + m->count, KMEM_MAGAZINE_BATCH);
+	}
+
+	m->objects[m->count++] = object;
+	thread->magazines.busy = 0;
+}
+
+uint32 kmem_object_size(void* ptr)
+{
+	if (kmem_is_slab_address(ptr) == false || kmem_object_slab(ptr)->magic != KMEM_SLAB_MAGIC)
+		return 0;
+
+	return kmem_object_slab(ptr)->cache->object_size;
+}
+
+void kmem_magazines_init(kmem_magazines* m)
+{
+	m->busy = 0;
+
+	for (uint32 i = 0; i < KMEM_SIZE_CACHES; i++)
+		m->size_classes[i].count = 0;
+}
+
+bool kmem_magazines_flush(kmem_magazines* m)
+{
+	if (CAS<uint32>(&m->busy, 0, 1) == false)
+		return false;
+
+	for (uint32 i = 0; i < KMEM_SIZE_CACHES; i++)
+	{
+		if (m->size_classes[i].count != 0)
+			kmem_cache_free_batch(kmem_size_caches[i], m->size_classes[i].objects, m->size_classes[i].count);
+
+		m->size_classes[i].count = 0;
+	}
+
+	m->busy = 0;
+	return true;
+}
+
+uint32 kmem_reclaim()
+{
+	if (kmem_ready == false)
+		return 0;
+
+	// the queues are walked with interrupts off, so the magazines are flushed (which takes the critical lock) afterwards.
+	// Threads are never freed, so the gathered ones are still there
+	kmem_reclaim_threads list;
+	list.count = 0;
+	thread_for_each(kmem_reclaim_gather, &list);
+
+	for (uint32 i = 0; i < list.count; i++)
+		kmem_magazines_flush(&list.threads[i]->magazines);
+
+	uint32 released = 0;
+	for (uint32 i = 0; i < KMEM_SIZE_CACHES; i++)
+		released += kmem_cache_shrink(kmem_size_caches[i]);
+
+	return released;
+}
+
+void kmem_print()
+{
+	for (kmem_cache* c = kmem_caches; c != 0; c = c->next)
+		printfln("%s: size %u, %u per slab, %u colors, slabs: %u, in use: %u, allocs: %u, frees: %u", c->name, c->object_size,
+			c->objects, c->colors, c->stats.slabs, c->stats.in_use, c->stats.allocs, c->stats.frees);
+}
@@ -0,0 +1,164 @@
+#ifndef KMEM_CACHE_H_16102026
+#define KMEM_CACHE_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Slab allocator for fixed size kernel objects.
+
+	A cache hands out objects of one size from slabs: single pages of a private kernel window that start with a slab
+	header followed by the objects. Each slab keeps a free list threaded through its free objects, and the cache keeps its
+	slabs in partial, full and empty lists, so both allocation and free are O(1). The slab of an object is found by
+	rounding its address down to the page.
+
+	A constructor given to a cache runs once per object when its slab is created. Objects are returned to the cache in
+	their constructed state, as the next allocation does not run it again. Consecutive slabs start their objects at
+	different offsets (colors) inside the unused tail of the page, so equal objects of different slabs do not all compete
+	for the same cache lines.
+
+	kmem_alloc serves small requests from power of two size caches and the rest from the kernel heap. kmem_free accepts
+	memory from either.
+
+	Every thread keeps a magazine of free objects for each size cache, so most small allocations and frees only touch
+	memory of the calling thread and never take the critical lock. An empty magazine is refilled, and a full one partly
+	emptied, with KMEM_MAGAZINE_BATCH objects at a time from the caches (the depot) under a single critical section. The
+	kernel runs on one CPU, so per thread magazines are per CPU ones without the CPU migration problem. As with the heap,
+	interrupt handlers must not allocate.
+
+	A thread marks its magazines busy while it uses them. When memory is short, kmem_reclaim empties the magazines of every
+	thread that is not in the middle of a magazine operation, so objects do not stay stranded in idle threads. A thread that
+	finds its magazines busy (being emptied) goes to the caches directly.
+*/
+
+#define KMEM_WINDOW_BASE		0xDB000000		// kernel virtual window of the slab pages
+#define KMEM_WINDOW_SIZE		4 MB
+#define KMEM_MIN_SIZE			16				// smallest size cache
+#define KMEM_MAX_SIZE			1024			// largest size cache. Larger requests go to the kernel heap
+#define KMEM_MAX_EMPTY			1				// empty slabs kept by a cache before their pages are released
+#define KMEM_SLAB_MAGIC			0x5AB5
+#define KMEM_SIZE_CACHES		7				// 16, 32, ... 1024 bytes
+#define KMEM_MAGAZINE_SIZE		16				// free objects a thread keeps per size cache
+#define KMEM_MAGAZINE_BATCH		8				// objects moved between a magazine and its cache at once
+#define KMEM_RECLAIM_THREADS	64				// threads whose magazines one reclaim empties
+
+enum KMEM_ERROR
+{
+	KMEM_NONE,
+	KMEM_NOT_INITIALIZED,
+	KMEM_BAD_ARGUMENT,
+	KMEM_OUT_OF_MEM
+};
+
+typedef void(*kmem_ctor)(void* object);
+
+struct kmem_cache;
+
+struct kmem_slab
+{
+	uint16 magic;
+	uint16 in_use;				// allocated objects
+	kmem_cache* cache;
+	kmem_slab* prev;
+	kmem_slab* next;
+	void* free_list;			// first free object. A free object holds the address of the next
+};
+
+struct kmem_cache_stats
+{
+	uint32 allocs;				// objects handed out so far
+	uint32 frees;				// objects returned so far
+	uint32 in_use;				// objects currently allocated
+	uint32 slabs;				// slabs currently owned
+};
+
+struct kmem_cache
+{
+	char* name;
+	uint32 object_size;			// requested size rounded up to the alignment
+	uint32 align;
+	uint32 objects;				// objects per slab
+	uint32 colors;				// distinct offsets of the first object
+	uint32 color_next;			// color of the next slab
+	kmem_ctor ctor;
+
+	kmem_slab* partial;			// slabs with used and free objects
+	kmem_slab* full;			// slabs without free objects
+	kmem_slab* empty;			// slabs without used objects
+	uint32 empty_count;
+
+	kmem_cache_stats stats;
+	kmem_cache* next;			// all caches list
+};
+
+// free objects of one size cache owned by a thread
+struct kmem_magazine
+{
+	uint32 count;
+	void* objects[KMEM_MAGAZINE_SIZE];
+};
+
+struct kmem_magazines
+{
+	uint32 busy;				// set (with CAS) by the owner or a reclaiming thread while it uses the magazines
+	kmem_magazine size_classes[KMEM_SIZE_CACHES];
+};
+
+// prepares the slab window and the size caches. Must be called once paging is ready, before any process is created
+error_t init_kmem();
+
+// creates a cache of objects of size bytes aligned to align (power of two, 0 for the default). ctor may be 0
+kmem_cache* kmem_cache_create(char* name, uint32 size, uint32 align, kmem_ctor ctor);
+
+// releases the pages of the cache. All its objects must have been freed
+error_t kmem_cache_destroy(kmem_cache* cache);
+
+// allocates an object from the cache. Returns 0 if memory is out
+void* kmem_cache_alloc(kmem_cache* cache);
+
+// returns an object to its cache
+void kmem_cache_free(kmem_cache* cache, void* object);
+
+// allocates up to count objects from the cache in one critical section. Returns the number allocated
+uint32 kmem_cache_alloc_batch(kmem_cache* cache, void** objects, uint32 count);
+
+// returns count objects to the cache in one critical section
+void kmem_cache_free_batch(kmem_cache* cache, void** objects, uint32 count);
+
+// releases the pages of the empty slabs of the cache and returns their number
+uint32 kmem_cache_shrink(kmem_cache* cache);
+
+// returns the statistics of the cache
+kmem_cache_stats kmem_cache_get_stats(kmem_cache* cache);
+
+// allocates size bytes from the matching size cache, or from the kernel heap for large sizes or before init_kmem
+void* kmem_alloc(uint32 size);
+
+// frees memory of kmem_alloc (slab or heap)
+void kmem_free(void* ptr);
+
+// allocates size bytes from the calling thread's magazine of the matching size cache. Returns 0 if size is not served
+// by the size caches, before init_kmem or if the slab window is out
+void* kmem_magazine_alloc(uint32 size);
+
+// returns a slab object to the calling thread's magazine, or to its cache if it does not belong to a size cache
+void kmem_magazine_free(void* object);
+
+// returns the object size of the cache ptr was allocated from, or 0 if ptr is not a slab object
+uint32 kmem_object_size(void* ptr);
+
+// empties the magazines
+void kmem_magazines_init(kmem_magazines* m);
+
+// gives the objects of the magazines (of any thread) back to their caches. Returns false, leaving them as they are, if
+// they are busy
+bool kmem_magazines_flush(kmem_magazines* m);
+
+// flushes the magazines of the threads and releases the pages of the empty slabs of the size caches. Returns the pages
+// released
+uint32 kmem_reclaim();
+
+// prints every cache with its statistics (for debug purposes)
+void kmem_print();
+
+#endif
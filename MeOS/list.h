@@ -6,6 +6,7 @@
 #include "types.h"
 #include "utility.h"
 #include "memory.h"
+#include "kmem_cache.h"
 
 #define LIST_PEEK(l) l->head->data
 
@@ -14,6 +15,10 @@ struct list_node
 {
 	T data;
 	list_node* next;
+
+	// nodes are small and short lived, so they come from the slab size caches
+	void* operator new(uint32 size) { return kmem_alloc(size); }
+	void operator delete(void* ptr) { kmem_free(ptr); }
 };
 
 template<class T>
@@ -0,0 +1,196 @@
+#include "lz4.h"
+
+// private data
+
+#define LZ4_LAST_LITERALS		5				// the last bytes of a block are always literals
+#define LZ4_MF_LIMIT			12				// a match cannot start in the last bytes of a block
+#define LZ4_MAX_OFFSET			0xFFFF
+
+// private functions
+
+inline uint32 lz4_read32(uint8* p)
+{
+	return *(uint32*)p;		// x86 handles unaligned reads
+}
+
+inline uint32 lz4_hash(uint32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// writes the remainder of a length that did not fit in its token nibble
+inline uint8* lz4_write_length(uint8* op, uint32 length)
+{
+	for (; length >= 255; length -= 255)
+		*op++ = 255;
+
+	*op++ = (uint8)length;
+	return op;
+}
+
+// reads the extra bytes of a length. Returns false if the block ends first
+inline bool lz4_read_length(uint8** ip, uint8* iend, uint32* length)
+{
+	uint8 b;
+
+	do
+	{
+		if (*ip >= iend)
+			return false;
+
+		b = *(*ip)++;
+		*length += b;
+	} while (b == 255);
+
+	return true;
+}
+
+// public functions
+
+uint32 lz4_compress(uint8* src, uint32 length, uint8* dst, uint32 capacity, uint16* table)
+{
+	if (length > LZ4_MAX_INPUT)
+		return 0;
+
+	uint8* ip = src;
+	uint8* anchor = src;						// first literal not yet emitted
+	uint8* iend = src + length;
+	uint8* op = dst;
+	uint8* oend = dst + capacity;
+
+	memset(table, 0, LZ4_HASH_SIZE * sizeof(uint16));
+
+	if (length >= LZ4_MF_LIMIT)
+	{
+		uint8* mflimit = iend - LZ4_MF_LIMIT;
+		uint8* matchlimit = iend - LZ4_LAST_LITERALS;
+
+		while (ip < mflimit)
+		{
+			uint32 sequence = lz4_read32(ip);
+			uint32 h = lz4_hash(sequence);
+			uint8* ref = src + table[h];
+			table[h] = (uint16)(ip - src);
+
+			if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != sequence)
+			{
+				ip++;
+				continue;
+			}
+
+			// extend the match backwards into the pending literals
+			while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+
+			uint8* mp = ip + LZ4_MIN_MATCH;
+			uint8* rp = ref + LZ4_MIN_MATCH;
+
+			while (mp < matchlimit && *mp == *rp)
+			{
+				mp++;
+				rp++;
+			}
+
+			uint32 literals = ip - anchor;
+			uint32 match = mp - ip - LZ4_MIN_MATCH;
+
+			// token, lengths, literals and offset
+			if ((uint32)(oend - op) < 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1)
+				return 0;
+
+			uint8* token = op++;
+			*token = (uint8)((literals >= 15 ? 15 : literals) << 4);
+
+			if (literals >= 15)
+				op = lz4_write_length(op, literals - 15);
+
+			memcpy(op, anchor, literals);
+			op += literals;
+
+			uint32 offset = ip - ref;
+			*op++ = (uint8)offset;
+			*op++ = (uint8)(offset >> 8);
+
+			*token |= match >= 15 ? 15 : match;
+
+			if (match >= 15)
+				op = lz4_write_length(op, match - 15);
+
+			ip = mp;
+			anchor = ip;
+		}
+	}
+
+	// the last literals
+	uint32 literals = iend - anchor;
+
+	if ((uint32)(oend - op) < 1 + literals / 255 + 1 + literals)
+		return 0;
+
+	*op++ = (uint8)((literals >= 15 ? 15 : literals) << 4);
+
+	if (literals >= 15)
+		op = lz4_write_length(op, literals - 15);
+
+	memcpy(op, anchor, literals);
+	op += literals;
+
+	return op - dst;
+}
+
+uint32 lz4_decompress(uint8* src, uint32 length, uint8* dst, uint32 capacity)
+{
+	uint8* ip = src;
+	uint8* iend = src + length;
+	uint8* op = dst;
+	uint8* oend = dst + capacity;
+
+	while (ip < iend)
+	{
+		uint8 token = *ip++;
+		uint32 literals = token >> 4;
+
+		if (literals == 15 && lz4_read_length(&ip, iend, &literals) == false)
+			return 0;
+
+		if (literals > (uint32)(iend - ip) || literals > (uint32)(oend - op))
+			return 0;
+
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+
+		// the last sequence has no match
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return 0;
+
+		uint32 offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (uint32)(op - dst))
+			return 0;
+
+		uint32 match = token & 15;
+
+		if (match == 15 && lz4_read_length(&ip, iend, &match) == false)
+			return 0;
+
+		match += LZ4_MIN_MATCH;
+
+		if (match > (uint32)(oend - op))
+			return 0;
+
+		// byte copy as the match may overlap the output (offset < match repeats a pattern)
+		uint8* ref = op - offset;
+		while (match-- > 0)
+			*op++ = *ref++;
+	}
+
+	return op - dst;
+}
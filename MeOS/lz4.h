@@ -0,0 +1,28 @@
+#ifndef LZ4_H_16102026
+#define LZ4_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	LZ4 block format compressor and decompressor.
+
+	A block is a list of sequences: a token (literal length in the high nibble, match length - 4 in the low nibble, 15 meaning
+	more length bytes follow), the literals, a 16 bit little endian back offset and the extra match length bytes. The last
+	sequence holds only literals. The compressor is the fast greedy variant with a single hash table of recent positions.
+*/
+
+#define LZ4_MIN_MATCH			4				// shortest match encoded
+#define LZ4_HASH_BITS			12
+#define LZ4_HASH_SIZE			(1 << LZ4_HASH_BITS)	// entries of the work table given to lz4_compress
+#define LZ4_MAX_INPUT			0xFFFF			// positions are kept in 16 bits
+
+// compresses length bytes of src into dst. 'table' is caller provided work memory of LZ4_HASH_SIZE entries.
+// Returns the compressed size, or 0 if the result does not fit in capacity bytes
+uint32 lz4_compress(uint8* src, uint32 length, uint8* dst, uint32 capacity, uint16* table);
+
+// decompresses a block of length bytes into dst. Returns the decompressed size, or 0 if the block is malformed or
+// does not fit in capacity bytes
+uint32 lz4_decompress(uint8* src, uint32 length, uint8* dst, uint32 capacity);
+
+#endif
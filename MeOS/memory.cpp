@@ -2,51 +2,79 @@
 #include "spinlock.h"
 #include "thread_sched.h"
 #include "print_utility.h"
-#include "critlock.h"
+#include "file.h"
+#include "kmem_cache.h"
+#include "heap_profile.h"
 
 extern heap* kernel_heap;
 spinlock kernel_heap_lock = 0;
 
-void* malloc(uint32 size)
+void* malloc_from(uint32 size, void* caller)
 {
 	/*if (kernel_heap_lock)
 		PANIC("HEAP ACQUIRED");*/
 
-	//spinlock_acquire(&kernel_heap_lock);
-	critlock_acquire();
-	void* addr = heap_alloc(kernel_heap, size);
-	critlock_release();
-	//spinlock_release(&kernel_heap_lock);
+	// small sizes come from the thread's magazines without any lock
+	void* addr = kmem_magazine_alloc(size);
+
+	// the heap serializes itself and leaves its critical section while it maps pages
+	if (addr == 0)
+		addr = heap_alloc(kernel_heap, size);
 
+	heap_profile_alloc(addr, size, caller);
 	return addr;
 }
 
+void* malloc(uint32 size)
+{
+	return malloc_from(size, _ReturnAddress());
+}
+
 void* calloc(uint32 size)
 {
-	void* ptr = malloc(size);
+	void* ptr = malloc_from(size, _ReturnAddress());
 	memset(ptr, 0, size);
 	return ptr;
 }
 
 error_t free(void* ptr)
 {
-	//spinlock_acquire(&kernel_heap_lock);
-	critlock_acquire();
-	error_t res = heap_free(kernel_heap, ptr);
-	critlock_release();
-	//spinlock_release(&kernel_heap_lock);
+	// the record goes first, as the address may be handed out again as soon as it is freed
+	heap_profile_free(ptr);
 
-	return res;
+	if (kmem_object_size(ptr) != 0)
+	{
+		kmem_magazine_free(ptr);
+		return ERROR_OK;
+	}
+
+	return heap_free(kernel_heap, ptr);
 }
 
 void* realloc(void* ptr, uint32 new_size)
 {
-	//spinlock_acquire(&kernel_heap_lock);
-	critlock_acquire();
+	// slab objects cannot change size, so they move unless the object is already large enough
+	uint32 object_size = kmem_object_size(ptr);
+	if (object_size != 0)
+	{
+		if (new_size <= object_size)
+			return ptr;
+
+		void* addr = malloc_from(new_size, _ReturnAddress());
+		if (addr == 0)
+			return 0;
+
+		memcpy(addr, ptr, object_size);
+		free(ptr);
+		return addr;
+	}
+
+	heap_profile_free(ptr);
+
 	void* addr = heap_realloc(kernel_heap, ptr, new_size);
-	critlock_release();
-	//spinlock_release(&kernel_heap_lock);
 
+	// on failure the old block stays allocated, so it is tracked again
+	heap_profile_alloc(addr != 0 ? addr : ptr, new_size, _ReturnAddress());
 	return addr;
 }
 
@@ -73,6 +101,13 @@ virtual_addr vfs_mmap_p(void* _proc, virtual_addr pref, uint32 gfd, uint32 offse
 		return MAP_FAILED;
 	}
 
+	// large pages are only backed by identity mappings (no 4MB contiguous allocations on faults)
+	if (CHK_BIT(flags, MMAP_LARGE_PAGES) && !CHK_BIT(flags, MMAP_IDENTITY_MAP))
+	{
+		set_last_error(EINVAL, MEMORY_BAD_FLAGS, EO_MEMORY);
+		return MAP_FAILED;
+	}
+
 	vm_area area = vm_area_create(pref, pref + length, flags | prot, gfd, offset);
 
 	if (area.flags == MMAP_INVALID)
@@ -92,26 +127,76 @@ virtual_addr vfs_mmap(virtual_addr pref, uint32 gfd, uint32 offset, uint32 lengt
 	return vfs_mmap_p(process_get_current(), pref, gfd, offset, length, prot, flags);
 }
 
+error_t vfs_madvise_p(void* _proc, virtual_addr addr, uint32 length, uint32 advice)
+{
+	PCB* proc = (PCB*)_proc;
+
+	if (advice > MADV_WILLNEED)
+	{
+		set_last_error(EINVAL, MEMORY_BAD_FLAGS, EO_MEMORY);
+		return ERROR_OCCUR;
+	}
+
+	spinlock_acquire(&proc->contract_spinlock);
+
+	vm_area* p_area = vm_contract_find_area(&proc->memory_contract, addr);
+	if (p_area == 0)
+	{
+		spinlock_release(&proc->contract_spinlock);
+		return ERROR_OCCUR;
+	}
+
+	if (advice != MADV_WILLNEED)
+	{
+		p_area->advice = advice;
+		p_area->ra_pages = 0;
+		spinlock_release(&proc->contract_spinlock);
+
+		return ERROR_OK;
+	}
+
+	vm_area area = *p_area;
+	spinlock_release(&proc->contract_spinlock);
+
+	// only file mappings can be read ahead
+	if (CHK_BIT(area.flags, MMAP_ANONYMOUS))
+		return ERROR_OK;
+
+	addr &= ~(PAGE_SIZE - 1);
+	length = min(length, area.end_addr - addr);
+
+	if (read_file_global(area.fd, area.offset + (addr - area.start_addr), length, -1, VFS_CAP_READ | VFS_CAP_CACHE) == INVALID_IO)
+		return ERROR_OCCUR;
+
+	return ERROR_OK;
+}
+
+error_t vfs_madvise(virtual_addr addr, uint32 length, uint32 advice)
+{
+	return vfs_madvise_p(process_get_current(), addr, length, advice);
+}
+
 #ifdef __cplusplus
 
 void* operator new(uint32 size)
 {
-	return  malloc(size);
+	return  malloc_from(size, _ReturnAddress());
 }
 
 void* operator new[](uint32 size)
 {
-	return  malloc(size);
+	return  malloc_from(size, _ReturnAddress());
 }
 
+// objects may come from the slab caches (vfs nodes, list nodes), which kmem_free tells apart from the heap
 void operator delete(void* ptr)
 {
-	free(ptr);
+	kmem_free(ptr);
 }
 
 void operator delete(void* ptr, unsigned int)
 {
-	free(ptr);
+	kmem_free(ptr);
 }
 
 void operator delete[](void* ptr)
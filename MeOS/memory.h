@@ -11,9 +11,16 @@ extern "C" {
 #include "types.h"
 #include "utility.h"
 
+	// return address of the calling function (compiler intrinsic). Names allocation sites for the heap profiler
+	void* _ReturnAddress(void);
+#pragma intrinsic(_ReturnAddress)
+
 	// allocates size contiguous memory
 	void* malloc(uint32 size);
 
+	// allocates like malloc, reporting caller as the allocation site to the heap profiler
+	void* malloc_from(uint32 size, void* caller);
+
 	// allocates size contiguous memory and initializes to zero
 	void* calloc(uint32 size);
 
@@ -34,5 +41,10 @@ extern "C" {
 virtual_addr vfs_mmap(virtual_addr pref, uint32 gfd, uint32 offset, uint32 length, uint32 prot, uint32 flags);
 virtual_addr vfs_mmap_p(void* proc, virtual_addr pref, uint32 gfd, uint32 offset, uint32 length, uint32 prot, uint32 flags);
 
+// gives an access pattern hint (MMAP_ADVICE) for the mapped area containing addr. The hint applies to the whole area,
+// except MADV_WILLNEED which reads the file range [addr, addr + length) into the page cache immediately.
+error_t vfs_madvise(virtual_addr addr, uint32 length, uint32 advice);
+error_t vfs_madvise_p(void* proc, virtual_addr addr, uint32 length, uint32 advice);
+
 
 #endif
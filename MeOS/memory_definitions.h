@@ -38,6 +38,16 @@ enum MMAP_FLAGS
 	MMAP_ALLOC_IMMEDIATE = 1 << 14,			// Upon the first exception, the whole region is memory mapped
 	MMAP_IDENTITY_MAP = 1 << 15,			// The area must be identity mapped
 	MMAP_INVALID = 1 << 16,
+	MMAP_LARGE_PAGES = 1 << 17,			// Identity mapped areas use 4MB pages where a whole 4MB chunk lies inside the area
+};
+
+// access pattern hints given to vfs_madvise
+enum MMAP_ADVICE
+{
+	MADV_NORMAL,			// adaptive read-ahead based on the fault pattern
+	MADV_RANDOM,			// no read-ahead, no fault-around
+	MADV_SEQUENTIAL,		// always use the maximum read-ahead window
+	MADV_WILLNEED			// read the range into the page cache now
 };
 
 enum MEMORY_ERROR
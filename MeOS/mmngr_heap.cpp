@@ -1,145 +1,432 @@
 #include "mmngr_heap.h"
 #include "spinlock.h"
+#include "critlock.h"
 #include "print_utility.h"
 
-// private functions
+// private data
+
+#define HEAP_LARGE_WINDOW_PAGES		(HEAP_LARGE_WINDOW_SIZE / PAGE_SIZE)
 
-uint32 heap_block_size(heap* h, heap_block* b)
+// list links at the start of the payload of a free block
+struct heap_free_links
 {
-	if (b->next == 0)
-		return h->start_address + h->size - (uint32)b - sizeof(heap_block);
-	return (uint32)b->next - (uint32)b - sizeof(heap_block);
-}
+	heap_block* next;
+	heap_block* prev;
+};
+
+// a free block holds its links and its footer
+#define HEAP_MIN_PAYLOAD			((sizeof(heap_free_links) + sizeof(uint32) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1))
+
+static uint32 heap_large_pages[HEAP_LARGE_WINDOW_PAGES / 32];		// set bit => window page in use
+
+// private functions
 
 inline void* heap_block_start_address(heap_block* b)
 {
 	return ((char*)b + sizeof(heap_block));
 }
 
-// merges block b with its next. No condition checks are made
-void heap_front_merge_block(heap* h, heap_block* b)
+inline heap_block* heap_block_from_address(void* address)
+{
+	return (heap_block*)((char*)address - sizeof(heap_block));
+}
+
+inline heap_free_links* heap_block_links(heap_block* b)
+{
+	return (heap_free_links*)heap_block_start_address(b);
+}
+
+inline heap_block* heap_block_next(heap_block* b)
+{
+	return (heap_block*)((char*)heap_block_start_address(b) + b->size);
+}
+
+// returns the block before b, which must be free (its footer holds its size)
+inline heap_block* heap_block_prev(heap_block* b)
 {
-	b->next = b->next->next;
-	h->current_blocks--;
+	uint32 prev_size = *((uint32*)b - 1);
+	return (heap_block*)((char*)b - prev_size - sizeof(heap_block));
 }
 
-// returns true if the next block of prev is unused
-inline bool heap_is_next_unused(heap_block* prev)
+inline void heap_block_write_footer(heap_block* b)
 {
-	return (prev->next != 0 && prev->next->used == false);
+	*((uint32*)heap_block_next(b) - 1) = b->size;
+}
+
+inline bool heap_is_large(void* address)
+{
+	return (virtual_addr)address >= HEAP_LARGE_WINDOW_BASE && (virtual_addr)address < HEAP_LARGE_WINDOW_BASE + HEAP_LARGE_WINDOW_SIZE;
+}
+
+// returns true if the block lies inside the region of h
+inline bool heap_owns(heap* h, heap_block* b)
+{
+	return (virtual_addr)b >= h->start_address && (virtual_addr)b < h->start_address + h->size;
+}
+
+// size class of a block: one class per power of two starting at HEAP_MIN_PAYLOAD
+uint32 heap_size_class(uint32 size)
+{
+	uint32 index = 0;
+
+	for (size /= HEAP_MIN_PAYLOAD; size > 1 && index < HEAP_SIZE_CLASSES - 1; size >>= 1)
+		index++;
+
+	return index;
+}
+
+// index of the lowest set bit of a non zero value
+uint32 heap_lowest_bit(uint32 value)
+{
+	uint32 index = 0;
+
+	while ((value & 1) == 0)
+	{
+		value >>= 1;
+		index++;
+	}
+
+	return index;
 }
 
-heap_block* heap_block_create(heap* h, void* base, bool used, heap_block* next, bool flags)
+heap_block* heap_block_create(heap* h, void* base, bool used, bool prev_used, uint32 size)
 {
 	heap_block* block = (heap_block*)base;
 	block->magic = HEAP_BLOCK_MAGIC;
-	block->used = false;
-	block->next = next;
-	block->flags = flags;
+	block->used = used;
+	block->prev_used = prev_used;
+	block->size = size;
 
 	h->current_blocks++;
 
 	return block;
 }
 
-// Front merges blocks until either the merged block size suits r_size or fail.
-// Merged block remains for on-spot defrag purposes.
-bool heap_front_merge_size_fit(heap* h, heap_block* prev, uint32 r_size)
+void heap_free_insert(heap* h, heap_block* b)
+{
+	uint32 index = heap_size_class(b->size);
+	heap_free_links* links = heap_block_links(b);
+
+	links->prev = 0;
+	links->next = h->free_lists[index];
+
+	if (links->next != 0)
+		heap_block_links(links->next)->prev = b;
+
+	h->free_lists[index] = b;
+	h->class_bitmap |= 1 << index;
+
+	heap_block_write_footer(b);
+}
+
+void heap_free_remove(heap* h, heap_block* b)
+{
+	uint32 index = heap_size_class(b->size);
+	heap_free_links* links = heap_block_links(b);
+
+	if (links->prev != 0)
+		heap_block_links(links->prev)->next = links->next;
+	else
+		h->free_lists[index] = links->next;
+
+	if (links->next != 0)
+		heap_block_links(links->next)->prev = links->prev;
+
+	if (h->free_lists[index] == 0)
+		h->class_bitmap &= ~(1 << index);
+}
+
+// returns a free block of at least size bytes (still in its list) or 0
+heap_block* heap_find_fit(heap* h, uint32 size)
 {
-	while (prev->next != 0 && r_size > heap_block_size(h, prev))
+	uint32 index = heap_size_class(size);
+
+	// blocks of the request's own class may be smaller than it, so look at a few of them
+	uint32 scanned = 0;
+	for (heap_block* b = h->free_lists[index]; b != 0 && scanned < HEAP_FIT_SCAN; b = heap_block_links(b)->next, scanned++)
+		if (b->size >= size)
+			return b;
+
+	// any block of a larger class fits
+	uint32 larger = index + 1 < HEAP_SIZE_CLASSES ? h->class_bitmap & ~((1 << (index + 1)) - 1) : 0;
+	if (larger == 0)
+		return 0;
+
+	return h->free_lists[heap_lowest_bit(larger)];
+}
+
+// marks the free block b used for size bytes, giving the remainder back as a free block
+void heap_block_take(heap* h, heap_block* b, uint32 size)
+{
+	heap_free_remove(h, b);
+	b->used = true;
+
+	if (b->size >= size + sizeof(heap_block) + HEAP_MIN_PAYLOAD)
 	{
-		if (heap_is_next_unused(prev))
-			heap_front_merge_block(h, prev);
-		else
-			break;
+		uint32 rest = b->size - size - sizeof(heap_block);
+		b->size = size;
+
+		heap_block* remainder = heap_block_create(h, heap_block_next(b), false, true, rest);
+		heap_free_insert(h, remainder);
 	}
+	else
+		heap_block_next(b)->prev_used = true;
+}
 
-	return r_size <= heap_block_size(h, prev);
+// frees the used block b, merging it with its free neighbours
+void heap_block_release(heap* h, heap_block* b)
+{
+	b->used = false;
+
+	heap_block* next = heap_block_next(b);
+	if (next->used == false)
+	{
+		heap_free_remove(h, next);
+		b->size += sizeof(heap_block) + next->size;
+		next->magic = 0;
+		h->current_blocks--;
+	}
+
+	if (b->prev_used == false)
+	{
+		heap_block* prev = heap_block_prev(b);
+		heap_free_remove(h, prev);
+		prev->size += sizeof(heap_block) + b->size;
+		b->magic = 0;
+		h->current_blocks--;
+		b = prev;
+	}
+
+	heap_free_insert(h, b);
+	heap_block_next(b)->prev_used = false;
 }
 
-// public functions
+// creates the page tables of a kernel window in the current (kernel) directory, so that every address space shares them
+void heap_window_init(virtual_addr base, uint32 size)
+{
+	pdirectory* dir = vmmngr_get_directory();
 
-heap* heap_create(virtual_addr base, uint32 size)
+	for (virtual_addr addr = base & ~(LARGE_PAGE_SIZE - 1); addr < base + size; addr += LARGE_PAGE_SIZE)
+	{
+		pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, addr);
+
+		if (pd_entry_is_present(*e) == false)
+			vmmngr_create_table(dir, addr, DEFAULT_FLAGS);
+	}
+}
+
+// unmaps the pages of [start, end)
+void heap_unmap(virtual_addr start, virtual_addr end)
 {
-	heap* new_heap = (heap*)base;
-	new_heap->start_address = (virtual_addr)((char*)base + sizeof(heap));
-	new_heap->size = size - sizeof(heap);
-	new_heap->current_blocks = 0;
+	for (virtual_addr addr = start; addr < end; addr += PAGE_SIZE)
+	{
+		vmmngr_free_page_addr(addr);
+		vmmngr_flush_TLB_entry(addr);
+	}
+}
 
-	heap_block_create(new_heap, (void*)new_heap->start_address, false, 0, 0);
-	return new_heap;
+// maps the pages of [start, end). Either all of them are mapped or none
+error_t heap_map(virtual_addr start, virtual_addr end)
+{
+	for (virtual_addr addr = start; addr < end; addr += PAGE_SIZE)
+	{
+		if (vmmngr_alloc_page(addr) != ERROR_OK)
+		{
+			heap_unmap(start, addr);
+			set_last_error(ENOMEM, HEAP_OUT_OF_MEMORY, EO_HMMNGR);
+			return ERROR_OCCUR;
+		}
+	}
+
+	return ERROR_OK;
 }
 
-void* heap_alloc(heap* h, uint32 r_size)
+// marks (used true) or clears the window pages [first, first + pages)
+void heap_large_mark(uint32 first, uint32 pages, bool used)
 {
-	if (h == 0 || r_size == 0)
+	for (uint32 page = first; page < first + pages; page++)
 	{
-		set_last_error(EINVAL, HEAP_BAD_ARGUMENT, EO_HMMNGR);
-		return 0;
+		if (used)
+			heap_large_pages[page / 32] |= 1 << (page % 32);
+		else
+			heap_large_pages[page / 32] &= ~(1 << (page % 32));
 	}
+}
 
-	heap_block* block = (heap_block*)h->start_address;
+// allocates whole window pages for a large request. The run is reserved inside the critical section and mapped outside it
+void* heap_large_alloc(uint32 size)
+{
+	uint32 pages = (size + sizeof(heap_block) + PAGE_SIZE - 1) / PAGE_SIZE;
+	uint32 run = 0;
+	uint32 first = HEAP_LARGE_WINDOW_PAGES;
+
+	critlock_acquire();
 
-	while (block != 0)
+	for (uint32 page = 0; page < HEAP_LARGE_WINDOW_PAGES; page++)
 	{
-		if (block->magic != HEAP_BLOCK_MAGIC)
+		if (heap_large_pages[page / 32] & (1 << (page % 32)))
 		{
-			set_last_error(EINVAL, HEAP_BAD_MAGIC, EO_HMMNGR);	// invalid heap given or invalid heap state (can this happen?)
-			return 0;
+			run = 0;
+			continue;
 		}
 
-		if (block->used == true)
-			block = block->next;
-		else if (heap_front_merge_size_fit(h, block, r_size))	// try create contiguous chunk of at least 'r_size' size
-		{
-			uint32 size = heap_block_size(h, block);
+		if (++run < pages)
+			continue;
 
-			if (r_size + sizeof(heap_block) < size)			// try squeeze a heap_block
-			{
-				heap_block* new_block = heap_block_create(h, (char*)block + sizeof(heap_block) + r_size, false,
-					block->next, block->flags);
+		first = page + 1 - pages;
+		heap_large_mark(first, pages, true);
+		break;
+	}
 
-				block->next = new_block;
-			}
+	critlock_release();
 
-			block->used = true;
-			return heap_block_start_address(block);
-		}
-		else											// requested size does not fit so continue to the next block
-			block = block->next;						// the contiguous unsused chunk remains.
+	if (first == HEAP_LARGE_WINDOW_PAGES)
+	{
+		set_last_error(ENOMEM, HEAP_OUT_OF_MEMORY, EO_HMMNGR);
+		return 0;
 	}
 
-	// allocation failed
-	set_last_error(ENOMEM, HEAP_OUT_OF_MEMORY, EO_HMMNGR);
-	return 0;
+	// the reserved run is ours, so mapping it (which may reclaim memory) needs no lock. On failure heap_map unwinds
+	virtual_addr base = HEAP_LARGE_WINDOW_BASE + first * PAGE_SIZE;
+	if (heap_map(base, base + pages * PAGE_SIZE) != ERROR_OK)
+	{
+		critlock_acquire();
+		heap_large_mark(first, pages, false);
+		critlock_release();
+
+		return 0;
+	}
+
+	heap_block* block = (heap_block*)base;
+	block->magic = HEAP_BLOCK_MAGIC;
+	block->used = true;
+	block->prev_used = true;
+	block->size = pages * PAGE_SIZE - sizeof(heap_block);
+
+	return heap_block_start_address(block);
 }
 
-error_t heap_free(heap* h, void* address)
+// frees the pages of a large block. Called inside the critical section, which it leaves while the pages are unmapped
+void heap_large_free(heap_block* block)
 {
-	if (h == 0 || address == 0)
+	virtual_addr base = (virtual_addr)block;
+	uint32 first = (base - HEAP_LARGE_WINDOW_BASE) / PAGE_SIZE;
+	uint32 pages = (block->size + sizeof(heap_block)) / PAGE_SIZE;
+
+	// a second free of the block fails validation from now on, and its pages stay reserved until they are unmapped
+	block->magic = 0;
+
+	critlock_release();
+	heap_unmap(base, base + pages * PAGE_SIZE);
+	critlock_acquire();
+
+	heap_large_mark(first, pages, false);
+}
+
+inline heap_block* heap_epilogue(heap* h)
+{
+	return (heap_block*)(h->start_address + h->size);
+}
+
+// writes the used, empty block that ends the region of h
+void heap_epilogue_create(heap* h, bool prev_used)
+{
+	heap_block* epilogue = heap_epilogue(h);
+	epilogue->magic = HEAP_BLOCK_MAGIC;
+	epilogue->used = true;
+	epilogue->prev_used = prev_used;
+	epilogue->size = 0;
+}
+
+// commits enough pages at the end of a growable heap for a free block of size bytes. Called inside the critical section,
+// which it leaves while the pages are mapped, so the caller must look for a fitting block again
+error_t heap_grow(heap* h, uint32 size)
+{
+	uint32 grow = max(size + sizeof(heap_block), HEAP_GROW_SIZE);
+	grow = (grow + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	// another thread is resizing the heap. Wait for it, its pages may be enough
+	if (spinlock_try_acquire(&h->resize_lock) == false)
 	{
-		set_last_error(EINVAL, HEAP_BAD_ARGUMENT, EO_HMMNGR);
-		return ERROR_OCCUR;
+		critlock_release();
+		spinlock_acquire(&h->resize_lock);
+		spinlock_release(&h->resize_lock);
+		critlock_acquire();
+
+		return ERROR_OK;
 	}
 
-	heap_block* block = (heap_block*)((char*)address - sizeof(heap_block));
-	if (block->magic != HEAP_BLOCK_MAGIC)
+	if (h->reserved - h->committed < grow)
 	{
-		set_last_error(EINVAL, HEAP_BAD_MAGIC, EO_HMMNGR);
+		spinlock_release(&h->resize_lock);
+		set_last_error(ENOMEM, HEAP_OUT_OF_MEMORY, EO_HMMNGR);
 		return ERROR_OCCUR;
 	}
 
-	block->used = false;
-	if (block->next != 0 && block->next->used == false)		// front-only merge unused block to partially defrag
+	// the pages past the end belong to no block, so they are mapped unlocked and linked in afterwards
+	virtual_addr end = (virtual_addr)h + h->committed;
+
+	critlock_release();
+	error_t res = heap_map(end, end + grow);
+	critlock_acquire();
+
+	if (res != ERROR_OK)
 	{
-		block->next = block->next->next;
-		h->current_blocks--;
+		spinlock_release(&h->resize_lock);
+		return ERROR_OCCUR;
 	}
 
+	h->committed += grow;
+
+	// the old epilogue heads the new space and is freed into it, merging with a free last block
+	heap_block* block = heap_epilogue(h);
+	h->size += grow;
+	heap_epilogue_create(h, true);
+
+	heap_block_create(h, block, true, block->prev_used, grow - sizeof(heap_block));
+	heap_block_release(h, block);
+
+	spinlock_release(&h->resize_lock);
 	return ERROR_OK;
 }
 
-void* heap_realloc(heap* h, void* address, uint32 new_size)
+// releases the pages of a large free block at the end of a growable heap, keeping HEAP_GROW_SIZE bytes of it. Called
+// inside the critical section, which it leaves while the pages are unmapped
+void heap_trim(heap* h)
+{
+	heap_block* epilogue = heap_epilogue(h);
+	if (epilogue->prev_used)
+		return;
+
+	heap_block* last = heap_block_prev(epilogue);
+	if (last->size <= HEAP_TRIM_SIZE)
+		return;
+
+	// a resize is running. A later free trims the heap
+	if (spinlock_try_acquire(&h->resize_lock) == false)
+		return;
+
+	uint32 release = (last->size - HEAP_GROW_SIZE) & ~(PAGE_SIZE - 1);
+
+	heap_free_remove(h, last);
+	last->size -= release;
+	h->size -= release;
+	heap_epilogue_create(h, false);
+	heap_free_insert(h, last);
+
+	h->committed -= release;
+	virtual_addr end = (virtual_addr)h + h->committed;
+
+	// the released pages are no longer part of the heap
+	critlock_release();
+	heap_unmap(end, end + release);
+	critlock_acquire();
+
+	spinlock_release(&h->resize_lock);
+}
+
+// returns the block of an allocated address or 0 (and sets the error) if it is not a used block of h
+heap_block* heap_validate(heap* h, void* address)
 {
 	if (h == 0 || address == 0)
 	{
@@ -147,57 +434,190 @@ void* heap_realloc(heap* h, void* address, uint32 new_size)
 		return 0;
 	}
 
-	heap_block* block = (heap_block*)((char*)address - sizeof(heap_block));
+	heap_block* block = heap_block_from_address(address);
 
-	if (block->magic != HEAP_BLOCK_MAGIC)
+	if ((heap_is_large(address) == false && heap_owns(h, block) == false) || block->magic != HEAP_BLOCK_MAGIC)
 	{
 		set_last_error(EINVAL, HEAP_BAD_MAGIC, EO_HMMNGR);
 		return 0;
 	}
 
-	uint32 block_size = heap_block_size(h, block);
+	// double free
+	if (block->used == false)
+	{
+		set_last_error(EINVAL, HEAP_BAD_ARGUMENT, EO_HMMNGR);
+		return 0;
+	}
 
-	if (block_size == new_size)
-		return address;
+	return block;
+}
+
+// public functions
 
-	/*if (new_size < block_size)		// request to shrink allocated space
+heap* heap_create(virtual_addr base, uint32 size)
+{
+	heap* new_heap = (heap*)base;
+	memset(new_heap, 0, sizeof(heap));
+
+	// the region ends with a used, empty block so that the last block never looks past it
+	new_heap->start_address = (virtual_addr)((char*)base + sizeof(heap));
+	new_heap->size = (size - sizeof(heap) - sizeof(heap_block)) & ~(HEAP_ALIGN - 1);
+	new_heap->committed = size;
+	heap_block* first = heap_block_create(new_heap, (void*)new_heap->start_address, false, true, new_heap->size - sizeof(heap_block));
+	heap_epilogue_create(new_heap, false);
+
+	heap_free_insert(new_heap, first);
+	heap_window_init(HEAP_LARGE_WINDOW_BASE, HEAP_LARGE_WINDOW_SIZE);
+
+	return new_heap;
+}
+
+heap* heap_create_growable(virtual_addr base, uint32 size, uint32 reserve)
+{
+	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	if ((base & (PAGE_SIZE - 1)) != 0 || size == 0 || size > reserve)
 	{
-		// try squeeze a new block
-		if (heap_is_next_unused(block))			// only one front merge required to squeeze a block
-			heap_front_merge_block(h, block);
+		set_last_error(EINVAL, HEAP_BAD_ARGUMENT, EO_HMMNGR);
+		return 0;
+	}
 
-		uint32 remaining_size = heap_block_size(h, block) - new_size;	// be careful as block size may have changed
+	heap_window_init(base, reserve);
 
-		if (remaining_size > sizeof(heap_block))		// squeeze a new block
-		{
-			heap_block* new_block = heap_block_create(h, (char*)address + new_size, false, block->next, block->flags);
-			block->next = new_block;
-		}
+	if (heap_map(base, base + size) != ERROR_OK)
+		return 0;
+
+	heap* new_heap = heap_create(base, size);
+	new_heap->reserved = reserve;
+
+	return new_heap;
+}
+
+void* heap_alloc(heap* h, uint32 r_size)
+{
+	if (h == 0 || r_size == 0)
+	{
+		set_last_error(EINVAL, HEAP_BAD_ARGUMENT, EO_HMMNGR);
+		return 0;
+	}
+
+	uint32 size = (max(r_size, HEAP_MIN_PAYLOAD) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+
+	if (size >= HEAP_LARGE_SIZE)
+		return heap_large_alloc(size);
+
+	critlock_acquire();
+
+	heap_block* block = heap_find_fit(h, size);
+	while (block == 0 && h->reserved != 0 && heap_grow(h, size) == ERROR_OK)
+		block = heap_find_fit(h, size);
+
+	if (block == 0)
+	{
+		critlock_release();
+		set_last_error(ENOMEM, HEAP_OUT_OF_MEMORY, EO_HMMNGR);
+		return 0;
+	}
+
+	if (block->magic != HEAP_BLOCK_MAGIC)
+	{
+		critlock_release();
+		set_last_error(EINVAL, HEAP_BAD_MAGIC, EO_HMMNGR);	// invalid heap given or invalid heap state (can this happen?)
+		return 0;
+	}
+
+	heap_block_take(h, block, size);
+	critlock_release();
+
+	return heap_block_start_address(block);
+}
+
+error_t heap_free(heap* h, void* address)
+{
+	critlock_acquire();
 
-		return heap_block_start_address(block);
+	heap_block* block = heap_validate(h, address);
+	if (block == 0)
+	{
+		critlock_release();
+		return ERROR_OCCUR;
 	}
-	else if (new_size > block_size)
+
+	if (heap_is_large(address))
+		heap_large_free(block);
+	else
 	{
-		if (heap_front_merge_size_fit(h, block, new_size))
+		heap_block_release(h, block);
+
+		if (h->reserved != 0)
+			heap_trim(h);
+	}
+
+	critlock_release();
+	return ERROR_OK;
+}
+
+void* heap_realloc(heap* h, void* address, uint32 new_size)
+{
+	critlock_acquire();
+
+	heap_block* block = heap_validate(h, address);
+	if (block == 0)
+	{
+		critlock_release();
+		return 0;
+	}
+
+	uint32 size = (max(new_size, HEAP_MIN_PAYLOAD) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+
+	if (heap_is_large(address) == false && size < HEAP_LARGE_SIZE)
+	{
+		// grow into a free next block
+		heap_block* next = heap_block_next(block);
+		if (size > block->size && next->used == false && block->size + sizeof(heap_block) + next->size >= size)
 		{
+			heap_free_remove(h, next);
+			block->size += sizeof(heap_block) + next->size;
+			next->magic = 0;
+			h->current_blocks--;
+			heap_block_next(block)->prev_used = true;
+		}
+
+		// shrink (or trim what the merge added) by freeing the tail
+		if (size <= block->size)
+		{
+			if (block->size >= size + sizeof(heap_block) + HEAP_MIN_PAYLOAD)
+			{
+				uint32 rest = block->size - size - sizeof(heap_block);
+				block->size = size;
+
+				heap_block* tail = heap_block_create(h, heap_block_next(block), true, true, rest);
+				heap_block_release(h, tail);
+			}
+
+			critlock_release();
+			return address;
 		}
 	}
-	else
-		return address;		// re-allocation does nothing as 'new_size' equals the currently allocated 'block_size'*/
+	else if (heap_is_large(address) && size <= block->size && size >= HEAP_LARGE_SIZE)
+	{
+		critlock_release();
+		return address;
+	}
 
-#ifndef HEAP_REALLOC_FIRST_IMPLEMENT
-		//uint32 block_size = heap_block_size(h, block);
+	// the block stays the caller's while it moves, so the copy runs outside the critical section
+	uint32 old_size = block->size;
+	critlock_release();
 
 	void* new_addr = heap_alloc(h, new_size);
 	if (new_addr == 0)
 		return 0;
 
-	memcpy(new_addr, address, min(block_size, new_size));
+	memcpy(new_addr, address, min(old_size, new_size));
 	if (heap_free(h, address) != ERROR_OK)
 		return 0;
 
 	return new_addr;
-#endif
 }
 
 uint32 heap_defrag(heap* h)
@@ -208,21 +628,31 @@ uint32 heap_defrag(heap* h)
 		return 0;
 	}
 
+	critlock_acquire();
+
 	uint32 blocks_merged = 0;
 	heap_block* block = (heap_block*)h->start_address;
 
-	while (block != 0)
+	// free blocks are merged on release, so two adjacent free blocks only appear if the heap was corrupted
+	while (block->size != 0)
 	{
-		if (block->used == false && block->next != 0 && block->next->used == false)		// merge blocks
+		heap_block* next = heap_block_next(block);
+
+		if (block->used == false && next->used == false)
 		{
-			block->next = block->next->next;
+			heap_free_remove(h, block);
+			heap_free_remove(h, next);
+			block->size += sizeof(heap_block) + next->size;
+			next->magic = 0;
 			h->current_blocks--;
+			heap_free_insert(h, block);
 			blocks_merged++;
 		}
 		else
-			block = block->next;
+			block = next;
 	}
 
+	critlock_release();
 	return blocks_merged;
 }
 
@@ -231,19 +661,24 @@ void heap_display(heap* h)
 	if (h == 0)
 		return;
 	printfln("Heap start: %h with size: %x. Currently using %u blocks.", h->start_address, h->size, h->current_blocks);
+	if (h->reserved != 0)
+		printfln("Committed %u of %u reserved bytes.", h->committed, h->reserved);
 	heap_block* block = (heap_block*)h->start_address;
 
-	while (block != 0)
+	while (block->size != 0)
 	{
 		if (block->magic != HEAP_BLOCK_MAGIC)
+		{
 			printfln("HEAP ERROR");
-		uint32 size = heap_block_size(h, block);
-		printf("block at: %h with size: %x, ", block, size);
+			return;
+		}
+
+		printf("block at: %h with size: %x, ", block, block->size);
 		if (block->used)
 			printfln("used");
 		else
 			printfln("unused");
 
-		block = block->next;
+		block = heap_block_next(block);
 	}
-}
\ No newline at end of file
+}
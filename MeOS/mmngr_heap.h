@@ -5,11 +5,37 @@
 #include "error.h"
 #include "utility.h"
 #include "mmngr_virtual.h"
+#include "spinlock.h"
+
+/*
+	General purpose heap with segregated free lists.
+
+	Every block starts with a heap_block header. Free blocks are kept in per size class lists (one class per power of two)
+	and end with a footer holding their size, so that freeing a block merges it with both neighbours in O(1) (boundary tags).
+	An allocation searches a bounded part of its own class and otherwise takes the first block of the next non-empty
+	larger class, found with a bitmap of the non-empty classes.
+
+	Requests of HEAP_LARGE_SIZE bytes or more do not use the heap region. They are given whole pages of a kernel window
+	shared by all heaps.
+
+	A heap made with heap_create_growable only commits part of its reserved window. When no block fits, it maps at least
+	HEAP_GROW_SIZE more bytes at its end, and when the free block at its end exceeds HEAP_TRIM_SIZE, the pages past
+	HEAP_GROW_SIZE of it are unmapped and returned to the physical allocator.
+
+	The heap functions run inside the critical section and leave it while pages are mapped or unmapped, as a mapping may
+	have to reclaim memory (and wait for the disk). One resize of a heap runs at a time.
+*/
 
 #define HEAP_BLOCK_MAGIC 0x1F2E
 
-#undef HEAP_ALLOC_FIRST_IMPLEMENT
-#undef HEAP_REALLOC_FIRST_IMPLEMENT
+#define HEAP_ALIGN					8					// payload alignment and size granularity
+#define HEAP_SIZE_CLASSES			24					// classes of 16 bytes to 128MB
+#define HEAP_FIT_SCAN				8					// blocks of the exact class examined before moving to a larger class
+#define HEAP_LARGE_SIZE				2 KB				// requests served with whole pages
+#define HEAP_LARGE_WINDOW_BASE		0xDB400000			// kernel virtual window of the page granular allocations
+#define HEAP_LARGE_WINDOW_SIZE		12 MB
+#define HEAP_GROW_SIZE				16 KB				// least a growable heap commits at a time
+#define HEAP_TRIM_SIZE				64 KB				// free bytes at the end of a growable heap before pages are released
 
 enum HEAP_ERROR
 {
@@ -24,8 +50,8 @@ struct heap_block
 {
 	uint16 magic;
 	bool used;
-	bool flags;
-	heap_block* next;
+	bool prev_used;				// the block before is used, so it has no footer (always true for the first block)
+	uint32 size;				// payload size in bytes
 };
 
 // Heap master. Defines a heap region to allocate blocks and space for user.
@@ -34,25 +60,33 @@ struct heap
 	virtual_addr start_address;
 	uint32 size;
 	uint32 current_blocks;
+	uint32 committed;								// mapped bytes from the heap master onwards
+	uint32 reserved;								// bytes of the window a growable heap may map (0 for a fixed heap)
+	uint32 class_bitmap;							// set bit => the class list is not empty
+	spinlock resize_lock;							// held while a growable heap maps or unmaps pages at its end
+	heap_block* free_lists[HEAP_SIZE_CLASSES];		// free blocks of each size class
 };
 
 // creates a heap of size at the virtual address base.
 heap* heap_create(virtual_addr base, uint32 size);
 
+// creates a heap at the virtual address base that commits 'size' bytes (page rounded) and grows on demand up to 'reserve'
+// bytes. The page tables of the window are created in the current directory, so kernel heaps must be made at boot.
+heap* heap_create_growable(virtual_addr base, uint32 size, uint32 reserve);
+
 // allocates size bytes at the heap h for use by a user program.
-// also merges every contiguous unused blocks found on its way.
 void* heap_alloc(heap* h, uint32 size);
 
-// deallocates a previously allocated space. (May front-merge unused blocks)
+// deallocates a previously allocated space, merging it with its unused neighbours.
 error_t heap_free(heap* h, void* address);
 
 // re-allocates a previously allocated space to take up 'new_size' space.
 void* heap_realloc(heap* h, void* address, uint32 new_size);
 
-// defrags the heap h merging all contiguous unsued blocks.
+// defrags the heap h merging all contiguous unsued blocks. Freeing already merges, so this only repairs (returns merged count).
 uint32 heap_defrag(heap* h);
 
 // displays the heap master entry along with info for every block allocated.
 void heap_display(heap* h);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,18 +1,43 @@
 #include "mmngr_phys.h"
 #include "error.h"
 #include "print_utility.h"
+#include "page_frame.h"
 
-#define PMMNGR_BLOCKS_PER_BYTE	8		// this is used in our bitmap structure
+#define PMMNGR_BLOCKS_PER_BYTE	8		// this is used in our bitmap structures
 #define PMMNGR_BLOCK_SIZE		4096	// block size in bytes (use same as page size for convenience)
 #define PMMNGR_BLOCK_ALIGN		PMMNGR_BLOCK_SIZE
 
+#define PMMNGR_MAX_ORDER		10		// largest buddy block is 2^10 blocks (4MB)
+#define PMMNGR_ORDERS			(PMMNGR_MAX_ORDER + 1)
+
+// uncomment to keep the old one bit per block map alongside the buddy structures and cross check every allocation against it
+//#define PMMNGR_DEBUG_BITMAP
+
 static uint32 mmngr_memory_size = 0;
 static uint32 mmngr_used_blocks = 0;
 static uint32 mmngr_max_blocks = 0;
 static uint32* mmngr_bitmap = 0;
 
+// buddy allocator data of a zone. For each order a bitmap is kept where a set bit means that the (2^order)-block at that index is free as a whole.
+// indices are relative to the zone's first frame. Zone boundaries are aligned to the largest buddy block, so blocks stay naturally aligned.
+struct pmmngr_zone
+{
+	uint32 start_frame;						// first frame covered by the zone
+	uint32 blocks;							// number of frames covered by the zone
+	uint32 used_blocks;						// frames of the zone in use
+
+	uint32* map[PMMNGR_ORDERS];
+	uint32 free_count[PMMNGR_ORDERS];		// free blocks at each order
+	uint32 hint[PMMNGR_ORDERS];				// lowest bitmap word that may contain a free block
+};
+
+static pmmngr_zone mmngr_zones[PMMNGR_ZONE_COUNT];
+static uint32 mmngr_metadata_size = 0;				// bytes used at the base address for the zone structures
+
 //PRIVATE - AUX FUNCTIONS
 
+#pragma region block tracking
+
 inline void mmap_set(int bit)
 {
 	mmngr_bitmap[bit / 32] |= 1 << (bit % 32);
@@ -28,70 +53,268 @@ inline bool mmap_test(int bit)
 	return mmngr_bitmap[bit / 32] & (1 << (bit % 32));
 }
 
-// returns first free block
-uint32 mmap_first_free()
+// called when count blocks starting at frame are handed out. Resets their page frame entries and, in debug mode,
+// marks them in the bitmap, panicking if the buddy allocator handed out a block in use.
+void pmmngr_track_alloc(uint32 frame, uint32 count)
+{
+#ifdef PMMNGR_DEBUG_BITMAP
+	for (uint32 i = 0; i < count; i++)
+	{
+		if (mmap_test(frame + i) == true)
+			PANIC("pmmngr: buddy allocator returned a block that is in use");
+
+		mmap_set(frame + i);
+	}
+#endif
+
+	page_frame_db_reset(frame, count, 1);
+}
+
+// called when count blocks starting at frame return to the allocator. Panics in debug mode if any of them was not in use.
+void pmmngr_track_free(uint32 frame, uint32 count)
+{
+#ifdef PMMNGR_DEBUG_BITMAP
+	for (uint32 i = 0; i < count; i++)
+	{
+		if (mmap_test(frame + i) == false)
+			PANIC("pmmngr: freeing a block that is not in use");
+
+		mmap_unset(frame + i);
+	}
+#endif
+
+	page_frame_db_reset(frame, count, 0);
+}
+
+#pragma endregion
+
+#pragma region buddy allocator
+
+// number of whole blocks of the given order that fit in the zone
+inline uint32 buddy_blocks(pmmngr_zone* zone, uint32 order)
+{
+	return zone->blocks >> order;
+}
+
+// number of bitmap words used for the given order
+inline uint32 buddy_words(pmmngr_zone* zone, uint32 order)
+{
+	return ceil_division(max(buddy_blocks(zone, order), 1), 32);
+}
+
+inline bool buddy_test(pmmngr_zone* zone, uint32 order, uint32 index)
+{
+	if (index >= buddy_blocks(zone, order))
+		return false;
+
+	return zone->map[order][index / 32] & (1 << (index % 32));
+}
+
+inline void buddy_insert(pmmngr_zone* zone, uint32 order, uint32 index)
+{
+	zone->map[order][index / 32] |= 1 << (index % 32);
+	zone->free_count[order]++;
+
+	if (index / 32 < zone->hint[order])
+		zone->hint[order] = index / 32;
+}
+
+inline void buddy_remove(pmmngr_zone* zone, uint32 order, uint32 index)
+{
+	zone->map[order][index / 32] &= ~(1 << (index % 32));
+	zone->free_count[order]--;
+}
+
+// returns the zone that contains the given frame
+pmmngr_zone* buddy_zone_of(uint32 frame)
 {
-	for (uint32 i = 0; i < mmngr_max_blocks / 32; i++)	// 32 blocks per uint32
+	for (uint32 i = PMMNGR_ZONE_COUNT - 1; i > 0; i--)
+		if (frame >= mmngr_zones[i].start_frame)
+			return &mmngr_zones[i];
+
+	return &mmngr_zones[0];
+}
+
+// returns the lowest free block index of the given order. The order must have at least one free block.
+uint32 buddy_find(pmmngr_zone* zone, uint32 order)
+{
+	uint32* map = zone->map[order];
+	uint32 words = buddy_words(zone, order);
+
+	for (uint32 i = zone->hint[order]; i < words; i++)
 	{
-		if (mmngr_bitmap[i] != 0xFFFFFFFF)	// at least one bit is off
+		if (map[i] != 0)
 		{
-			int bit = 1;
-			for (int j = 0; j < 32; j++)
-			{
-				if (!(mmngr_bitmap[i] & bit))	// bit not set
-					return i * 32 + j;
-
-				bit <<= 1;
-			}
+			zone->hint[order] = i;
+			return i * 32 + bit_scan_forward(map[i]);
 		}
 	}
 
-	set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
+	PANIC("pmmngr: buddy free count and bitmap mismatch");
 	return 0;
 }
 
-// returns the first count free blocks
-int mmap_first_free_s(uint32 count)
+// allocates a (2^order)-block from the zone and returns its first (absolute) frame or 0 if no such block exists
+uint32 buddy_alloc(pmmngr_zone* zone, uint32 order)
 {
-	if (count == 0)		// error
+	uint32 current = order;
+
+	// find the smallest order that has a free block
+	while (current <= PMMNGR_MAX_ORDER && zone->free_count[current] == 0)
+		current++;
+
+	if (current > PMMNGR_MAX_ORDER)
+		return 0;
+
+	uint32 index = buddy_find(zone, current);
+	buddy_remove(zone, current, index);
+
+	uint32 frame = index << current;
+
+	// split the block, keeping the lower half and freeing the upper one at each level
+	while (current > order)
 	{
-		set_last_error(EINVAL, PMEM_BAD_ARGUMENT, EO_PMMNGR);
-		return -1;
+		current--;
+		buddy_insert(zone, current, (frame >> current) + 1);
 	}
 
-	if (count == 1)		// mmap_first_free should be used
-		return mmap_first_free();
+	zone->used_blocks += 1 << order;
+	return zone->start_frame + frame;
+}
+
+// frees a (2^order)-block starting at the zone relative frame, coalescing it with its free buddies
+void buddy_free(pmmngr_zone* zone, uint32 frame, uint32 order)
+{
+	zone->used_blocks -= 1 << order;
 
-	for (uint32 bit = 0; bit < mmngr_max_blocks;)
+	while (order < PMMNGR_MAX_ORDER)
 	{
-		if (mmngr_bitmap[bit / 32] == 0xFFFFFFFF)	// if uint32 is full goto next
-		{
-			bit += 32;
+		uint32 buddy = (frame >> order) ^ 1;
+
+		if (buddy_test(zone, order, buddy) == false)
+			break;
+
+		buddy_remove(zone, order, buddy);
+		frame &= ~(1 << order);
+		order++;
+	}
+
+	buddy_insert(zone, order, frame >> order);
+}
+
+// returns true if the (absolute) frame lies inside a free buddy block
+bool buddy_frame_is_free(uint32 frame)
+{
+	pmmngr_zone* zone = buddy_zone_of(frame);
+	frame -= zone->start_frame;
+
+	for (uint32 order = 0; order <= PMMNGR_MAX_ORDER; order++)
+		if (buddy_test(zone, order, frame >> order))
+			return true;
+
+	return false;
+}
+
+// removes a single (absolute) frame from the free structures, splitting the free block that contains it. Returns false if the frame was not free.
+bool buddy_take_frame(uint32 frame)
+{
+	pmmngr_zone* zone = buddy_zone_of(frame);
+	frame -= zone->start_frame;
+
+	for (uint32 order = 0; order <= PMMNGR_MAX_ORDER; order++)
+	{
+		if (buddy_test(zone, order, frame >> order) == false)
 			continue;
-		}
 
-		if (mmap_test(bit) == false)
+		buddy_remove(zone, order, frame >> order);
+
+		// give back the halves that do not contain the frame
+		while (order > 0)
 		{
-			uint32 startBit = bit;				// mark the free bit
-			while (bit < mmngr_max_blocks)		// start iterating through next bits
-			{
-				bit++;
+			order--;
+			buddy_insert(zone, order, (frame >> order) ^ 1);
+		}
+
+		zone->used_blocks++;
+		return true;
+	}
 
-				if (mmap_test(bit) == true)
-					break;
+	return false;
+}
 
-				if (bit - startBit + 1 == count)	// space found so return the first bit
-					return startBit;
-			}
+// returns true if any of the count (absolute) frames starting at frame lies inside a free buddy block
+bool buddy_range_has_free(uint32 frame, uint32 count)
+{
+	for (uint32 i = 0; i < count; i++)
+		if (buddy_frame_is_free(frame + i))
+			return true;
+
+	return false;
+}
+
+// frees count (absolute) frames starting at frame, splitting the range into the largest aligned blocks possible
+void buddy_free_range(uint32 frame, uint32 count)
+{
+	while (count > 0)
+	{
+		pmmngr_zone* zone = buddy_zone_of(frame);
+		uint32 relative = frame - zone->start_frame;
+		uint32 order = 0;
+
+		// a block may not cross the end of its zone
+		uint32 limit = min(count, zone->blocks - relative);
+
+		while (order < PMMNGR_MAX_ORDER && (relative & ((2 << order) - 1)) == 0 && (2u << order) <= limit)
+			order++;
+
+		// a block that is free in part (double free or overlapping regions) is freed a frame at a time, skipping the
+		// free frames, so that only the frames actually freed are counted
+		if (order != 0 && buddy_range_has_free(frame, 1 << order))
+			order = 0;
+
+		if (buddy_frame_is_free(frame) == false)
+		{
+			pmmngr_track_free(frame, 1 << order);
+			buddy_free(zone, relative, order);
+			mmngr_used_blocks -= 1 << order;
 		}
 
-		bit++;
+		frame += 1 << order;
+		count -= 1 << order;
 	}
+}
 
-	set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
-	return 0;
+// returns the smallest order whose block holds count frames
+uint32 buddy_order_for(uint32 count)
+{
+	uint32 order = 0;
+	while ((1u << order) < count)
+		order++;
+
+	return order;
 }
 
+// allocates count frames from the zone, aligned to 2^align_order frames. The unused tail of the buddy block is given back.
+uint32 buddy_alloc_frames(pmmngr_zone* zone, uint32 count, uint32 align_order)
+{
+	uint32 order = max(buddy_order_for(count), align_order);
+
+	if (order > PMMNGR_MAX_ORDER)
+		return 0;
+
+	uint32 frame = buddy_alloc(zone, order);
+	if (frame == 0)
+		return 0;
+
+	pmmngr_track_alloc(frame, 1 << order);
+	mmngr_used_blocks += 1 << order;
+
+	buddy_free_range(frame + count, (1 << order) - count);
+	return frame;
+}
+
+#pragma endregion
+
 // modifies reg: base and length to be block aligned and to be within the former borders (new_base >= base and new_length <= length)
 void pmmngr_block_align_region(physical_memory_region* reg)
 {
@@ -132,12 +355,48 @@ uint32 pmmngr_get_prev_align(uint32 value)
 void pmmngr_init(uint32 size, physical_addr base)
 {
 	mmngr_memory_size = size;
-	mmngr_bitmap = (uint32*)base;
-	mmngr_max_blocks = pmmngr_get_memory_size() * 1024 / PMMNGR_BLOCK_SIZE;
+	mmngr_max_blocks = pmmngr_get_memory_size() / (PMMNGR_BLOCK_SIZE / 1024);
 	mmngr_used_blocks = mmngr_max_blocks;
 
-	// by default all memory is in use
-	memset(mmngr_bitmap, 0xff, pmmngr_get_block_count() / PMMNGR_BLOCKS_PER_BYTE);
+	// the DMA zone covers the ISA reachable memory and the normal zone everything above it
+	uint32 dma_blocks = min(mmngr_max_blocks, PMMNGR_ZONE_DMA_LIMIT / PMMNGR_BLOCK_SIZE);
+
+	mmngr_zones[PMMNGR_ZONE_DMA].start_frame = 0;
+	mmngr_zones[PMMNGR_ZONE_DMA].blocks = dma_blocks;
+	mmngr_zones[PMMNGR_ZONE_NORMAL].start_frame = PMMNGR_ZONE_DMA_LIMIT / PMMNGR_BLOCK_SIZE;
+	mmngr_zones[PMMNGR_ZONE_NORMAL].blocks = mmngr_max_blocks - dma_blocks;
+
+	// by default all memory is in use, so no order has free blocks
+	uint8* metadata = (uint8*)base;
+
+	for (uint32 i = 0; i < PMMNGR_ZONE_COUNT; i++)
+	{
+		pmmngr_zone* zone = &mmngr_zones[i];
+		zone->used_blocks = zone->blocks;
+
+		for (uint32 order = 0; order <= PMMNGR_MAX_ORDER; order++)
+		{
+			zone->map[order] = (uint32*)metadata;
+			zone->free_count[order] = 0;
+			zone->hint[order] = 0;
+
+			memset(zone->map[order], 0, buddy_words(zone, order) * sizeof(uint32));
+			metadata += buddy_words(zone, order) * sizeof(uint32);
+		}
+	}
+
+#ifdef PMMNGR_DEBUG_BITMAP
+	mmngr_bitmap = (uint32*)metadata;
+	memset(mmngr_bitmap, 0xff, ceil_division(mmngr_max_blocks, 32) * sizeof(uint32));
+	metadata += ceil_division(mmngr_max_blocks, 32) * sizeof(uint32);
+#endif
+
+	mmngr_metadata_size = (uint32)metadata - base;
+}
+
+uint32 pmmngr_get_metadata_size()
+{
+	return mmngr_metadata_size;
 }
 
 error_t pmmngr_free_region(physical_memory_region* region)
@@ -154,20 +413,19 @@ error_t pmmngr_free_region(physical_memory_region* region)
 	uint32 aligned_addr = region->base / PMMNGR_BLOCK_SIZE;
 	uint32 aligned_size = region->length / PMMNGR_BLOCK_SIZE;
 
-	for (int i = 0; i < aligned_size; i++)
-	{
-		if (mmap_test(aligned_addr) == true)	// if block is in use
-		{
-			mmap_unset(aligned_addr++);			// unset it to make it available
-			mmngr_used_blocks--;				// reduce blocks in use
-		}
-	}
+	if (aligned_addr >= mmngr_max_blocks)
+		return ERROR_OK;
+
+	aligned_size = min(aligned_size, mmngr_max_blocks - aligned_addr);
+	buddy_free_range(aligned_addr, aligned_size);
 
-	if (mmap_test(0) == false)		// if zero bit is unset, set it to disable 0 allocation
+	if (buddy_take_frame(0) == true)		// if zero block became free, take it back to disable 0 allocation
 	{
-		mmap_set(0);
+		pmmngr_track_alloc(0, 1);
 		mmngr_used_blocks++;
 	}
+
+	return ERROR_OK;
 }
 
 error_t pmmngr_reserve_region(physical_memory_region* region)
@@ -184,71 +442,75 @@ error_t pmmngr_reserve_region(physical_memory_region* region)
 	uint32 aligned_addr = region->base / PMMNGR_BLOCK_SIZE;
 	uint32 aligned_size = region->length / PMMNGR_BLOCK_SIZE;
 
-	for (int i = 0; i < aligned_size; i++)
+	for (uint32 i = 0; i < aligned_size && aligned_addr + i < mmngr_max_blocks; i++)
 	{
-		if (mmap_test(aligned_addr) == false)		// if block is not in use
+		if (buddy_take_frame(aligned_addr + i) == true)		// if block is not in use
 		{
-			mmap_set(aligned_addr++);				// set it to make it unavailable
-			mmngr_used_blocks++;					// increase used blocks
+			pmmngr_track_alloc(aligned_addr + i, 1);
+			mmngr_used_blocks++;								// increase used blocks
 		}
 	}
+
+	return ERROR_OK;
 }
 
 void* pmmngr_alloc_block()
 {
-	if (pmmngr_get_free_block_count() <= 0)		// out of memory
-	{
-		set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
-		return 0;
-	}
+	uint32 frame = 0;
 
-	uint32 frame = mmap_first_free();
+	// paging structures are accessed through the identity mapped low memory, so allocations are served from the lowest zone first
+	for (uint32 i = 0; i < PMMNGR_ZONE_COUNT && frame == 0; i++)
+		frame = buddy_alloc(&mmngr_zones[i], 0);
 
 	if (frame == 0)		// out of memory
+	{
+		set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
 		return 0;
+	}
 
-	mmap_set(frame);		// here we set directly without mmap_test as this is done in mmap_first_free
-
-	physical_addr addr = frame * PMMNGR_BLOCK_SIZE;
+	pmmngr_track_alloc(frame, 1);
 	mmngr_used_blocks++;
 
-	return (void*)addr;
+	return (void*)(frame * PMMNGR_BLOCK_SIZE);
 }
 
 void pmmngr_free_block(void* block)
 {
 	physical_addr addr = (physical_addr)block;
-	int frame = addr / PMMNGR_BLOCK_SIZE;
+	uint32 frame = addr / PMMNGR_BLOCK_SIZE;
 
-	if (mmap_test(frame) == true)		// if it is set (as in init and deinit region)
-	{
-		mmap_unset(frame);
-		mmngr_used_blocks--;
-	}
+	// ignore frames outside managed memory (identity mapped MMIO) and frames that are already free
+	if (frame == 0 || frame >= mmngr_max_blocks || buddy_frame_is_free(frame) == true)
+		return;
+
+	pmmngr_zone* zone = buddy_zone_of(frame);
+
+	pmmngr_track_free(frame, 1);
+	buddy_free(zone, frame - zone->start_frame, 0);
+	mmngr_used_blocks--;
 }
 
 void* pmmngr_alloc_blocks(uint32 size)
 {
 	uint32 count = ceil_division(size, pmmngr_get_block_size());
 
-	if (pmmngr_get_free_block_count() < count)	// not enough memory
+	if (count == 0)
 	{
-		set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
+		set_last_error(EINVAL, PMEM_BAD_ARGUMENT, EO_PMMNGR);
 		return 0;
 	}
 
-	uint32 frame = mmap_first_free_s(count);
+	uint32 frame = 0;
+	for (uint32 i = 0; i < PMMNGR_ZONE_COUNT && frame == 0; i++)
+		frame = buddy_alloc_frames(&mmngr_zones[i], count, 0);
 
 	if (frame == 0)		// out of memory
+	{
+		set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
 		return 0;
+	}
 
-	for (uint32 i = 0; i < count; i++)
-		mmap_set(frame + i);
-
-	physical_addr addr = frame * PMMNGR_BLOCK_SIZE;
-	mmngr_used_blocks += count;
-
-	return (void*)addr;
+	return (void*)(frame * PMMNGR_BLOCK_SIZE);
 }
 
 void pmmngr_free_blocks(void* block, uint32 size)
@@ -256,16 +518,44 @@ void pmmngr_free_blocks(void* block, uint32 size)
 	uint32 count = ceil_division(size, pmmngr_get_block_size());
 
 	physical_addr addr = (physical_addr)block;
-	int frame = addr / PMMNGR_BLOCK_SIZE;
+	uint32 frame = addr / PMMNGR_BLOCK_SIZE;
 
-	for (int i = 0; i < count; i++)
+	if (frame == 0 || frame >= mmngr_max_blocks)
+		return;
+
+	buddy_free_range(frame, min(count, mmngr_max_blocks - frame));
+}
+
+void* pmmngr_alloc_contiguous(uint32 size, uint32 align, PMMNGR_ZONE zone)
+{
+	uint32 count = ceil_division(size, pmmngr_get_block_size());
+
+	// alignment must be a power of two
+	if (count == 0 || zone >= PMMNGR_ZONE_COUNT || (align & (align - 1)) != 0)
 	{
-		if (mmap_test(frame + i) == true)
-		{
-			mmap_unset(frame);
-			mmngr_used_blocks--;
-		}
+		set_last_error(EINVAL, PMEM_BAD_ARGUMENT, EO_PMMNGR);
+		return 0;
 	}
+
+	// buddy blocks are naturally aligned to their size, so alignment is achieved by asking for a large enough order
+	uint32 align_order = buddy_order_for(ceil_division(align, pmmngr_get_block_size()));
+	uint32 frame = buddy_alloc_frames(&mmngr_zones[zone], count, align_order);
+
+	if (frame == 0)
+	{
+		set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
+		return 0;
+	}
+
+	return (void*)(frame * PMMNGR_BLOCK_SIZE);
+}
+
+uint32 pmmngr_get_zone_free_block_count(PMMNGR_ZONE zone)
+{
+	if (zone >= PMMNGR_ZONE_COUNT)
+		return 0;
+
+	return mmngr_zones[zone].blocks - mmngr_zones[zone].used_blocks;
 }
 
 uint32 pmmngr_get_memory_size()
@@ -16,6 +16,16 @@ extern "C" {
 		PMEM_BAD_ARGUMENT
 	};
 
+	// physical memory zones. Zones are tried from the lowest to the highest when no zone is requested
+	enum PMMNGR_ZONE
+	{
+		PMMNGR_ZONE_DMA,			// ISA DMA reachable memory (below 16MB)
+		PMMNGR_ZONE_NORMAL,			// the rest of the memory
+		PMMNGR_ZONE_COUNT
+	};
+
+#define PMMNGR_ZONE_DMA_LIMIT	0x1000000		// 16MB, end of the DMA zone
+
 	struct physical_memory_region
 	{
 		physical_memory_region() {}
@@ -36,12 +46,15 @@ extern "C" {
 	// maximum block number
 	extern uint32 mmngr_max_blocks;
 
-	// bitmap structure where each bit represents a block in memory
+	// bitmap structure where each bit represents a block in memory (debug cross-check of the buddy allocator)
 	extern uint32* mmngr_bitmap;
 
 	// initialize the physical memory manager. (size in KB)
 	void pmmngr_init(uint32 size, physical_addr base);
 
+	// get the size in bytes of the allocator structures placed at the base address given to pmmngr_init
+	uint32 pmmngr_get_metadata_size();
+
 	// initialize a region for use
 	error_t pmmngr_free_region(physical_memory_region* region);
 
@@ -60,6 +73,12 @@ extern "C" {
 	// frees allocated blocks
 	void pmmngr_free_blocks(void* block, uint32 size);
 
+	// allocates physically contiguous blocks to hold size, aligned to align bytes (power of two) from the given zone. Free with pmmngr_free_blocks
+	void* pmmngr_alloc_contiguous(uint32 size, uint32 align, PMMNGR_ZONE zone);
+
+	// get the number of blocks not in use in the given zone
+	uint32 pmmngr_get_zone_free_block_count(PMMNGR_ZONE zone);
+
 	// get the memory amount the manager is initialized to use
 	uint32 pmmngr_get_memory_size();
 
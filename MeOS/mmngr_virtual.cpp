@@ -4,6 +4,11 @@
 #include "print_utility.h"
 #include "file.h"
 #include "error.h"
+#include "page_frame.h"
+#include "zero_pool.h"
+#include "system.h"
+#include "swap.h"
+#include "kmem_cache.h"
 
 // private data
 
@@ -12,6 +17,9 @@ physical_addr current_pdbr = 0;			// current page directory base register
 
 pdirectory* kernel_directory = 0;		// kernel page directory
 
+bool large_pages_enabled = false;		// cr4.PSE is set and 4MB pages can be used
+bool global_pages_enabled = false;		// cr4.PGE is set and kernel pages are marked global
+
 #pragma region HELPER FUNCTION
 // when fault occured the page was present in memory
 bool page_fault_error_is_page_present(uint32 error)
@@ -81,7 +89,133 @@ void page_fault_alloc_page(uint32 area_flags, virtual_addr address)
 	if (CHK_BIT(area_flags, MMAP_IDENTITY_MAP))
 		vmmngr_map_page(vmmngr_get_directory(), address, address, flags);
 	else
-		vmmngr_alloc_page_f(address, flags);
+		vmmngr_alloc_zeroed_page_f(address, flags);
+}
+
+// maps the shared zero page read-only for a read of untouched anonymous memory. Writable areas get it copy-on-write,
+// so the first write allocates the real frame
+bool page_fault_map_zero_page(uint32 area_flags, virtual_addr address)
+{
+	// without cr0.WP ring 0 writes would go straight through the read-only mapping into the shared frame
+	if (zero_pool_get_zero_page() == 0 || CHK_BIT(area_flags, MMAP_IDENTITY_MAP) || write_protection_enabled() == false)
+		return false;
+
+	// the table (if created here) keeps the area flags, only the page itself is read-only
+	uint32 flags = page_fault_calculate_present_flags(area_flags);
+	if (vmmngr_map_page(vmmngr_get_directory(), zero_pool_get_zero_page(), address, flags) != ERROR_OK)
+		return false;
+
+	pt_entry* page = vmmngr_lookup_page(current_directory, address);
+	pt_entry_del_attrib(page, I86_PTE_WRITABLE);
+
+	if (CHK_BIT(area_flags, MMAP_WRITE))
+		pt_entry_add_attrib(page, I86_PTE_COPY_ON_WRITE);
+
+	vmmngr_flush_TLB_entry(address);
+	return true;
+}
+
+// maps the 4MB chunk containing address with a single large page if the area asks for it and covers the whole chunk
+bool page_fault_map_large_page(vm_area* area, virtual_addr address)
+{
+	if (!CHK_BIT(area->flags, MMAP_LARGE_PAGES) || !CHK_BIT(area->flags, MMAP_IDENTITY_MAP) || !vmmngr_large_pages_enabled())
+		return false;
+
+	virtual_addr chunk = address & ~(LARGE_PAGE_SIZE - 1);
+	if (chunk < area->start_addr || chunk + (LARGE_PAGE_SIZE - 1) > area->end_addr - 1)
+		return false;
+
+	return vmmngr_map_large_page(vmmngr_get_directory(), chunk, chunk, page_fault_calculate_present_flags(area->flags)) == ERROR_OK;
+}
+
+// maps one file page of the area from the page cache. Private mappings get a copy, shared mappings map the cache frame.
+bool page_fault_map_file_page(vm_area* area, virtual_addr address)
+{
+	uint32 file_page = (area->offset + (address - area->start_addr)) / PAGE_SIZE;
+
+	virtual_addr cache = page_cache_get_buffer(area->fd, file_page);
+	if (cache == 0)
+		return false;
+
+	uint32 flags = page_fault_calculate_present_flags(area->flags);
+
+	if (CHK_BIT(area->flags, MMAP_SHARED))
+	{
+		// the process mapping holds its own reference so the cache frame outlives the buffer release
+		physical_addr cache_frame = vmmngr_get_phys_addr(cache);
+		page_frame_get_ref(cache_frame);
+
+		if (vmmngr_map_page(vmmngr_get_directory(), cache_frame, address, flags) != ERROR_OK)
+		{
+			page_frame_put(cache_frame);
+			page_cache_put_buffer(cache);
+			return false;
+		}
+
+		// let the page cache unmap it before evicting the buffer. The pin is dropped only once eviction knows the mapping
+		page_cache_add_mapping(cache, vmmngr_get_directory(), address);
+		page_cache_put_buffer(cache);
+		return true;
+	}
+
+	if (vmmngr_alloc_page_f(address, flags) != ERROR_OK)
+	{
+		page_cache_put_buffer(cache);
+		return false;
+	}
+
+	memcpy((void*)address, (void*)cache, PAGE_SIZE);
+	page_cache_put_buffer(cache);
+	return true;
+}
+
+// maps the neighbouring file pages (aligned fault-around block and read-ahead window) that are already cached
+void page_fault_around(vm_area* area, virtual_addr address, uint32 ra_pages)
+{
+	if (area->advice == MADV_RANDOM)
+		return;
+
+	virtual_addr start = address & ~(FAULT_AROUND_PAGES * PAGE_SIZE - 1);
+	virtual_addr end = start + FAULT_AROUND_PAGES * PAGE_SIZE;
+	virtual_addr ra_end = address + ra_pages * PAGE_SIZE;
+
+	start = max(start, area->start_addr);
+	end = max(end, ra_end);
+	end = min(end, area->end_addr);
+
+	for (virtual_addr page = start; page < end; page += PAGE_SIZE)
+		if (page != address && vmmngr_is_page_present(page) == false)
+			page_fault_map_file_page(area, page);
+}
+
+// serves a fault on a file mapping. One read brings the faulting page and the read-ahead window in the page cache.
+void page_fault_file(vm_area* area, virtual_addr address, uint32 ra_pages)
+{
+	address &= ~(PAGE_SIZE - 1);
+	uint32 read_start = area->offset + (address - area->start_addr);		// file read start
+
+	gfe* entry = gft_get(area->fd);
+	if (entry == 0)
+	{
+		serial_printf("area.fd = %u", area->fd);
+		PANIC("page fault gfd entry = 0");
+	}
+
+	// pages already in the cache are skipped by the read. It stops at the end of the file, so only nothing read is a failure
+	size_t read = read_file_global(area->fd, read_start, ra_pages * PAGE_SIZE, -1, VFS_CAP_READ | VFS_CAP_CACHE);
+	if (read == INVALID_IO || read == 0)
+	{
+		serial_printf("mmap file read failed, fd: %u, offset: %h: %e\n", area->fd, read_start, get_last_error());
+		PANIC("mmap file read failed");
+	}
+
+	if (page_fault_map_file_page(area, address) == false)
+	{
+		serial_printf("read fd: %u\n", area->fd);
+		PANIC("mmap file read less bytes than expected");
+	}
+
+	page_fault_around(area, address, ra_pages);
 }
 
 void page_fault_bottom(thread_exception te)
@@ -96,7 +230,7 @@ void page_fault_bottom(thread_exception te)
 		PANIC("PAge fault spinlock is already reserved\n");
 
 	spinlock_acquire(&process_get_current()->contract_spinlock);
-	vm_area* p_area = vm_contract_find_area(&thread_get_current()->parent->memory_contract, addr);
+	vm_area* p_area = vm_contract_find_area_hint(&thread_get_current()->parent->memory_contract, addr, &thread_get_current()->contract_hint);
 
 	if (p_area == 0)
 	{
@@ -104,6 +238,11 @@ void page_fault_bottom(thread_exception te)
 		PANIC("");		// terminate thread and process with SIGSEGV
 	}
 
+	// file faults update the area read-ahead state, so do it while the contract is locked
+	uint32 ra_pages = 1;
+	if (CHK_BIT(p_area->flags, MMAP_ANONYMOUS) == false && page_fault_error_is_page_present(code) == false)
+		ra_pages = vm_area_update_readahead(p_area, addr);
+
 	vm_area area = *p_area;
 	spinlock_release(&process_get_current()->contract_spinlock);
 
@@ -128,7 +267,31 @@ void page_fault_bottom(thread_exception te)
 		PANIC("");
 	}*/
 
-	// if the page is present then a violation happened (we do not implement swap out/shared anonymous yet)
+	// a write to a page shared after fork, give this process its own copy
+	if (page_fault_error_is_page_present(code) && page_fault_error_is_write(code) && vmmngr_is_page_cow(addr))
+	{
+		if (vmmngr_break_cow(addr) != ERROR_OK)
+		{
+			serial_printf("copy on write failed at address: %h\n", addr);
+			PANIC("");
+		}
+
+		return;
+	}
+
+	// the page was evicted to the swap file, read it back
+	if (page_fault_error_is_page_present(code) == false && swap_is_page_swapped(addr))
+	{
+		if (swap_in_page(addr, page_fault_calculate_present_flags(area.flags)) != ERROR_OK)
+		{
+			serial_printf("swap in failed at address: %h\n", addr);
+			PANIC("");
+		}
+
+		return;
+	}
+
+	// if the page is present then a violation happened (we do not implement shared anonymous yet)
 	if (page_fault_error_is_page_present(code) == true)
 	{
 		serial_printf("memory violation at address: %h with code: %h\n", addr, code);
@@ -141,43 +304,30 @@ void page_fault_bottom(thread_exception te)
 	{
 		if (CHK_BIT(area.flags, MMAP_ALLOC_IMMEDIATE))
 		{
-			// loop through all addresses and map them
-			for (virtual_addr address = area.start_addr; address < area.end_addr; address += 4096)
-				//if (CHK_BIT(area.flags, MMAP_ANONYMOUS))	ALLOC_IMMEDIATE works only for anonymous (imposed in mmap)
-				page_fault_alloc_page(area.flags, address);
+			// loop through all addresses and map them (whole 4MB chunks at once when large pages are requested)
+			for (virtual_addr address = area.start_addr; address < area.end_addr;)
+			{
+				if (address % LARGE_PAGE_SIZE == 0 && page_fault_map_large_page(&area, address))
+					address += LARGE_PAGE_SIZE;
+				else
+				{
+					//if (CHK_BIT(area.flags, MMAP_ANONYMOUS))	ALLOC_IMMEDIATE works only for anonymous (imposed in mmap)
+					page_fault_alloc_page(area.flags, address);
+					address += 4096;
+				}
+			}
 		}
 		else
 		{
 			if (CHK_BIT(area.flags, MMAP_ANONYMOUS))
-				page_fault_alloc_page(area.flags, addr & (~0xFFF));
-			else
 			{
-				uint32 flags = page_fault_calculate_present_flags(area.flags);
-				vmmngr_alloc_page_f(addr & (~0xFFF), flags);
-
-				uint32 read_start = area.offset + ((addr - area.start_addr) / PAGE_SIZE) * PAGE_SIZE;		// file read start
-				uint32 read_size = PAGE_SIZE;		// we read one page at a time (not the whole area as this may not be necessary)
-
-				//if (read_start < area.start_addr + PAGE_SIZE)	// we are reading the first page so subtract offset from read_size
-				//	read_size -= area.offset;
-
-				serial_printf("gfd: %u, reading at mem: %h, phys: %h file: %h, size: %u\n", area.fd, addr & (~0xfff), vmmngr_get_phys_addr(addr & (~0xfff)),
-					read_start, read_size);
-
-				gfe* entry = gft_get(area.fd);
-				if (entry == 0)
-				{
-					serial_printf("area.fd = %u", area.fd);
-					PANIC("page fault gfd entry = 0");
-				}
-
-				// read one page from the file offset given at the 4KB-aligned fault address 
-				if (read_file_global(area.fd, read_start, read_size, addr & (~0xFFF), VFS_CAP_READ | VFS_CAP_CACHE) != read_size)
-				{
-					serial_printf("read fd: %u\n", area.fd);
-					PANIC("mmap anonymous file read less bytes than expected");
-				}
+				// reads of untouched memory share the zero page until the first write
+				if (page_fault_map_large_page(&area, addr) == false &&
+					(page_fault_error_is_write(code) || page_fault_map_zero_page(area.flags, addr & (~0xFFF)) == false))
+					page_fault_alloc_page(area.flags, addr & (~0xFFF));
 			}
+			else
+				page_fault_file(&area, addr, ra_pages);
 		}
 	}
 	else		// MMAP_SHARED
@@ -185,21 +335,7 @@ void page_fault_bottom(thread_exception te)
 		if (CHK_BIT(area.flags, MMAP_ANONYMOUS))
 			PANIC("A shared area cannot be marked as anonymous yet.");
 		else
-		{
-			// in the shared file mapping the address to read is ignored as data are read only to page cache. 
-			uint32 read_start = area.offset + ((addr & (~0xfff)) - area.start_addr);
-			gfe* entry = gft_get(area.fd);
-
-			if (read_file_global(area.fd, read_start, PAGE_SIZE, -1, VFS_CAP_READ | VFS_CAP_CACHE) != PAGE_SIZE)
-				PANIC("mmap shared file failed");
-
-			virtual_addr used_cache = page_cache_get_buffer(area.fd, read_start / PAGE_SIZE);
-			//serial_printf("m%h\n", used_cache);
-
-			uint32 flags = page_fault_calculate_present_flags(area.flags);
-			vmmngr_map_page(vmmngr_get_directory(), vmmngr_get_phys_addr(used_cache), addr & (~0xfff), flags/*DEFAULT_FLAGS*/);
-			//serial_printf("shared mapping fd: %u, cache: %h, phys cache: %h, read: %u, addr: %h\n", area.fd, used_cache, used_cache, read_start, addr);
-		}
+			page_fault_file(&area, addr, ra_pages);
 	}
 }
 
@@ -209,6 +345,16 @@ error_t vmmngr_map_page(pdirectory* dir, physical_addr phys, virtual_addr virt,
 
 	pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, virt);
 
+	if (pd_entry_is_present(*e) && pd_entry_is_4mb(*e))
+	{
+		// nothing to do if the 4MB page already gives this translation
+		if (pd_entry_get_large_frame(*e) + (virt & (LARGE_PAGE_SIZE - 1)) == (phys & ~(PAGE_SIZE - 1)) && (*e & flags) == flags)
+			return ERROR_OK;
+
+		if (vmmngr_split_large_page(dir, virt) != ERROR_OK)
+			return ERROR_OCCUR;
+	}
+
 	if (pd_entry_test_attrib(e, I86_PDE_PRESENT) == false)	// table is not present
 		if (vmmngr_create_table(dir, virt, flags) != ERROR_OK)
 			return ERROR_OCCUR;
@@ -224,15 +370,190 @@ error_t vmmngr_map_page(pdirectory* dir, physical_addr phys, virtual_addr virt,
 		return ERROR_OCCUR;
 	}
 	
+	// kernel half translations are the same in every address space so keep them in the TLB across cr3 reloads
+	if (global_pages_enabled && virt >= KERNEL_SPACE_START)
+		flags |= I86_PTE_CPU_GLOBAL;
+
+	// keep the page frame map counts in sync with the page tables
+	physical_addr frame = phys & ~(PAGE_SIZE - 1);
+	if (pt_entry_is_present(*page) == false)
+		page_frame_map(frame);
+	else if (pt_entry_get_frame(*page) != frame)
+	{
+		page_frame_unmap(pt_entry_get_frame(*page));
+		page_frame_map(frame);
+	}
+
 	//*page = 0;												// delete possible previous information (pt_entry is just a uint32)
 	*page |= flags;											// and reset
 	pt_entry_set_frame(page, phys);
 
-	vmmngr_flush_TLB_entry(virt);
+	// other address spaces are not cached in the TLB
+	if (dir == current_directory)
+		vmmngr_flush_TLB_entry(virt);
+
+	return ERROR_OK;
+}
+
+// adds or removes the mapping of the 1024 frames covered by a large page from the page frame database
+void vmmngr_large_page_account(physical_addr frame, bool map)
+{
+	if (page_frame_db_ready() == false)
+		return;
+
+	for (uint32 i = 0; i < PAGES_PER_TABLE; i++, frame += PAGE_SIZE)
+	{
+		if (map)
+			page_frame_map(frame);
+		else
+			page_frame_unmap(frame);
+	}
+}
+
+error_t vmmngr_map_large_page(pdirectory* dir, physical_addr phys, virtual_addr virt, uint32 flags)
+{
+	if (large_pages_enabled == false || ((phys | virt) & (LARGE_PAGE_SIZE - 1)) != 0)
+	{
+		set_last_error(EINVAL, VMEM_BAD_ARGUMENT, EO_VMMNGR);
+		return ERROR_OCCUR;
+	}
+
+	pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, virt);
+	if (e == 0)
+		return ERROR_OCCUR;
+
+	if (global_pages_enabled && virt >= KERNEL_SPACE_START)
+		flags |= I86_PDE_CPU_GLOBAL;
+
+	if (pd_entry_is_present(*e))
+	{
+		// a page table already holds 4KB mappings here, do not throw them away
+		if (pd_entry_is_4mb(*e) == false)
+		{
+			set_last_error(EINVAL, VMEM_BAD_ARGUMENT, EO_VMMNGR);
+			return ERROR_OCCUR;
+		}
+
+		if (pd_entry_get_large_frame(*e) != phys)
+		{
+			vmmngr_large_page_account(pd_entry_get_large_frame(*e), false);
+			vmmngr_large_page_account(phys, true);
+		}
+	}
+	else
+		vmmngr_large_page_account(phys, true);
+
+	*e = phys | flags | I86_PDE_4MB;
+
+	if (dir == current_directory)
+		vmmngr_flush_TLB_entry(virt);
+
+	return ERROR_OK;
+}
+
+error_t vmmngr_split_large_page(pdirectory* dir, virtual_addr virt)
+{
+	pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, virt);
+	if (e == 0 || pd_entry_is_present(*e) == false || pd_entry_is_4mb(*e) == false)
+	{
+		set_last_error(EINVAL, VMEM_BAD_ARGUMENT, EO_VMMNGR);
+		return ERROR_OCCUR;
+	}
+
+	ptable* table = (ptable*)pmmngr_alloc_block();
+	if (!table)
+		return ERROR_OCCUR;		// not enough memory!!
+
+	// the same frames stay mapped, so the page frame map counts do not change.
+	// The global bit is dropped as the split is done to give (some of) these pages a private translation.
+	uint32 flags = *e & (I86_PDE_PRESENT | I86_PDE_WRITABLE | I86_PDE_USER | I86_PDE_PWT | I86_PDE_PCD);
+	physical_addr frame = pd_entry_get_large_frame(*e);
+
+	for (uint32 i = 0; i < PAGES_PER_TABLE; i++, frame += PAGE_SIZE)
+		table->entries[i] = frame | flags;
+
+	*e = (physical_addr)table | flags;
+
+	// invalidating any address inside the large page drops its whole TLB entry
+	if (dir == current_directory)
+		vmmngr_flush_TLB_entry(virt);
 
 	return ERROR_OK;
 }
 
+// turns on cr4.PSE if cpuid reports page size extension support
+bool vmmngr_enable_large_pages()
+{
+	uint32 features;
+
+	_asm
+	{
+		mov eax, 1
+		cpuid
+		mov dword ptr[features], edx
+	}
+
+	if (CHK_BIT(features, 1 << 3) == false)
+		return false;
+
+	_asm
+	{
+		mov eax, cr4
+		or eax, 0x10		// set bit 4 (PSE) of cr4 register
+		mov cr4, eax
+	}
+
+	return true;
+}
+
+bool vmmngr_large_pages_enabled()
+{
+	return large_pages_enabled;
+}
+
+// turns on cr4.PGE if cpuid reports global page support
+bool vmmngr_enable_global_pages()
+{
+	uint32 features;
+
+	_asm
+	{
+		mov eax, 1
+		cpuid
+		mov dword ptr[features], edx
+	}
+
+	if (CHK_BIT(features, 1 << 13) == false)
+		return false;
+
+	_asm
+	{
+		mov eax, cr4
+		or eax, 0x80		// set bit 7 (PGE) of cr4 register
+		mov cr4, eax
+	}
+
+	return true;
+}
+
+bool vmmngr_global_pages_enabled()
+{
+	return global_pages_enabled;
+}
+
+void vmmngr_flush_TLB_global()
+{
+	// toggling cr4.PGE invalidates every TLB entry, global ones included
+	_asm
+	{
+		mov eax, cr4
+		mov ebx, eax
+		and eax, 0xFFFFFF7F
+		mov cr4, eax
+		mov cr4, ebx
+	}
+}
+
 error_t vmmngr_initialize(uint32 kernel_pages)
 {
 	pdirectory* pdir = (pdirectory*)pmmngr_alloc_block();
@@ -245,10 +566,25 @@ error_t vmmngr_initialize(uint32 kernel_pages)
 	physical_addr phys = 0;		// page directory structure is allocated at the beginning (<1MB) (false)
 								// so identity map the first 4MB to be sure we can point to them
 
-	for (uint32 i = 0; i < 1024; i++, phys += 4096)
-		if (vmmngr_map_page(pdir, phys, phys, DEFAULT_FLAGS) != ERROR_OK)
+	large_pages_enabled = vmmngr_enable_large_pages();
+	global_pages_enabled = vmmngr_enable_global_pages();
+
+	// the low identity map is copied to every address space too, so it is global like the kernel half
+	uint32 identity_flags = DEFAULT_FLAGS | (global_pages_enabled ? I86_PDE_CPU_GLOBAL : 0);
+
+	if (large_pages_enabled)
+	{
+		if (vmmngr_map_large_page(pdir, 0, 0, identity_flags) != ERROR_OK)
 			return ERROR_OCCUR;
+	}
+	else
+	{
+		for (uint32 i = 0; i < 1024; i++, phys += 4096)
+			if (vmmngr_map_page(pdir, phys, phys, identity_flags) != ERROR_OK)
+				return ERROR_OCCUR;
+	}
 
+	// the kernel is loaded at 1MB which is not 4MB aligned so its image is mapped with 4KB pages
 	phys = 0x100000;
 	virtual_addr virt = 0xC0000000;
 
@@ -271,19 +607,53 @@ error_t vmmngr_alloc_page(virtual_addr base)
 }
 
 // TODO: Consider using invalidate page assembly instruction. When mapping a non-null page this is needed to update the hardware cache.
+physical_addr vmmngr_alloc_frame()
+{
+	physical_addr frame = (physical_addr)pmmngr_alloc_block();
+	if (frame != 0)
+		return frame;
+
+	// zeroed frames are good for anything, then free slab pages cached by the kernel and make room by evicting cold pages
+	frame = zero_pool_alloc_frame();
+	if (frame == 0 && kmem_reclaim() > 0)
+		frame = (physical_addr)pmmngr_alloc_block();
+
+	if (frame == 0 && swap_reclaim(SWAP_RECLAIM_BATCH) > 0)
+		frame = (physical_addr)pmmngr_alloc_block();
+
+	return frame;
+}
+
+// drops a shared zero page translation of addr so that a real frame can take its place
+void vmmngr_drop_zero_page(virtual_addr addr)
+{
+	if (zero_pool_get_zero_page() == 0)
+		return;
+
+	pt_entry* page = vmmngr_lookup_page(current_directory, addr);
+
+	if (page != 0 && pt_entry_is_present(*page) && pt_entry_get_frame(*page) == zero_pool_get_zero_page())
+	{
+		*page = 0;
+		vmmngr_flush_TLB_entry(addr);
+	}
+}
+
 error_t vmmngr_alloc_page_f(virtual_addr base, uint32 flags)
 {
 	//TODO: cater for memory mapped IO where (in the most simple case) an identity map must be done.
 	//TODO: fix this function
 	physical_addr addr = base;
 
+	vmmngr_drop_zero_page(base);
+
 	if (vmmngr_is_page_present(base))
 		addr = vmmngr_get_phys_addr(base);
 	else
 	{
 		if (base < 0xF0000000)		// memory mapped IO above 3GB
 		{
-			addr = (physical_addr)pmmngr_alloc_block();
+			addr = vmmngr_alloc_frame();
 			if (addr == 0)
 				return ERROR_OCCUR;
 		}
@@ -301,6 +671,32 @@ error_t vmmngr_alloc_page_f(virtual_addr base, uint32 flags)
 	return ERROR_OK;
 }
 
+error_t vmmngr_alloc_zeroed_page_f(virtual_addr base, uint32 flags)
+{
+	vmmngr_drop_zero_page(base);
+
+	if (vmmngr_is_page_present(base))
+		return vmmngr_alloc_page_f(base, flags);
+
+	physical_addr addr = zero_pool_alloc_frame();
+	if (addr != 0)
+		return vmmngr_map_page(vmmngr_get_directory(), addr, base, flags);
+
+	// the pool is empty, so zero the page here. It is mapped writable first as read-only pages fault on ring 0 writes with cr0.WP
+	if (vmmngr_alloc_page_f(base, flags | I86_PTE_WRITABLE) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	memset((void*)(base & ~(PAGE_SIZE - 1)), 0, PAGE_SIZE);
+
+	if ((flags & I86_PTE_WRITABLE) != I86_PTE_WRITABLE)
+	{
+		pt_entry_del_attrib(vmmngr_lookup_page(current_directory, base), I86_PTE_WRITABLE);
+		vmmngr_flush_TLB_entry(base);
+	}
+
+	return ERROR_OK;
+}
+
 error_t vmmngr_free_page(pt_entry* entry)
 {
 	if (!entry)
@@ -309,10 +705,23 @@ error_t vmmngr_free_page(pt_entry* entry)
 		return ERROR_OCCUR;
 	}
 
-	void* addr = (void*)pt_entry_get_frame(*entry);
+	// the page lives in the swap file, release its slot
+	if (swap_is_entry_swapped(*entry))
+	{
+		swap_free_entry(*entry);
+		*entry = 0;
+
+		return ERROR_OK;
+	}
+
+	physical_addr addr = pt_entry_get_frame(*entry);
 
-	if (addr)
-		pmmngr_free_block(addr);
+	// the mapping drops its reference. The frame is freed only if no one else (page cache, other mappings) holds it.
+	if (addr && pt_entry_is_present(*entry))
+	{
+		page_frame_unmap(addr);
+		page_frame_put(addr);
+	}
 
 	pt_entry_del_attrib(entry, I86_PTE_PRESENT);
 	pt_entry_del_attrib(entry, I86_PTE_WRITABLE);
@@ -349,9 +758,10 @@ void vmmngr_flush_TLB_entry(virtual_addr addr)
 {
 	_asm
 	{
+		pushfd						// keep the caller's interrupt state
 		cli
 		invlpg addr					// use assembly special instruction
-		sti
+		popfd
 	}
 }
 
@@ -382,6 +792,9 @@ error_t vmmngr_pdirectory_clear(pdirectory* pdir)
 {
 	for (int i = 0; i < TABLES_PER_DIR; i++)
 	{
+		if (pd_entry_is_4mb(pdir->entries[i]))		// large pages do not own a page table
+			continue;
+
 		if (vmmngr_ptable_clear((ptable*)pd_entry_get_frame(pdir->entries[i])) != ERROR_OK)
 			return ERROR_OCCUR;
 	}
@@ -408,6 +821,12 @@ void vmmngr_print(pdirectory* dir)
 		if (pd_entry_test_attrib(&dir->entries[i], I86_PDE_PRESENT) == false)
 			continue;
 
+		if (pd_entry_is_4mb(dir->entries[i]))
+		{
+			printfln("table %i is a 4MB page at %h", i, pd_entry_get_large_frame(dir->entries[i]));
+			continue;
+		}
+
 		ptable* table = (ptable*)PAGE_GET_PHYSICAL_ADDR(&dir->entries[i]);
 
 		printfln("table %i is present at %h", i, table);
@@ -428,6 +847,9 @@ physical_addr vmmngr_get_phys_addr(virtual_addr addr)
 	if (!e)
 		return 0;
 
+	if (pd_entry_is_present(*e) && pd_entry_is_4mb(*e))
+		return pd_entry_get_large_frame(*e) + (addr & (LARGE_PAGE_SIZE - 1));
+
 	ptable* table = (ptable*)pd_entry_get_frame(*e);
 	pt_entry* page = vmmngr_ptable_lookup_entry(table, addr);
 	if (!page)
@@ -442,6 +864,12 @@ physical_addr vmmngr_get_phys_addr(virtual_addr addr)
 void vmmngr_free_page_addr(virtual_addr addr)
 {
 	pd_entry* e = vmmngr_pdirectory_lookup_entry(vmmngr_get_directory(), addr);
+
+	// only a 4KB page is freed, so break the large page first
+	if (pd_entry_is_present(*e) && pd_entry_is_4mb(*e))
+		if (vmmngr_split_large_page(vmmngr_get_directory(), addr) != ERROR_OK)
+			return;
+
 	ptable* table = (ptable*)pd_entry_get_frame(*e);
 	pt_entry* page = vmmngr_ptable_lookup_entry(table, addr);
 
@@ -454,6 +882,9 @@ bool vmmngr_is_page_present(virtual_addr addr)
 	if (e == 0 || pd_entry_is_present(*e) == false)
 		return false;
 
+	if (pd_entry_is_4mb(*e))
+		return true;
+
 	ptable* table = (ptable*)pd_entry_get_frame(*e);
 	if (table == 0)
 		return false;
@@ -501,6 +932,209 @@ pdirectory* vmmngr_create_address_space()
 	return dir;
 }
 
+// returns the page table entry of addr in dir or 0 if no page table covers it (or it is a large page)
+pt_entry* vmmngr_lookup_page(pdirectory* dir, virtual_addr addr)
+{
+	pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, addr);
+	if (e == 0 || pd_entry_is_present(*e) == false || pd_entry_is_4mb(*e))
+		return 0;
+
+	return vmmngr_ptable_lookup_entry((ptable*)pd_entry_get_frame(*e), addr);
+}
+
+// undoes the first count directory entries of a partial clone of src. The references the clone took are dropped, pages that
+// no other space shares any more are writable again in src, and the clone tables and directory are freed
+void vmmngr_unwind_clone(pdirectory* src, pdirectory* dir, uint32 count)
+{
+	for (uint32 i = 0; i < count; i++)
+	{
+		// shared entries were copied as they are
+		if (dir->entries[i] == src->entries[i])
+			continue;
+
+		ptable* table = (ptable*)pd_entry_get_frame(dir->entries[i]);
+		ptable* src_table = (ptable*)pd_entry_get_frame(src->entries[i]);
+
+		for (uint32 j = 0; j < PAGES_PER_TABLE; j++)
+		{
+			pt_entry page = table->entries[j];
+
+			if (swap_is_entry_swapped(page))
+			{
+				swap_free_entry(page);
+				continue;
+			}
+
+			if (pt_entry_is_present(page) == false)
+				continue;
+
+			physical_addr frame = pt_entry_get_frame(page);
+			page_frame_unmap(frame);
+			page_frame_put(frame);
+
+			pt_entry* parent = &src_table->entries[j];
+			page_frame* pf = page_frame_get(frame);
+
+			if (frame != zero_pool_get_zero_page() && pf != 0 && pf->refcount == 1 && pt_entry_test_attrib(parent, I86_PTE_COPY_ON_WRITE))
+			{
+				pt_entry_del_attrib(parent, I86_PTE_COPY_ON_WRITE);
+				pt_entry_add_attrib(parent, I86_PTE_WRITABLE);
+			}
+		}
+
+		pmmngr_free_block(table);
+	}
+
+	pmmngr_free_block(dir);
+}
+
+pdirectory* vmmngr_clone_address_space(pdirectory* src, vm_contract* c)
+{
+	pdirectory* dir = vmmngr_create_address_space();
+	if (!dir)
+		return 0;
+
+	vm_area* area = 0;
+
+	for (uint32 i = 0; i < TABLES_PER_DIR; i++)
+	{
+		pd_entry entry = src->entries[i];
+
+		// the kernel half, tables copied from the kernel directory and large pages are shared by every address space
+		if (pd_entry_is_present(entry) == false || pd_entry_is_4mb(entry) || entry == kernel_directory->entries[i] ||
+			i >= PAGE_DIR_INDEX(KERNEL_SPACE_START))
+		{
+			dir->entries[i] = entry;
+			continue;
+		}
+
+		ptable* table = (ptable*)pmmngr_alloc_block();
+		if (!table)
+		{
+			// not enough memory!! The tables before this one are complete, the rest of dir is still empty
+			vmmngr_unwind_clone(src, dir, i);
+
+			if (src == current_directory)
+				pmmngr_load_PDBR(current_pdbr);
+
+			return 0;
+		}
+
+		memset(table, 0, sizeof(ptable));
+		ptable* src_table = (ptable*)pd_entry_get_frame(entry);
+
+		for (uint32 j = 0; j < PAGES_PER_TABLE; j++)
+		{
+			pt_entry* page = &src_table->entries[j];
+
+			// both spaces refer to the same swap slot until each reads it back
+			if (swap_is_entry_swapped(*page))
+			{
+				table->entries[j] = *page;
+				swap_dup_entry(*page);
+				continue;
+			}
+
+			if (pt_entry_is_present(*page) == false)
+				continue;
+
+			virtual_addr addr = (i << 22) | (j << 12);
+			if (area == 0 || addr < area->start_addr || addr >= area->end_addr)
+				area = vm_contract_find_area(c, addr);
+
+			// writable private pages become read-only in both spaces until one of them writes
+			if (area != 0 && CHK_BIT(area->flags, MMAP_PRIVATE) && pt_entry_is_writable(*page))
+			{
+				pt_entry_del_attrib(page, I86_PTE_WRITABLE);
+				pt_entry_add_attrib(page, I86_PTE_COPY_ON_WRITE);
+			}
+
+			table->entries[j] = *page;
+
+			// frames mapped before the database existed are untracked, so count the parent mapping first
+			physical_addr frame = pt_entry_get_frame(*page);
+			page_frame* pf = page_frame_get(frame);
+			if (pf != 0 && pf->refcount == 0)
+				page_frame_get_ref(frame);
+
+			page_frame_get_ref(frame);
+			page_frame_map(frame);
+		}
+
+		dir->entries[i] = (entry & ~I86_PDE_FRAME) | (physical_addr)table;
+	}
+
+	// drop the stale writable translations of the parent
+	if (src == current_directory)
+		pmmngr_load_PDBR(current_pdbr);
+
+	return dir;
+}
+
+bool vmmngr_is_page_cow(virtual_addr addr)
+{
+	pt_entry* page = vmmngr_lookup_page(current_directory, addr);
+
+	return page != 0 && pt_entry_is_present(*page) && pt_entry_test_attrib(page, I86_PTE_COPY_ON_WRITE);
+}
+
+static uint8 cow_buffer[PAGE_SIZE];		// staging area for the page being copied
+static spinlock cow_lock = 0;
+
+error_t vmmngr_break_cow(virtual_addr addr)
+{
+	addr &= ~(PAGE_SIZE - 1);
+
+	pt_entry* page = vmmngr_lookup_page(current_directory, addr);
+	if (page == 0 || pt_entry_test_attrib(page, I86_PTE_COPY_ON_WRITE) == false)
+	{
+		set_last_error(EINVAL, VMEM_BAD_ARGUMENT, EO_VMMNGR);
+		return ERROR_OCCUR;
+	}
+
+	physical_addr frame = pt_entry_get_frame(*page);
+	page_frame* pf = page_frame_get(frame);
+
+	// the first write to the shared zero page gets a zeroed frame of its own, there is nothing to copy
+	if (frame == zero_pool_get_zero_page())
+		return vmmngr_alloc_zeroed_page_f(addr, (*page & (I86_PTE_PRESENT | I86_PTE_USER)) | I86_PTE_WRITABLE);
+
+	// the other spaces already dropped the frame, so this is the last owner and can simply write to it
+	if (pf != 0 && pf->refcount == 1)
+	{
+		pt_entry_del_attrib(page, I86_PTE_COPY_ON_WRITE);
+		pt_entry_add_attrib(page, I86_PTE_WRITABLE);
+		vmmngr_flush_TLB_entry(addr);
+
+		return ERROR_OK;
+	}
+
+	physical_addr copy = vmmngr_alloc_frame();
+	if (copy == 0)
+		return ERROR_OCCUR;
+
+	spinlock_acquire(&cow_lock);
+
+	memcpy(cow_buffer, (void*)addr, PAGE_SIZE);
+
+	uint32 flags = (*page & (I86_PTE_PRESENT | I86_PTE_USER)) | I86_PTE_WRITABLE;
+	*page &= ~I86_PTE_COPY_ON_WRITE;
+
+	if (vmmngr_map_page(current_directory, copy, addr, flags) != ERROR_OK)
+	{
+		spinlock_release(&cow_lock);
+		return ERROR_OCCUR;
+	}
+
+	memcpy((void*)addr, cow_buffer, PAGE_SIZE);
+	spinlock_release(&cow_lock);
+
+	// the mapping reference moved to the new frame
+	page_frame_put(frame);
+
+	return ERROR_OK;
+}
+
 error_t vmmngr_map_kernel_space(pdirectory* pdir)
 {
 	if (!pdir)
@@ -17,6 +17,11 @@ enum VMEM_ERROR
 #define PAGES_PER_TABLE 1024	// intel arch definitions
 #define TABLES_PER_DIR	1024
 #define PAGE_SIZE 4096
+#define LARGE_PAGE_SIZE 0x400000	// PSE 4MB page, maps a whole page directory entry
+
+#define FAULT_AROUND_PAGES 16		// file faults map the already cached pages of this aligned block around the fault
+
+#define KERNEL_SPACE_START 0xC0000000	// kernel half shared by all address spaces. Its pages are global (PGE) and survive cr3 reloads
 
 #define DEFAULT_FLAGS I86_PDE_PRESENT | I86_PDE_WRITABLE	// default flags for page tables and pages.
 
@@ -26,6 +31,8 @@ enum VMEM_ERROR
 #define PAGE_TABLE_INDEX(x)			( ((x) >> 12) & 0x3ff )		// Get the 10 "middle" bits of x
 #define PAGE_GET_PHYSICAL_ADDR(x)	( (*x) & ~0xfff )			// Physical address is 4KB aligned, so return all bits except the 12 first
 
+struct vm_contract;
+
 void page_fault(registers_struct* regs);
 // page table definition
 struct ptable
@@ -49,15 +56,36 @@ struct pdirectory
 // maps the virtual address given to the physical address given
 error_t vmmngr_map_page(pdirectory* dir, physical_addr phys, virtual_addr virt, uint32 flags);
 
+// maps a 4MB page at the 4MB-aligned virtual address given to the 4MB-aligned physical address given
+error_t vmmngr_map_large_page(pdirectory* dir, physical_addr phys, virtual_addr virt, uint32 flags);
+
+// breaks the 4MB page containing virt into a page table of 4KB pages with the same mappings
+error_t vmmngr_split_large_page(pdirectory* dir, virtual_addr virt);
+
+// returns true if the cpu supports 4MB pages (PSE) and they are enabled
+bool vmmngr_large_pages_enabled();
+
+// returns true if the cpu supports global pages (PGE) and they are enabled
+bool vmmngr_global_pages_enabled();
+
+// flushes the whole TLB including the global kernel entries
+void vmmngr_flush_TLB_global();
+
 // initializes the virtual memory manager
 error_t vmmngr_initialize(uint32 kernel_pages);
 
+// allocates a physical frame. When memory is exhausted the zero pool is drained and cold pages are evicted to the swap file
+physical_addr vmmngr_alloc_frame();
+
 // allocates a virtual page with the default flags
 error_t vmmngr_alloc_page(virtual_addr base);
 
 // allocates a virtual page with flags
 error_t vmmngr_alloc_page_f(virtual_addr base, uint32 flags);
 
+// allocates a virtual page with flags backed by a zeroed frame (taken from the zero pool when it has one)
+error_t vmmngr_alloc_zeroed_page_f(virtual_addr base, uint32 flags);
+
 // frees a virtual page
 error_t vmmngr_free_page(pt_entry* entry);
 
@@ -100,7 +128,21 @@ error_t vmmngr_create_table(pdirectory* dir, virtual_addr addr, uint32 flags);
 // creates a new address space
 pdirectory* vmmngr_create_address_space();
 
-// maps the kernel pages to the directory given
+// creates a copy-on-write clone of the src address space. Kernel tables are shared, private tables are duplicated with
+// their writable private pages (based on the contract) turned read-only in both spaces. Every copied entry holds a frame reference.
+// NOTE: ring 0 writes to such pages fault only if cr0.WP is set
+pdirectory* vmmngr_clone_address_space(pdirectory* src, vm_contract* c);
+
+// returns the page table entry of addr in dir or 0 if no page table covers it (or it is a large page)
+pt_entry* vmmngr_lookup_page(pdirectory* dir, virtual_addr addr);
+
+// returns true if the page at addr of the current address space is a copy-on-write page
+bool vmmngr_is_page_cow(virtual_addr addr);
+
+// gives the current address space a private writable copy of the copy-on-write page at addr
+error_t vmmngr_break_cow(virtual_addr addr);
+
+// maps the kernel pages to the directory given (the kernel half is global, so switching to the directory keeps its TLB entries)
 error_t vmmngr_map_kernel_space(pdirectory* pdir);
 
 error_t vmmngr_switch_to_kernel_directory();
@@ -116,7 +116,8 @@ gfe create_gfe(vfs_node* file)
 	entry.file_node = file;
 	entry.open_count = 0;
 	spinlock_init(&entry.lock);
-	list_init(&entry.pages);
+	page_index_init(&entry.pages);
+	readahead_init(&entry.ra);
 
 	return entry;
 }
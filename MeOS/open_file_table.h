@@ -7,6 +7,7 @@
 #include "vfs.h"
 #include "spinlock.h"
 #include "page_cache.h"
+#include "readahead.h"
 
 enum OPEN_FILE_TBL_ERROR
 {
@@ -29,7 +30,8 @@ struct global_file_entry
 	vfs_node* file_node;					// actual file description node
 	uint32 open_count;						// shows how many times the file has been opened
 	spinlock lock;							// per entry lock
-	list<_page_cache_file_info> pages;		// file cached data (this may not be used if the file doesn't support caching)
+	page_index pages;						// file cached data by file page (this may not be used if the file doesn't support caching)
+	file_readahead ra;						// read-ahead window of cached reads
 };
 
 typedef vector<global_file_entry> global_file_table;
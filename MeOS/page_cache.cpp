@@ -2,10 +2,16 @@
 #include "open_file_table.h"
 #include "print_utility.h"
 #include "critlock.h"
+#include "page_frame.h"
+#include "memory.h"
+#include "spinlock.h"
+#include "timer.h"
 
 // private data
 _page_cache page_cache;			// the global page cache
-uint8* alloced_bitmap;			// bitmap containing the buffers allocated
+uint32* alloced_bitmap;			// one bit per buffer, set when the buffer is allocated
+uint32 alloced_hint;			// bitmap word where the search for a free buffer starts
+spinlock page_cache_lock = 0;	// guards the bitmap, the buffer states and lists and the page indices of the files
 
 // private functions
 
@@ -24,51 +30,52 @@ virtual_addr page_cache_addr_by_index(uint32 index)
 	return (virtual_addr)(page_cache.cache) + index * PAGE_CACHE_SIZE;
 }
 
-virtual_addr page_cache_get_last()
+uint32 page_cache_bitmap_words()
 {
-	return (virtual_addr)(page_cache.cache + page_cache_num_buffers() - 1);
+	return ceil_division(page_cache_num_buffers(), 32);
 }
 
-// returns the first free buffer index
+// returns a free buffer index. Full words (32 buffers) are skipped, starting from the word of the last allocation
 uint32 page_cache_index_free_buffer()
 {
-	uint32 buffers = page_cache_num_buffers();
+	uint32 words = page_cache_bitmap_words();
+	uint32 word = alloced_hint;
 
-	for (uint32 i = 0; i < page_cache_num_buffers(); i++)
+	for (uint32 i = 0; i < words; i++)
 	{
-		// TODO: optimize to use one bit per allocation
-		if (alloced_bitmap[i] == 0)
-			return i;
+		if (alloced_bitmap[word] != 0xFFFFFFFF)
+		{
+			alloced_hint = word;
+			return word * 32 + bit_scan_forward(~alloced_bitmap[word]);
+		}
+
+		if (++word == words)
+			word = 0;
 	}
 
 	// not found. return invalid index == number of buffers.
-	return buffers;
+	return page_cache_num_buffers();
+}
+
+bool page_cache_index_is_reserved(uint32 index)
+{
+	return (alloced_bitmap[index / 32] & (1 << (index % 32))) != 0;
 }
 
 // reserves an unallocated buffer using its index to retrieve it.
 void page_cache_index_reserve_buffer(uint32 index)
 {
-	alloced_bitmap[index] = 1;	// TODO: optimize as above
+	alloced_bitmap[index / 32] |= 1 << (index % 32);
 }
 
 // releases the allocated buffer indexed by index
 void page_cache_index_release_buffer(uint32 index)
 {
-	alloced_bitmap[index] = 0;	// TODO: optimize as above
+	alloced_bitmap[index / 32] &= ~(1 << (index % 32));
 }
 
-// create a page_cache_file_info struct
-_page_cache_file_info page_cache_file_info_create(uint32 page, uint32 buffer_index)
-{
-	_page_cache_file_info finfo;
-	finfo.page = page;
-	finfo.buffer_index = buffer_index;
-	finfo.dirty = false;
-
-	return finfo;
-}
-
-list_node<_page_cache_file_info>* page_cache_get_finfo(uint32 gfd, uint32 page)
+// returns the page index of the file or 0 if the descriptor is bad
+page_index* page_cache_get_index(uint32 gfd)
 {
 	if (gfd >= gft_get_table()->count)
 	{
@@ -82,16 +89,343 @@ list_node<_page_cache_file_info>* page_cache_get_finfo(uint32 gfd, uint32 page)
 		return 0;
 	}
 
-	auto temp = gft_get_table()->data[gfd].pages.head;
-	while (temp != 0)
+	return &gft_get_table()->data[gfd].pages;
+}
+
+void page_cache_list_remove(_page_cache_list* list, uint32 index)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+
+	if (buf->prev != PAGE_CACHE_NO_BUFFER)
+		page_cache.buffers[buf->prev].next = buf->next;
+	else
+		list->head = buf->next;
+
+	if (buf->next != PAGE_CACHE_NO_BUFFER)
+		page_cache.buffers[buf->next].prev = buf->prev;
+	else
+		list->tail = buf->prev;
+
+	buf->prev = buf->next = PAGE_CACHE_NO_BUFFER;
+	list->count--;
+}
+
+void page_cache_list_push(_page_cache_list* list, uint32 index)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+
+	buf->prev = PAGE_CACHE_NO_BUFFER;
+	buf->next = list->head;
+
+	if (list->head != PAGE_CACHE_NO_BUFFER)
+		page_cache.buffers[list->head].prev = index;
+	else
+		list->tail = index;
+
+	list->head = index;
+	list->count++;
+}
+
+// returns the list the file buffer is on
+_page_cache_list* page_cache_list_of(uint32 index)
+{
+	return CHK_BIT(page_cache.buffers[index].flags, PAGE_CACHE_BUF_ACTIVE) ? &page_cache.active : &page_cache.inactive;
+}
+
+// moves the file buffer to the head of the active (young) or inactive (old) list, clearing its reference bit
+void page_cache_move(uint32 index, bool active)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+
+	if (active && CHK_BIT(buf->flags, PAGE_CACHE_BUF_ACTIVE) == false)
+		page_cache.stats.activations++;
+
+	page_cache_list_remove(page_cache_list_of(index), index);
+	buf->flags &= ~(PAGE_CACHE_BUF_REFERENCED | PAGE_CACHE_BUF_ACTIVE);
+
+	if (active)
+		buf->flags |= PAGE_CACHE_BUF_ACTIVE;
+
+	page_cache_list_push(page_cache_list_of(index), index);
+}
+
+// starts tracking a buffer that caches the page of the file, on the inactive list
+void page_cache_track(uint32 index, uint32 gfd, uint32 page)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+
+	buf->gfd = gfd;
+	buf->page = page;
+	buf->flags = PAGE_CACHE_BUF_FILE;
+	buf->mapping_count = 0;
+	buf->pins = 0;
+
+	page_cache_list_push(&page_cache.inactive, index);
+}
+
+void page_cache_untrack(uint32 index)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+
+	if (CHK_BIT(buf->flags, PAGE_CACHE_BUF_FILE))
+		page_cache_list_remove(page_cache_list_of(index), index);
+
+	buf->flags = 0;
+	buf->mapping_count = 0;
+	buf->pins = 0;
+}
+
+// second touch of an inactive buffer promotes it, any touch marks it referenced
+void page_cache_mark_accessed(uint32 index)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+
+	if (CHK_BIT(buf->flags, PAGE_CACHE_BUF_FILE) == false)
+		return;
+
+	if (CHK_BIT(buf->flags, PAGE_CACHE_BUF_ACTIVE) == false && CHK_BIT(buf->flags, PAGE_CACHE_BUF_REFERENCED))
+		page_cache_move(index, true);
+	else
+		buf->flags |= PAGE_CACHE_BUF_REFERENCED;
+}
+
+bool page_cache_frame_is_locked(uint32 index)
+{
+	return page_frame_test_flags(vmmngr_get_phys_addr(page_cache_addr_by_index(index)), PAGE_FRAME_LOCKED);
+}
+
+// sets the dirty tag of a cached page and the dirty flag of its frame. Called with the lock held
+error_t page_cache_set_dirty(uint32 gfd, uint32 page, bool dirty)
+{
+	page_index* index = page_cache_get_index(gfd);
+	if (index == 0)
+		return ERROR_OCCUR;
+
+	virtual_addr address = (virtual_addr)page_index_lookup(index, page);
+	if (address == 0)
+	{
+		set_last_error(EINVAL, PAGE_CACHE_FINFO_NOT_FOUND, EO_PAGE_CACHE);
+		return ERROR_OCCUR;
+	}
+
+	if (page_index_is_tagged(index, page, PAGE_INDEX_TAG_DIRTY) != dirty)
+	{
+		page_index_tag(index, page, PAGE_INDEX_TAG_DIRTY, dirty);
+
+		if (dirty)
+			page_cache.stats.dirty++;
+		else
+			page_cache.stats.dirty--;
+	}
+
+	physical_addr frame = vmmngr_get_phys_addr(address);
+	if (dirty)
+		page_frame_set_flags(frame, PAGE_FRAME_DIRTY);
+	else
+		page_frame_clear_flags(frame, PAGE_FRAME_DIRTY);
+
+	return ERROR_OK;
+}
+
+// untracks and unmaps the buffer and gives its index back. Called with the lock held
+void page_cache_free_buffer(uint32 index)
+{
+	page_cache_untrack(index);
+	vmmngr_free_page_addr(page_cache_addr_by_index(index));
+	page_cache_index_release_buffer(index);
+}
+
+// returns the page table entry of the mapping if it still maps the frame, else 0 (unmapped since, or the space is gone)
+pt_entry* page_cache_mapping_entry(_page_cache_mapping* m, physical_addr frame)
+{
+	pt_entry* entry = vmmngr_lookup_page(m->dir, m->address);
+
+	if (entry == 0 || pt_entry_is_present(*entry) == false || pt_entry_get_frame(*entry) != frame)
+		return 0;
+
+	return entry;
+}
+
+// collects the accessed bits of the shared mappings of the buffer into its reference bit, and drops stale records
+void page_cache_harvest_mappings(uint32 index)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+	physical_addr frame = vmmngr_get_phys_addr(page_cache_addr_by_index(index));
+
+	for (uint32 i = 0; i < buf->mapping_count; )
+	{
+		pt_entry* entry = page_cache_mapping_entry(&buf->mappings[i], frame);
+
+		if (entry == 0)
+		{
+			buf->mappings[i] = buf->mappings[--buf->mapping_count];
+			continue;
+		}
+
+		if (pt_entry_test_attrib(entry, I86_PTE_ACCESSED))
+		{
+			pt_entry_del_attrib(entry, I86_PTE_ACCESSED);
+			if (buf->mappings[i].dir == vmmngr_get_directory())
+				vmmngr_flush_TLB_entry(buf->mappings[i].address);
+
+			buf->flags |= PAGE_CACHE_BUF_REFERENCED;
+		}
+
+		i++;
+	}
+}
+
+// removes the buffer frame from the shared mappings. Fails if the frame is mapped anywhere else than the cache and the
+// recorded mappings. A mapping that wrote to the page makes the buffer dirty
+error_t page_cache_unmap_buffer(uint32 index)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+	physical_addr frame = vmmngr_get_phys_addr(page_cache_addr_by_index(index));
+	page_frame* pf = page_frame_get(frame);
+
+	// the stale records are gone after the harvest, and the cache mapping is the one left
+	if (pf != 0 && pf->mapcount != buf->mapping_count + 1)
+	{
+		set_last_error(EBUSY, PAGE_CACHE_BUFFER_BUSY, EO_PAGE_CACHE);
+		return ERROR_OCCUR;
+	}
+
+	for (uint32 i = 0; i < buf->mapping_count; i++)
+	{
+		pt_entry* entry = page_cache_mapping_entry(&buf->mappings[i], frame);
+		if (entry == 0)
+			continue;
+
+		if (pt_entry_test_attrib(entry, I86_PTE_DIRTY))
+			page_cache_set_dirty(buf->gfd, buf->page, true);
+
+		// the next access faults and finds the page through the cache again
+		vmmngr_free_page(entry);
+		*entry = 0;
+
+		if (buf->mappings[i].dir == vmmngr_get_directory())
+			vmmngr_flush_TLB_entry(buf->mappings[i].address);
+
+		page_cache.stats.unmaps++;
+	}
+
+	buf->mapping_count = 0;
+	return ERROR_OK;
+}
+
+// writes back a dirty victim without the lock, which is dropped for the write. Its locked frame keeps it from being
+// evicted or released meanwhile. Called with the lock held
+error_t page_cache_evict_writeback(uint32 index, uint32 gfd, uint32 page)
+{
+	physical_addr frame = vmmngr_get_phys_addr(page_cache_addr_by_index(index));
+
+	page_cache_set_dirty(gfd, page, false);
+	page_frame_set_flags(frame, PAGE_FRAME_LOCKED);
+
+	spinlock_release(&page_cache_lock);
+	error_t res = vfs_sync(gfd, gft_get(gfd)->file_node, page, page);
+	spinlock_acquire(&page_cache_lock);
+
+	page_frame_clear_flags(frame, PAGE_FRAME_LOCKED);
+
+	if (res != ERROR_OK)
+	{
+		page_cache_set_dirty(gfd, page, true);
+		return ERROR_OCCUR;
+	}
+
+	page_cache.stats.writebacks++;
+	return ERROR_OK;
+}
+
+// writes back, unmaps and releases the file buffer. Called with the lock held, which is dropped to write a dirty victim
+error_t page_cache_evict(uint32 index)
+{
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+	uint32 gfd = buf->gfd, page = buf->page;
+
+	page_index* pages = page_cache_get_index(gfd);
+	if (pages == 0)
+		return ERROR_OCCUR;
+
+	// the writeback daemon (or another eviction) is transferring it, or a caller is copying or mapping it
+	if (page_cache_frame_is_locked(index) || buf->pins != 0)
+	{
+		set_last_error(EBUSY, PAGE_CACHE_BUFFER_BUSY, EO_PAGE_CACHE);
+		return ERROR_OCCUR;
+	}
+
+	if (page_cache_unmap_buffer(index) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	if (page_index_is_tagged(pages, page, PAGE_INDEX_TAG_DIRTY))
+	{
+		if (page_cache_evict_writeback(index, gfd, page) != ERROR_OK)
+			return ERROR_OCCUR;
+
+		// written, mapped or looked up again while the lock was dropped
+		if (page_index_is_tagged(pages, page, PAGE_INDEX_TAG_DIRTY) || buf->mapping_count != 0 || buf->pins != 0)
+		{
+			set_last_error(EBUSY, PAGE_CACHE_BUFFER_BUSY, EO_PAGE_CACHE);
+			return ERROR_OCCUR;
+		}
+	}
+
+	page_index_remove(pages, page);
+	page_cache_free_buffer(index);
+	page_cache.stats.evictions++;
+
+	return ERROR_OK;
+}
+
+// ages the active list: while it holds more than the inactive one (or the inactive one is empty), its oldest buffer
+// goes to the inactive list unless it was referenced, which buys it another round
+void page_cache_age_active()
+{
+	uint32 rounds = page_cache.active.count;
+
+	while (page_cache.active.count != 0 && rounds-- != 0 &&
+		(page_cache.active.count > page_cache.inactive.count || page_cache.inactive.count == 0))
+	{
+		uint32 index = page_cache.active.tail;
+		page_cache_harvest_mappings(index);
+
+		bool referenced = CHK_BIT(page_cache.buffers[index].flags, PAGE_CACHE_BUF_REFERENCED);
+		page_cache_move(index, referenced && page_cache.inactive.count != 0);
+	}
+}
+
+// frees one file buffer. Returns false if none can be evicted. Called with the lock held
+bool page_cache_reclaim()
+{
+	// every buffer may come around twice (once to lose its reference bit) before giving up
+	uint32 scans = 2 * page_cache_num_buffers();
+
+	while (scans-- != 0)
 	{
-		if (temp->data.page == page)
-			return temp;
-		temp = temp->next;
+		page_cache_age_active();
+
+		if (page_cache.inactive.count == 0)
+			return false;
+
+		uint32 index = page_cache.inactive.tail;
+		page_cache_harvest_mappings(index);
+
+		// referenced since it got here => second chance on the active list
+		if (CHK_BIT(page_cache.buffers[index].flags, PAGE_CACHE_BUF_REFERENCED))
+		{
+			page_cache_move(index, true);
+			continue;
+		}
+
+		if (page_cache_evict(index) == ERROR_OK)
+			return true;
+
+		// busy (unknown mappings or failed writeback). Keep it out of the way for a while
+		page_cache_move(index, true);
 	}
 
-	set_last_error(EINVAL, PAGE_CACHE_FINFO_NOT_FOUND, EO_PAGE_CACHE);
-	return 0;
+	return false;
 }
 
 // public functions
@@ -102,41 +436,119 @@ error_t page_cache_init(virtual_addr start, uint32 no_buffers)
 
 	page_cache.cache = (_cache_cell*)start;
 
-	// Here we assume that alloced bitmap fits into just one page buffer. 
-	// TODO: Perhaps change this in the future.
+	uint32 words = page_cache_bitmap_words();
 
-	// auto reserve the last buffer as this is where the alloced bitmap lives.
-	virtual_addr last_buffer = page_cache_get_last();
+	alloced_bitmap = (uint32*)malloc(words * sizeof(uint32));
+	if (alloced_bitmap == 0)
+		return ERROR_OCCUR;
+
+	memset(alloced_bitmap, 0, words * sizeof(uint32));
+	alloced_hint = 0;
+
+	// the bits past the last buffer are never free
+	if (no_buffers % 32 != 0)
+		alloced_bitmap[words - 1] = ~((1 << (no_buffers % 32)) - 1);
+
+	page_cache.buffers = (_page_cache_buffer*)malloc(no_buffers * sizeof(_page_cache_buffer));
+	if (page_cache.buffers == 0)
+		return ERROR_OCCUR;
 
-	alloced_bitmap = (uint8*)last_buffer;
-	memset(alloced_bitmap, 0, PAGE_CACHE_SIZE);
+	memset(page_cache.buffers, 0, no_buffers * sizeof(_page_cache_buffer));
+	page_cache.active.head = page_cache.active.tail = PAGE_CACHE_NO_BUFFER;
+	page_cache.inactive.head = page_cache.inactive.tail = PAGE_CACHE_NO_BUFFER;
+	page_cache.active.count = page_cache.inactive.count = 0;
 
-	page_cache_index_reserve_buffer(page_cache_index_by_addr(last_buffer));
+	memset(&page_cache.stats, 0, sizeof(page_cache_stats));
+	page_cache.stats.buffers = no_buffers;
 
 	return ERROR_OK;
 }
 
 virtual_addr page_cache_get_buffer(uint32 gfd, uint32 page)
 {
-	auto finfo = page_cache_get_finfo(gfd, page);
+	spinlock_acquire(&page_cache_lock);
+
+	page_index* index = page_cache_get_index(gfd);
+	if (index == 0)
+	{
+		spinlock_release(&page_cache_lock);
+		return 0;
+	}
 
 	// page not found. No buffer is allocated. Return failure.
-	if (finfo == 0)
+	virtual_addr address = (virtual_addr)page_index_lookup(index, page);
+
+	// its reserver is still reading it in. Wait for the data, or for the reservation to be dropped
+	while (address != 0 && CHK_BIT(page_cache.buffers[page_cache_index_by_addr(address)].flags, PAGE_CACHE_BUF_UPTODATE) == false)
+	{
+		spinlock_release(&page_cache_lock);
+		sleep(1);
+		spinlock_acquire(&page_cache_lock);
+
+		address = (virtual_addr)page_index_lookup(index, page);
+	}
+
+	if (address == 0)
+	{
+		page_cache.stats.misses++;
+		spinlock_release(&page_cache_lock);
+
+		set_last_error(EINVAL, PAGE_CACHE_FINFO_NOT_FOUND, EO_PAGE_CACHE);
 		return 0;
+	}
 
-	return (virtual_addr)(page_cache.cache + finfo->data.buffer_index);
+	page_cache.stats.hits++;
+	page_cache_mark_accessed(page_cache_index_by_addr(address));
+	page_cache.buffers[page_cache_index_by_addr(address)].pins++;
+
+	spinlock_release(&page_cache_lock);
+	return address;
+}
+
+void page_cache_put_buffer(virtual_addr buffer)
+{
+	uint32 index = page_cache_index_by_addr(buffer);
+	if (index >= page_cache_num_buffers())
+		return;
+
+	spinlock_acquire(&page_cache_lock);
+
+	if (page_cache.buffers[index].pins != 0)
+		page_cache.buffers[index].pins--;
+
+	spinlock_release(&page_cache_lock);
+}
+
+void page_cache_set_uptodate(virtual_addr buffer)
+{
+	uint32 index = page_cache_index_by_addr(buffer);
+	if (index >= page_cache_num_buffers())
+		return;
+
+	spinlock_acquire(&page_cache_lock);
+
+	if (CHK_BIT(page_cache.buffers[index].flags, PAGE_CACHE_BUF_FILE))
+		page_cache.buffers[index].flags |= PAGE_CACHE_BUF_UPTODATE;
+
+	spinlock_release(&page_cache_lock);
 }
 
 virtual_addr page_cache_reserve_anonymous()
 {
+	spinlock_acquire(&page_cache_lock);
+
 	// find the first free buffer index
-	//critlock_acquire();
 	uint32 free_buf = page_cache_index_free_buffer();
-	//critlock_release();
 
-	// could not find free buffer. Die!
+	// every buffer is taken. Make room by evicting a file page (the lock is dropped meanwhile, so look again)
+	while (free_buf >= page_cache_num_buffers() && page_cache_reclaim())
+		free_buf = page_cache_index_free_buffer();
+
+	// nothing could be evicted. Die!
 	if (free_buf >= page_cache_num_buffers())
 	{
+		spinlock_release(&page_cache_lock);
+
 		DEBUG("Could not find empty page cache buffer");
 		set_last_error(ENOMEM, PAGE_CACHE_DEPLET, EO_PAGE_CACHE);
 		return 0;
@@ -146,19 +558,27 @@ virtual_addr page_cache_reserve_anonymous()
 	page_cache_index_reserve_buffer(free_buf);
 	virtual_addr address = page_cache_addr_by_index(free_buf);
 
+	// the page allocation may reclaim memory through the disk, so it runs unlocked. The reserved index is ours
+	spinlock_release(&page_cache_lock);
+
 	// Pages are not freed so always check to see if they are already present
 	//if (vmmngr_is_page_present(address) == false)	// HUGE BUG. If page is present and an allocation happens the software is updated but the TLB still points to the previous entry. Now the vmmngr is updated to check already alloced pages.
 	/*if (vmmngr_alloc_page(address) != ERROR_OK)
 		return 0;*/
 		// if page is present and page is re-allocated then vmmngr_flush_TLB_entry(address);
 
-	//critlock_acquire();
 	if (vmmngr_alloc_page(address) != ERROR_OK)
 	{
+		spinlock_acquire(&page_cache_lock);
 		page_cache_index_release_buffer(free_buf);
+		spinlock_release(&page_cache_lock);
+
 		return 0;
 	}
-	//critlock_release();
+
+	physical_addr frame = vmmngr_get_phys_addr(address);
+	page_frame_set_flags(frame, PAGE_FRAME_CACHE_OWNED);
+	page_frame_set_owner(frame, (void*)address);
 
 	return address;
 }
@@ -170,10 +590,9 @@ void page_cache_release_anonymous(virtual_addr address)
 	if (index >= page_cache_num_buffers())
 		return;
 
-	//critlock_acquire();
-	page_cache_index_release_buffer(index);
-	vmmngr_free_page_addr(address); 
-	//critlock_release();
+	spinlock_acquire(&page_cache_lock);
+	page_cache_free_buffer(index);
+	spinlock_release(&page_cache_lock);
 	// ?? The cache will eat up space until it reaches a lethal point. Then a special kernel thread will clean up.
 }
 
@@ -194,110 +613,237 @@ virtual_addr page_cache_reserve_buffer(uint32 gfd, uint32 page)
 		return 0;
 	}
 
-	uint32 free_buf = page_cache_index_by_addr(address);
-
 	// associate the buffer with the given gfd + page
-	// assume gfd entry exists but file info doesn't
+	spinlock_acquire(&page_cache_lock);
+
+	uint32 buffer = page_cache_index_by_addr(address);
+	page_index* index = page_cache_get_index(gfd);
+
+	if (index == 0)
+	{
+		page_cache_free_buffer(buffer);
+		spinlock_release(&page_cache_lock);
+		return 0;
+	}
+
+	if (page_index_lookup(index, page) != 0)
+	{
+		page_cache_free_buffer(buffer);
+		spinlock_release(&page_cache_lock);
+
+		set_last_error(EINVAL, PAGE_CACHE_PAGE_EXISTS, EO_PAGE_CACHE);
+		return 0;
+	}
 
-	_page_cache_file_info finfo = page_cache_file_info_create(page, free_buf);
+	if (page_index_insert(index, page, (void*)address) != ERROR_OK)
+	{
+		page_cache_free_buffer(buffer);
+		spinlock_release(&page_cache_lock);
 
-	list_insert_back(&gft_get(gfd)->pages, finfo);	// TODO : Check for errors in this line
+		set_last_error(ENOMEM, PAGE_CACHE_DEPLET, EO_PAGE_CACHE);
+		return 0;
+	}
+
+	page_cache_track(buffer, gfd, page);
+	page_cache.buffers[buffer].pins = 1;
 
+	spinlock_release(&page_cache_lock);
 	return address;
 }
 
-// TODO: APPLY NEW FIX
 error_t page_cache_release_buffer(uint32 gfd, uint32 page)
 {
-	//if (gfd >= page_cache.cached_files.count || page_cache.cached_files[gfd].gfd == INVALID_FD)		// kinda erroneous gfd
-	//{
-	//	set_last_error(EBADF, PAGE_CACHE_INVALID, EO_PAGE_CACHE);
-	//	return ERROR_OCCUR;
-	//}
-
-	uint32 index = -1;
-
-	// remove index from page list
-	auto list = &gft_get_table()->data[gfd].pages;
-	auto prev = list->head;
+	spinlock_acquire(&page_cache_lock);
 
-	if (prev == 0)
+	page_index* index = page_cache_get_index(gfd);
+	if (index == 0)
 	{
-		DEBUG("Page cache release got zero length page list");
-		set_last_error(EINVAL, PAGE_CACHE_BAD_PAGES, EO_PAGE_CACHE);
+		spinlock_release(&page_cache_lock);
 		return ERROR_OCCUR;
 	}
 
-	if (prev->data.page == page)
-	{
-		index = prev->data.buffer_index;
-		list_remove_front(list);					// TODO: Check this line for errors
-	}
-	else
-	{
-		while (prev->next != 0)
-		{
-			if (prev->next->data.page == page)
-			{
-				index = prev->next->data.buffer_index;
-				list_remove(list, prev);			// TODO: Check this line for errors
-				break;
-			}
-			prev = prev->next;
-		}
-	}
-	
-	if (index == -1)
+	virtual_addr address = (virtual_addr)page_index_lookup(index, page);
+
+	if (address == 0)
 	{
+		spinlock_release(&page_cache_lock);
+
 		DEBUG("Page not found to release");
 		set_last_error(EINVAL, PAGE_CACHE_PAGE_NOT_FOUND, EO_PAGE_CACHE);
 		return ERROR_OCCUR;
 	}
 
-	page_cache_release_anonymous(page_cache_addr_by_index(index));
+	// its frame is being written back (it stays until the write ends) or a caller still uses it
+	if (page_cache_frame_is_locked(page_cache_index_by_addr(address)) || page_cache.buffers[page_cache_index_by_addr(address)].pins != 0)
+	{
+		spinlock_release(&page_cache_lock);
 
+		set_last_error(EBUSY, PAGE_CACHE_BUFFER_BUSY, EO_PAGE_CACHE);
+		return ERROR_OCCUR;
+	}
+
+	if (page_index_is_tagged(index, page, PAGE_INDEX_TAG_DIRTY))
+		page_cache.stats.dirty--;
+
+	page_index_remove(index, page);
+	page_cache_free_buffer(page_cache_index_by_addr(address));
+
+	spinlock_release(&page_cache_lock);
 	return ERROR_OK;
 }
 
 error_t page_cache_make_dirty(uint32 gfd, uint32 page, bool dirty)
 {
-	auto finfo = page_cache_get_finfo(gfd, page);
-	if (finfo == 0)
-		return ERROR_OCCUR;
+	spinlock_acquire(&page_cache_lock);
+	error_t res = page_cache_set_dirty(gfd, page, dirty);
+	spinlock_release(&page_cache_lock);
 
-	finfo->data.dirty = dirty;
-	return ERROR_OK;
+	return res;
 }
 
 bool page_cache_is_page_dirty(uint32 gfd, uint32 page)
 {
-	auto finfo = page_cache_get_finfo(gfd, page);
-	if (finfo == 0)
-		return false;
+	spinlock_acquire(&page_cache_lock);
+
+	page_index* index = page_cache_get_index(gfd);
+	bool dirty = index != 0 && page_index_is_tagged(index, page, PAGE_INDEX_TAG_DIRTY);
+
+	spinlock_release(&page_cache_lock);
+	return dirty;
+}
+
+// the buffer addresses are the items of the index (pointers and virtual addresses have the same size)
+uint32 page_cache_lookup_range(uint32 gfd, uint32 first, uint32 last, uint32* pages, virtual_addr* buffers, uint32 max)
+{
+	spinlock_acquire(&page_cache_lock);
+
+	uint32 found = 0;
+	page_index* index = page_cache_get_index(gfd);
+
+	if (index != 0)
+		found = page_index_lookup_range(index, first, last, pages, (void**)buffers, max);
+
+	spinlock_release(&page_cache_lock);
+	return found;
+}
+
+uint32 page_cache_find_dirty(uint32 gfd, uint32 first, uint32 last, uint32* pages, virtual_addr* buffers, uint32 max)
+{
+	spinlock_acquire(&page_cache_lock);
+
+	uint32 found = 0;
+	page_index* index = page_cache_get_index(gfd);
+
+	if (index != 0)
+		found = page_index_lookup_tagged(index, first, last, PAGE_INDEX_TAG_DIRTY, pages, (void**)buffers, max);
+
+	spinlock_release(&page_cache_lock);
+	return found;
+}
+
+uint32 page_cache_begin_writeback(uint32 gfd, uint32 first, uint32 last, uint32* pages, virtual_addr* buffers, uint32 max)
+{
+	spinlock_acquire(&page_cache_lock);
 
-	return finfo->data.dirty;
+	uint32 found = 0;
+	page_index* index = page_cache_get_index(gfd);
+
+	if (index != 0)
+		found = page_index_lookup_tagged(index, first, last, PAGE_INDEX_TAG_DIRTY, pages, (void**)buffers, max);
+
+	// clean before the write starts, so that a write to the page meanwhile dirties it again
+	for (uint32 i = 0; i < found; i++)
+	{
+		page_cache_set_dirty(gfd, pages[i], false);
+		page_frame_set_flags(vmmngr_get_phys_addr(buffers[i]), PAGE_FRAME_LOCKED);
+	}
+
+	spinlock_release(&page_cache_lock);
+	return found;
+}
+
+void page_cache_end_writeback(uint32 gfd, uint32 page, virtual_addr buffer, bool written)
+{
+	spinlock_acquire(&page_cache_lock);
+
+	page_frame_clear_flags(vmmngr_get_phys_addr(buffer), PAGE_FRAME_LOCKED);
+
+	if (written == false)
+		page_cache_set_dirty(gfd, page, true);
+
+	spinlock_release(&page_cache_lock);
+}
+
+void page_cache_add_mapping(virtual_addr buffer, pdirectory* dir, virtual_addr address)
+{
+	uint32 index = page_cache_index_by_addr(buffer);
+	if (index >= page_cache_num_buffers())
+		return;
+
+	spinlock_acquire(&page_cache_lock);
+
+	_page_cache_buffer* buf = &page_cache.buffers[index];
+
+	// an unrecorded mapping keeps the buffer from being evicted, as the frame map count will not match the records
+	if (buf->mapping_count < PAGE_CACHE_MAX_MAPPINGS)
+	{
+		buf->mappings[buf->mapping_count].dir = dir;
+		buf->mappings[buf->mapping_count].address = address & ~(PAGE_SIZE - 1);
+		buf->mapping_count++;
+	}
+
+	spinlock_release(&page_cache_lock);
+}
+
+page_cache_stats page_cache_get_stats()
+{
+	spinlock_acquire(&page_cache_lock);
+
+	page_cache.stats.active = page_cache.active.count;
+	page_cache.stats.inactive = page_cache.inactive.count;
+	page_cache_stats stats = page_cache.stats;
+
+	spinlock_release(&page_cache_lock);
+	return stats;
 }
 
 void page_cache_print()
 {
+	uint32 pages[16];
+	virtual_addr buffers[16];
+
 	for (uint32 i = 0; i < gft_get_table()->count; i++)
 	{
-		if (gft_get_table()->data[i].pages.count > 0)
+		if (gft_get_table()->data[i].file_node == 0 || gft_get_table()->data[i].pages.count == 0)
+			continue;
+
+		serial_printf("gfd %u %s (page, buf_ind):", i, gft_get_table()->data[i].file_node->name);
+
+		uint32 next = 0, found;
+		while ((found = page_cache_lookup_range(i, next, 0xFFFFFFFF, pages, buffers, 16)) != 0)
 		{
-			serial_printf("gfd %u %s (page, buf_ind):", i, gft_get_table()->data[i].file_node->name);
-			for (auto temp = gft_get_table()->data[i].pages.head; temp != 0; temp = temp->next)
-				serial_printf("(%u, %u)", temp->data.page, temp->data.buffer_index);
+			for (uint32 j = 0; j < found; j++)
+				serial_printf("(%u, %u)", pages[j], page_cache_index_by_addr(buffers[j]));
 
-			serial_printf("\n");
+			if (pages[found - 1] == 0xFFFFFFFF)
+				break;
+
+			next = pages[found - 1] + 1;
 		}
+
+		serial_printf("\n");
 	}
 
 	serial_printf("alloced: \n");
-	
+
+	spinlock_acquire(&page_cache_lock);
+
 	for (uint32 i = 0; i < page_cache_num_buffers(); i++)
-		if (alloced_bitmap[i])
+		if (page_cache_index_is_reserved(i))
 			serial_printf("%u ", i);
 
+	spinlock_release(&page_cache_lock);
+
 	serial_printf("\n\n");
 }
 
@@ -6,8 +6,37 @@
 #include "vfs.h"
 #include "vector.h"
 #include "mmngr_virtual.h"
+#include "page_index.h"
+
+/*
+	Page cache replacement.
+
+	Buffers that cache a file page take part in an active/inactive (2Q) policy with CLOCK reference bits. A new file
+	buffer enters the inactive list. A lookup sets its reference bit, and a lookup of an already referenced inactive
+	buffer moves it to the active list, so pages read once never displace the working set. When no buffer is free, the
+	oldest inactive buffer is evicted: referenced ones get a second chance on the active list instead, and the active
+	list is aged into the inactive one whenever it grows past half of the file buffers.
+
+	A dirty victim is written back with vfs_sync before its buffer is reused. Buffers whose frame is locked (under
+	writeback I/O) are skipped, and so are pinned ones: page_cache_get_buffer and page_cache_reserve_buffer pin the buffer
+	they return, so that it is neither evicted nor released while its caller copies or maps it. Every pin is dropped with
+	page_cache_put_buffer.
+
+	A reserved file buffer is in the file index before its data is. Until its reserver fills it and calls
+	page_cache_set_uptodate, lookups of the page wait (and miss if the reservation is released instead), so a concurrent
+	reader never copies a page that is still being read in.
+
+	Every function takes the page cache lock, which is never held across disk I/O: the page allocation of a reservation
+	and the write of a dirty victim run with the lock dropped. A page being written back has its frame locked, so it is
+	neither evicted nor released until page_cache_end_writeback. Shared file mappings map the cache frame
+	itself, so the page fault handler records them with page_cache_add_mapping and eviction unmaps them first (their
+	accessed and dirty bits count as a reference and a write). A buffer mapped in places it does not know about (more
+	than PAGE_CACHE_MAX_MAPPINGS, or copied by fork) is never evicted. Anonymous buffers are never evicted.
+*/
 
 #define PAGE_CACHE_SIZE 4096
+#define PAGE_CACHE_MAX_MAPPINGS		4			// shared mappings of a buffer that eviction can undo
+#define PAGE_CACHE_NO_BUFFER		0xFFFFFFFF	// list terminator
 
 enum PAGE_CACHE_ERROR
 {
@@ -17,16 +46,21 @@ enum PAGE_CACHE_ERROR
 	PAGE_CACHE_DEPLET,
 	PAGE_CACHE_BAD_PAGES,
 	PAGE_CACHE_PAGE_NOT_FOUND,
-	PAGE_CACHE_FINFO_NOT_FOUND
+	PAGE_CACHE_FINFO_NOT_FOUND,
+	PAGE_CACHE_PAGE_EXISTS,
+	PAGE_CACHE_BUFFER_BUSY
 };
 
-struct _page_cache_file_info
+enum PAGE_CACHE_BUFFER_FLAGS
 {
-	uint32 page;			// the in-file page offset (used to determine where in the file we point)
-	uint32 buffer_index;	// index in the page cache structure of this file page
-	bool dirty;				// set if the page is dirty => has been written to
+	PAGE_CACHE_BUF_FILE = 1,				// the buffer caches a file page and may be evicted
+	PAGE_CACHE_BUF_REFERENCED = 1 << 1,		// used since the replacement scan last looked at it
+	PAGE_CACHE_BUF_ACTIVE = 1 << 2,			// on the active list (else on the inactive one)
+	PAGE_CACHE_BUF_UPTODATE = 1 << 3		// holds the data of its page (lookups wait for it otherwise)
 };
 
+// the cached pages of a file are kept in its global file entry, in a page_index from file page to buffer address
+
 //struct _page_cache_file
 //{
 //	uint32 gfd;
@@ -39,29 +73,86 @@ struct _cache_cell
 	char array[PAGE_CACHE_SIZE];				// 4KB array.
 };
 
+// a process page that maps a buffer frame (shared file mapping)
+struct _page_cache_mapping
+{
+	pdirectory* dir;
+	virtual_addr address;
+};
+
+// replacement state of a buffer
+struct _page_cache_buffer
+{
+	uint32 gfd;									// cached file and page (file buffers only)
+	uint32 page;
+	uint32 flags;								// PAGE_CACHE_BUFFER_FLAGS
+	uint32 prev;								// neighbours on the active or inactive list
+	uint32 next;
+	uint32 mapping_count;
+	_page_cache_mapping mappings[PAGE_CACHE_MAX_MAPPINGS];
+	uint32 pins;								// callers using the buffer (page_cache_put_buffer drops a pin)
+};
+
+// list of buffer indices, newest at the head
+struct _page_cache_list
+{
+	uint32 head;
+	uint32 tail;
+	uint32 count;
+};
+
+struct page_cache_stats
+{
+	uint32 buffers;								// buffers of the cache
+	uint32 active;								// file buffers on the active list
+	uint32 inactive;							// file buffers on the inactive list
+	uint32 dirty;								// file buffers not yet written back
+	uint32 hits;								// lookups that found their page
+	uint32 misses;								// lookups that did not
+	uint32 activations;							// buffers moved to the active list
+	uint32 evictions;							// file buffers reclaimed to serve a reservation
+	uint32 writebacks;							// dirty victims written back
+	uint32 unmaps;								// shared mappings removed from evicted buffers
+};
+
 struct _page_cache
 {
 	//vector<_page_cache_file> cached_files;		// all the cached files descriptors
 	_cache_cell* cache;							// cached data
 	uint32 cache_size;							// page cache size
+
+	_page_cache_buffer* buffers;				// replacement state of each buffer
+	_page_cache_list active;
+	_page_cache_list inactive;
+	page_cache_stats stats;
 };
 
 // initialize the page cache
 error_t page_cache_init(virtual_addr start, uint32 no_buffers);
 
-// returns the virtual address of the buffer assigned to the given page in the given file.
+// returns the virtual address of the buffer assigned to the given page in the given file. The buffer is pinned.
+// Waits while the page is being read in
 virtual_addr page_cache_get_buffer(uint32 gfd, uint32 page);
 
+// drops a pin of page_cache_get_buffer or page_cache_reserve_buffer
+void page_cache_put_buffer(virtual_addr buffer);
+
 // reserves a buffer without associating it with any file descriptor. Returns its virtual address.
+// When every buffer is taken, a file buffer is evicted (written back first if dirty).
 virtual_addr page_cache_reserve_anonymous();
 
 // releases the buffer indicated by address.
 void page_cache_release_anonymous(virtual_addr address);
 
-// reserves a buffer and associates it with the given file descriptor and file page. Returns its virtual address.
+// reserves a buffer and associates it with the given file descriptor and file page. Returns its virtual address, pinned.
+// Lookups of the page wait until the caller fills the buffer and calls page_cache_set_uptodate
 virtual_addr page_cache_reserve_buffer(uint32 gfd, uint32 page);
 
-// releases a buffer that is associated with the given file descriptor and page.
+// marks a reserved buffer as holding the data of its page, which lets the lookups waiting for it through
+void page_cache_set_uptodate(virtual_addr buffer);
+
+// releases a buffer that is associated with the given file descriptor and page. Fails while the page is written back or
+// the buffer is pinned.
 error_t page_cache_release_buffer(uint32 gfd, uint32 page);
 
 // modifies the dirty flag for the given page
@@ -70,6 +161,28 @@ error_t page_cache_make_dirty(uint32 gfd, uint32 page, bool dirty);
 // returns the dirty flag of the requested page
 bool page_cache_is_page_dirty(uint32 gfd, uint32 page);
 
+// stores up to max cached pages of the file in [first, last] and their buffers (buffers may be 0) in ascending page order.
+// Returns the pages found
+uint32 page_cache_lookup_range(uint32 gfd, uint32 first, uint32 last, uint32* pages, virtual_addr* buffers, uint32 max);
+
+// like page_cache_lookup_range, returning only the dirty pages (for writeback)
+uint32 page_cache_find_dirty(uint32 gfd, uint32 first, uint32 last, uint32* pages, virtual_addr* buffers, uint32 max);
+
+// like page_cache_find_dirty, and in the same locked step marks the pages clean and locks their frames, so that they are
+// not evicted or released while they are written. A write to a page meanwhile dirties it again. Every page found must be
+// finished with page_cache_end_writeback
+uint32 page_cache_begin_writeback(uint32 gfd, uint32 first, uint32 last, uint32* pages, virtual_addr* buffers, uint32 max);
+
+// unlocks the frame of a page of page_cache_begin_writeback, dirtying the page again if it was not written
+void page_cache_end_writeback(uint32 gfd, uint32 page, virtual_addr buffer, bool written);
+
+// records that the buffer frame is mapped at address of the address space dir (shared file mapping), so that eviction
+// can unmap it. If the buffer cannot hold more mappings it is never evicted
+void page_cache_add_mapping(virtual_addr buffer, pdirectory* dir, virtual_addr address);
+
+// returns the page cache statistics
+page_cache_stats page_cache_get_stats();
+
 // registers a file for caching services using its global file descriptor. This is needed prior to any caching function call.
 //error_t page_cache_register_file(uint32 gfd);
 
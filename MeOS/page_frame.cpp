@@ -0,0 +1,161 @@
+#include "page_frame.h"
+#include "mmngr_phys.h"
+#include "mmngr_virtual.h"
+#include "error.h"
+#include "print_utility.h"
+
+// private data
+
+static page_frame* frame_db = 0;		// frame entries indexed by pfn
+static uint32 frame_db_count = 0;		// number of entries
+
+// public functions
+
+error_t page_frame_db_init()
+{
+	uint32 count = pmmngr_get_block_count();
+	uint32 size = pmmngr_get_next_align(count * sizeof(page_frame));
+
+	for (virtual_addr addr = PAGE_FRAME_DB_BASE; addr < PAGE_FRAME_DB_BASE + size; addr += PAGE_SIZE)
+	{
+		physical_addr frame = (physical_addr)pmmngr_alloc_block();
+		if (frame == 0)
+			return ERROR_OCCUR;
+
+		if (vmmngr_map_page(vmmngr_get_directory(), frame, addr, I86_PTE_PRESENT | I86_PTE_WRITABLE) != ERROR_OK)
+		{
+			set_last_error(ENOMEM, PMEM_OUT_OF_MEM, EO_PMMNGR);
+			return ERROR_OCCUR;
+		}
+	}
+
+	memset((void*)PAGE_FRAME_DB_BASE, 0, size);
+
+	frame_db = (page_frame*)PAGE_FRAME_DB_BASE;
+	frame_db_count = count;
+
+	// the database itself must never be reclaimed
+	for (virtual_addr addr = PAGE_FRAME_DB_BASE; addr < PAGE_FRAME_DB_BASE + size; addr += PAGE_SIZE)
+	{
+		page_frame* frame = page_frame_get(vmmngr_get_phys_addr(addr));
+		frame->refcount = 1;
+		frame->mapcount = 1;
+		frame->flags = PAGE_FRAME_PINNED;
+	}
+
+	return ERROR_OK;
+}
+
+bool page_frame_db_ready()
+{
+	return frame_db != 0;
+}
+
+page_frame* page_frame_get(physical_addr addr)
+{
+	uint32 pfn = addr / PAGE_SIZE;
+
+	if (frame_db == 0 || pfn >= frame_db_count)
+		return 0;
+
+	return &frame_db[pfn];
+}
+
+void page_frame_db_reset(uint32 pfn, uint32 count, uint16 refcount)
+{
+	if (frame_db == 0)
+		return;
+
+	for (uint32 i = pfn; i < pfn + count && i < frame_db_count; i++)
+	{
+		frame_db[i].refcount = refcount;
+		frame_db[i].mapcount = 0;
+		frame_db[i].flags = 0;
+		frame_db[i].owner = 0;
+	}
+}
+
+void page_frame_get_ref(physical_addr addr)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	if (frame != 0 && !CHK_BIT(frame->flags, PAGE_FRAME_UNCOUNTED))
+		frame->refcount++;
+}
+
+void page_frame_put(physical_addr addr)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	// outside managed memory (identity mapped MMIO)
+	if (frame == 0)
+	{
+		pmmngr_free_block((void*)addr);
+		return;
+	}
+
+	if (CHK_BIT(frame->flags, PAGE_FRAME_UNCOUNTED))
+		return;
+
+	if (frame->refcount > 1)
+	{
+		frame->refcount--;
+		return;
+	}
+
+	// last reference or untracked frame
+	if (CHK_BIT(frame->flags, PAGE_FRAME_PINNED) && frame->mapcount > 0)
+		PANIC("page frame: releasing a pinned frame that is still mapped");
+
+	pmmngr_free_block((void*)(addr & ~(PAGE_SIZE - 1)));
+}
+
+void page_frame_map(physical_addr addr)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	if (frame != 0 && !CHK_BIT(frame->flags, PAGE_FRAME_UNCOUNTED))
+		frame->mapcount++;
+}
+
+void page_frame_unmap(physical_addr addr)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	if (frame != 0 && frame->mapcount > 0 && !CHK_BIT(frame->flags, PAGE_FRAME_UNCOUNTED))
+		frame->mapcount--;
+}
+
+void page_frame_set_flags(physical_addr addr, uint32 flags)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	if (frame != 0)
+		frame->flags |= flags;
+}
+
+void page_frame_clear_flags(physical_addr addr, uint32 flags)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	if (frame != 0)
+		frame->flags &= ~flags;
+}
+
+bool page_frame_test_flags(physical_addr addr, uint32 flags)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	if (frame == 0)
+		return false;
+
+	return (frame->flags & flags) == flags;
+}
+
+void page_frame_set_owner(physical_addr addr, void* owner)
+{
+	page_frame* frame = page_frame_get(addr);
+
+	if (frame != 0)
+		frame->owner = owner;
+}
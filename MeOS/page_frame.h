@@ -0,0 +1,75 @@
+#ifndef PAGE_FRAME_H_16102026
+#define PAGE_FRAME_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Page frame database. One entry per physical frame (PFN indexed) that tracks who uses the frame.
+
+	refcount	- owners of the frame. An allocation starts with one reference and the frame returns to the physical
+				  manager when the last reference is dropped. Every page table entry that maps the frame holds a reference.
+	mapcount	- page table entries that currently map the frame.
+
+	Frames with refcount 0 are either free or allocated before the database existed (untracked). Dropping a reference of an
+	untracked frame frees it directly, like the physical manager did before.
+*/
+
+#define PAGE_FRAME_DB_BASE		0xD0000000		// virtual window where the database is mapped
+
+enum PAGE_FRAME_FLAGS
+{
+	PAGE_FRAME_DIRTY = 1,				// frame contents differ from the backing store
+	PAGE_FRAME_LOCKED = 2,				// frame is under I/O and must not be touched
+	PAGE_FRAME_PINNED = 4,				// frame must never be reclaimed (DMA memory, kernel structures)
+	PAGE_FRAME_CACHE_OWNED = 8,			// frame belongs to the page cache
+	PAGE_FRAME_UNCOUNTED = 16			// frame is mapped by any number of entries (shared zero page). Its counts are not tracked and it is never freed
+};
+
+struct page_frame
+{
+	uint16 refcount;		// references held to the frame
+	uint16 mapcount;		// page table entries mapping the frame
+	uint32 flags;			// PAGE_FRAME_FLAGS
+	void* owner;			// back pointer to the owner structure (page cache buffer address for cache owned frames)
+};
+
+// INTERFACE
+
+// allocates and maps the database for all the frames known to the physical memory manager. Paging must be enabled.
+error_t page_frame_db_init();
+
+// returns true once the database is usable
+bool page_frame_db_ready();
+
+// returns the frame entry for the given physical address or 0 if the address is not managed
+page_frame* page_frame_get(physical_addr addr);
+
+// resets count frames starting at pfn to the given reference count (used by the physical manager on alloc and free)
+void page_frame_db_reset(uint32 pfn, uint32 count, uint16 refcount);
+
+// takes an extra reference to the frame
+void page_frame_get_ref(physical_addr addr);
+
+// drops a reference to the frame. The frame is freed when no references remain.
+void page_frame_put(physical_addr addr);
+
+// records that a page table entry maps the frame
+void page_frame_map(physical_addr addr);
+
+// records that a page table entry stopped mapping the frame
+void page_frame_unmap(physical_addr addr);
+
+// sets flags to the frame
+void page_frame_set_flags(physical_addr addr, uint32 flags);
+
+// clears flags from the frame
+void page_frame_clear_flags(physical_addr addr, uint32 flags);
+
+// returns true if all the given flags are set
+bool page_frame_test_flags(physical_addr addr, uint32 flags);
+
+// sets the owner back pointer of the frame
+void page_frame_set_owner(physical_addr addr, void* owner);
+
+#endif
@@ -0,0 +1,340 @@
+#include "page_index.h"
+#include "kmem_cache.h"
+
+// private data
+
+#define PAGE_INDEX_MASK			(PAGE_INDEX_SLOTS - 1)
+#define PAGE_INDEX_NO_TAG		PAGE_INDEX_TAGS
+
+static kmem_cache* page_index_cache = 0;
+
+// private functions
+
+page_index_node* page_index_node_alloc(page_index_node* parent, uint32 offset)
+{
+	// the first tree is made after the slab caches are ready
+	if (page_index_cache == 0 && (page_index_cache = kmem_cache_create("page_index_node", sizeof(page_index_node), 0, 0)) == 0)
+		return 0;
+
+	page_index_node* node = (page_index_node*)kmem_cache_alloc(page_index_cache);
+	if (node == 0)
+		return 0;
+
+	memset(node, 0, sizeof(page_index_node));
+	node->parent = parent;
+	node->offset = offset;
+
+	return node;
+}
+
+inline bool page_index_tag_get(page_index_node* node, uint32 tag, uint32 slot)
+{
+	return (node->tags[tag][slot / 32] & (1 << (slot % 32))) != 0;
+}
+
+inline void page_index_tag_set(page_index_node* node, uint32 tag, uint32 slot)
+{
+	node->tags[tag][slot / 32] |= 1 << (slot % 32);
+}
+
+inline void page_index_tag_clear(page_index_node* node, uint32 tag, uint32 slot)
+{
+	node->tags[tag][slot / 32] &= ~(1 << (slot % 32));
+}
+
+bool page_index_tag_any(page_index_node* node, uint32 tag)
+{
+	for (uint32 i = 0; i < PAGE_INDEX_SLOTS / 32; i++)
+		if (node->tags[tag][i] != 0)
+			return true;
+
+	return false;
+}
+
+// the largest key a tree of the given height holds
+inline uint32 page_index_max_key(uint32 height)
+{
+	if (height >= PAGE_INDEX_MAX_HEIGHT)
+		return 0xFFFFFFFF;
+
+	return (1 << (height * PAGE_INDEX_SHIFT)) - 1;
+}
+
+// returns the leaf node that holds key or 0
+page_index_node* page_index_leaf(page_index* index, uint32 key)
+{
+	if (index->root == 0 || key > page_index_max_key(index->height))
+		return 0;
+
+	page_index_node* node = index->root;
+
+	for (uint32 shift = (index->height - 1) * PAGE_INDEX_SHIFT; shift > 0 && node != 0; shift -= PAGE_INDEX_SHIFT)
+		node = (page_index_node*)node->slots[(key >> shift) & PAGE_INDEX_MASK];
+
+	return node;
+}
+
+// frees node and its ancestors while they are empty
+void page_index_prune(page_index* index, page_index_node* node)
+{
+	while (node != 0 && node->count == 0)
+	{
+		page_index_node* parent = node->parent;
+
+		if (parent != 0)
+		{
+			parent->slots[node->offset] = 0;
+			parent->count--;
+		}
+		else
+		{
+			index->root = 0;
+			index->height = 0;
+		}
+
+		kmem_cache_free(page_index_cache, node);
+		node = parent;
+	}
+}
+
+// drops root levels that only lead to their first slot
+void page_index_shrink(page_index* index)
+{
+	while (index->height > 1 && index->root->count == 1 && index->root->slots[0] != 0)
+	{
+		page_index_node* root = index->root;
+
+		index->root = (page_index_node*)root->slots[0];
+		index->root->parent = 0;
+		index->height--;
+
+		kmem_cache_free(page_index_cache, root);
+	}
+}
+
+// adds root levels until the tree can hold key
+error_t page_index_extend(page_index* index, uint32 key)
+{
+	if (index->root == 0)
+	{
+		index->height = 1;
+		while (key > page_index_max_key(index->height))
+			index->height++;
+
+		index->root = page_index_node_alloc(0, 0);
+		if (index->root == 0)
+		{
+			index->height = 0;
+			return ERROR_OCCUR;
+		}
+
+		return ERROR_OK;
+	}
+
+	while (key > page_index_max_key(index->height))
+	{
+		page_index_node* root = page_index_node_alloc(0, 0);
+		if (root == 0)
+			return ERROR_OCCUR;
+
+		root->slots[0] = index->root;
+		root->count = 1;
+
+		for (uint32 tag = 0; tag < PAGE_INDEX_TAGS; tag++)
+			if (page_index_tag_any(index->root, tag))
+				page_index_tag_set(root, tag, 0);
+
+		index->root->parent = root;
+		index->root->offset = 0;
+		index->root = root;
+		index->height++;
+	}
+
+	return ERROR_OK;
+}
+
+void page_index_free_nodes(page_index_node* node, uint32 shift)
+{
+	if (shift > 0)
+		for (uint32 slot = 0; slot < PAGE_INDEX_SLOTS; slot++)
+			if (node->slots[slot] != 0)
+				page_index_free_nodes((page_index_node*)node->slots[slot], shift - PAGE_INDEX_SHIFT);
+
+	kmem_cache_free(page_index_cache, node);
+}
+
+// collects the items of [first, last] below node (whose keys start at base) into keys/items from position found on
+uint32 page_index_collect(page_index_node* node, uint32 shift, uint32 base, uint32 first, uint32 last, uint32 tag,
+	uint32* keys, void** items, uint32 max, uint32 found)
+{
+	uint32 slot = first > base ? (first - base) >> shift : 0;
+	uint32 end = min((last - base) >> shift, PAGE_INDEX_MASK);
+
+	for (; slot <= end && found < max; slot++)
+	{
+		if (node->slots[slot] == 0 || (tag != PAGE_INDEX_NO_TAG && page_index_tag_get(node, tag, slot) == false))
+			continue;
+
+		uint32 slot_base = base + (slot << shift);
+
+		if (shift == 0)
+		{
+			if (keys != 0)
+				keys[found] = slot_base;
+			items[found++] = node->slots[slot];
+		}
+		else
+			found = page_index_collect((page_index_node*)node->slots[slot], shift - PAGE_INDEX_SHIFT, slot_base, first, last,
+				tag, keys, items, max, found);
+	}
+
+	return found;
+}
+
+uint32 page_index_gang_lookup(page_index* index, uint32 first, uint32 last, uint32 tag, uint32* keys, void** items, uint32 max)
+{
+	if (index->root == 0 || first > last || first > page_index_max_key(index->height) || max == 0)
+		return 0;
+
+	last = min(last, page_index_max_key(index->height));
+
+	return page_index_collect(index->root, (index->height - 1) * PAGE_INDEX_SHIFT, 0, first, last, tag, keys, items, max, 0);
+}
+
+// public functions
+
+void page_index_init(page_index* index)
+{
+	index->root = 0;
+	index->height = 0;
+	index->count = 0;
+}
+
+void page_index_clear(page_index* index)
+{
+	if (index->root != 0)
+		page_index_free_nodes(index->root, (index->height - 1) * PAGE_INDEX_SHIFT);
+
+	page_index_init(index);
+}
+
+error_t page_index_insert(page_index* index, uint32 key, void* item)
+{
+	if (item == 0 || page_index_lookup(index, key) != 0)
+		return ERROR_OCCUR;
+
+	if (page_index_extend(index, key) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	page_index_node* node = index->root;
+
+	for (uint32 shift = (index->height - 1) * PAGE_INDEX_SHIFT; shift > 0; shift -= PAGE_INDEX_SHIFT)
+	{
+		uint32 slot = (key >> shift) & PAGE_INDEX_MASK;
+
+		if (node->slots[slot] == 0)
+		{
+			page_index_node* child = page_index_node_alloc(node, slot);
+			if (child == 0)
+			{
+				page_index_prune(index, node);
+				return ERROR_OCCUR;
+			}
+
+			node->slots[slot] = child;
+			node->count++;
+		}
+
+		node = (page_index_node*)node->slots[slot];
+	}
+
+	node->slots[key & PAGE_INDEX_MASK] = item;
+	node->count++;
+	index->count++;
+
+	return ERROR_OK;
+}
+
+void* page_index_lookup(page_index* index, uint32 key)
+{
+	page_index_node* leaf = page_index_leaf(index, key);
+	if (leaf == 0)
+		return 0;
+
+	return leaf->slots[key & PAGE_INDEX_MASK];
+}
+
+void* page_index_remove(page_index* index, uint32 key)
+{
+	page_index_node* leaf = page_index_leaf(index, key);
+	if (leaf == 0 || leaf->slots[key & PAGE_INDEX_MASK] == 0)
+		return 0;
+
+	void* item = leaf->slots[key & PAGE_INDEX_MASK];
+
+	for (uint32 tag = 0; tag < PAGE_INDEX_TAGS; tag++)
+		page_index_tag(index, key, (PAGE_INDEX_TAG)tag, false);
+
+	leaf->slots[key & PAGE_INDEX_MASK] = 0;
+	leaf->count--;
+	index->count--;
+
+	page_index_prune(index, leaf);
+	if (index->root != 0)
+		page_index_shrink(index);
+
+	return item;
+}
+
+error_t page_index_tag(page_index* index, uint32 key, PAGE_INDEX_TAG tag, bool set)
+{
+	page_index_node* node = page_index_leaf(index, key);
+	if (node == 0 || node->slots[key & PAGE_INDEX_MASK] == 0)
+		return ERROR_OCCUR;
+
+	uint32 slot = key & PAGE_INDEX_MASK;
+
+	// a set tag marks the path up to the root, a cleared one unmarks it as far as nothing else below is tagged
+	while (node != 0)
+	{
+		if (set)
+		{
+			if (page_index_tag_get(node, tag, slot))
+				break;
+
+			page_index_tag_set(node, tag, slot);
+		}
+		else
+		{
+			page_index_tag_clear(node, tag, slot);
+
+			if (page_index_tag_any(node, tag))
+				break;
+		}
+
+		slot = node->offset;
+		node = node->parent;
+	}
+
+	return ERROR_OK;
+}
+
+bool page_index_is_tagged(page_index* index, uint32 key, PAGE_INDEX_TAG tag)
+{
+	page_index_node* leaf = page_index_leaf(index, key);
+	if (leaf == 0)
+		return false;
+
+	return page_index_tag_get(leaf, tag, key & PAGE_INDEX_MASK);
+}
+
+uint32 page_index_lookup_range(page_index* index, uint32 first, uint32 last, uint32* keys, void** items, uint32 max)
+{
+	return page_index_gang_lookup(index, first, last, PAGE_INDEX_NO_TAG, keys, items, max);
+}
+
+uint32 page_index_lookup_tagged(page_index* index, uint32 first, uint32 last, PAGE_INDEX_TAG tag, uint32* keys, void** items,
+	uint32 max)
+{
+	return page_index_gang_lookup(index, first, last, tag, keys, items, max);
+}
@@ -0,0 +1,73 @@
+#ifndef PAGE_INDEX_H_16102026
+#define PAGE_INDEX_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Radix tree of the cached pages of a file, keyed by file page.
+
+	Each node resolves PAGE_INDEX_SHIFT bits of the key, so a lookup walks at most six nodes whatever the file size, and
+	the tree only grows as tall as the largest key needs. Every node keeps per tag bitmaps of the slots that have a
+	tagged item below them, so tagged items (dirty pages) are found without visiting the untagged parts of the tree.
+	Range lookups return the items of a key range in ascending key order.
+
+	The tree does not lock. Its users serialize access to it.
+*/
+
+#define PAGE_INDEX_SHIFT		6
+#define PAGE_INDEX_SLOTS		(1 << PAGE_INDEX_SHIFT)
+#define PAGE_INDEX_MAX_HEIGHT	6						// 6 * 6 bits cover the 32 bit keys
+
+enum PAGE_INDEX_TAG
+{
+	PAGE_INDEX_TAG_DIRTY,
+	PAGE_INDEX_TAGS
+};
+
+struct page_index_node
+{
+	uint16 count;										// used slots
+	uint16 offset;										// slot of this node in its parent
+	page_index_node* parent;
+	void* slots[PAGE_INDEX_SLOTS];						// children, or items at the leaves
+	uint32 tags[PAGE_INDEX_TAGS][PAGE_INDEX_SLOTS / 32];	// set bit => the slot has (or leads to) a tagged item
+};
+
+struct page_index
+{
+	page_index_node* root;
+	uint32 height;										// 0 for an empty tree
+	uint32 count;										// items in the tree
+};
+
+// initializes an empty tree
+void page_index_init(page_index* index);
+
+// frees every node of the tree. The items are not touched
+void page_index_clear(page_index* index);
+
+// adds the (non zero) item at key. Fails if the key is taken or memory is out
+error_t page_index_insert(page_index* index, uint32 key, void* item);
+
+// returns the item at key or 0
+void* page_index_lookup(page_index* index, uint32 key);
+
+// removes the item at key and returns it (0 if there was none)
+void* page_index_remove(page_index* index, uint32 key);
+
+// sets or clears the tag of the item at key. Fails if there is no item at key
+error_t page_index_tag(page_index* index, uint32 key, PAGE_INDEX_TAG tag, bool set);
+
+// returns true if the item at key has the tag
+bool page_index_is_tagged(page_index* index, uint32 key, PAGE_INDEX_TAG tag);
+
+// stores up to max items with keys in [first, last] and their keys (keys may be 0) in ascending key order.
+// Returns the items found
+uint32 page_index_lookup_range(page_index* index, uint32 first, uint32 last, uint32* keys, void** items, uint32 max);
+
+// like page_index_lookup_range, returning only the items that have the tag
+uint32 page_index_lookup_tagged(page_index* index, uint32 first, uint32 last, PAGE_INDEX_TAG tag, uint32* keys, void** items,
+	uint32 max);
+
+#endif
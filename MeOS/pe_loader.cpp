@@ -58,6 +58,7 @@ IMAGE_DOS_HEADER* pe_load_image(uint32 gfd, PCB* proc)
 		return 0;
 	}
 
+	// the returned headers live in the cache buffer, so its pin is kept for as long as the image is loaded
 	void* buffer = (void*)page_cache_get_buffer(gfd, 0);
 	if (buffer == 0)
 		PANIC("Some strange error");
@@ -65,6 +66,7 @@ IMAGE_DOS_HEADER* pe_load_image(uint32 gfd, PCB* proc)
 	if (!validate_PE_image(buffer))
 	{
 		DEBUG("Could not load PE image. Corrupt image or data.");
+		page_cache_put_buffer((virtual_addr)buffer);
 		return 0;
 	}
 
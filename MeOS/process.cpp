@@ -2,6 +2,7 @@
 #include "descriptor_tables.h"
 #include "thread_sched.h"
 #include "print_utility.h"
+#include "swap.h"
 
 // private data and functions
 
@@ -160,12 +161,66 @@ PCB* process_create(PCB* parent, pdirectory* pdir, uint32 low_address, uint32 hi
 		proc->page_dir = pdir;
 
 	queue_init(&proc->threads);
+	proc->ring = 0;
 	vm_contract_init(&proc->memory_contract, low_address, high_address);
 	init_local_file_table(&proc->lft, 10);
+	swap_add_process(proc);
 
 	return proc;
 }
 
+PCB* process_fork(PCB* parent)
+{
+	PCB* proc = (PCB*)malloc(sizeof(PCB));
+	if (proc == 0)
+		return 0;
+
+	proc->id = ++lastID;
+	proc->parent = parent;
+	proc->image_base = parent->image_base;
+	proc->image_size = parent->image_size;
+	spinlock_init(&proc->contract_spinlock);
+
+	spinlock_acquire(&parent->contract_spinlock);
+
+	if (vm_contract_clone(&proc->memory_contract, &parent->memory_contract) != ERROR_OK)
+	{
+		spinlock_release(&parent->contract_spinlock);
+		free(proc);
+		return 0;
+	}
+
+	proc->page_dir = vmmngr_clone_address_space(parent->page_dir, &parent->memory_contract);
+	spinlock_release(&parent->contract_spinlock);
+
+	if (proc->page_dir == 0)
+	{
+		vm_contract_uninit(&proc->memory_contract);
+		free(proc);
+		return 0;
+	}
+
+	queue_init(&proc->threads);
+	proc->ring = 0;						// the ring and its worker stay with the parent
+
+	// the child inherits the open files at the same descriptors
+	init_local_file_table(&proc->lft, parent->lft.entries.count);
+
+	spinlock_acquire(&parent->lft.lock);
+	for (uint32 i = 0; i < parent->lft.entries.count; i++)
+	{
+		lfe entry = parent->lft.entries[i];
+		vector_insert_back(&proc->lft.entries, entry);
+
+		if (lfe_is_invalid(&entry) == false)
+			gfe_increase_open_count(entry.gfd);
+	}
+	spinlock_release(&parent->lft.lock);
+
+	swap_add_process(proc);
+	return proc;
+}
+
 // stack top is the top-most exclusive (last_valid + 1) value for stack.
 TCB* thread_create(PCB* parent, uint32 entry, virtual_addr stack_top, uint32 stack_size, uint32 priority, uint32 param_count, ...)
 {
@@ -193,6 +248,11 @@ TCB* thread_create(PCB* parent, uint32 entry, virtual_addr stack_top, uint32 sta
 	queue_spsc_init(&t->exceptions, 10);
 	t->exception_lock = 0;
 
+	t->contract_hint.area = 0;
+	t->contract_hint.version = 0;
+
+	kmem_magazines_init(&t->magazines);
+
 	// TODO: Replace the directory switches by a simple kernel page map
 	pdirectory* old_dir = vmmngr_get_directory();
 	vmmngr_switch_directory(parent->page_dir, (physical_addr)parent->page_dir);
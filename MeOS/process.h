@@ -8,6 +8,7 @@
 
 #include "queue_spsc.h"
 #include "thread_exception.h"
+#include "kmem_cache.h"
 
 #include "Debugger.h"
 #include "spinlock.h"
@@ -94,6 +95,7 @@ _asm	mov esp, 0x90000
 
 
 	typedef struct process_control_block PCB;
+	struct io_ring;
 
 	typedef struct thread_control_block
 	{
@@ -119,6 +121,10 @@ _asm	mov esp, 0x90000
 
 		queue_spsc<thread_exception> exceptions;		// thread exception queue to be consumed and served by the kernel
 		uint32 exception_lock;						// lock for the exception consumption (to be used with CAS)
+
+		vm_contract_hint contract_hint;				// last memory area this thread faulted in (guarded by the contract spinlock)
+
+		kmem_magazines magazines;					// free small objects of this thread, used by malloc and free without locking
 	}TCB;
 
 	typedef struct process_control_block
@@ -137,10 +143,14 @@ _asm	mov esp, 0x90000
 		spinlock contract_spinlock;				// virtual memory contract spinlock used for reading and writing
 
 		queue<TCB> threads;						// child threads of the process
+		io_ring* ring;							// asynchronous I/O ring (0 until io_ring_create)
 	}PCB;
 
 	uint32 process_create_s(char* app_name);
 	PCB* process_create(PCB* parent, pdirectory* pdir, uint32 low_address, uint32 high_address);
+
+	// creates a child process sharing the parent's memory copy-on-write and its open files. The child has no threads.
+	PCB* process_fork(PCB* parent);
 	TCB* thread_create(PCB* parent, uint32 entry, virtual_addr stack_top, uint32 stack_size, uint32 priority, uint32 param_count, ...);
 
 	int32 thread_get_priority(TCB* thread);
@@ -6,12 +6,17 @@
 #include "types.h"
 #include "utility.h"
 #include "memory.h"
+#include "kmem_cache.h"
 
 template<class T>
 struct queue_node
 {
 	T data;
 	queue_node* next;
+
+	// served by the slab size caches (kmem_cache.h)
+	void* operator new(uint32 size) { return kmem_alloc(size); }
+	void operator delete(void* ptr) { kmem_free(ptr); }
 };
 
 template<class T>
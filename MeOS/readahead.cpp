@@ -0,0 +1,257 @@
+#include "readahead.h"
+#include "page_cache.h"
+#include "open_file_table.h"
+#include "page_frame.h"
+
+#define READAHEAD_PAGE_SECTORS		(PAGE_SIZE / 512)
+
+// a missing page of a window and where it lives on disk
+struct readahead_page
+{
+	vfs_node* device;			// 0 => the file could not locate the page, so it is read with vfs_read_file
+	uint32 lba;
+	uint32 page;
+	virtual_addr buffer;
+};
+
+// private data
+
+static readahead_stats readahead_info;
+
+// private functions
+
+// returns the first window of a sequential read of wanted pages
+uint32 readahead_initial_size(uint32 wanted)
+{
+	uint32 size = wanted * READAHEAD_GROWTH;
+
+	if (size < READAHEAD_MIN_PAGES)
+		return READAHEAD_MIN_PAGES;
+
+	return size > READAHEAD_MAX_PAGES ? READAHEAD_MAX_PAGES : size;
+}
+
+// returns the window that follows a window of size pages
+uint32 readahead_next_size(uint32 size)
+{
+	size *= READAHEAD_GROWTH;
+	return size > READAHEAD_MAX_PAGES ? READAHEAD_MAX_PAGES : size;
+}
+
+// asks the file system for the device sectors of the page
+void readahead_locate(vfs_node* file, readahead_page* p)
+{
+	vfs_node* device = 0;
+	uint32 lba = 0;
+
+	if (file->fs_ops->fs_ioctl != 0 && file->fs_ops->fs_ioctl(file, VFS_IOCTL_BMAP, p->page, &device, &lba) == ERROR_OK)
+	{
+		p->device = device;
+		p->lba = lba;
+	}
+	else
+		p->device = 0;
+}
+
+// returns the length of the run of pages at the start of the list that one request can read
+uint32 readahead_run_length(readahead_page* list, uint32 count)
+{
+	if (list[0].device == 0)
+		return 1;
+
+	uint32 length = 1;
+	while (length < count && list[length].device == list[0].device && list[length].page == list[length - 1].page + 1 &&
+		list[length].lba == list[length - 1].lba + READAHEAD_PAGE_SECTORS)
+		length++;
+
+	return length;
+}
+
+// reads a run of pages from consecutive sectors of its device
+error_t readahead_read_run(uint32 gfd, vfs_node* file, readahead_page* run, uint32 count)
+{
+	vfs_node* device = run[0].device;
+	uint32 done = 0;
+
+	if (device != 0)
+	{
+		virtual_addr buffers[READAHEAD_MAX_PAGES];
+		for (uint32 i = 0; i < count; i++)
+			buffers[i] = run[i].buffer;
+
+		if (device->fs_ops->fs_ioctl != 0 &&
+			device->fs_ops->fs_ioctl(device, MASS_STORAGE_IOCTL_READ_PAGES, run[0].lba, count, buffers, &done) != ERROR_OK)
+			return ERROR_OCCUR;
+
+		if (done == count)
+		{
+			readahead_info.requests++;
+			return ERROR_OK;
+		}
+	}
+
+	// the page could not be located or the device does not take page vectors: go through the file system
+	for (uint32 i = done; i < count; i++)
+	{
+		if (vfs_read_file(gfd, file, run[i].page * PAGE_CACHE_SIZE, PAGE_CACHE_SIZE, run[i].buffer) == INVALID_IO)
+			return ERROR_OCCUR;
+
+		readahead_info.requests++;
+	}
+
+	return ERROR_OK;
+}
+
+// reads the pages [first, first + count) of the file that are not cached yet. Returns the buffer of the first page if it
+// was read, still pinned, else 0
+virtual_addr readahead_read(uint32 gfd, uint32 first, uint32 count)
+{
+	vfs_node* file = gft_get(gfd)->file_node;
+	readahead_page list[READAHEAD_MAX_PAGES];
+	uint32 cached[READAHEAD_MAX_PAGES];
+	virtual_addr cached_buffers[READAHEAD_MAX_PAGES];
+	uint32 missing = 0;
+
+	uint32 found = page_cache_lookup_range(gfd, first, first + count - 1, cached, cached_buffers, count);
+
+	// every missing page gets its buffer before the reads start. When the cache runs out the window ends early
+	for (uint32 page = first, c = 0; page < first + count; page++)
+	{
+		if (c < found && cached[c] == page)
+		{
+			c++;
+			continue;
+		}
+
+		virtual_addr buffer = page_cache_reserve_buffer(gfd, page);
+		if (buffer == 0)
+			break;
+
+		list[missing].page = page;
+		list[missing].buffer = buffer;
+		readahead_locate(file, &list[missing]);
+
+		// the buffer is in the file index already (lookups wait until it is up to date), but eviction must not take it
+		// under the transfer
+		page_frame_set_flags(vmmngr_get_phys_addr(buffer), PAGE_FRAME_LOCKED);
+		missing++;
+	}
+
+	virtual_addr first_buffer = 0;
+
+	for (uint32 i = 0; i < missing; )
+	{
+		uint32 length = readahead_run_length(list + i, missing - i);
+		error_t result = readahead_read_run(gfd, file, list + i, length);
+
+		for (uint32 j = i; j < i + length; j++)
+		{
+			page_frame_clear_flags(vmmngr_get_phys_addr(list[j].buffer), PAGE_FRAME_LOCKED);
+
+			// the readers waiting for the page may copy it now
+			if (result == ERROR_OK)
+				page_cache_set_uptodate(list[j].buffer);
+
+			// the reservation pin is kept for the caller on the first page only
+			if (result == ERROR_OK && list[j].page == first)
+			{
+				first_buffer = list[j].buffer;
+				continue;
+			}
+
+			page_cache_put_buffer(list[j].buffer);
+
+			// a page that could not be read must not be found in the cache
+			if (result != ERROR_OK)
+				page_cache_release_buffer(gfd, list[j].page);
+		}
+
+		if (result == ERROR_OK)
+			readahead_info.pages += length;
+
+		i += length;
+	}
+
+	return first_buffer;
+}
+
+// public functions
+
+void readahead_init(file_readahead* ra)
+{
+	ra->start = 0;
+	ra->size = 0;
+	ra->async_size = 0;
+	ra->prev_page = READAHEAD_NO_PAGE;		// so that a read from page 0 counts as sequential
+	ra->async_pending = false;
+}
+
+virtual_addr readahead_get_buffer(uint32 gfd, uint32 page, uint32 wanted)
+{
+	gfe* entry = gft_get(gfd);
+	file_readahead* ra = &entry->ra;
+	uint32 file_pages = ceil_division(entry->file_node->file_length, PAGE_CACHE_SIZE);
+
+	virtual_addr cache = page_cache_get_buffer(gfd, page);
+
+	if (cache == 0)
+	{
+		uint32 count;
+
+		if (page == ra->prev_page + 1)
+		{
+			ra->size = ra->size == 0 ? readahead_initial_size(wanted) : readahead_next_size(ra->size);
+			ra->async_size = ra->size > wanted ? ra->size - wanted : 0;
+			count = ra->size;
+		}
+		else
+		{
+			// random access: read just the request
+			ra->size = 0;
+			ra->async_size = 0;
+			count = wanted > READAHEAD_MAX_PAGES ? READAHEAD_MAX_PAGES : wanted;
+		}
+
+		ra->start = page;
+		readahead_info.windows++;
+
+		cache = readahead_read(gfd, page, min(count, file_pages - page));
+	}
+	else if (ra->async_size != 0 && page == ra->start + ra->size - ra->async_size)
+	{
+		// the marker: the next window is read while the reader consumes the rest of this one
+		ra->start += ra->size;
+		ra->size = readahead_next_size(ra->size);
+		ra->async_size = ra->size;
+		ra->async_pending = ra->start < file_pages;
+	}
+
+	ra->prev_page = page;
+	return cache;
+}
+
+void readahead_start_async(uint32 gfd)
+{
+	gfe* entry = gft_get(gfd);
+	file_readahead* ra = &entry->ra;
+
+	if (ra->async_pending == false)
+		return;
+
+	ra->async_pending = false;
+
+	uint32 file_pages = ceil_division(entry->file_node->file_length, PAGE_CACHE_SIZE);
+	if (ra->start >= file_pages)
+		return;
+
+	readahead_info.async_windows++;
+
+	virtual_addr buffer = readahead_read(gfd, ra->start, min(ra->size, file_pages - ra->start));
+	if (buffer != 0)
+		page_cache_put_buffer(buffer);
+}
+
+readahead_stats readahead_get_stats()
+{
+	return readahead_info;
+}
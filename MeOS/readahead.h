@@ -0,0 +1,63 @@
+#ifndef READAHEAD_H_16102026
+#define READAHEAD_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Read-ahead of cached file reads.
+
+	Every open file keeps a read-ahead window: a range of pages read in before the reader asks for them. A miss that
+	continues a sequential read starts a new window at the missing page, sized after the request for the first window
+	and READAHEAD_GROWTH times the previous one after that, up to READAHEAD_MAX_PAGES. Random misses read just the
+	request, and reset the window.
+
+	The last async_size pages of a window are its asynchronous part. A hit on the first of them (the marker) reads the
+	next window while the reader still has the rest of the current one to consume, so a steady stream never misses. The
+	window is read only after the reader copied the marker page (readahead_start_async), as its buffer reservations may
+	evict that page.
+
+	The missing pages of a window get their page cache buffers up front. They are located on disk with the VFS_IOCTL_BMAP
+	ioctl of the file and pages adjacent on disk are read with a single MASS_STORAGE_IOCTL_READ_PAGES request (one
+	scatter-gather command on AHCI). Files that cannot locate their pages are read a page at a time with vfs_read_file.
+	A page is marked up to date once its run is read, so other readers of the window wait for it rather than copy it early.
+*/
+
+#define READAHEAD_MIN_PAGES			4		// smallest window of a sequential read
+#define READAHEAD_MAX_PAGES			32		// largest window (128 KB)
+#define READAHEAD_GROWTH			2		// each window of a stream is this many times the previous one
+#define READAHEAD_NO_PAGE			0xFFFFFFFF
+
+// read-ahead state of an open file
+struct file_readahead
+{
+	uint32 start;				// first page of the current window
+	uint32 size;				// pages of the window (0 => no window, the file is read at random)
+	uint32 async_size;			// pages at the end of the window whose first one starts the next window
+	uint32 prev_page;			// last page read
+	bool async_pending;			// a marker hit moved the window, which readahead_start_async reads
+};
+
+struct readahead_stats
+{
+	uint32 windows;				// windows read on a miss
+	uint32 async_windows;		// windows read ahead of the reader, on a marker hit
+	uint32 pages;				// pages read in
+	uint32 requests;			// device requests that read them (pages / requests is the mean run length)
+};
+
+// resets the read-ahead state of a newly opened file
+void readahead_init(file_readahead* ra);
+
+// returns the cache buffer of the page of the file, which the reader reads with wanted - 1 pages after it. A miss
+// reads the page in with its window, and a marker hit moves the window to the next one. The buffer is pinned until the
+// reader drops it with page_cache_put_buffer. Returns 0 if the page could not be read
+virtual_addr readahead_get_buffer(uint32 gfd, uint32 page, uint32 wanted);
+
+// reads the window a marker hit of readahead_get_buffer moved to, if any. Called once the reader is done with the buffer
+void readahead_start_async(uint32 gfd);
+
+// returns the read-ahead statistics
+readahead_stats readahead_get_stats();
+
+#endif
@@ -95,8 +95,14 @@ void init_screen_gfx(vbe_mode_info_block* _vbe)
 
 	uint32 frame_length = vbe->pitch * vbe->height;
 
-	if (!vfs_mmap(vbe->framebuffer & (~0xFFF), INVALID_FD, 0, frame_length + PAGE_SIZE - (frame_length % PAGE_SIZE), 
-		PROT_READ | PROT_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_IDENTITY_MAP | MMAP_ALLOC_IMMEDIATE) == MAP_FAILED)
+	// cover the framebuffer with whole 4MB pages when possible (one TLB entry per 4MB instead of 1024)
+	uint32 granularity = vmmngr_large_pages_enabled() ? LARGE_PAGE_SIZE : PAGE_SIZE;
+	physical_addr frame_start = vbe->framebuffer & ~(granularity - 1);
+	uint32 map_length = vbe->framebuffer - frame_start + frame_length;
+	map_length += granularity - (map_length % granularity);
+
+	if (!vfs_mmap(frame_start, INVALID_FD, 0, map_length, 
+		PROT_READ | PROT_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_IDENTITY_MAP | MMAP_ALLOC_IMMEDIATE | MMAP_LARGE_PAGES) == MAP_FAILED)
 		PANIC("Could not map screen region");
 
 	cursor = make_point(0, 0);
@@ -1,10 +1,11 @@
 #include "sock_buf.h"
+#include "kmem_cache.h"
 
 int ind = 0;
 
 error_t sock_buf_init(sock_buf* buf, uint32 len)
 {
-	buf->head = malloc(len);
+	buf->head = kmem_alloc(len);
 	ind++;
 
 	if (buf->head == 0)
@@ -71,9 +72,10 @@ uint32 sock_buf_get_data_len(sock_buf* buf)
 // TODO: Take into account multiple references to this buffer
 error_t sock_buf_release(sock_buf* buf)
 {
-	if (free(buf->head) != ERROR_OK)
+	if (buf->head == 0)
 		return ERROR_OCCUR;
 
+	kmem_free(buf->head);
 	return ERROR_OK;
 }
 
@@ -0,0 +1,570 @@
+#include "swap.h"
+#include "mmngr_phys.h"
+#include "mmngr_virtual.h"
+#include "page_frame.h"
+#include "spinlock.h"
+#include "memory.h"
+#include "file.h"
+#include "thread_sched.h"
+#include "vfs.h"
+#include "zswap.h"
+
+// private data
+
+static uint32 swap_gfd = INVALID_FD;								// global descriptor of the swap file (INVALID_FD => compressed tier only)
+static uint8* swap_slot_refs = (uint8*)SWAP_REFS_BASE;				// entries referring to each slot (0 => free)
+static uint32 swap_slot_cursor = 0;									// next slot to try on allocation
+static pt_entry* swap_window_page = 0;								// page table entry of the swap window
+static spinlock swap_lock = 0;										// serializes evictions and swap ins
+static swap_stats swap_info;
+
+static PCB* swap_processes[SWAP_MAX_PROCESSES];						// address spaces walked by the clock hand
+static uint32 swap_process_count = 0;
+static uint32 swap_hand_proc = 0;									// clock hand: process index
+static virtual_addr swap_hand_addr = 0;								// clock hand: next user page of the process
+
+size_t swap_dev_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
+
+static fs_operations swap_dev_ops =
+{
+	swap_dev_read,		// read
+	NULL,				// write
+	NULL,				// open
+	NULL,				// close
+	NULL,				// sync
+	NULL,				// lookup
+	NULL				// ioctl
+};
+
+// private functions
+
+// maps the frame at the swap window. Only used with the swap lock held
+void swap_map_window(physical_addr frame)
+{
+	*swap_window_page = 0;
+	pt_entry_set_frame(swap_window_page, frame);
+	pt_entry_add_attrib(swap_window_page, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+	vmmngr_flush_TLB_entry(SWAP_WINDOW);
+}
+
+void swap_unmap_window()
+{
+	*swap_window_page = 0;
+	vmmngr_flush_TLB_entry(SWAP_WINDOW);
+}
+
+// writes the kernel page at 'page' to the slot of the swap file
+error_t swap_write_slot(uint32 slot, virtual_addr page)
+{
+	if (swap_gfd == INVALID_FD)
+	{
+		set_last_error(ENOSPC, SWAP_NO_SPACE, EO_SWAP);
+		return ERROR_OCCUR;
+	}
+
+	if (write_file_global(swap_gfd, slot * PAGE_SIZE, PAGE_SIZE, page, VFS_CAP_WRITE) != PAGE_SIZE)
+	{
+		set_last_error(EIO, SWAP_IO_ERROR, EO_SWAP);
+		return ERROR_OCCUR;
+	}
+
+	swap_info.written++;
+	return ERROR_OK;
+}
+
+error_t swap_read_slot(uint32 slot, virtual_addr page)
+{
+	if (swap_gfd == INVALID_FD || read_file_global(swap_gfd, slot * PAGE_SIZE, PAGE_SIZE, page, VFS_CAP_READ) != PAGE_SIZE)
+	{
+		set_last_error(EIO, SWAP_IO_ERROR, EO_SWAP);
+		return ERROR_OCCUR;
+	}
+
+	return ERROR_OK;
+}
+
+// moves the oldest page of the compressed tier to its slot of the swap file
+error_t swap_demote()
+{
+	if (swap_gfd == INVALID_FD)
+		return ERROR_OCCUR;
+
+	uint32 slot = zswap_demote(SWAP_DEMOTE_PAGE);
+	if (slot == INVALID_FD || swap_write_slot(slot, SWAP_DEMOTE_PAGE) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	zswap_invalidate(slot);
+	swap_info.demoted++;
+
+	return ERROR_OK;
+}
+
+// returns true if the last compressed store failed only for lack of room
+bool swap_zswap_is_full()
+{
+	return ((get_raw_error() >> 8) & 0xFFFF) == ZSWAP_POOL_FULL && (get_raw_error() >> 24) == EO_ZSWAP;
+}
+
+// stores the frame in the compressed tier, demoting older pages to make room, or else in the swap file
+error_t swap_store_frame(uint32 slot, physical_addr frame)
+{
+	swap_map_window(frame);
+
+	error_t res = zswap_store(slot, SWAP_WINDOW);
+	while (res != ERROR_OK && swap_zswap_is_full() && swap_demote() == ERROR_OK)
+		res = zswap_store(slot, SWAP_WINDOW);
+
+	// incompressible page or a pool that cannot make room
+	if (res != ERROR_OK)
+		res = swap_write_slot(slot, SWAP_WINDOW);
+
+	swap_unmap_window();
+	return res;
+}
+
+// reads the page of the slot back from the compressed tier or the swap file
+error_t swap_load_frame(uint32 slot, physical_addr frame)
+{
+	swap_map_window(frame);
+
+	error_t res = zswap_load(slot, SWAP_WINDOW);
+	if (res != ERROR_OK && zswap_is_stored(slot) == false)
+		res = swap_read_slot(slot, SWAP_WINDOW);
+
+	swap_unmap_window();
+	return res;
+}
+
+// maps the not yet present pages of the kernel range
+error_t swap_map_range(virtual_addr base, uint32 size)
+{
+	for (virtual_addr addr = base; addr < base + size; addr += PAGE_SIZE)
+	{
+		if (vmmngr_is_page_present(addr) == false && vmmngr_alloc_page(addr) != ERROR_OK)
+		{
+			set_last_error(ENOMEM, SWAP_OUT_OF_MEM, EO_SWAP);
+			return ERROR_OCCUR;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+// appends "name: value" and a new line to the text
+char* swap_dev_print(char* text, char* name, uint32 value)
+{
+	strcpy(text, name);
+	text += strlen(text);
+	*text++ = ':';
+	*text++ = ' ';
+
+	uitoa(value, text, 10);
+	text += strlen(text);
+	*text++ = '\n';
+
+	return text;
+}
+
+// appends "name: value.xx" for a value given in hundredths
+char* swap_dev_print_fixed(char* text, char* name, uint32 hundredths)
+{
+	text = swap_dev_print(text, name, hundredths / 100) - 1;
+	*text++ = '.';
+	*text++ = '0' + hundredths % 100 / 10;
+	*text++ = '0' + hundredths % 10;
+	*text++ = '\n';
+
+	return text;
+}
+
+// returns a free slot with one reference or INVALID_FD if the swap file is full
+uint32 swap_slot_alloc()
+{
+	for (uint32 i = 0; i < swap_info.slots; i++)
+	{
+		uint32 slot = (swap_slot_cursor + i) % swap_info.slots;
+
+		if (swap_slot_refs[slot] == 0)
+		{
+			swap_slot_refs[slot] = 1;
+			swap_slot_cursor = slot + 1;
+			swap_info.used++;
+
+			return slot;
+		}
+	}
+
+	return INVALID_FD;
+}
+
+void swap_slot_put(uint32 slot)
+{
+	if (slot >= swap_info.slots || swap_slot_refs[slot] == 0)
+		return;
+
+	if (--swap_slot_refs[slot] == 0)
+	{
+		zswap_invalidate(slot);
+		swap_info.used--;
+	}
+}
+
+// returns true if the page at addr may go to the swap file (user page of a private anonymous area)
+bool swap_area_is_evictable(PCB* proc, virtual_addr addr)
+{
+	// a busy contract means its owner is changing it (or we are inside its fault handler), so leave the page alone
+	if (spinlock_try_acquire(&proc->contract_spinlock) == false)
+		return false;
+
+	vm_area* area = vm_contract_find_area(&proc->memory_contract, addr);
+	bool evictable = area != 0 && CHK_BIT(area->flags, MMAP_PRIVATE) && CHK_BIT(area->flags, MMAP_ANONYMOUS) &&
+		!CHK_BIT(area->flags, MMAP_IDENTITY_MAP) && !CHK_BIT(area->flags, MMAP_ALLOC_IMMEDIATE) && !CHK_BIT(area->flags, MMAP_LOCKED);
+
+	spinlock_release(&proc->contract_spinlock);
+	return evictable;
+}
+
+// writes the page mapped by 'page' to a new slot and frees its frame
+bool swap_evict_page(PCB* proc, pt_entry* page, virtual_addr addr)
+{
+	physical_addr frame = pt_entry_get_frame(*page);
+	page_frame* pf = page_frame_get(frame);
+
+	// shared frames (fork, page cache, zero page) and untracked or pinned frames stay in memory
+	if (pf == 0 || pf->refcount != 1 || pf->mapcount > 1 ||
+		(pf->flags & (PAGE_FRAME_PINNED | PAGE_FRAME_LOCKED | PAGE_FRAME_CACHE_OWNED | PAGE_FRAME_UNCOUNTED)) != 0)
+		return false;
+
+	if (swap_area_is_evictable(proc, addr) == false)
+		return false;
+
+	uint32 slot = swap_slot_alloc();
+	if (slot == INVALID_FD)
+		return false;
+
+	// unmap first so that the owner cannot change the page while it is written. A fault on it waits for the swap lock
+	pt_entry old = *page;
+	*page = (slot << 12) | I86_PTE_SWAPPED;
+
+	if (proc->page_dir == vmmngr_get_directory())
+		vmmngr_flush_TLB_entry(addr);
+
+	if (swap_store_frame(slot, frame) != ERROR_OK)
+	{
+		*page = old;
+		swap_slot_put(slot);
+		return false;
+	}
+
+	page_frame_unmap(frame);
+	page_frame_put(frame);
+	swap_info.swapped_out++;
+
+	return true;
+}
+
+// moves the clock hand by step (page or table size), wrapping to the next process at the kernel half
+void swap_clock_advance(uint32 step)
+{
+	swap_hand_addr = (swap_hand_addr & ~(step - 1)) + step;
+
+	if (swap_hand_addr >= KERNEL_SPACE_START || swap_hand_addr == 0)
+	{
+		swap_hand_addr = 0;
+		swap_hand_proc = (swap_hand_proc + 1) % swap_process_count;
+	}
+}
+
+// public functions
+
+error_t init_swap(char* path)
+{
+	pdirectory* dir = vmmngr_get_directory();
+	pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, SWAP_WINDOW);
+
+	// the table is created now, in the kernel directory, so that every address space shares it
+	if (pd_entry_is_present(*e) == false && vmmngr_create_table(dir, SWAP_WINDOW, DEFAULT_FLAGS) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	swap_window_page = vmmngr_ptable_lookup_entry((ptable*)pd_entry_get_frame(*e), SWAP_WINDOW);
+
+	uint32 slots = SWAP_RAM_SLOTS;
+	uint32 gfd = INVALID_FD;
+
+	if (path != 0)
+	{
+		uint32 fd;
+		if (open_file(path, &fd, VFS_CAP_READ | VFS_CAP_WRITE) != ERROR_OK)
+			return ERROR_OCCUR;
+
+		lfe* local_entry = lft_get(&process_get_current()->lft, fd);
+		gfe* entry = local_entry == 0 ? 0 : gft_get(local_entry->gfd);
+
+		// the file is not grown, so its current length gives the slots
+		if (entry == 0 || entry->file_node->file_length < PAGE_SIZE)
+		{
+			set_last_error(EINVAL, SWAP_BAD_FILE, EO_SWAP);
+			return ERROR_OCCUR;
+		}
+
+		slots = min(entry->file_node->file_length / PAGE_SIZE, SWAP_MAX_SLOTS);
+		gfd = local_entry->gfd;
+	}
+
+	// the slot metadata lives in kernel pages of its own, as the kernel heap is far too small for it
+	if (init_zswap(slots) != ERROR_OK || swap_map_range(SWAP_REFS_BASE, pmmngr_get_next_align(slots)) != ERROR_OK ||
+		swap_map_range(SWAP_DEMOTE_PAGE, PAGE_SIZE) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	memset(swap_slot_refs, 0, slots);
+	memset(&swap_info, 0, sizeof(swap_stats));
+	swap_info.slots = slots;
+	swap_slot_cursor = 0;
+	spinlock_init(&swap_lock);
+
+	swap_gfd = gfd;
+	vfs_create_device("swap", VFS_CAP_READ, 0, 0, &swap_dev_ops);
+
+	return ERROR_OK;
+}
+
+bool swap_enabled()
+{
+	return swap_info.slots != 0;
+}
+
+bool swap_file_enabled()
+{
+	return swap_gfd != INVALID_FD;
+}
+
+void swap_add_process(PCB* proc)
+{
+	if (swap_process_count == SWAP_MAX_PROCESSES)
+	{
+		serial_printf("swap: process %u is not scanned\n", proc->id);
+		return;
+	}
+
+	swap_processes[swap_process_count++] = proc;
+}
+
+uint32 swap_reclaim(uint32 count)
+{
+	if (swap_enabled() == false || swap_process_count == 0)
+		return 0;
+
+	// another eviction or swap in is running, or the swap path itself ran out of memory. Do not wait for it
+	if (spinlock_try_acquire(&swap_lock) == false)
+		return 0;
+
+	uint32 evicted = 0;
+
+	for (uint32 scanned = 0; evicted < count && scanned < SWAP_SCAN_LIMIT; scanned++)
+	{
+		PCB* proc = swap_processes[swap_hand_proc];
+		pd_entry* e = vmmngr_pdirectory_lookup_entry(proc->page_dir, swap_hand_addr);
+
+		// skip whole tables that are missing or are large (identity) pages
+		if (pd_entry_is_present(*e) == false || pd_entry_is_4mb(*e))
+		{
+			swap_clock_advance(LARGE_PAGE_SIZE);
+			continue;
+		}
+
+		swap_info.scanned++;
+
+		virtual_addr addr = swap_hand_addr;
+		pt_entry* page = vmmngr_ptable_lookup_entry((ptable*)pd_entry_get_frame(*e), addr);
+		swap_clock_advance(PAGE_SIZE);
+
+		if (pt_entry_is_present(*page) == false || pt_entry_test_attrib(page, I86_PTE_USER) == false)
+			continue;
+
+		// second chance for a recently used page
+		if (pt_entry_test_attrib(page, I86_PTE_ACCESSED))
+		{
+			pt_entry_del_attrib(page, I86_PTE_ACCESSED);
+
+			if (proc->page_dir == vmmngr_get_directory())
+				vmmngr_flush_TLB_entry(addr);
+
+			continue;
+		}
+
+		if (swap_evict_page(proc, page, addr))
+			evicted++;
+	}
+
+	spinlock_release(&swap_lock);
+	return evicted;
+}
+
+bool swap_is_entry_swapped(pt_entry entry)
+{
+	return pt_entry_is_present(entry) == false && (entry & I86_PTE_SWAPPED) == I86_PTE_SWAPPED;
+}
+
+bool swap_is_page_swapped(virtual_addr addr)
+{
+	pt_entry* page = vmmngr_lookup_page(vmmngr_get_directory(), addr);
+	return page != 0 && swap_is_entry_swapped(*page);
+}
+
+error_t swap_out_page(virtual_addr addr)
+{
+	addr &= ~(PAGE_SIZE - 1);
+
+	if (swap_enabled() == false)
+	{
+		set_last_error(EINVAL, SWAP_NOT_INITIALIZED, EO_SWAP);
+		return ERROR_OCCUR;
+	}
+
+	pt_entry* page = vmmngr_lookup_page(vmmngr_get_directory(), addr);
+	if (page == 0 || pt_entry_is_present(*page) == false)
+	{
+		set_last_error(EINVAL, SWAP_BAD_ARGUMENT, EO_SWAP);
+		return ERROR_OCCUR;
+	}
+
+	// a failed store leaves its own error. Anything else means the page may not leave memory
+	clear_last_error();
+	spinlock_acquire(&swap_lock);
+	bool evicted = swap_evict_page(process_get_current(), page, addr);
+	spinlock_release(&swap_lock);
+
+	if (evicted == false)
+	{
+		if (get_raw_error() == 0)
+			set_last_error(EINVAL, SWAP_BAD_ARGUMENT, EO_SWAP);
+
+		return ERROR_OCCUR;
+	}
+
+	return ERROR_OK;
+}
+
+error_t swap_in_page(virtual_addr addr, uint32 flags)
+{
+	addr &= ~(PAGE_SIZE - 1);
+
+	pt_entry* page = vmmngr_lookup_page(vmmngr_get_directory(), addr);
+	if (page == 0 || swap_is_entry_swapped(*page) == false)
+	{
+		set_last_error(EINVAL, SWAP_BAD_ARGUMENT, EO_SWAP);
+		return ERROR_OCCUR;
+	}
+
+	// the frame is taken before the lock as the allocation may have to evict pages itself
+	physical_addr frame = vmmngr_alloc_frame();
+	if (frame == 0)
+	{
+		set_last_error(ENOMEM, SWAP_OUT_OF_MEM, EO_SWAP);
+		return ERROR_OCCUR;
+	}
+
+	spinlock_acquire(&swap_lock);
+
+	// another thread of this space brought the page back meanwhile
+	if (swap_is_entry_swapped(*page) == false)
+	{
+		spinlock_release(&swap_lock);
+		pmmngr_free_block((void*)frame);
+
+		return ERROR_OK;
+	}
+
+	uint32 slot = *page >> 12;
+	if (swap_load_frame(slot, frame) != ERROR_OK)
+	{
+		spinlock_release(&swap_lock);
+		pmmngr_free_block((void*)frame);
+
+		return ERROR_OCCUR;
+	}
+
+	*page = 0;
+	if (vmmngr_map_page(vmmngr_get_directory(), frame, addr, flags) != ERROR_OK)
+	{
+		// keep the page in the swap file
+		*page = (slot << 12) | I86_PTE_SWAPPED;
+		spinlock_release(&swap_lock);
+		pmmngr_free_block((void*)frame);
+
+		return ERROR_OCCUR;
+	}
+
+	swap_slot_put(slot);
+	swap_info.swapped_in++;
+	spinlock_release(&swap_lock);
+
+	return ERROR_OK;
+}
+
+void swap_dup_entry(pt_entry entry)
+{
+	if (swap_is_entry_swapped(entry) == false)
+		return;
+
+	spinlock_acquire(&swap_lock);
+
+	uint32 slot = entry >> 12;
+	if (slot < swap_info.slots && swap_slot_refs[slot] != 0xFF)
+		swap_slot_refs[slot]++;
+	else
+		PANIC("swap: slot reference overflow");
+
+	spinlock_release(&swap_lock);
+}
+
+void swap_free_entry(pt_entry entry)
+{
+	if (swap_is_entry_swapped(entry) == false)
+		return;
+
+	spinlock_acquire(&swap_lock);
+	swap_slot_put(entry >> 12);
+	spinlock_release(&swap_lock);
+}
+
+swap_stats swap_get_stats()
+{
+	return swap_info;
+}
+
+size_t swap_dev_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
+{
+	static char text[512];
+
+	swap_stats swap = swap_get_stats();
+	zswap_stats pool = zswap_get_stats();
+	uint32 lookups = pool.hits + pool.misses;
+
+	char* end = text;
+	end = swap_dev_print(end, "slots", swap.slots);
+	end = swap_dev_print(end, "used slots", swap.used);
+	end = swap_dev_print(end, "swapped out", swap.swapped_out);
+	end = swap_dev_print(end, "swapped in", swap.swapped_in);
+	end = swap_dev_print(end, "written to disk", swap.written);
+	end = swap_dev_print(end, "demoted", swap.demoted);
+	end = swap_dev_print(end, "pool size", pool.pool_size);
+	end = swap_dev_print(end, "pool used", pool.pool_used);
+	end = swap_dev_print(end, "pool pages", pool.stored);
+	end = swap_dev_print(end, "compressed bytes", pool.compressed_bytes);
+	end = swap_dev_print_fixed(end, "compression ratio", pool.compressed_bytes == 0 ? 0 :
+		(uint32)((uint64)pool.stored * PAGE_SIZE * 100 / pool.compressed_bytes));
+	end = swap_dev_print(end, "rejected", pool.rejected);
+	end = swap_dev_print(end, "pool hits", pool.hits);
+	end = swap_dev_print(end, "pool misses", pool.misses);
+	end = swap_dev_print(end, "hit rate %", lookups == 0 ? 0 : pool.hits * 100 / lookups);
+
+	uint32 length = end - text;
+	if (start >= length)
+		return 0;
+
+	count = min(count, length - start);
+	memcpy((void*)address, text + start, count);
+
+	return count;
+}
@@ -0,0 +1,94 @@
+#ifndef SWAP_H_16102026
+#define SWAP_H_16102026
+
+#include "types.h"
+#include "utility.h"
+#include "process.h"
+#include "zswap.h"
+
+/*
+	Demand paging to a swap file.
+
+	Cold user pages of private anonymous areas are given a page sized slot of a pre-allocated swap file. Their page
+	table entry is left not present with I86_PTE_SWAPPED set and the slot number in the frame bits, so a fault on it
+	reads the slot back. Slots are reference counted, as a fork copies swapped entries to the child.
+
+	A slot is first stored LZ4 compressed in the in-memory tier (zswap.h) and reaches the file only when the page does not
+	compress well or when the tier demotes it to make room. Without a swap file the tier alone backs a fixed number of
+	slots. The statistics of both are readable as text from the "swap" device.
+
+	Victims are chosen by a CLOCK scan over the user page tables of every process: a page accessed since the hand last
+	passed gets its accessed bit cleared (second chance), otherwise it is evicted. Shared, pinned, page cache and
+	zero page frames are never evicted, and neither are kernel (non-user) pages.
+*/
+
+#define SWAP_WINDOW				0xDA001000		// kernel virtual page through which frames are written and read back
+#define SWAP_DEMOTE_PAGE		0xDA002000		// kernel page a demoted slot is decompressed to before it is written
+#define SWAP_REFS_BASE			0xDA380000		// kernel virtual address of the slot reference counts
+#define SWAP_MAX_SLOTS			ZSWAP_MAX_SLOTS	// slots used of a swap file (512MB)
+#define SWAP_RAM_SLOTS			4096			// slots backed by the compressed tier alone when there is no swap file
+#define SWAP_RECLAIM_BATCH		16				// pages evicted when an allocation finds physical memory exhausted
+#define SWAP_SCAN_LIMIT			8192			// page table entries (or empty tables) the hand visits in one reclaim
+#define SWAP_MAX_PROCESSES		64				// address spaces the hand can walk
+
+enum SWAP_ERROR
+{
+	SWAP_NONE,
+	SWAP_NOT_INITIALIZED,
+	SWAP_BAD_FILE,
+	SWAP_BAD_ARGUMENT,
+	SWAP_IO_ERROR,
+	SWAP_OUT_OF_MEM,
+	SWAP_NO_SPACE
+};
+
+struct swap_stats
+{
+	uint32 slots;			// page slots (of the swap file or of the compressed tier alone)
+	uint32 used;			// slots holding a page
+	uint32 swapped_out;		// pages evicted so far
+	uint32 swapped_in;		// pages read back so far
+	uint32 written;			// pages written to the swap file, directly or by demotion
+	uint32 demoted;			// pages moved from the compressed tier to the swap file
+	uint32 scanned;			// entries visited by the clock hand
+};
+
+// opens the (already allocated) swap file given by path, or uses the compressed tier alone if path is 0.
+// Must be called before any process other than process 0 is created
+error_t init_swap(char* path);
+
+// returns true once swapping is enabled
+bool swap_enabled();
+
+// returns true if a swap file backs the slots (otherwise the compressed tier alone does)
+bool swap_file_enabled();
+
+// adds the address space of the process to the clock scan
+void swap_add_process(PCB* proc);
+
+// evicts up to count cold pages and returns the number evicted
+uint32 swap_reclaim(uint32 count);
+
+// returns true if the page table entry refers to a swap slot
+bool swap_is_entry_swapped(pt_entry entry);
+
+// returns true if the page at addr of the current address space is in the swap file
+bool swap_is_page_swapped(virtual_addr addr);
+
+// evicts the page at addr of the current address space to a slot. Fails if the page may not be evicted or if neither
+// tier has room for it
+error_t swap_out_page(virtual_addr addr);
+
+// reads the swapped page at addr of the current address space back and maps it with flags
+error_t swap_in_page(virtual_addr addr, uint32 flags);
+
+// takes an extra reference to the slot of a swapped entry (the entry is copied to another address space)
+void swap_dup_entry(pt_entry entry);
+
+// drops the reference of a swapped entry to its slot
+void swap_free_entry(pt_entry entry);
+
+// returns the swap statistics
+swap_stats swap_get_stats();
+
+#endif
@@ -115,6 +115,18 @@ void disable_write_protection()
 	}
 }
 
+bool write_protection_enabled()
+{
+	uint32 cr0_value;
+
+	_asm {
+		mov eax, cr0
+		mov cr0_value, eax
+	}
+
+	return (cr0_value & 0x10000) != 0;
+}
+
 __declspec(naked) uint32 get_eip()
 {
 	__asm
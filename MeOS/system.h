@@ -25,6 +25,9 @@ extern "C" {
 	void enable_write_protection();
 	void disable_write_protection();
 
+	// returns true if ring 0 writes to read-only pages fault (cr0.WP is set)
+	bool write_protection_enabled();
+
 #define low_address(addr) (addr & 0x0000FFFF)
 #define high_address(addr) (addr >> 16)
 
@@ -3,6 +3,11 @@
 #include "../thread_sched.h"
 #include "../process.h"
 #include "../kernel_stack.h"
+#include "../page_cache.h"
+#include "../MassStorageDefinitions.h"
+
+#define TEST_AHCI_PAGES			3			// each page takes its own PRDT entry
+#define TEST_AHCI_SCRATCH_LBA	4096		// saved and restored around the test
 
 uint8 buf[4096] = { 1 };
 
@@ -121,3 +126,58 @@ bool test_ahci_read()
 
 	RET_SUCCESS;
 }
+
+// writes several pages with one scatter-gather command, reads them back into other pages and compares them. The scratch
+// sectors are saved first and restored at the end
+bool test_ahci_page_transfer()
+{
+	vfs_node* dev;
+	if (vfs_root_lookup("dev/sdc", &dev) != ERROR_OK)
+		FAIL("Could not find sdc: %e\n");
+
+	virtual_addr saved[TEST_AHCI_PAGES], written[TEST_AHCI_PAGES], read[TEST_AHCI_PAGES];
+	for (uint32 i = 0; i < TEST_AHCI_PAGES; i++)
+	{
+		saved[i] = page_cache_reserve_anonymous();
+		written[i] = page_cache_reserve_anonymous();
+		read[i] = page_cache_reserve_anonymous();
+
+		if (saved[i] == 0 || written[i] == 0 || read[i] == 0)
+			FAIL("Could not reserve the transfer pages: %e\n");
+
+		// a different pattern per page, so pages swapped or shifted by a PRDT entry show up
+		for (uint32 j = 0; j < PAGE_SIZE; j++)
+			((uint8*)written[i])[j] = (uint8)(i * 37 + j);
+
+		memset((void*)read[i], 0, PAGE_SIZE);
+	}
+
+	uint32 done;
+	if (dev->fs_ops->fs_ioctl(dev, MASS_STORAGE_IOCTL_READ_PAGES, TEST_AHCI_SCRATCH_LBA, TEST_AHCI_PAGES, saved, &done) != ERROR_OK)
+		FAIL("Could not save the scratch sectors: %e\n");
+
+	if (dev->fs_ops->fs_ioctl(dev, MASS_STORAGE_IOCTL_WRITE_PAGES, TEST_AHCI_SCRATCH_LBA, TEST_AHCI_PAGES, written, &done) != ERROR_OK ||
+		done != TEST_AHCI_PAGES)
+		FAIL("Could not write the pages: %e\n");
+
+	if (dev->fs_ops->fs_ioctl(dev, MASS_STORAGE_IOCTL_READ_PAGES, TEST_AHCI_SCRATCH_LBA, TEST_AHCI_PAGES, read, &done) != ERROR_OK ||
+		done != TEST_AHCI_PAGES)
+		FAIL("Could not read the pages back: %e\n");
+
+	for (uint32 i = 0; i < TEST_AHCI_PAGES; i++)
+		for (uint32 j = 0; j < PAGE_SIZE; j++)
+			if (((uint8*)written[i])[j] != ((uint8*)read[i])[j])
+				FAIL("Page read back differs from the page written\n");
+
+	if (dev->fs_ops->fs_ioctl(dev, MASS_STORAGE_IOCTL_WRITE_PAGES, TEST_AHCI_SCRATCH_LBA, TEST_AHCI_PAGES, saved, &done) != ERROR_OK)
+		FAIL("Could not restore the scratch sectors: %e\n");
+
+	for (uint32 i = 0; i < TEST_AHCI_PAGES; i++)
+	{
+		page_cache_release_anonymous(saved[i]);
+		page_cache_release_anonymous(written[i]);
+		page_cache_release_anonymous(read[i]);
+	}
+
+	RET_SUCCESS;
+}
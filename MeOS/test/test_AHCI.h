@@ -5,4 +5,7 @@
 
 bool test_ahci_read();
 
+// multi-page scatter-gather write and read back through the page ioctls
+bool test_ahci_page_transfer();
+
 #endif
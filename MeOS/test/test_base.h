@@ -8,4 +8,18 @@
 #define SUCCESS(x) { serial_printf(x); return true; }
 #define RET_SUCCESS { serial_printf("--------Test is successful---------\n\n"); return true; }
 
+// returns the low 32 bits of the time stamp counter. Used by benchmarks to time short operations (differences wrap correctly).
+inline uint32 test_read_tsc()
+{
+	uint32 low;
+
+	_asm
+	{
+		rdtsc
+		mov dword ptr[low], eax
+	}
+
+	return low;
+}
+
 #endif
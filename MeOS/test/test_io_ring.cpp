@@ -0,0 +1,147 @@
+#include "test_io_ring.h"
+#include "../page_cache.h"
+
+#define TEST_IO_RING_PAGES			4
+#define TEST_IO_RING_READ			100				// bytes of each read
+#define TEST_IO_RING_BAD_OPCODE		99
+
+size_t test_io_ring_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
+size_t test_io_ring_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
+
+static fs_operations test_io_ring_ops =
+{
+	test_io_ring_read,			// read
+	test_io_ring_write,			// write
+	NULL,						// open
+	NULL,						// close
+	NULL,						// sync
+	NULL,						// lookup
+	NULL						// ioctl
+};
+
+static uint32 test_io_ring_writes = 0;
+
+// every byte of the device holds the low bits of its page and offset
+uint8 test_io_ring_value(uint32 position)
+{
+	return (uint8)(position / PAGE_CACHE_SIZE * 16 + position % 13);
+}
+
+size_t test_io_ring_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
+{
+	for (uint32 i = 0; i < count; i++)
+		((uint8*)address)[i] = test_io_ring_value(start + i);
+
+	return count;
+}
+
+size_t test_io_ring_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
+{
+	test_io_ring_writes++;
+	return count;
+}
+
+// a batch of reads, a write and a sync through the ring of the kernel process, reaped in submission order
+bool test_io_ring()
+{
+	vfs_node* node = vfs_create_device("io_ring_test", VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE, 0, 0, &test_io_ring_ops);
+	if (node == 0)
+		FAIL("Could not create the io ring test device: %e\n");
+
+	node->file_length = TEST_IO_RING_PAGES * PAGE_CACHE_SIZE;
+
+	uint32 fd;
+	if (open_file("dev/io_ring_test", &fd, VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE) != ERROR_OK)
+		FAIL("Could not open the io ring test device: %e\n");
+
+	io_ring* ring = io_ring_create(6);
+	if (ring == 0)
+		FAIL("Could not create the io ring: %e\n");
+
+	if (ring->entries != 8 || io_ring_create(8) != 0)
+		FAIL("Io ring was created with the wrong size or twice\n");
+
+	uint8 data[TEST_IO_RING_PAGES][TEST_IO_RING_READ];
+	uint8 record[4] = { 1, 2, 3, 4 };
+
+	// one batch: a read of every page, a write, the sync of the written page and a request the worker does not know
+	io_ring_sqe* sqe;
+	for (uint32 page = 0; page < TEST_IO_RING_PAGES; page++)
+	{
+		sqe = io_ring_get_sqe(ring);
+		sqe->opcode = IO_RING_OP_READ;
+		sqe->fd = fd;
+		sqe->start = page * PAGE_CACHE_SIZE;
+		sqe->count = TEST_IO_RING_READ;
+		sqe->buffer = (virtual_addr)data[page];
+		sqe->user_data = page;
+	}
+
+	sqe = io_ring_get_sqe(ring);
+	sqe->opcode = IO_RING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->start = 5;
+	sqe->count = 4;
+	sqe->buffer = (virtual_addr)record;
+	sqe->user_data = 4;
+
+	sqe = io_ring_get_sqe(ring);
+	sqe->opcode = IO_RING_OP_FSYNC;
+	sqe->fd = fd;
+	sqe->start = 0;
+	sqe->count = 0;
+	sqe->user_data = 5;
+
+	sqe = io_ring_get_sqe(ring);
+	sqe->opcode = TEST_IO_RING_BAD_OPCODE;
+	sqe->user_data = 6;
+
+	// taken entries are not seen by the worker before the submit
+	if (io_ring_peek_cqe(ring) != 0 || io_ring_submit(ring) != 7 || io_ring_submit(ring) != 0)
+		FAIL("Io ring did not submit the batch\n");
+
+	io_ring_wait(ring, 7);
+
+	for (uint32 i = 0; i < 7; i++)
+	{
+		io_ring_cqe* cqe = io_ring_peek_cqe(ring);
+		if (cqe == 0 || cqe->user_data != i)
+			FAIL("Io ring completions are missing or out of order\n");
+
+		if (i < TEST_IO_RING_PAGES && (cqe->result != TEST_IO_RING_READ || cqe->error != 0))
+			FAIL("Io ring read failed\n");
+
+		if (i == 4 && cqe->result != 4)
+			FAIL("Io ring write failed\n");
+
+		if (i == 5 && cqe->result != ERROR_OK)
+			FAIL("Io ring sync failed\n");
+
+		if (i == 6 && (cqe->result != ERROR_OCCUR || cqe->error == 0))
+			FAIL("Io ring accepted an unknown request\n");
+
+		io_ring_cqe_seen(ring);
+	}
+
+	if (io_ring_peek_cqe(ring) != 0)
+		FAIL("Io ring posted more completions than requests\n");
+
+	// the reads ran before the write
+	for (uint32 page = 0; page < TEST_IO_RING_PAGES; page++)
+		for (uint32 i = 0; i < TEST_IO_RING_READ; i++)
+			if (data[page][i] != test_io_ring_value(page * PAGE_CACHE_SIZE + i))
+				FAIL("Io ring read returned wrong data\n");
+
+	uint32 gfd = gft_get_by_fd(fd);
+	if (test_io_ring_writes == 0 || page_cache_is_page_dirty(gfd, 0))
+		FAIL("Io ring sync did not write the page\n");
+
+	if (ring->stats.batches != 1 || ring->stats.completed != 7 || ring->stats.failed != 1)
+		FAIL("Io ring statistics are wrong\n");
+
+	for (uint32 page = 0; page < TEST_IO_RING_PAGES; page++)
+		if (page_cache_release_buffer(gfd, page) != ERROR_OK)
+			FAIL("Could not release page cache buffer: %e\n");
+
+	RET_SUCCESS;
+}
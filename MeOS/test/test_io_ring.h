@@ -0,0 +1,10 @@
+#ifndef TEST_IO_RING_H_16102026
+#define TEST_IO_RING_H_16102026
+
+#include "test_base.h"
+#include "../io_ring.h"
+#include "../file.h"
+
+bool test_io_ring();
+
+#endif
@@ -0,0 +1,189 @@
+#include "test_kmem_cache.h"
+
+#define TEST_KMEM_OBJECTS		512
+#define TEST_KMEM_MAGIC			0xC0FFEE
+#define TEST_KMEM_DATA			29				// 128 byte objects leave room for two colors
+
+struct test_kmem_object
+{
+	uint32 magic;
+	uint32 data[TEST_KMEM_DATA];
+};
+
+static uint32 test_kmem_constructed = 0;
+static volatile bool test_kmem_thread_ready = false;
+
+void test_kmem_ctor(void* object)
+{
+	((test_kmem_object*)object)->magic = TEST_KMEM_MAGIC;
+	test_kmem_constructed++;
+}
+
+// leaves a freed object in its magazine and blocks for good
+void test_kmem_magazine_thread()
+{
+	free(malloc(24));
+	test_kmem_thread_ready = true;
+
+	INT_OFF;
+	thread_block(thread_get_current_node());
+
+	while (true);
+}
+
+bool test_kmem_cache()
+{
+	static test_kmem_object* objects[TEST_KMEM_OBJECTS];
+
+	kmem_cache* cache = kmem_cache_create("test_object", sizeof(test_kmem_object), 0, test_kmem_ctor);
+	if (cache == 0)
+		FAIL("Cache creation failed: %e\n");
+
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+	{
+		objects[i] = (test_kmem_object*)kmem_cache_alloc(cache);
+		if (objects[i] == 0)
+			FAIL("Object allocation failed: %e\n");
+
+		if (objects[i]->magic != TEST_KMEM_MAGIC)
+			FAIL("Object was not constructed\n");
+
+		if (((virtual_addr)objects[i] & (sizeof(uint32) - 1)) != 0)
+			FAIL("Object is not aligned\n");
+
+		for (uint32 j = 0; j < TEST_KMEM_DATA; j++)
+			objects[i]->data[j] = i;
+	}
+
+	// every object is distinct and keeps its data
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		for (uint32 j = 0; j < TEST_KMEM_DATA; j++)
+			if (objects[i]->data[j] != i)
+				FAIL("Objects overlap\n");
+
+	kmem_cache_stats stats = kmem_cache_get_stats(cache);
+	if (stats.in_use != TEST_KMEM_OBJECTS || stats.slabs == 0 || test_kmem_constructed < TEST_KMEM_OBJECTS)
+		FAIL("Cache statistics are wrong\n");
+
+	// the first objects of consecutive slabs start at different page offsets
+	if (cache->colors > 1 && ((virtual_addr)objects[0] & (PAGE_SIZE - 1)) == ((virtual_addr)objects[cache->objects] & (PAGE_SIZE - 1)))
+		FAIL("Slabs are not colored\n");
+
+	uint32 constructed = test_kmem_constructed;
+
+	// freed objects stay constructed and are reused without running the constructor again
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		kmem_cache_free(cache, objects[i]);
+
+	test_kmem_object* reused = (test_kmem_object*)kmem_cache_alloc(cache);
+	if (reused == 0 || reused->magic != TEST_KMEM_MAGIC || test_kmem_constructed != constructed)
+		FAIL("Freed object lost its constructed state\n");
+
+	kmem_cache_free(cache, reused);
+
+	stats = kmem_cache_get_stats(cache);
+	if (stats.in_use != 0 || stats.slabs > KMEM_MAX_EMPTY)
+		FAIL("Empty slabs were not released\n");
+
+	if (kmem_cache_destroy(cache) != ERROR_OK)
+		FAIL("Cache destruction failed: %e\n");
+
+	// size caches and the heap fallback
+	void* small = kmem_alloc(24);
+	void* large = kmem_alloc(KMEM_MAX_SIZE + 1);
+
+	if (small == 0 || large == 0)
+		FAIL("Generic allocation failed: %e\n");
+
+	if ((virtual_addr)small < KMEM_WINDOW_BASE || (virtual_addr)small >= KMEM_WINDOW_BASE + KMEM_WINDOW_SIZE)
+		FAIL("Small allocation did not come from a slab\n");
+
+	kmem_free(small);
+	kmem_free(large);
+
+	// the thread's magazine hands the object just freed back first
+	void* first = malloc(24);
+	free(first);
+	void* second = malloc(24);
+	free(second);
+
+	if (first != second)
+		FAIL("Magazine did not reuse the freed object\n");
+
+	// reclaiming memory gives the thread's magazines back to the caches
+	kmem_reclaim();
+
+	for (uint32 i = 0; i < KMEM_SIZE_CACHES; i++)
+		if (thread_get_current()->magazines.size_classes[i].count != 0)
+			FAIL("Reclaim did not flush the thread's magazines\n");
+
+	// and the magazines of the other threads, which would keep their objects as long as they do not run
+	virtual_addr stack = kernel_stack_reserve();
+	if (stack == 0)
+		FAIL("Could not allocate stack: %e\n");
+
+	TCB* thread = thread_create(process_get_current(), (uint32)test_kmem_magazine_thread, stack, 4096, 3, 0);
+	INT_OFF;
+	thread_insert(thread);
+	INT_ON;
+
+	while (test_kmem_thread_ready == false)
+		sleep(1);
+
+	kmem_reclaim();
+
+	for (uint32 i = 0; i < KMEM_SIZE_CACHES; i++)
+		if (thread->magazines.size_classes[i].count != 0)
+			FAIL("Reclaim did not flush the magazines of another thread\n");
+
+	RET_SUCCESS;
+}
+
+bool test_kmem_alloc_benchmark()
+{
+	static void* objects[TEST_KMEM_OBJECTS];
+
+	kmem_cache* cache = kmem_cache_create("test_bench", 16, 0, 0);
+	if (cache == 0)
+		FAIL("Cache creation failed: %e\n");
+
+	// warm both paths so that the slab pages exist
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		objects[i] = kmem_cache_alloc(cache);
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		kmem_cache_free(cache, objects[i]);
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		objects[i] = malloc(16);
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		free(objects[i]);
+
+	// a cache call takes the critical lock every time
+	uint32 start = test_read_tsc();
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+	{
+		void* object = kmem_cache_alloc(cache);
+		kmem_cache_free(cache, object);
+	}
+	uint32 slab_cycles = test_read_tsc() - start;
+
+	// malloc and free of a small size stay in the thread's magazine
+	start = test_read_tsc();
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		free(malloc(16));
+	uint32 magazine_cycles = test_read_tsc() - start;
+
+	// bursts larger than a magazine move batches to and from the caches
+	start = test_read_tsc();
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		objects[i] = malloc(16);
+	for (uint32 i = 0; i < TEST_KMEM_OBJECTS; i++)
+		free(objects[i]);
+	uint32 burst_cycles = test_read_tsc() - start;
+
+	kmem_cache_destroy(cache);
+
+	serial_printf("kmem: %u allocations and frees of 16 bytes: slab %u cycles, magazine %u cycles, burst %u cycles\n",
+		TEST_KMEM_OBJECTS, slab_cycles, magazine_cycles, burst_cycles);
+
+	RET_SUCCESS;
+}
@@ -0,0 +1,14 @@
+#ifndef TEST_KMEM_CACHE_H_16102026
+#define TEST_KMEM_CACHE_H_16102026
+
+#include "test_base.h"
+#include "../kmem_cache.h"
+#include "../memory.h"
+#include "../thread_sched.h"
+#include "../kernel_stack.h"
+#include "../timer.h"
+
+bool test_kmem_cache();
+bool test_kmem_alloc_benchmark();
+
+#endif
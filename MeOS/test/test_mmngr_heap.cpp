@@ -0,0 +1,284 @@
+#include "test_mmngr_heap.h"
+
+#define TEST_HEAP_SIZE			128 KB
+#define TEST_HEAP_SLOTS			256
+#define TEST_HEAP_TRACE			20000
+#define TEST_HEAP_GROW_BLOCKS	512				// more than the kernel heap commits at boot
+#define TEST_HEAP_GROW_SIZE		1536			// above the size caches and below the page granular path
+#define TEST_HEAP_PROFILE_ALLOCS	64
+
+extern heap* kernel_heap;
+
+struct test_heap_alloc
+{
+	uint8* address;
+	uint32 size;
+	uint8 pattern;
+};
+
+static uint32 test_heap_seed;
+
+static uint32 test_heap_random()
+{
+	test_heap_seed = test_heap_seed * 1103515245 + 12345;
+	return (test_heap_seed >> 16) & 0x7FFF;
+}
+
+static bool test_heap_check(test_heap_alloc* a)
+{
+	for (uint32 i = 0; i < a->size; i++)
+		if (a->address[i] != a->pattern)
+			return false;
+
+	return true;
+}
+
+// returns the size of the next allocation of a kernel like trace: object names, list and area nodes, file tables,
+// network buffers and thread stacks, in roughly the proportions the kernel requests them at run time.
+static uint32 test_heap_trace_size()
+{
+	uint32 kind = test_heap_random() % 100;
+
+	if (kind < 30)
+		return 8 + test_heap_random() % 33;			// names and paths
+	if (kind < 55)
+		return 12 + (test_heap_random() % 3) * 4;	// list, queue and tree nodes
+	if (kind < 70)
+		return 32 + test_heap_random() % 33;		// vm areas, file descriptors
+	if (kind < 82)
+		return 128 + test_heap_random() % 385;		// open file tables, page cache entries
+	if (kind < 95)
+		return 60 + test_heap_random() % 1455;		// network buffers
+	return 4050;									// thread stacks (page granular path)
+}
+
+bool test_heap_integrity()
+{
+	static test_heap_alloc allocs[TEST_HEAP_SLOTS];
+
+	void* region = malloc(TEST_HEAP_SIZE);
+	if (region == 0)
+		FAIL("Heap region allocation failed: %e\n");
+
+	heap* h = heap_create((virtual_addr)region, TEST_HEAP_SIZE);
+	uint32 initial_blocks = h->current_blocks;
+
+	test_heap_seed = 7;
+	memset(allocs, 0, sizeof(allocs));
+
+	for (uint32 i = 0; i < TEST_HEAP_TRACE; i++)
+	{
+		test_heap_alloc* a = &allocs[test_heap_random() % TEST_HEAP_SLOTS];
+
+		if (a->address == 0)
+		{
+			a->size = test_heap_trace_size();
+			a->address = (uint8*)heap_alloc(h, a->size);
+			if (a->address == 0)
+				continue;
+
+			if (((virtual_addr)a->address & (HEAP_ALIGN - 1)) != 0)
+				FAIL("Allocation is not aligned\n");
+		}
+		else
+		{
+			if (test_heap_check(a) == false)
+				FAIL("Allocation was overwritten\n");
+
+			// grow or shrink some allocations, as vectors and strings do
+			if (test_heap_random() % 4 == 0)
+			{
+				uint32 new_size = (test_heap_random() % 2 == 0) ? min(a->size * 2, 16 KB) : a->size / 2 + 1;
+				uint8* address = (uint8*)heap_realloc(h, a->address, new_size);
+				if (address == 0)
+					continue;
+
+				a->address = address;
+				a->size = min(a->size, new_size);
+				if (test_heap_check(a) == false)
+					FAIL("Reallocation lost the contents\n");
+
+				a->size = new_size;
+			}
+			else
+			{
+				if (heap_free(h, a->address) != ERROR_OK)
+					FAIL("Free failed: %e\n");
+
+				a->address = 0;
+				continue;
+			}
+		}
+
+		a->pattern = (uint8)test_heap_random();
+		memset(a->address, a->pattern, a->size);
+	}
+
+	// a second free of the same block is caught by the block header checks
+	void* address = heap_alloc(h, 40);
+	heap_free(h, address);
+	if (heap_free(h, address) == ERROR_OK)
+		FAIL("Double free was not detected\n");
+
+	for (uint32 i = 0; i < TEST_HEAP_SLOTS; i++)
+	{
+		if (allocs[i].address == 0)
+			continue;
+
+		if (test_heap_check(&allocs[i]) == false)
+			FAIL("Allocation was overwritten\n");
+
+		heap_free(h, allocs[i].address);
+	}
+
+	// freeing merges eagerly, so everything coalesces back to the initial block with nothing left for defrag
+	if (h->current_blocks != initial_blocks || heap_defrag(h) != 0)
+		FAIL("Free blocks were not coalesced\n");
+
+	free(region);
+	RET_SUCCESS;
+}
+
+bool test_heap_malloc_benchmark()
+{
+	static test_heap_alloc allocs[TEST_HEAP_SLOTS];
+
+	void* region = malloc(TEST_HEAP_SIZE);
+	if (region == 0)
+		FAIL("Heap region allocation failed: %e\n");
+
+	heap* h = heap_create((virtual_addr)region, TEST_HEAP_SIZE);
+
+	test_heap_seed = 11;
+	memset(allocs, 0, sizeof(allocs));
+
+	uint32 operations = 0, failures = 0, peak_blocks = 0;
+	uint32 start = test_read_tsc();
+
+	for (uint32 i = 0; i < TEST_HEAP_TRACE; i++)
+	{
+		test_heap_alloc* a = &allocs[test_heap_random() % TEST_HEAP_SLOTS];
+
+		if (a->address == 0)
+		{
+			a->size = test_heap_trace_size();
+			if ((a->address = (uint8*)heap_alloc(h, a->size)) == 0)
+				failures++;
+		}
+		else
+		{
+			heap_free(h, a->address);
+			a->address = 0;
+		}
+
+		operations++;
+		peak_blocks = max(peak_blocks, h->current_blocks);
+	}
+
+	uint32 cycles = test_read_tsc() - start;
+
+	// free memory left in the region while the trace still holds its allocations, and how scattered it is
+	uint32 free_bytes = 0, free_blocks = 0, largest_free = 0;
+	for (uint32 i = 0; i < HEAP_SIZE_CLASSES; i++)
+	{
+		for (heap_block* block = h->free_lists[i]; block != 0; block = *(heap_block**)((char*)block + sizeof(heap_block)))
+		{
+			free_bytes += block->size;
+			free_blocks++;
+			largest_free = max(largest_free, block->size);
+		}
+	}
+
+	for (uint32 i = 0; i < TEST_HEAP_SLOTS; i++)
+		if (allocs[i].address != 0)
+			heap_free(h, allocs[i].address);
+
+	serial_printf("heap: %u trace operations in %u cycles (%u per operation), %u failed\n", operations, cycles,
+		cycles / operations, failures);
+	serial_printf("heap: peak %u blocks, %u free bytes in %u blocks, largest %u\n", peak_blocks, free_bytes, free_blocks,
+		largest_free);
+
+	free(region);
+	RET_SUCCESS;
+}
+
+bool test_heap_growth()
+{
+	static uint32* blocks[TEST_HEAP_GROW_BLOCKS];
+	uint32 committed = kernel_heap->committed;
+
+	for (uint32 i = 0; i < TEST_HEAP_GROW_BLOCKS; i++)
+	{
+		blocks[i] = (uint32*)malloc(TEST_HEAP_GROW_SIZE);
+		if (blocks[i] == 0)
+			FAIL("Kernel heap did not grow: %e\n");
+
+		*blocks[i] = i;
+	}
+
+	if (kernel_heap->committed <= committed)
+		FAIL("Kernel heap committed no pages\n");
+
+	serial_printf("heap: grew from %u to %u committed bytes\n", committed, kernel_heap->committed);
+
+	for (uint32 i = 0; i < TEST_HEAP_GROW_BLOCKS; i++)
+	{
+		if (*blocks[i] != i)
+			FAIL("Grown heap block was overwritten\n");
+
+		free(blocks[i]);
+	}
+
+	// the free tail beyond HEAP_GROW_SIZE goes back to the physical allocator
+	if (kernel_heap->committed > committed + HEAP_TRIM_SIZE)
+		FAIL("Kernel heap did not release its free pages\n");
+
+	RET_SUCCESS;
+}
+
+// a single allocation site for the profiler test
+void* test_heap_profile_site(uint32 size)
+{
+	return malloc(size);
+}
+
+bool test_heap_profile()
+{
+	static void* blocks[TEST_HEAP_PROFILE_ALLOCS];
+
+	if (heap_profile_start() != ERROR_OK)
+		FAIL("Profiler did not start: %e\n");
+
+	heap_profile_snapshot snapshot = heap_profile_take_snapshot();
+	heap_profile_stats before = heap_profile_get_stats();
+
+	for (uint32 i = 0; i < TEST_HEAP_PROFILE_ALLOCS; i++)
+	{
+		blocks[i] = test_heap_profile_site(100 + i * 32);
+		if (blocks[i] == 0)
+			FAIL("Allocation failed: %e\n");
+	}
+
+	heap_profile_stats stats = heap_profile_get_stats();
+	if (stats.allocations - before.allocations != TEST_HEAP_PROFILE_ALLOCS || stats.bytes - before.bytes < TEST_HEAP_PROFILE_ALLOCS * 100)
+		FAIL("Profiler missed allocations\n");
+
+	// leave half of them live, the test site should lead the diff
+	for (uint32 i = 0; i < TEST_HEAP_PROFILE_ALLOCS; i += 2)
+		free(blocks[i]);
+
+	stats = heap_profile_get_stats();
+	if (stats.allocations - before.allocations != TEST_HEAP_PROFILE_ALLOCS / 2)
+		FAIL("Profiler missed frees\n");
+
+	serial_printf("test site at %h\n", test_heap_profile_site);
+	heap_profile_print_top(5);
+	heap_profile_print_diff(&snapshot, 5);
+	heap_profile_print_leaks(0, 5);
+
+	for (uint32 i = 1; i < TEST_HEAP_PROFILE_ALLOCS; i += 2)
+		free(blocks[i]);
+
+	heap_profile_stop();
+	RET_SUCCESS;
+}
@@ -0,0 +1,14 @@
+#ifndef TEST_MMNGR_HEAP_H_16102026
+#define TEST_MMNGR_HEAP_H_16102026
+
+#include "test_base.h"
+#include "../mmngr_heap.h"
+#include "../memory.h"
+#include "../heap_profile.h"
+
+bool test_heap_integrity();
+bool test_heap_malloc_benchmark();
+bool test_heap_growth();
+bool test_heap_profile();
+
+#endif
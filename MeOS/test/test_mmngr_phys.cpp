@@ -0,0 +1,188 @@
+#include "test_mmngr_phys.h"
+
+#define BENCH_ITERATIONS	512			// allocations timed at each occupancy level
+#define BENCH_MAX_FILLERS	1024		// maximum number of filler allocations used to raise occupancy
+
+static void* bench_allocs[BENCH_ITERATIONS];
+static void* bench_fillers[BENCH_MAX_FILLERS];
+
+bool test_pmmngr_alloc_free()
+{
+	uint32 free_before = pmmngr_get_free_block_count();
+
+	void* b1 = pmmngr_alloc_block();
+	void* b2 = pmmngr_alloc_blocks(5 * 4096);		// non power of two, tail must be returned
+	void* b3 = pmmngr_alloc_blocks(64 KB);
+
+	if (b1 == 0 || b2 == 0 || b3 == 0)
+		FAIL("Physical allocation failed: %e\n");
+
+	serial_printf("allocated blocks at: %h %h %h\n", b1, b2, b3);
+
+	if ((uint32)b3 % (64 KB) != 0)
+		FAIL("Buddy block is not naturally aligned\n");
+
+	if (pmmngr_get_free_block_count() != free_before - 1 - 5 - 16)
+		FAIL("Used block accounting is wrong after allocation\n");
+
+	pmmngr_free_blocks(b2, 5 * 4096);
+	pmmngr_free_block(b1);
+	pmmngr_free_blocks(b3, 64 KB);
+
+	// double free must be ignored
+	pmmngr_free_block(b1);
+
+	if (pmmngr_get_free_block_count() != free_before)
+		FAIL("Used block accounting is wrong after free\n");
+
+	// a range that is free in part is freed frame by frame, counting only the frames that were used
+	b3 = pmmngr_alloc_blocks(64 KB);
+	if (b3 == 0)
+		FAIL("Physical allocation failed: %e\n");
+
+	pmmngr_free_block((uint8*)b3 + 5 * 4096);
+	pmmngr_free_blocks(b3, 64 KB);
+
+	if (pmmngr_get_free_block_count() != free_before)
+		FAIL("Used block accounting is wrong after freeing a partly free range\n");
+
+	RET_SUCCESS;
+}
+
+bool test_pmmngr_alloc_contiguous()
+{
+	uint32 dma_free = pmmngr_get_zone_free_block_count(PMMNGR_ZONE_DMA);
+
+	void* ring = pmmngr_alloc_contiguous(12 KB, 64 KB, PMMNGR_ZONE_DMA);
+	if (ring == 0)
+		FAIL("Contiguous DMA allocation failed: %e\n");
+
+	serial_printf("contiguous DMA block at: %h\n", ring);
+
+	if ((uint32)ring % (64 KB) != 0 || (uint32)ring + 12 KB > PMMNGR_ZONE_DMA_LIMIT)
+		FAIL("Contiguous block is misaligned or outside the DMA zone\n");
+
+	if (pmmngr_get_zone_free_block_count(PMMNGR_ZONE_DMA) != dma_free - 3)
+		FAIL("Zone accounting is wrong after contiguous allocation\n");
+
+	pmmngr_free_blocks(ring, 12 KB);
+
+	if (pmmngr_get_zone_free_block_count(PMMNGR_ZONE_DMA) != dma_free)
+		FAIL("Zone accounting is wrong after free\n");
+
+	// bad alignment must be rejected
+	if (pmmngr_alloc_contiguous(4 KB, 3000, PMMNGR_ZONE_DMA) != 0)
+		FAIL("Non power of two alignment was accepted\n");
+
+	RET_SUCCESS;
+}
+
+bool test_page_frame_refcount()
+{
+	uint32 free_before = pmmngr_get_free_block_count();
+
+	physical_addr frame = (physical_addr)pmmngr_alloc_block();
+	if (frame == 0)
+		FAIL("Physical allocation failed: %e\n");
+
+	page_frame* pf = page_frame_get(frame);
+	if (pf == 0 || pf->refcount != 1 || pf->mapcount != 0 || pf->flags != 0)
+		FAIL("New frame entry is not initialized\n");
+
+	// a second owner keeps the frame alive after the first one drops it
+	page_frame_get_ref(frame);
+	page_frame_put(frame);
+
+	if (pmmngr_get_free_block_count() != free_before - 1 || pf->refcount != 1)
+		FAIL("Frame was released while still referenced\n");
+
+	page_frame_set_flags(frame, PAGE_FRAME_DIRTY | PAGE_FRAME_LOCKED);
+	if (page_frame_test_flags(frame, PAGE_FRAME_DIRTY | PAGE_FRAME_LOCKED) == false)
+		FAIL("Frame flags were not set\n");
+
+	page_frame_put(frame);
+
+	if (pmmngr_get_free_block_count() != free_before || pf->refcount != 0 || pf->flags != 0)
+		FAIL("Frame was not released with its last reference\n");
+
+	RET_SUCCESS;
+}
+
+// allocates filler blocks until the given occupancy percentage is reached. Returns the number of fillers used.
+static uint32 bench_fill(uint32 percent)
+{
+	uint32 filler_size = max(pmmngr_get_block_count() / BENCH_MAX_FILLERS, 1) * pmmngr_get_block_size();
+	uint32 count = 0;
+
+	while (count < BENCH_MAX_FILLERS && pmmngr_get_block_use_count() * 100 < pmmngr_get_block_count() * percent)
+	{
+		bench_fillers[count] = pmmngr_alloc_blocks(filler_size);
+		if (bench_fillers[count] == 0)
+			break;
+
+		count++;
+	}
+
+	return count;
+}
+
+static void bench_release(uint32 count)
+{
+	uint32 filler_size = max(pmmngr_get_block_count() / BENCH_MAX_FILLERS, 1) * pmmngr_get_block_size();
+
+	for (uint32 i = 0; i < count; i++)
+		pmmngr_free_blocks(bench_fillers[i], filler_size);
+}
+
+// times single and multi-block allocations. Returns false if an allocation failed.
+static bool bench_run(uint32 percent)
+{
+	uint32 fillers = bench_fill(percent);
+	uint32 single_cycles = 0, multi_cycles = 0;
+
+	for (uint32 i = 0; i < BENCH_ITERATIONS; i++)
+	{
+		uint32 start = test_read_tsc();
+		bench_allocs[i] = pmmngr_alloc_block();
+		single_cycles += test_read_tsc() - start;
+
+		if (bench_allocs[i] == 0)
+			return false;
+	}
+
+	for (uint32 i = 0; i < BENCH_ITERATIONS; i++)
+		pmmngr_free_block(bench_allocs[i]);
+
+	for (uint32 i = 0; i < BENCH_ITERATIONS; i++)
+	{
+		uint32 start = test_read_tsc();
+		bench_allocs[i] = pmmngr_alloc_blocks(8 * 4096);
+		multi_cycles += test_read_tsc() - start;
+
+		if (bench_allocs[i] == 0)
+			return false;
+
+		// free immediately so that the benchmark does not move the occupancy
+		pmmngr_free_blocks(bench_allocs[i], 8 * 4096);
+	}
+
+	serial_printf("occupancy %u percent (used %u of %u blocks): alloc_block %u cycles, alloc_blocks(32KB) %u cycles\n",
+		percent, pmmngr_get_block_use_count(), pmmngr_get_block_count(),
+		single_cycles / BENCH_ITERATIONS, multi_cycles / BENCH_ITERATIONS);
+
+	bench_release(fillers);
+	return true;
+}
+
+bool test_pmmngr_benchmark()
+{
+	uint32 free_before = pmmngr_get_free_block_count();
+
+	if (bench_run(10) == false || bench_run(50) == false || bench_run(90) == false)
+		FAIL("Benchmark allocation failed: %e\n");
+
+	if (pmmngr_get_free_block_count() != free_before)
+		FAIL("Benchmark leaked physical blocks\n");
+
+	RET_SUCCESS;
+}
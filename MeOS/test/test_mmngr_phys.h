@@ -0,0 +1,13 @@
+#ifndef TEST_MMNGR_PHYS_H_16102026
+#define TEST_MMNGR_PHYS_H_16102026
+
+#include "test_base.h"
+#include "../mmngr_phys.h"
+#include "../page_frame.h"
+
+bool test_pmmngr_alloc_free();
+bool test_pmmngr_alloc_contiguous();
+bool test_page_frame_refcount();
+bool test_pmmngr_benchmark();
+
+#endif
@@ -0,0 +1,670 @@
+#include "test_mmngr_virtual.h"
+
+#define TEST_LARGE_PAGE_VIRT	0xDC000000		// unused 4MB window used as scratch space
+#define TEST_USER_VIRT			0x3C000000		// unused 4MB window below the (global) kernel half
+#define SWITCH_BENCH_ROUNDS		256				// address space switch pairs timed
+#define SWITCH_BENCH_PAGES		32				// kernel pages touched after every switch
+#define CONTRACT_TEST_AREAS		2048			// areas inserted in the contract lookup test
+
+// drops the scratch window mapping without releasing the (low memory) frames it pointed to
+static void test_vmmngr_release_window(virtual_addr virt)
+{
+	pd_entry* e = vmmngr_pdirectory_lookup_entry(vmmngr_get_directory(), virt);
+
+	if (pd_entry_is_4mb(*e))
+	{
+		for (uint32 i = 0; i < PAGES_PER_TABLE; i++)
+			page_frame_unmap(pd_entry_get_large_frame(*e) + i * PAGE_SIZE);
+	}
+	else
+	{
+		ptable* table = (ptable*)pd_entry_get_frame(*e);
+
+		for (uint32 i = 0; i < PAGES_PER_TABLE; i++)
+			if (pt_entry_is_present(table->entries[i]))
+				page_frame_unmap(pt_entry_get_frame(table->entries[i]));
+
+		pmmngr_free_block(table);
+	}
+
+	*e = 0;
+
+	for (uint32 i = 0; i < PAGES_PER_TABLE; i++)
+		vmmngr_flush_TLB_entry(virt + i * PAGE_SIZE);
+}
+
+bool test_vmmngr_large_page()
+{
+	if (vmmngr_large_pages_enabled() == false)
+		SUCCESS("PSE is not supported, skipping large page test\n");
+
+	pdirectory* dir = vmmngr_get_directory();
+
+	// the first 4MB are identity mapped with a single large page
+	if (pd_entry_is_4mb(dir->entries[0]) == false || vmmngr_get_phys_addr(0x123456) != 0x123456)
+		FAIL("Low memory is not identity mapped with a large page\n");
+
+	// map the low 4MB again at the scratch window. The kernel image (physical 1MB) must be visible through it.
+	if (vmmngr_map_large_page(dir, 0, TEST_LARGE_PAGE_VIRT, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Large page mapping failed: %e\n");
+
+	if (*(uint32*)(TEST_LARGE_PAGE_VIRT + 0x100000) != *(uint32*)0xC0000000)
+		FAIL("Large page does not point to the right frame\n");
+
+	if (vmmngr_get_phys_addr(TEST_LARGE_PAGE_VIRT + 0x3456) != 0x3456 || vmmngr_is_page_present(TEST_LARGE_PAGE_VIRT + 0x3FF000) == false)
+		FAIL("Large page lookup is wrong\n");
+
+	// a 4KB mapping with the same translation keeps the large page
+	if (vmmngr_map_page(dir, 0x5000, TEST_LARGE_PAGE_VIRT + 0x5000, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Mapping over a large page failed: %e\n");
+
+	if (pd_entry_is_4mb(*vmmngr_pdirectory_lookup_entry(dir, TEST_LARGE_PAGE_VIRT)) == false)
+		FAIL("Large page was split without need\n");
+
+	// a different translation splits it while keeping the rest of the mappings
+	if (vmmngr_map_page(dir, 0x200000, TEST_LARGE_PAGE_VIRT + 0x5000, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Remapping inside a large page failed: %e\n");
+
+	if (pd_entry_is_4mb(*vmmngr_pdirectory_lookup_entry(dir, TEST_LARGE_PAGE_VIRT)))
+		FAIL("Large page was not split\n");
+
+	if (vmmngr_get_phys_addr(TEST_LARGE_PAGE_VIRT + 0x5010) != 0x200010 || vmmngr_get_phys_addr(TEST_LARGE_PAGE_VIRT + 0x6010) != 0x6010)
+		FAIL("Split page table has wrong translations\n");
+
+	test_vmmngr_release_window(TEST_LARGE_PAGE_VIRT);
+
+	RET_SUCCESS;
+}
+
+bool test_vmmngr_large_page_benchmark()
+{
+	if (vmmngr_large_pages_enabled() == false)
+		SUCCESS("PSE is not supported, skipping large page benchmark\n");
+
+	pdirectory* dir = vmmngr_get_directory();
+
+	// map the same 4MB both ways and compare the cost
+	uint32 start = test_read_tsc();
+
+	for (uint32 i = 0; i < PAGES_PER_TABLE; i++)
+		if (vmmngr_map_page(dir, i * PAGE_SIZE, TEST_LARGE_PAGE_VIRT + i * PAGE_SIZE, DEFAULT_FLAGS) != ERROR_OK)
+			FAIL("4KB mapping failed: %e\n");
+
+	uint32 small_cycles = test_read_tsc() - start;
+	test_vmmngr_release_window(TEST_LARGE_PAGE_VIRT);
+
+	start = test_read_tsc();
+
+	if (vmmngr_map_large_page(dir, 0, TEST_LARGE_PAGE_VIRT, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Large page mapping failed: %e\n");
+
+	uint32 large_cycles = test_read_tsc() - start;
+	test_vmmngr_release_window(TEST_LARGE_PAGE_VIRT);
+
+	serial_printf("mapping 4MB: 1024 x 4KB pages: %u cycles, one 4MB page: %u cycles, page tables saved: 1\n", small_cycles, large_cycles);
+
+	RET_SUCCESS;
+}
+
+bool test_vmmngr_global_pages()
+{
+	if (vmmngr_global_pages_enabled() == false)
+		SUCCESS("PGE is not supported, skipping global page test\n");
+
+	pdirectory* dir = vmmngr_get_directory();
+
+	if (vmmngr_alloc_page(TEST_LARGE_PAGE_VIRT) != ERROR_OK || vmmngr_map_page(dir, 0x5000, 0x5000, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Page mapping failed: %e\n");
+
+	ptable* table = (ptable*)pd_entry_get_frame(*vmmngr_pdirectory_lookup_entry(dir, TEST_LARGE_PAGE_VIRT));
+	if (pt_entry_test_attrib(vmmngr_ptable_lookup_entry(table, TEST_LARGE_PAGE_VIRT), I86_PTE_CPU_GLOBAL) == false)
+		FAIL("Kernel half page is not global\n");
+
+	vmmngr_free_page_addr(TEST_LARGE_PAGE_VIRT);
+	test_vmmngr_release_window(TEST_LARGE_PAGE_VIRT);
+
+	RET_SUCCESS;
+}
+
+// switches between two address spaces that share the kernel half and touches kernel pages after each switch
+static uint32 test_vmmngr_time_switches(pdirectory* a, pdirectory* b)
+{
+	uint32 start = test_read_tsc();
+
+	for (uint32 round = 0; round < SWITCH_BENCH_ROUNDS; round++)
+	{
+		vmmngr_switch_directory(round % 2 ? a : b, (physical_addr)(round % 2 ? a : b));
+
+		for (uint32 i = 0; i < SWITCH_BENCH_PAGES; i++)
+			*(volatile uint32*)(TEST_LARGE_PAGE_VIRT + i * PAGE_SIZE);
+	}
+
+	return test_read_tsc() - start;
+}
+
+static void test_vmmngr_set_pge(bool enable)
+{
+	if (enable)
+	{
+		_asm
+		{
+			mov eax, cr4
+			or eax, 0x80
+			mov cr4, eax
+		}
+	}
+	else
+	{
+		_asm
+		{
+			mov eax, cr4
+			and eax, 0xFFFFFF7F
+			mov cr4, eax
+		}
+	}
+}
+
+bool test_vmmngr_context_switch_benchmark()
+{
+	if (vmmngr_global_pages_enabled() == false)
+		SUCCESS("PGE is not supported, skipping context switch benchmark\n");
+
+	pdirectory* old_dir = vmmngr_get_directory();
+
+	for (uint32 i = 0; i < SWITCH_BENCH_PAGES; i++)
+		if (vmmngr_alloc_page(TEST_LARGE_PAGE_VIRT + i * PAGE_SIZE) != ERROR_OK)
+			FAIL("Page allocation failed: %e\n");
+
+	// two process-like address spaces that share the kernel page tables
+	pdirectory* a = vmmngr_create_address_space();
+	pdirectory* b = vmmngr_create_address_space();
+	if (a == 0 || b == 0)
+		FAIL("Address space creation failed: %e\n");
+
+	memcpy(a, old_dir, sizeof(pdirectory));
+	memcpy(b, old_dir, sizeof(pdirectory));
+
+	// the scheduler must not switch directories under the benchmark
+	INT_OFF;
+
+	test_vmmngr_set_pge(false);
+	uint32 plain_cycles = test_vmmngr_time_switches(a, b);
+
+	test_vmmngr_set_pge(true);
+	test_vmmngr_time_switches(a, b);		// warm up the global entries
+	uint32 global_cycles = test_vmmngr_time_switches(a, b);
+
+	vmmngr_switch_directory(old_dir, (physical_addr)old_dir);
+	INT_ON;
+
+	serial_printf("%u address space switches touching %u kernel pages: no PGE: %u cycles, PGE: %u cycles\n", SWITCH_BENCH_ROUNDS,
+		SWITCH_BENCH_PAGES, plain_cycles, global_cycles);
+
+	pmmngr_free_block(a);
+	pmmngr_free_block(b);
+
+	for (uint32 i = 0; i < SWITCH_BENCH_PAGES; i++)
+		vmmngr_free_page_addr(TEST_LARGE_PAGE_VIRT + i * PAGE_SIZE);
+
+	test_vmmngr_release_window(TEST_LARGE_PAGE_VIRT);
+
+	RET_SUCCESS;
+}
+
+bool test_vmmngr_cow()
+{
+	pdirectory* old_dir = vmmngr_get_directory();
+
+	vm_contract c;
+	if (vm_contract_init(&c, TEST_USER_VIRT - LARGE_PAGE_SIZE, TEST_USER_VIRT + LARGE_PAGE_SIZE) != ERROR_OK)
+		FAIL("Contract creation failed: %e\n");
+
+	vm_area area = vm_area_create(TEST_USER_VIRT, TEST_USER_VIRT + PAGE_SIZE, MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_READ | MMAP_WRITE, INVALID_FD, 0);
+	if (vm_contract_add_area(&c, &area) != ERROR_OK)
+		FAIL("Area insertion failed: %e\n");
+
+	// parent address space with a private page table holding one written page
+	pdirectory* parent = vmmngr_create_address_space();
+	if (parent == 0)
+		FAIL("Address space creation failed: %e\n");
+
+	memcpy(parent, old_dir, sizeof(pdirectory));
+
+	INT_OFF;
+	vmmngr_switch_directory(parent, (physical_addr)parent);
+
+	if (vmmngr_alloc_page(TEST_USER_VIRT) != ERROR_OK)
+		FAIL("Page allocation failed: %e\n");
+
+	*(uint32*)TEST_USER_VIRT = 0xC0FFEE;
+	physical_addr frame = vmmngr_get_phys_addr(TEST_USER_VIRT);
+
+	uint32 start = test_read_tsc();
+	pdirectory* child = vmmngr_clone_address_space(parent, &c);
+	uint32 fork_cycles = test_read_tsc() - start;
+
+	if (child == 0)
+		FAIL("Address space clone failed: %e\n");
+
+	if (vmmngr_is_page_cow(TEST_USER_VIRT) == false || page_frame_get(frame)->refcount != 2)
+		FAIL("Parent page is not shared copy-on-write\n");
+
+	// the child write gets its own frame
+	vmmngr_switch_directory(child, (physical_addr)child);
+
+	if (vmmngr_break_cow(TEST_USER_VIRT) != ERROR_OK)
+		FAIL("Copy on write failed: %e\n");
+
+	if (vmmngr_get_phys_addr(TEST_USER_VIRT) == frame || *(uint32*)TEST_USER_VIRT != 0xC0FFEE)
+		FAIL("Child did not receive a copy of the page\n");
+
+	*(uint32*)TEST_USER_VIRT = 0xBAD;
+
+	// the parent is now the last owner and keeps the original frame
+	vmmngr_switch_directory(parent, (physical_addr)parent);
+
+	if (*(uint32*)TEST_USER_VIRT != 0xC0FFEE || page_frame_get(frame)->refcount != 1)
+		FAIL("Child write is visible to the parent\n");
+
+	if (vmmngr_break_cow(TEST_USER_VIRT) != ERROR_OK || vmmngr_get_phys_addr(TEST_USER_VIRT) != frame)
+		FAIL("Last owner did not reuse its frame\n");
+
+	vmmngr_free_page_addr(TEST_USER_VIRT);
+	test_vmmngr_release_window(TEST_USER_VIRT);
+
+	vmmngr_switch_directory(child, (physical_addr)child);
+	vmmngr_free_page_addr(TEST_USER_VIRT);
+	test_vmmngr_release_window(TEST_USER_VIRT);
+
+	vmmngr_switch_directory(old_dir, (physical_addr)old_dir);
+	INT_ON;
+
+	pmmngr_free_block(parent);
+	pmmngr_free_block(child);
+	vm_contract_uninit(&c);
+
+	serial_printf("copy-on-write clone of an address space: %u cycles\n", fork_cycles);
+
+	RET_SUCCESS;
+}
+
+bool test_vm_area_readahead()
+{
+	vm_area area = vm_area_create(TEST_USER_VIRT, TEST_USER_VIRT + 64 * PAGE_SIZE, MMAP_PRIVATE | MMAP_READ, 0, 0);
+
+	// first fault and random faults read a single page
+	if (vm_area_update_readahead(&area, TEST_USER_VIRT + 10 * PAGE_SIZE) != 1 || vm_area_update_readahead(&area, TEST_USER_VIRT + 3 * PAGE_SIZE) != 1)
+		FAIL("Random faults must not read ahead\n");
+
+	// sequential faults grow the window up to the maximum
+	uint32 expected[] = { VM_AREA_RA_MIN_PAGES, 2 * VM_AREA_RA_MIN_PAGES, VM_AREA_RA_MAX_PAGES, VM_AREA_RA_MAX_PAGES };
+	for (uint32 i = 0; i < 4; i++)
+	{
+		uint32 window = vm_area_update_readahead(&area, area.start_addr + area.ra_next * PAGE_SIZE);
+		if (window != expected[i])
+		{
+			serial_printf("window %u is %u pages\n", i, window);
+			FAIL("Sequential read-ahead window is wrong\n");
+		}
+	}
+
+	// the window never crosses the area end
+	area.advice = MADV_SEQUENTIAL;
+	if (vm_area_update_readahead(&area, TEST_USER_VIRT + 60 * PAGE_SIZE) != 4)
+		FAIL("Read-ahead crossed the area end\n");
+
+	area.advice = MADV_RANDOM;
+	if (vm_area_update_readahead(&area, area.start_addr + area.ra_next * PAGE_SIZE) != 1)
+		FAIL("Random advice must disable read-ahead\n");
+
+	RET_SUCCESS;
+}
+
+bool test_vm_contract_lookup()
+{
+	vm_contract c;
+	if (vm_contract_init(&c, TEST_USER_VIRT, TEST_USER_VIRT + 4 * CONTRACT_TEST_AREAS * PAGE_SIZE) != ERROR_OK)
+		FAIL("Contract creation failed: %e\n");
+
+	// one page areas with a page hole between them, inserted out of order
+	for (uint32 i = 0; i < CONTRACT_TEST_AREAS; i++)
+	{
+		uint32 slot = (i * 7) % CONTRACT_TEST_AREAS;
+		vm_area area = vm_area_create(TEST_USER_VIRT + (2 * slot + 2) * PAGE_SIZE, TEST_USER_VIRT + (2 * slot + 3) * PAGE_SIZE,
+			MMAP_PRIVATE | MMAP_ANONYMOUS | MMAP_READ, INVALID_FD, 0);
+
+		if (vm_contract_add_area(&c, &area) != ERROR_OK)
+			FAIL("Area insertion failed: %e\n");
+	}
+
+	vm_area overlap = vm_area_create(TEST_USER_VIRT + 4 * PAGE_SIZE, TEST_USER_VIRT + 6 * PAGE_SIZE, MMAP_PRIVATE | MMAP_READ, INVALID_FD, 0);
+	if (vm_contract_add_area(&c, &overlap) == ERROR_OK)
+		FAIL("Overlapping area was inserted\n");
+
+	uint32 start = test_read_tsc();
+
+	for (uint32 i = 0; i < CONTRACT_TEST_AREAS; i++)
+	{
+		vm_area* area = vm_contract_find_area(&c, TEST_USER_VIRT + (2 * i + 2) * PAGE_SIZE + 100);
+		if (area == 0 || area->start_addr != TEST_USER_VIRT + (2 * i + 2) * PAGE_SIZE)
+			FAIL("Area lookup failed\n");
+
+		if (vm_contract_find_area(&c, TEST_USER_VIRT + (2 * i + 3) * PAGE_SIZE) != 0)
+			FAIL("Lookup found an area inside a hole\n");
+	}
+
+	uint32 lookup_cycles = (test_read_tsc() - start) / CONTRACT_TEST_AREAS;
+
+	// the hint survives insertions but not removals
+	vm_contract_hint hint = { 0, 0 };
+	vm_area* area = vm_contract_find_area_hint(&c, TEST_USER_VIRT + 2 * PAGE_SIZE, &hint);
+	if (area == 0 || hint.area != area)
+		FAIL("Hint was not updated\n");
+
+	vm_area removed = *vm_contract_find_area(&c, TEST_USER_VIRT + 4 * PAGE_SIZE);
+	if (vm_contract_remove_area(&c, &removed) != ERROR_OK)
+		FAIL("Area removal failed: %e\n");
+
+	if (hint.version == c.version || vm_contract_find_area_hint(&c, TEST_USER_VIRT + 2 * PAGE_SIZE, &hint) != area)
+		FAIL("Hint was not invalidated\n");
+
+	// a clone gets a version of its own, so the hints of the original thread never match it
+	vm_contract clone;
+	if (vm_contract_clone(&clone, &c) != ERROR_OK)
+		FAIL("Contract clone failed: %e\n");
+
+	if (clone.version == c.version || clone.version == hint.version)
+		FAIL("Cloned contract reused a version\n");
+
+	vm_contract_uninit(&clone);
+
+	// first fit: the only 3 page hole is the one left by the removed area
+	if (vm_contract_get_area_for_length(&c, 3 * PAGE_SIZE) != TEST_USER_VIRT + 3 * PAGE_SIZE)
+		FAIL("Wrong free gap found\n");
+
+	if (c.count != CONTRACT_TEST_AREAS + 1)
+		FAIL("Wrong area count\n");
+
+	vm_contract_uninit(&c);
+
+	serial_printf("vm contract lookup with %u areas: %u cycles\n", CONTRACT_TEST_AREAS, lookup_cycles);
+
+	RET_SUCCESS;
+}
+
+bool test_zero_pool()
+{
+	zero_pool_stats before = zero_pool_get_stats();
+
+	if (zero_pool_refill(ZERO_POOL_BATCH) == 0 && before.count < ZERO_POOL_MAX_FRAMES)
+		FAIL("Zero pool refill failed: %e\n");
+
+	zero_pool_stats filled = zero_pool_get_stats();
+	if (filled.count == 0 || filled.count > filled.capacity)
+		FAIL("Zero pool is empty after a refill\n");
+
+	// a pool frame is mapped without being touched
+	uint32 start = test_read_tsc();
+	if (vmmngr_alloc_zeroed_page_f(TEST_USER_VIRT, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Zeroed page allocation failed: %e\n");
+	uint32 pool_cycles = test_read_tsc() - start;
+
+	zero_pool_stats after = zero_pool_get_stats();
+	if (after.hits != filled.hits + 1 || after.count != filled.count - 1)
+		FAIL("Page was not taken from the zero pool\n");
+
+	for (uint32 i = 0; i < PAGE_SIZE / sizeof(uint32); i++)
+		if (((uint32*)TEST_USER_VIRT)[i] != 0)
+			FAIL("Zero pool frame is not zeroed\n");
+
+	vmmngr_free_page_addr(TEST_USER_VIRT);
+	test_vmmngr_release_window(TEST_USER_VIRT);
+
+	// a write to the shared zero page gets a zeroed frame of its own and leaves the zero page untouched
+	physical_addr zero = zero_pool_get_zero_page();
+	if (vmmngr_map_page(vmmngr_get_directory(), zero, TEST_USER_VIRT, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Zero page mapping failed: %e\n");
+
+	pt_entry* page = vmmngr_lookup_page(vmmngr_get_directory(), TEST_USER_VIRT);
+	pt_entry_del_attrib(page, I86_PTE_WRITABLE);
+	pt_entry_add_attrib(page, I86_PTE_COPY_ON_WRITE);
+	vmmngr_flush_TLB_entry(TEST_USER_VIRT);
+
+	if (*(uint32*)TEST_USER_VIRT != 0 || vmmngr_is_page_cow(TEST_USER_VIRT) == false)
+		FAIL("Zero page is not mapped copy-on-write\n");
+
+	if (vmmngr_break_cow(TEST_USER_VIRT) != ERROR_OK || vmmngr_get_phys_addr(TEST_USER_VIRT) == zero)
+		FAIL("Write to the zero page did not allocate a frame\n");
+
+	*(uint32*)TEST_USER_VIRT = 0xBAD;
+
+	if (page_frame_test_flags(zero, PAGE_FRAME_UNCOUNTED) == false || page_frame_get(zero)->mapcount != 0)
+		FAIL("Zero page is counted\n");
+
+	vmmngr_free_page_addr(TEST_USER_VIRT);
+	test_vmmngr_release_window(TEST_USER_VIRT);
+
+	serial_printf("zero pool: %u frames, %u hits, %u misses. Pool page fault allocation: %u cycles\n",
+		after.count, after.hits, after.misses, pool_cycles);
+
+	RET_SUCCESS;
+}
+
+bool test_swap_compression()
+{
+	static uint8 page[PAGE_SIZE];
+	static uint8 compressed[PAGE_SIZE + PAGE_SIZE / 255 + 16];
+	static uint8 restored[PAGE_SIZE];
+	static uint16 table[LZ4_HASH_SIZE];
+
+	// a zeroed page, a repeating pattern and pseudo random data
+	for (uint32 pattern = 0; pattern < 3; pattern++)
+	{
+		uint32 seed = 0x12345678;
+
+		for (uint32 i = 0; i < PAGE_SIZE; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			page[i] = pattern == 0 ? 0 : pattern == 1 ? (uint8)(i % 13) : (uint8)(seed >> 16);
+		}
+
+		uint32 start = test_read_tsc();
+		uint32 size = lz4_compress(page, PAGE_SIZE, compressed, sizeof(compressed), table);
+		uint32 cycles = test_read_tsc() - start;
+
+		if (size == 0)
+			FAIL("Page compression failed\n");
+
+		if (lz4_decompress(compressed, size, restored, PAGE_SIZE) != PAGE_SIZE)
+			FAIL("Page decompression failed\n");
+
+		for (uint32 i = 0; i < PAGE_SIZE; i++)
+			if (page[i] != restored[i])
+				FAIL("Decompressed page differs\n");
+
+		// random data must be rejected by the compressed swap tier
+		if (pattern == 2 && lz4_compress(page, PAGE_SIZE, compressed, ZSWAP_MAX_STORE, table) != 0)
+			FAIL("Incompressible page fits the compressed tier\n");
+
+		serial_printf("lz4: pattern %u compressed to %u bytes in %u cycles\n", pattern, size, cycles);
+	}
+
+	RET_SUCCESS;
+}
+
+// fills the page with pseudo random bytes up to 'random' and zeros after them
+static void test_swap_fill(virtual_addr page, uint32 seed, uint32 random)
+{
+	uint8* p = (uint8*)page;
+
+	for (uint32 i = 0; i < PAGE_SIZE; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		p[i] = i < random ? (uint8)(seed >> 16) : 0;
+	}
+}
+
+static bool test_swap_check(virtual_addr page, uint32 seed, uint32 random)
+{
+	uint8* p = (uint8*)page;
+
+	for (uint32 i = 0; i < PAGE_SIZE; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		if (p[i] != (i < random ? (uint8)(seed >> 16) : 0))
+			return false;
+	}
+
+	return true;
+}
+
+// drops every page of the window, resident or swapped
+static void test_swap_release(virtual_addr base, uint32 pages)
+{
+	for (uint32 i = 0; i < pages; i++)
+	{
+		pt_entry* page = vmmngr_lookup_page(vmmngr_get_directory(), base + i * PAGE_SIZE);
+
+		if (swap_is_entry_swapped(*page))
+		{
+			swap_free_entry(*page);
+			*page = 0;
+		}
+		else if (pt_entry_is_present(*page))
+			vmmngr_free_page_addr(base + i * PAGE_SIZE);
+	}
+}
+
+bool test_swap_tiers()
+{
+	if (swap_enabled() == false || zswap_enabled() == false)
+		SUCCESS("Swapping is disabled, skipping swap tiers test\n");
+
+	const virtual_addr compressible = TEST_USER_VIRT;
+	const virtual_addr incompressible = TEST_USER_VIRT + PAGE_SIZE;
+	const uint32 filler_random = 2560;		// random bytes of a filler page, which still fits the compressed tier
+	const uint32 filler_first = 2;
+	const uint32 pages = PAGES_PER_TABLE;
+	PCB* proc = process_get_current();
+
+	// private anonymous pages of the current process are the only ones that may be evicted
+	if (vfs_mmap(TEST_USER_VIRT, INVALID_FD, 0, LARGE_PAGE_SIZE, MMAP_READ | MMAP_WRITE, MMAP_PRIVATE | MMAP_ANONYMOUS) != TEST_USER_VIRT)
+		FAIL("Area creation failed: %e\n");
+
+	for (uint32 i = 0; i < pages; i++)
+		if (vmmngr_alloc_page(TEST_USER_VIRT + i * PAGE_SIZE) != ERROR_OK)
+			FAIL("Page allocation failed: %e\n");
+
+	for (uint32 i = 0; i < PAGE_SIZE; i++)
+		((uint8*)compressible)[i] = (uint8)(i % 13);
+
+	test_swap_fill(incompressible, 1, PAGE_SIZE);
+
+	zswap_stats zs = zswap_get_stats();
+	swap_stats ss = swap_get_stats();
+
+	// the compressible page stays in memory, compressed
+	if (swap_out_page(compressible) != ERROR_OK || swap_is_page_swapped(compressible) == false)
+		FAIL("Compressible page eviction failed: %e\n");
+
+	uint32 slot = *vmmngr_lookup_page(vmmngr_get_directory(), compressible) >> 12;
+	if (zswap_is_stored(slot) == false || zswap_get_stats().stores != zs.stores + 1)
+		FAIL("Compressible page is not in the compressed tier\n");
+
+	// the incompressible page goes straight to the swap file, or stays resident without one
+	error_t res = swap_out_page(incompressible);
+	if (zswap_get_stats().rejected != zs.rejected + 1)
+		FAIL("Incompressible page was not rejected by the compressed tier\n");
+
+	if (swap_file_enabled())
+	{
+		if (res != ERROR_OK || swap_get_stats().written != ss.written + 1)
+			FAIL("Incompressible page was not written to the swap file: %e\n");
+	}
+	else if (res == ERROR_OK || swap_is_page_swapped(incompressible) || test_swap_check(incompressible, 1, PAGE_SIZE) == false)
+		FAIL("Incompressible page left memory without a swap file\n");
+
+	// fill the pool. With a swap file the oldest (compressible) page is demoted to disk to make room, without one the
+	// eviction that finds the pool full fails and the page stays resident
+	uint32 filler = filler_first;
+	for (; filler < pages; filler++)
+	{
+		virtual_addr addr = TEST_USER_VIRT + filler * PAGE_SIZE;
+		test_swap_fill(addr, filler, filler_random);
+
+		if (swap_out_page(addr) != ERROR_OK)
+		{
+			if (swap_file_enabled() || swap_is_page_swapped(addr) || test_swap_check(addr, filler, filler_random) == false)
+				FAIL("Filler page eviction failed: %e\n");
+
+			break;
+		}
+
+		if (swap_file_enabled() && zswap_is_stored(slot) == false)
+		{
+			filler++;
+			break;
+		}
+	}
+
+	if (filler == pages || filler == filler_first)
+		FAIL("Compressed tier did not fill up\n");
+
+	if (swap_file_enabled() && swap_get_stats().demoted == ss.demoted)
+		FAIL("Full compressed tier did not demote to the swap file\n");
+
+	// read the early pages back: from disk with a swap file (a miss), from the pool without one (a hit)
+	zswap_stats before = zswap_get_stats();
+
+	if (swap_in_page(compressible, DEFAULT_FLAGS) != ERROR_OK)
+		FAIL("Compressible page swap in failed: %e\n");
+
+	for (uint32 i = 0; i < PAGE_SIZE; i++)
+		if (((uint8*)compressible)[i] != (uint8)(i % 13))
+			FAIL("Compressible page differs after swap in\n");
+
+	if (swap_file_enabled())
+	{
+		if (swap_in_page(incompressible, DEFAULT_FLAGS) != ERROR_OK || test_swap_check(incompressible, 1, PAGE_SIZE) == false)
+			FAIL("Incompressible page swap in failed: %e\n");
+
+		if (zswap_get_stats().misses != before.misses + 2)
+			FAIL("Demoted pages were not read from the swap file\n");
+	}
+	else if (zswap_get_stats().hits != before.hits + 1)
+		FAIL("Compressible page was not read from the compressed tier\n");
+
+	// a page still in the pool is a hit and its slot leaves the pool once released, so a reused slot never sees it
+	virtual_addr last = TEST_USER_VIRT + (filler - 1) * PAGE_SIZE;
+	slot = *vmmngr_lookup_page(vmmngr_get_directory(), last) >> 12;
+	before = zswap_get_stats();
+
+	if (zswap_is_stored(slot) == false)
+		FAIL("Last filler page is not in the compressed tier\n");
+
+	if (swap_in_page(last, DEFAULT_FLAGS) != ERROR_OK || test_swap_check(last, filler - 1, filler_random) == false)
+		FAIL("Filler page swap in failed: %e\n");
+
+	if (zswap_get_stats().hits != before.hits + 1 || zswap_is_stored(slot) || zswap_get_stats().stored != before.stored - 1)
+		FAIL("Released slot was not invalidated in the compressed tier\n");
+
+	zs = zswap_get_stats();
+	ss = swap_get_stats();
+
+	test_swap_release(TEST_USER_VIRT, pages);
+
+	spinlock_acquire(&proc->contract_spinlock);
+	vm_area area = *vm_contract_find_area(&proc->memory_contract, TEST_USER_VIRT);
+	res = vm_contract_remove_area(&proc->memory_contract, &area);
+	spinlock_release(&proc->contract_spinlock);
+
+	if (res != ERROR_OK)
+		FAIL("Area removal failed: %e\n");
+
+	test_vmmngr_release_window(TEST_USER_VIRT);
+
+	serial_printf("swap tiers: %u filler pages, pool %u/%u bytes, %u stores, %u rejected, %u written, %u demoted\n",
+		filler - filler_first, zs.pool_used, zs.pool_size, zs.stores, zs.rejected, ss.written, ss.demoted);
+
+	RET_SUCCESS;
+}
@@ -0,0 +1,26 @@
+#ifndef TEST_MMNGR_VIRTUAL_H_16102026
+#define TEST_MMNGR_VIRTUAL_H_16102026
+
+#include "test_base.h"
+#include "../mmngr_virtual.h"
+#include "../page_frame.h"
+#include "../system.h"
+#include "../vm_contract.h"
+#include "../zero_pool.h"
+#include "../lz4.h"
+#include "../zswap.h"
+#include "../swap.h"
+#include "../memory.h"
+
+bool test_vmmngr_large_page();
+bool test_vmmngr_large_page_benchmark();
+bool test_vmmngr_global_pages();
+bool test_vmmngr_context_switch_benchmark();
+bool test_vmmngr_cow();
+bool test_vm_area_readahead();
+bool test_vm_contract_lookup();
+bool test_zero_pool();
+bool test_swap_compression();
+bool test_swap_tiers();
+
+#endif
@@ -3,6 +3,9 @@
 #include "../file.h"
 #include "../thread_sched.h"
 
+#define TEST_VEC_DISK_PAGES	5			// room for the saved, written and read sectors at the offsets of the disk test
+#define TEST_VEC_DISK_LBA		4096		// scratch sectors of the disk test
+
 bool test_open_file_table_open()
 {
 	vfs_node* file;
@@ -237,4 +240,232 @@ bool test_sync_file()
 	// expect to see test dev write
 
 	RET_SUCCESS;
-}
\ No newline at end of file
+}
+
+#define TEST_BYTES_PAGES	3				// length of the byte test device, in pages
+
+// byte test device data: every byte tells its offset
+inline uint8 test_bytes_value(uint32 offset)
+{
+	return (uint8)(offset % 251);
+}
+
+size_t test_bytes_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
+{
+	for (uint32 i = 0; i < count; i++)
+		((uint8*)address)[i] = test_bytes_value(start + i);
+
+	return count;
+}
+
+static fs_operations test_bytes_ops =
+{
+	test_bytes_read,			// read
+	NULL,						// write
+	NULL,						// open
+	NULL,						// close
+	NULL,						// sync
+	NULL,						// lookup
+	NULL						// ioctl
+};
+
+// reads and writes across page boundaries and past the end of the file, through the page cache
+bool test_file_cached_bytes()
+{
+	vfs_node* node = vfs_create_device("bytes_test", VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE, 0, 0, &test_bytes_ops);
+	if (node == 0)
+		FAIL("Could not create the byte test device: %e\n");
+
+	node->file_length = TEST_BYTES_PAGES * PAGE_CACHE_SIZE;
+
+	uint32 fd;
+	if (open_file("dev/bytes_test", &fd, VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE) != ERROR_OK)
+		FAIL("Could not open the byte test device: %e\n");
+
+	uint8 data[20];
+
+	// a write across the boundary of two pages that are not cached, so both are read before the write
+	uint8 record[6] = { 1, 2, 3, 4, 5, 6 };
+	if (write_file(fd, 8190, 6, (virtual_addr)record) != 6)
+		FAIL("Could not write across a page boundary: %e\n");
+
+	if (read_file(fd, 8180, 20, (virtual_addr)data) != 20)
+		FAIL("Could not read the written record: %e\n");
+
+	for (uint32 i = 0; i < 20; i++)
+	{
+		uint8 expected = i >= 10 && i < 16 ? record[i - 10] : test_bytes_value(8180 + i);
+		if (data[i] != expected)
+			FAIL("Partial page write did not keep the page data\n");
+	}
+
+	// a read across a page boundary
+	if (read_file(fd, 4090, 10, (virtual_addr)data) != 10)
+		FAIL("Could not read across a page boundary: %e\n");
+
+	for (uint32 i = 0; i < 10; i++)
+		if (data[i] != test_bytes_value(4090 + i))
+			FAIL("Unaligned read returned wrong data\n");
+
+	// a write past the end of the file zero pads its new page and grows the file
+	uint32 end = TEST_BYTES_PAGES * PAGE_CACHE_SIZE;
+	if (write_file(fd, end + 100, 4, (virtual_addr)record) != 4 || node->file_length != end + 104)
+		FAIL("Could not write past the end of file: %e\n");
+
+	// reads stop at the end of the file
+	if (read_file(fd, end + 96, 20, (virtual_addr)data) != 8)
+		FAIL("Read did not stop at the end of file\n");
+
+	for (uint32 i = 0; i < 8; i++)
+		if (data[i] != (i < 4 ? 0 : record[i - 4]))
+			FAIL("Write past the end of file was not zero padded\n");
+
+	uint32 gfd = gft_get_by_fd(fd);
+	for (uint32 page = 0; page <= TEST_BYTES_PAGES; page++)
+		if (page_cache_release_buffer(gfd, page) != ERROR_OK)
+			FAIL("Could not release page cache buffer: %e\n");
+
+	RET_SUCCESS;
+}
+
+static uint32 test_vec_readv_calls = 0;
+static uint32 test_vec_write_calls = 0;
+
+size_t test_vec_readv(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	size_t total = 0;
+	test_vec_readv_calls++;
+
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		test_bytes_read(fd, file, start + total, vec[i].count, vec[i].address);
+		total += vec[i].count;
+	}
+
+	return total;
+}
+
+size_t test_vec_write(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
+{
+	test_vec_write_calls++;
+	return count;
+}
+
+static fs_operations test_vec_ops =
+{
+	test_bytes_read,			// read
+	test_vec_write,				// write
+	NULL,						// open
+	NULL,						// close
+	NULL,						// sync
+	NULL,						// lookup
+	NULL,						// ioctl
+	test_vec_readv,				// readv
+	NULL						// writev
+};
+
+static uint8 test_vec_disk[(TEST_VEC_DISK_PAGES + 1) * PAGE_SIZE];
+
+// a vectored round trip on the disk. The buffers cross page boundaries, so each request takes several PRDT entries, and
+// the read splits the sectors differently from the write. The scratch sectors are saved first and restored at the end
+static bool test_file_vectored_disk()
+{
+	uint32 fd;
+	if (open_file("dev/sdc", &fd, VFS_CAP_READ | VFS_CAP_WRITE) != ERROR_OK)
+		FAIL("Could not open sdc: %e\n");
+
+	// page aligned, so the offsets below decide where the buffers cross pages
+	uint8* base = (uint8*)(((virtual_addr)test_vec_disk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+	uint8* saved = base;
+	uint8* written = base + PAGE_SIZE + 1024;
+	uint8* read = base + 3 * PAGE_SIZE + 512;
+
+	io_vec save_vec[2] = { { (virtual_addr)saved, 6 }, { (virtual_addr)(saved + 6 * 512), 4 } };
+	io_vec write_vec[2] = { { (virtual_addr)written, 7 }, { (virtual_addr)(written + 7 * 512), 3 } };
+	io_vec read_vec[3] = { { (virtual_addr)read, 2 }, { (virtual_addr)(read + 2 * 512), 5 }, { (virtual_addr)(read + 7 * 512), 3 } };
+
+	for (uint32 i = 0; i < 10 * 512; i++)
+	{
+		written[i] = (uint8)(i * 7 + i / 512);
+		read[i] = 0;
+	}
+
+	if (readv_file(fd, TEST_VEC_DISK_LBA, save_vec, 2) != 10)
+		FAIL("Could not save the scratch sectors: %e\n");
+
+	if (writev_file(fd, TEST_VEC_DISK_LBA, write_vec, 2) != 10)
+		FAIL("Could not write a vector to the disk: %e\n");
+
+	if (readv_file(fd, TEST_VEC_DISK_LBA, read_vec, 3) != 10)
+		FAIL("Could not read a vector from the disk: %e\n");
+
+	for (uint32 i = 0; i < 10 * 512; i++)
+		if (read[i] != written[i])
+			FAIL("Vectored disk read returned wrong data\n");
+
+	if (writev_file(fd, TEST_VEC_DISK_LBA, save_vec, 2) != 10)
+		FAIL("Could not restore the scratch sectors: %e\n");
+
+	RET_SUCCESS;
+}
+
+// vectored reads and writes: uncached ones reach the driver as one request (or one per buffer when it has no vectored
+// operation), cached ones go through the page cache
+bool test_file_vectored()
+{
+	vfs_node* node = vfs_create_device("vec_test", VFS_CAP_READ | VFS_CAP_WRITE, 0, 0, &test_vec_ops);
+	vfs_node* cached_node = vfs_create_device("vec_cache_test", VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE, 0, 0, &test_vec_ops);
+	if (node == 0 || cached_node == 0)
+		FAIL("Could not create the vectored test devices: %e\n");
+
+	node->file_length = cached_node->file_length = TEST_BYTES_PAGES * PAGE_CACHE_SIZE;
+
+	uint32 fd, cached_fd;
+	if (open_file("dev/vec_test", &fd, VFS_CAP_READ | VFS_CAP_WRITE) != ERROR_OK ||
+		open_file("dev/vec_cache_test", &cached_fd, VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE) != ERROR_OK)
+		FAIL("Could not open the vectored test devices: %e\n");
+
+	uint8 a[10], b[20], c[30];
+	io_vec vec[3] = { { (virtual_addr)a, 10 }, { (virtual_addr)b, 20 }, { (virtual_addr)c, 30 } };
+
+	if (readv_file(fd, 100, vec, 3) != 60 || test_vec_readv_calls != 1)
+		FAIL("Vectored read was not a single request: %e\n");
+
+	for (uint32 i = 0; i < 60; i++)
+	{
+		uint8 value = i < 10 ? a[i] : i < 30 ? b[i - 10] : c[i - 30];
+		if (value != test_bytes_value(100 + i))
+			FAIL("Vectored read returned wrong data\n");
+	}
+
+	// the device has no vectored write, so it gets one write per buffer
+	if (writev_file(fd, 0, vec, 2) != 30 || test_vec_write_calls != 2)
+		FAIL("Vectored write did not fall back to plain writes: %e\n");
+
+	// a cached write across a page boundary, read back by other buffers
+	uint8 record[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	io_vec write_vec[2] = { { (virtual_addr)record, 6 }, { (virtual_addr)(record + 6), 4 } };
+
+	if (writev_file(cached_fd, 4094, write_vec, 2) != 10)
+		FAIL("Could not write a vector through the page cache: %e\n");
+
+	io_vec read_vec[2] = { { (virtual_addr)a, 3 }, { (virtual_addr)b, 13 } };
+	if (readv_file(cached_fd, 4091, read_vec, 2) != 16)
+		FAIL("Could not read a vector through the page cache: %e\n");
+
+	for (uint32 i = 0; i < 16; i++)
+	{
+		uint8 value = i < 3 ? a[i] : b[i - 3];
+		uint8 expected = i >= 3 && i < 13 ? record[i - 3] : test_bytes_value(4091 + i);
+
+		if (value != expected)
+			FAIL("Cached vectored read returned wrong data\n");
+	}
+
+	uint32 gfd = gft_get_by_fd(cached_fd);
+	for (uint32 page = 0; page < 2; page++)
+		if (page_cache_release_buffer(gfd, page) != ERROR_OK)
+			FAIL("Could not release page cache buffer: %e\n");
+
+	return test_file_vectored_disk();
+}
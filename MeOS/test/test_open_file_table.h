@@ -12,5 +12,7 @@ bool test_read_file_cached();
 bool test_write_file_cached();
 bool test_sync_file();
 bool test_write_with_dirty();
+bool test_file_cached_bytes();
+bool test_file_vectored();
 
 #endif
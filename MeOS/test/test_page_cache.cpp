@@ -58,6 +58,14 @@ bool test_page_cache_reserve_and_release()
 	serial_printf("page cache: \n");
 	page_cache_print();
 
+	// A PINNED BUFFER STAYS
+	if (page_cache_release_buffer(gfd, 5) == ERROR_OK)
+		FAIL("Released a pinned page cache buffer\n");
+
+	page_cache_put_buffer(p1);
+	page_cache_put_buffer(p2);
+	page_cache_put_buffer(p3);
+
 	serial_printf("Releasing page cache buffer: %h at page 5\n", p2);
 
 	// RELEASE THE SECOND BUFFER
@@ -101,6 +109,12 @@ bool test_page_cache_find_buffer()
 
 	serial_printf("allocated page cache buffers at: %h %h\n", p1, p2);
 
+	// lookups would wait for the pages to be read in
+	page_cache_set_uptodate(p1);
+	page_cache_set_uptodate(p2);
+	page_cache_put_buffer(p1);
+	page_cache_put_buffer(p2);
+
 	// TRY TO FIND THREE BUFFERS, THE TWO ABOVE AND A NON-EXISTING ONE
 	virtual_addr result1 = page_cache_get_buffer(gfd, 0);
 	virtual_addr result2 = page_cache_get_buffer(gfd, 10);
@@ -114,5 +128,132 @@ bool test_page_cache_find_buffer()
 
 	serial_printf("Got page cache buffers at: %h %h %h\n", result1, result2, result3);
 
+	page_cache_put_buffer(result1);
+	page_cache_put_buffer(result3);
+
+	RET_SUCCESS;
+}
+#define TEST_PAGE_INDEX_PAGES	4096			// a 16MB file
+
+// the item of a fake buffer for the page (never zero)
+inline void* test_page_index_item(uint32 page)
+{
+	return (void*)(0x1000 + page * PAGE_CACHE_SIZE);
+}
+
+bool test_page_index()
+{
+	page_index index;
+	page_index_init(&index);
+
+	// a streamed file and a far away page that makes the tree tall
+	for (uint32 page = 0; page < TEST_PAGE_INDEX_PAGES; page++)
+		if (page_index_insert(&index, page, test_page_index_item(page)) != ERROR_OK)
+			FAIL("Page index insertion failed\n");
+
+	if (page_index_insert(&index, 0x00FFFFFF, test_page_index_item(1)) != ERROR_OK)
+		FAIL("Page index insertion failed\n");
+
+	if (page_index_insert(&index, 7, test_page_index_item(7)) == ERROR_OK)
+		FAIL("Page index accepted a page twice\n");
+
+	uint32 start = test_read_tsc();
+	for (uint32 page = 0; page < TEST_PAGE_INDEX_PAGES; page++)
+		if (page_index_lookup(&index, page) != test_page_index_item(page))
+			FAIL("Page index lookup failed\n");
+	uint32 cycles = test_read_tsc() - start;
+
+	serial_printf("page index: %u lookups in %u cycles, height %u\n", TEST_PAGE_INDEX_PAGES, cycles, index.height);
+
+	// range lookup in page order
+	uint32 pages[16];
+	void* items[16];
+	if (page_index_lookup_range(&index, 100, 0xFFFFFFFF, pages, items, 16) != 16 || pages[0] != 100 || pages[15] != 115)
+		FAIL("Page index range lookup failed\n");
+
+	// dirty pages are found without visiting the clean ones
+	page_index_tag(&index, 3, PAGE_INDEX_TAG_DIRTY, true);
+	page_index_tag(&index, 2000, PAGE_INDEX_TAG_DIRTY, true);
+	page_index_tag(&index, 0x00FFFFFF, PAGE_INDEX_TAG_DIRTY, true);
+	page_index_tag(&index, 2000, PAGE_INDEX_TAG_DIRTY, false);
+
+	if (page_index_lookup_tagged(&index, 0, 0xFFFFFFFF, PAGE_INDEX_TAG_DIRTY, pages, items, 16) != 2 || pages[0] != 3 ||
+		pages[1] != 0x00FFFFFF || page_index_is_tagged(&index, 2000, PAGE_INDEX_TAG_DIRTY))
+		FAIL("Page index dirty lookup failed\n");
+
+	for (uint32 page = 0; page < TEST_PAGE_INDEX_PAGES; page++)
+		if (page_index_remove(&index, page) != test_page_index_item(page))
+			FAIL("Page index removal failed\n");
+
+	if (index.count != 1 || page_index_lookup(&index, 5) != 0)
+		FAIL("Page index kept removed pages\n");
+
+	page_index_clear(&index);
 	RET_SUCCESS;
-}
\ No newline at end of file
+}
+
+#define TEST_EVICTION_ROUNDS	3				// times the streamed file is larger than the cache
+
+bool test_page_cache_eviction()
+{
+	uint32 fd, gfd;
+	if (open_file("dev/keyboard", &fd, VFS_CAP_READ) != ERROR_OK)
+		FAIL("Could not open keyboard file: %e\n");
+
+	gfd = gft_get_by_fd(fd);
+	page_cache_stats before = page_cache_get_stats();
+	uint32 stream = TEST_EVICTION_ROUNDS * before.buffers;
+
+	// a hot page touched twice is promoted to the active list
+	virtual_addr hot = page_cache_reserve_buffer(gfd, stream);
+	if (hot == 0)
+		FAIL("Could not reserve page cache buffer: %e\n");
+
+	page_cache_set_uptodate(hot);
+	page_cache_put_buffer(hot);
+	page_cache_put_buffer(page_cache_get_buffer(gfd, stream));
+	page_cache_put_buffer(page_cache_get_buffer(gfd, stream));
+
+	// stream (and dirty) more pages than the cache holds. Every reservation must succeed
+	for (uint32 page = 0; page < stream; page++)
+	{
+		virtual_addr buffer = page_cache_reserve_buffer(gfd, page);
+		if (buffer == 0)
+			FAIL("Page cache did not evict to serve a streamed page: %e\n");
+
+		if (page % 2 == 0 && page_cache_make_dirty(gfd, page, true) != ERROR_OK)
+			FAIL("Could not dirty page cache buffer: %e\n");
+
+		page_cache_put_buffer(buffer);
+		page_cache_put_buffer(page_cache_get_buffer(gfd, stream));
+	}
+
+	page_cache_stats after = page_cache_get_stats();
+	serial_printf("page cache: %u evictions, %u writebacks, %u activations, active %u, inactive %u\n",
+		after.evictions - before.evictions, after.writebacks - before.writebacks, after.activations - before.activations,
+		after.active, after.inactive);
+
+	if (after.evictions - before.evictions < stream - before.buffers || after.writebacks == before.writebacks)
+		FAIL("Page cache did not evict the streamed pages\n");
+
+	hot = page_cache_get_buffer(gfd, stream);
+	if (hot == 0)
+		FAIL("Page cache evicted the hot page\n");
+
+	page_cache_put_buffer(hot);
+
+	if (page_cache_get_buffer(gfd, 0) != 0 || page_cache_is_page_dirty(gfd, 0))
+		FAIL("Page cache kept the oldest streamed page\n");
+
+	// give the buffers back
+	uint32 pages[16];
+	virtual_addr buffers[16];
+	uint32 found;
+
+	while ((found = page_cache_lookup_range(gfd, 0, 0xFFFFFFFF, pages, buffers, 16)) != 0)
+		for (uint32 i = 0; i < found; i++)
+			if (page_cache_release_buffer(gfd, pages[i]) != ERROR_OK)
+				FAIL("Could not release page cache buffer: %e\n");
+
+	RET_SUCCESS;
+}
@@ -8,5 +8,7 @@
 bool test_page_cache_reserve_anonymous();
 bool test_page_cache_reserve_and_release();
 bool test_page_cache_find_buffer();
+bool test_page_index();
+bool test_page_cache_eviction();
 
 #endif
\ No newline at end of file
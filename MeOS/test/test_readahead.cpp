@@ -0,0 +1,128 @@
+#include "test_readahead.h"
+#include "../page_cache.h"
+
+#define TEST_READAHEAD_PAGES		64				// file length. Read a page at a time, it takes five windows
+#define TEST_READAHEAD_LBA			1000			// the file lies forwards from this sector
+
+size_t test_readahead_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address);
+error_t test_readahead_ioctl(vfs_node* node, uint32 command, ...);
+
+static fs_operations test_readahead_ops =
+{
+	test_readahead_read,		// read
+	NULL,						// write
+	NULL,						// open
+	NULL,						// close
+	NULL,						// sync
+	NULL,						// lookup
+	test_readahead_ioctl		// ioctl
+};
+
+static uint32 test_readahead_lba[TEST_READAHEAD_PAGES];		// first sector of each device request
+static uint32 test_readahead_count[TEST_READAHEAD_PAGES];	// pages of each device request
+static uint32 test_readahead_requests = 0;
+static uint32 test_readahead_single_reads = 0;
+
+// page at a time reads are not expected, as every page can be located
+size_t test_readahead_read(uint32 fd, vfs_node* file, uint32 start, size_t count, virtual_addr address)
+{
+	test_readahead_single_reads++;
+	*(uint32*)address = start / PAGE_CACHE_SIZE;
+	return count;
+}
+
+// the device is its own file system. Each page read starts with its page number
+error_t test_readahead_ioctl(vfs_node* node, uint32 command, ...)
+{
+	va_list l;
+	va_start(l, command);
+
+	if (command == VFS_IOCTL_BMAP)
+	{
+		uint32 page = va_arg(l, uint32);
+		vfs_node** device = va_arg(l, vfs_node**);
+		uint32* lba = va_arg(l, uint32*);
+
+		*device = node;
+		*lba = TEST_READAHEAD_LBA + page * 8;
+	}
+	else if (command == MASS_STORAGE_IOCTL_READ_PAGES && test_readahead_requests < TEST_READAHEAD_PAGES)
+	{
+		uint32 lba = va_arg(l, uint32);
+		uint32 count = va_arg(l, uint32);
+		virtual_addr* pages = va_arg(l, virtual_addr*);
+
+		for (uint32 i = 0; i < count; i++)
+			*(uint32*)pages[i] = (lba - TEST_READAHEAD_LBA) / 8 + i;
+
+		*va_arg(l, uint32*) = count;
+
+		test_readahead_lba[test_readahead_requests] = lba;
+		test_readahead_count[test_readahead_requests] = count;
+		test_readahead_requests++;
+	}
+
+	va_end(l);
+	return ERROR_OK;
+}
+
+bool test_readahead()
+{
+	vfs_node* node = vfs_create_device("readahead_test", VFS_CAP_READ | VFS_CAP_CACHE, 0, 0, &test_readahead_ops);
+	if (node == 0)
+		FAIL("Could not create the read-ahead test device: %e\n");
+
+	node->file_length = TEST_READAHEAD_PAGES * PAGE_CACHE_SIZE;
+
+	uint32 fd, gfd;
+	if (open_file("dev/readahead_test", &fd, VFS_CAP_READ | VFS_CAP_CACHE) != ERROR_OK)
+		FAIL("Could not open the read-ahead test device: %e\n");
+
+	gfd = gft_get_by_fd(fd);
+
+	virtual_addr buffer = page_cache_reserve_anonymous();
+	if (buffer == 0)
+		FAIL("Could not reserve a buffer: %e\n");
+
+	readahead_stats before = readahead_get_stats();
+
+	for (uint32 page = 0; page < TEST_READAHEAD_PAGES; page++)
+	{
+		if (read_file(fd, page * PAGE_CACHE_SIZE, PAGE_CACHE_SIZE, buffer) != PAGE_CACHE_SIZE)
+			FAIL("Could not read the read-ahead test device: %e\n");
+
+		if (*(uint32*)buffer != page)
+			FAIL("Read-ahead returned the wrong page\n");
+	}
+
+	readahead_stats after = readahead_get_stats();
+	page_cache_release_anonymous(buffer);
+
+	serial_printf("read-ahead: %u pages in %u requests\n", after.pages - before.pages, after.requests - before.requests);
+
+	// windows of 4, 8, 16 and 32 pages and the last 4 pages of the file, one request each
+	uint32 expected[] = { 4, 8, 16, 32, 4 };
+	uint32 lba = TEST_READAHEAD_LBA;
+
+	if (test_readahead_requests != 5 || test_readahead_single_reads != 0)
+		FAIL("Read-ahead did not read whole windows\n");
+
+	for (uint32 i = 0; i < 5; i++)
+	{
+		if (test_readahead_lba[i] != lba || test_readahead_count[i] != expected[i])
+			FAIL("Read-ahead windows did not grow\n");
+
+		lba += expected[i] * 8;
+	}
+
+	// only the first window was read on a miss
+	if (after.windows - before.windows != 1 || after.async_windows - before.async_windows != 4 ||
+		after.pages - before.pages != TEST_READAHEAD_PAGES)
+		FAIL("Read-ahead statistics are wrong\n");
+
+	for (uint32 page = 0; page < TEST_READAHEAD_PAGES; page++)
+		if (page_cache_release_buffer(gfd, page) != ERROR_OK)
+			FAIL("Could not release page cache buffer: %e\n");
+
+	RET_SUCCESS;
+}
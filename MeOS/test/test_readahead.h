@@ -0,0 +1,10 @@
+#ifndef TEST_READAHEAD_H_16102026
+#define TEST_READAHEAD_H_16102026
+
+#include "test_base.h"
+#include "../readahead.h"
+#include "../file.h"
+
+bool test_readahead();
+
+#endif
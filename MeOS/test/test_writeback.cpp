@@ -0,0 +1,98 @@
+#include "test_writeback.h"
+#include "../thread_sched.h"
+
+#define TEST_WRITEBACK_PAGES	9				// two runs of four pages and one page the device cannot locate
+
+error_t test_writeback_ioctl(vfs_node* node, uint32 command, ...);
+
+static fs_operations test_writeback_ops =
+{
+	NULL,						// read
+	NULL,						// write
+	NULL,						// open
+	NULL,						// close
+	NULL,						// sync
+	NULL,						// lookup
+	test_writeback_ioctl		// ioctl
+};
+
+static uint32 test_writeback_lba[TEST_WRITEBACK_PAGES];		// first sector of each device request
+static uint32 test_writeback_count[TEST_WRITEBACK_PAGES];	// pages of each device request
+static uint32 test_writeback_requests = 0;
+
+// the device is its own file system: pages 0-3 lie backwards at sector 800, pages 4-7 forwards at sector 100
+error_t test_writeback_ioctl(vfs_node* node, uint32 command, ...)
+{
+	va_list l;
+	va_start(l, command);
+
+	if (command == VFS_IOCTL_BMAP)
+	{
+		uint32 page = va_arg(l, uint32);
+		vfs_node** device = va_arg(l, vfs_node**);
+		uint32* lba = va_arg(l, uint32*);
+
+		if (page >= 8)
+			return ERROR_OCCUR;
+
+		*device = node;
+		*lba = page < 4 ? 800 + (3 - page) * 8 : 100 + (page - 4) * 8;
+	}
+	else if (command == MASS_STORAGE_IOCTL_WRITE_PAGES && test_writeback_requests < TEST_WRITEBACK_PAGES)
+	{
+		test_writeback_lba[test_writeback_requests] = va_arg(l, uint32);
+		test_writeback_count[test_writeback_requests] = va_arg(l, uint32);
+		va_arg(l, virtual_addr*);
+		*va_arg(l, uint32*) = test_writeback_count[test_writeback_requests];
+
+		test_writeback_requests++;
+	}
+
+	va_end(l);
+	return ERROR_OK;
+}
+
+bool test_writeback()
+{
+	vfs_create_device("writeback_test", VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE, 0, 0, &test_writeback_ops);
+
+	uint32 fd, gfd;
+	if (open_file("dev/writeback_test", &fd, VFS_CAP_READ | VFS_CAP_WRITE | VFS_CAP_CACHE) != ERROR_OK)
+		FAIL("Could not open the writeback test device: %e\n");
+
+	gfd = gft_get_by_fd(fd);
+
+	for (uint32 page = 0; page < TEST_WRITEBACK_PAGES; page++)
+	{
+		virtual_addr buffer = page_cache_reserve_buffer(gfd, page);
+		if (buffer == 0 || page_cache_make_dirty(gfd, page, true) != ERROR_OK)
+			FAIL("Could not dirty page cache buffer: %e\n");
+
+		page_cache_put_buffer(buffer);
+	}
+
+	writeback_stats before = writeback_get_stats();
+	writeback_run(0xFFFFFFFF);
+	writeback_stats after = writeback_get_stats();
+
+	serial_printf("writeback: %u pages in %u requests\n", after.pages - before.pages, after.requests - before.requests);
+
+	uint32 pages[TEST_WRITEBACK_PAGES];
+	virtual_addr buffers[TEST_WRITEBACK_PAGES];
+	if (page_cache_find_dirty(gfd, 0, 0xFFFFFFFF, pages, buffers, TEST_WRITEBACK_PAGES) != 0)
+		FAIL("Writeback left dirty pages\n");
+
+	// sorted by sector and merged into one request per run. The unlocated page went through vfs_sync
+	if (test_writeback_requests != 2 || test_writeback_lba[0] != 100 || test_writeback_count[0] != 4 ||
+		test_writeback_lba[1] != 800 || test_writeback_count[1] != 4)
+		FAIL("Writeback did not coalesce the dirty pages\n");
+
+	if (after.pages - before.pages != TEST_WRITEBACK_PAGES || after.requests - before.requests != 3 || after.errors != before.errors)
+		FAIL("Writeback statistics are wrong\n");
+
+	for (uint32 page = 0; page < TEST_WRITEBACK_PAGES; page++)
+		if (page_cache_release_buffer(gfd, page) != ERROR_OK)
+			FAIL("Could not release page cache buffer: %e\n");
+
+	RET_SUCCESS;
+}
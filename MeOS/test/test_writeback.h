@@ -0,0 +1,10 @@
+#ifndef TEST_WRITEBACK_H_16102026
+#define TEST_WRITEBACK_H_16102026
+
+#include "test_base.h"
+#include "../writeback.h"
+#include "../file.h"
+
+bool test_writeback();
+
+#endif
@@ -290,6 +290,27 @@ __declspec(naked) void thread_current_yield()
 	thread_execute(*current_thread);
 }
 
+// calls visit for each thread of the list
+void thread_list_for_each(TCB_list* list, void(*visit)(TCB* thread, void* param), void* param)
+{
+	for (TCB_node* node = list->head; node != 0; node = node->next)
+		visit(node->data, param);
+}
+
+void thread_for_each(void(*visit)(TCB* thread, void* param), void* param)
+{
+	// we need a cli environment as we walk the common data structures
+	INT_OFF;
+
+	for (uint32 i = HIGHEST_PRIORITY; i < NUMBER_PRIORITIES; i++)
+		thread_list_for_each(&READY_QUEUE(i), visit, param);
+
+	thread_list_for_each(&BLOCK_QUEUE, visit, param);
+	thread_list_for_each(&SLEEP_QUEUE, visit, param);
+
+	INT_ON;
+}
+
 __declspec(naked) void thread_block(TCB_node* thread)
 {
 	// TODO: Perhaps we will need to disable interrupts throughout this function to control the reading of the thread's state
@@ -52,6 +52,10 @@ PCB* process_get_current();
 // finds a thread given its id
 TCB* thread_find(uint32 id);
 
+// calls visit for every thread of the scheduler queues (ready, blocked and sleeping). It runs with interrupts off, so
+// visit must neither block nor take locks
+void thread_for_each(void(*visit)(TCB* thread, void* param), void* param);
+
 // blocks a thread
 void thread_block(TCB_node* thread);
 
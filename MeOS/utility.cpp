@@ -127,6 +127,19 @@ uint32 ceil_division(uint32 value, uint32 divisor)
 	return div;
 }
 
+uint32 bit_scan_forward(uint32 value)
+{
+	uint32 index;
+
+	_asm
+	{
+		bsf eax, dword ptr[value]
+		mov dword ptr[index], eax
+	}
+
+	return index;
+}
+
 uint32 atoui(char* input)
 {
 	if (input[0] == '0' && tolower(input[1]) == 'x')	// hex
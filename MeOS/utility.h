@@ -44,6 +44,9 @@ extern "C" {
 	uint32 pow(uint32 base, uint32 exp);
 	uint32 ceil_division(uint32 value, uint32 divisor);
 
+	// returns the index of the least significant set bit (value must be non-zero)
+	uint32 bit_scan_forward(uint32 value);
+
 	uint32 get_flags();
 
 
@@ -1,5 +1,6 @@
 #include "vfs.h"
 #include "print_utility.h"
+#include "kmem_cache.h"
 
 // private functions and data
 
@@ -10,6 +11,8 @@ size_t vfs_default_write(uint32 fd, vfs_node* node, uint32 start, size_t count,
 error_t vfs_default_sync(uint32 fd, vfs_node* node, uint32 start_page, uint32 end_page);
 error_t vfs_default_open(vfs_node* node, uint32 capabilities);
 error_t vfs_default_lookup(vfs_node* parent, char* path, vfs_node** result);
+size_t vfs_default_readv(uint32 fd, vfs_node* node, uint32 start, io_vec* vec, uint32 vec_count);
+size_t vfs_default_writev(uint32 fd, vfs_node* node, uint32 start, io_vec* vec, uint32 vec_count);
 
 static fs_operations default_fs_operations =
 {
@@ -19,7 +22,9 @@ static fs_operations default_fs_operations =
 	NULL,
 	vfs_default_sync,
 	vfs_default_lookup,
-	NULL
+	NULL,
+	vfs_default_readv,
+	vfs_default_writev
 };
 
 vfs_node* vfs_find_child(vfs_node* node, char* name)
@@ -57,6 +62,47 @@ error_t vfs_default_sync(uint32 fd, vfs_node* node, uint32 start_page, uint32 en
 	return ERROR_OK;
 }
 
+// the buffers are read one at a time with the node's fs_read
+size_t vfs_default_readv(uint32 fd, vfs_node* node, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	size_t total = 0;
+
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		size_t done = node->fs_ops->fs_read(fd, node, start + total, vec[i].count, vec[i].address);
+		if (done == INVALID_IO)
+			return INVALID_IO;
+
+		total += done;
+
+		// a short read ends the request
+		if (done != vec[i].count)
+			break;
+	}
+
+	return total;
+}
+
+// the buffers are written one at a time with the node's fs_write
+size_t vfs_default_writev(uint32 fd, vfs_node* node, uint32 start, io_vec* vec, uint32 vec_count)
+{
+	size_t total = 0;
+
+	for (uint32 i = 0; i < vec_count; i++)
+	{
+		size_t done = node->fs_ops->fs_write(fd, node, start + total, vec[i].count, vec[i].address);
+		if (done == INVALID_IO)
+			return INVALID_IO;
+
+		total += done;
+
+		if (done != vec[i].count)
+			break;
+	}
+
+	return total;
+}
+
 error_t vfs_default_open(vfs_node* node, uint32 capabilities)
 {
 	clear_last_error();
@@ -81,7 +127,7 @@ error_t vfs_default_lookup(vfs_node* parent, char* path, vfs_node** result)
 vfs_node* vfs_create_node(char* name, bool copy_name, uint32 attributes, uint32 capabilities, uint32 file_length, uint32 deep_metadata_length, vfs_node* tag, 
 							vfs_node* parent, fs_operations* file_fncs)
 {
-	vfs_node* n = (vfs_node*)malloc(sizeof(vfs_node) + deep_metadata_length);
+	vfs_node* n = (vfs_node*)kmem_alloc(sizeof(vfs_node) + deep_metadata_length);
 
 	if (n == 0)			// allocation failed
 		return 0;
@@ -111,13 +157,17 @@ vfs_node* vfs_create_node(char* name, bool copy_name, uint32 attributes, uint32
 		file_fncs->fs_write = default_fs_operations.fs_write;
 	if (file_fncs->fs_sync == 0)
 		file_fncs->fs_sync = default_fs_operations.fs_sync;
+	if (file_fncs->fs_readv == 0)
+		file_fncs->fs_readv = default_fs_operations.fs_readv;
+	if (file_fncs->fs_writev == 0)
+		file_fncs->fs_writev = default_fs_operations.fs_writev;
 
 	if (copy_name)
 	{
 		n->name = (char*)malloc(n->name_length + 1);		// deep copy name
 		if (n->name == 0)									// allocation failed
 		{
-			free(n);
+			kmem_free(n);
 			return 0;
 		}
 
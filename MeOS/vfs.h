@@ -39,6 +39,13 @@ enum VFS_CAPABILITIES
 	VFS_CAP_MAX		= 0xFFFF,		// The maximum capabilities for vfs files is 16. The other 16 bits are for file-specific usage
 };
 
+// ioctl commands of file system nodes
+enum VFS_IOCTL
+{
+	VFS_IOCTL_INVALIDATE,			// writes the node metadata back to its directory entry
+	VFS_IOCTL_BMAP					// (uint32 page, vfs_node** device, uint32* lba) finds the device sectors holding a file page
+};
+
 enum VFS_ERROR
 {
 	VFS_OK,
@@ -58,6 +65,13 @@ enum VFS_ERROR
 
 struct vfs_node;
 
+// a buffer of a vectored request. count is in the units of fs_read (bytes for files, sectors for mass storage devices)
+struct io_vec
+{
+	virtual_addr address;
+	size_t count;
+};
+
 // File system node operations
 struct fs_operations
 {
@@ -83,6 +97,14 @@ struct fs_operations
 
 	// Call functions specific to each node.
 	error_t(*fs_ioctl)(vfs_node* node, uint32 command, ...);
+
+	// Reads the consecutive file data starting at 'start' to the buffers of vec, in order, as one request.
+	// Returns the number read. Nodes without it get a fs_read per buffer.
+	size_t(*fs_readv)(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count);
+
+	// Writes the buffers of vec, in order, to the consecutive file data starting at 'start' as one request.
+	// Returns the number written. Nodes without it get a fs_write per buffer.
+	size_t(*fs_writev)(uint32 fd, vfs_node* file, uint32 start, io_vec* vec, uint32 vec_count);
 };
 
 struct vfs_node
@@ -150,6 +172,12 @@ inline size_t vfs_read_file(uint32 fd, vfs_node* node, uint32 start, size_t coun
 // writes data to an opened file
 inline size_t vfs_write_file(uint32 fd, vfs_node* node, uint32 start, size_t count, virtual_addr address) { return node->fs_ops->fs_write(fd, node, start, count, address); }
 
+// reads consecutive data from an opened file to many buffers
+inline size_t vfs_readv_file(uint32 fd, vfs_node* node, uint32 start, io_vec* vec, uint32 vec_count) { return node->fs_ops->fs_readv(fd, node, start, vec, vec_count); }
+
+// writes many buffers to consecutive data of an opened file
+inline size_t vfs_writev_file(uint32 fd, vfs_node* node, uint32 start, io_vec* vec, uint32 vec_count) { return node->fs_ops->fs_writev(fd, node, start, vec, vec_count); }
+
 // syncs the in memory changes to the underlying drive
 inline error_t vfs_sync(uint32 fd, vfs_node* node, uint32 page_start, uint32 page_end) { return node->fs_ops->fs_sync(fd, node, page_start, page_end); }
 
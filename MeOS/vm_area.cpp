@@ -28,6 +28,9 @@ void vm_area_init(vm_area* area)
 	area->start_addr = area->end_addr = 0;
 	area->flags = MMAP_INVALID;
 	area->fd = INVALID_FD;
+	area->advice = MADV_NORMAL;
+	area->ra_next = 0;
+	area->ra_pages = 0;
 }
 
 vm_area vm_area_create(uint32 start, uint32 end, uint32 flags, uint32 fd, uint32 offset)
@@ -83,6 +86,34 @@ void vm_area_print(vm_area* area)
 		vm_area_get_length(area), ceil_division(vm_area_get_end_address(area) - vm_area_get_start_address(area) + 1, PAGE_SIZE), vm_area_get_end_address(area));
 }
 
+uint32 vm_area_update_readahead(vm_area* area, uint32 address)
+{
+	uint32 page = (address - area->start_addr) / PAGE_SIZE;
+	uint32 window;
+
+	if (area->advice == MADV_RANDOM)
+		window = 1;
+	else if (area->advice == MADV_SEQUENTIAL)
+		window = VM_AREA_RA_MAX_PAGES;
+	else if (page == area->ra_next && page != 0)
+	{
+		// sequential hit (the previous window ended right before us), so grow the window
+		window = area->ra_pages < VM_AREA_RA_MIN_PAGES ? VM_AREA_RA_MIN_PAGES : min(2 * area->ra_pages, VM_AREA_RA_MAX_PAGES);
+	}
+	else
+		window = 1;		// random access or first fault
+
+	// do not read past the area
+	uint32 area_pages = (area->end_addr - area->start_addr) / PAGE_SIZE;
+	if (page + window > area_pages)
+		window = area_pages - page;
+
+	area->ra_pages = window;
+	area->ra_next = page + window;
+
+	return window;
+}
+
 bool vm_area_is_ok(vm_area* area)
 {
 	return ((area->flags & MMAP_INVALID) != MMAP_INVALID) && area->start_addr < area->end_addr;
@@ -8,6 +8,9 @@
 #include "mmngr_virtual.h"
 #include "memory_definitions.h"
 
+#define VM_AREA_RA_MIN_PAGES	4			// read-ahead window once a sequential pattern is detected
+#define VM_AREA_RA_MAX_PAGES	16			// largest read-ahead window (kept small as the page cache is fixed)
+
 enum VM_AREA_ERROR
 {
 	VM_AREA_NONE,
@@ -23,6 +26,10 @@ struct vm_area
 	uint32 fd;					// the global file descriptor connected with this area
 	uint32 offset;				// the offset withing the file of the mapping
 
+	uint32 advice;				// access pattern hint (MMAP_ADVICE)
+	uint32 ra_next;				// area page expected next by a sequential reader
+	uint32 ra_pages;			// current read-ahead window in pages
+
 	bool operator< (const vm_area& other);		// necessary c++ functions for keeping order
 	bool operator> (const vm_area& other);
 };
@@ -54,6 +61,9 @@ uint32 vm_area_get_start_address(vm_area* area);
 // returns the actual (not full-page) length of the area
 uint32 vm_area_get_length(vm_area* area);
 
+// records a file fault at address and returns how many pages should be read starting from the faulting page
+uint32 vm_area_update_readahead(vm_area* area, uint32 address);
+
 // returns whether area can be removed from a contract.
 bool vm_area_is_removable(vm_area* area);
 
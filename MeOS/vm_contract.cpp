@@ -1,5 +1,296 @@
 #include "vm_contract.h"
+#include "memory.h"
+#include "kmem_cache.h"
 #include "print_utility.h"
+#include "atomic.h"
+
+// private data
+
+static uint32 vm_contract_generation = 0;		// last version handed to a contract
+
+// private functions
+
+// returns a version no contract has had yet, so that a hint taken from one contract (or from this one before a clone,
+// an uninit or a removal) never matches another
+static uint32 vm_contract_next_version()
+{
+	uint32 version = vm_contract_generation;
+	while (CAS<uint32>(&vm_contract_generation, version, version + 1) == false)
+		version = vm_contract_generation;
+
+	return version + 1;
+}
+
+// returns the exclusive full-page end of the area (the first address after it)
+static uint32 vm_area_node_end(vm_area_node* n)
+{
+	return vm_area_get_end_address(&n->area) + 1;
+}
+
+static int32 vm_area_node_height(vm_area_node* n)
+{
+	return n == 0 ? 0 : n->height;
+}
+
+// recalculates the height and the subtree bounds and gaps of n from its children
+static void vm_area_node_update(vm_area_node* n)
+{
+	n->height = max(vm_area_node_height(n->left), vm_area_node_height(n->right)) + 1;
+
+	n->min_start = vm_area_get_start_address(&n->area);
+	n->max_end = vm_area_node_end(n);
+	n->max_gap = 0;
+
+	if (n->left)
+	{
+		n->min_start = n->left->min_start;
+		n->max_gap = max(n->left->max_gap, vm_area_get_start_address(&n->area) - n->left->max_end);
+	}
+
+	if (n->right)
+	{
+		n->max_end = n->right->max_end;
+		n->max_gap = max(n->max_gap, max(n->right->max_gap, n->right->min_start - vm_area_node_end(n)));
+	}
+}
+
+static vm_area_node* vm_area_node_rotate_right(vm_area_node* n)
+{
+	vm_area_node* l = n->left;
+
+	n->left = l->right;
+	l->right = n;
+
+	vm_area_node_update(n);
+	vm_area_node_update(l);
+
+	return l;
+}
+
+static vm_area_node* vm_area_node_rotate_left(vm_area_node* n)
+{
+	vm_area_node* r = n->right;
+
+	n->right = r->left;
+	r->left = n;
+
+	vm_area_node_update(n);
+	vm_area_node_update(r);
+
+	return r;
+}
+
+// restores the AVL property at n (whose children are already balanced) and returns the new subtree root
+static vm_area_node* vm_area_node_balance(vm_area_node* n)
+{
+	vm_area_node_update(n);
+	int32 balance = vm_area_node_height(n->left) - vm_area_node_height(n->right);
+
+	if (balance > 1)
+	{
+		if (vm_area_node_height(n->left->left) < vm_area_node_height(n->left->right))
+			n->left = vm_area_node_rotate_left(n->left);
+
+		return vm_area_node_rotate_right(n);
+	}
+
+	if (balance < -1)
+	{
+		if (vm_area_node_height(n->right->right) < vm_area_node_height(n->right->left))
+			n->right = vm_area_node_rotate_right(n->right);
+
+		return vm_area_node_rotate_left(n);
+	}
+
+	return n;
+}
+
+static vm_area_node* vm_area_node_create(vm_area* area)
+{
+	vm_area_node* n = (vm_area_node*)kmem_alloc(sizeof(vm_area_node));
+	if (n == 0)
+		return 0;
+
+	n->area = *area;
+	n->left = n->right = 0;
+	vm_area_node_update(n);
+
+	return n;
+}
+
+// inserts the already allocated node into the subtree (the caller has checked for overlaps)
+static vm_area_node* vm_area_node_insert(vm_area_node* root, vm_area_node* n)
+{
+	if (root == 0)
+		return n;
+
+	if (n->area.start_addr < root->area.start_addr)
+		root->left = vm_area_node_insert(root->left, n);
+	else
+		root->right = vm_area_node_insert(root->right, n);
+
+	return vm_area_node_balance(root);
+}
+
+// unlinks the lowest node of the subtree into 'min' and returns the new subtree root
+static vm_area_node* vm_area_node_remove_min(vm_area_node* root, vm_area_node** min)
+{
+	if (root->left == 0)
+	{
+		*min = root;
+		return root->right;
+	}
+
+	root->left = vm_area_node_remove_min(root->left, min);
+	return vm_area_node_balance(root);
+}
+
+// unlinks the node starting at 'start' into 'removed' and returns the new subtree root
+static vm_area_node* vm_area_node_remove(vm_area_node* root, uint32 start, vm_area_node** removed)
+{
+	if (root == 0)
+		return 0;
+
+	if (start < root->area.start_addr)
+		root->left = vm_area_node_remove(root->left, start, removed);
+	else if (start > root->area.start_addr)
+		root->right = vm_area_node_remove(root->right, start, removed);
+	else
+	{
+		*removed = root;
+
+		if (root->left == 0)
+			return root->right;
+
+		if (root->right == 0)
+			return root->left;
+
+		// relink the successor in place of root so that no area is moved in memory
+		vm_area_node* succ;
+		vm_area_node* right = vm_area_node_remove_min(root->right, &succ);
+
+		succ->left = root->left;
+		succ->right = right;
+
+		return vm_area_node_balance(succ);
+	}
+
+	return vm_area_node_balance(root);
+}
+
+// returns the node whose area starts exactly at 'start'
+static vm_area_node* vm_area_node_find(vm_area_node* root, uint32 start)
+{
+	while (root)
+	{
+		if (start < root->area.start_addr)
+			root = root->left;
+		else if (start > root->area.start_addr)
+			root = root->right;
+		else
+			return root;
+	}
+
+	return 0;
+}
+
+// returns the areas with the closest start address below (prev) and above (next) 'start'
+static void vm_area_node_find_neighbours(vm_area_node* root, uint32 start, vm_area_node** prev, vm_area_node** next)
+{
+	*prev = *next = 0;
+
+	while (root)
+	{
+		if (start < root->area.start_addr)
+		{
+			*next = root;
+			root = root->left;
+		}
+		else if (start > root->area.start_addr)
+		{
+			*prev = root;
+			root = root->right;
+		}
+		else
+		{
+			// the neighbours are the extremes of the node subtrees (if any)
+			for (vm_area_node* n = root->left; n; n = n->right)
+				*prev = n;
+
+			for (vm_area_node* n = root->right; n; n = n->left)
+				*next = n;
+
+			return;
+		}
+	}
+}
+
+// returns the lowest address of a gap of at least 'length' inside the subtree or 0
+static uint32 vm_area_node_find_gap(vm_area_node* n, uint32 length)
+{
+	while (n && n->max_gap >= length)
+	{
+		if (n->left && n->left->max_gap >= length)
+		{
+			n = n->left;
+			continue;
+		}
+
+		if (n->left && vm_area_get_start_address(&n->area) - n->left->max_end >= length)
+			return n->left->max_end;
+
+		if (n->right && n->right->min_start - vm_area_node_end(n) >= length)
+			return vm_area_node_end(n);
+
+		n = n->right;
+	}
+
+	return 0;
+}
+
+static void vm_area_node_free(vm_area_node* n)
+{
+	if (n == 0)
+		return;
+
+	vm_area_node_free(n->left);
+	vm_area_node_free(n->right);
+	kmem_free(n);
+}
+
+static vm_area_node* vm_area_node_clone(vm_area_node* src)
+{
+	if (src == 0)
+		return 0;
+
+	vm_area_node* n = (vm_area_node*)kmem_alloc(sizeof(vm_area_node));
+	if (n == 0)
+		return 0;
+
+	*n = *src;
+	n->left = n->right = 0;
+
+	if ((src->left && (n->left = vm_area_node_clone(src->left)) == 0) ||
+		(src->right && (n->right = vm_area_node_clone(src->right)) == 0))
+	{
+		vm_area_node_free(n);
+		return 0;
+	}
+
+	return n;
+}
+
+static void vm_area_node_print(vm_area_node* n)
+{
+	if (n == 0)
+		return;
+
+	vm_area_node_print(n->left);
+	vm_area_print(&n->area);
+	vm_area_node_print(n->right);
+}
+
+// public functions
 
 error_t vm_contract_init(vm_contract* c, uint32 low_addr, uint32 high_addr)
 {
@@ -13,9 +304,9 @@ error_t vm_contract_init(vm_contract* c, uint32 low_addr, uint32 high_addr)
 
 	c->highest_addr = high_addr;
 	c->lowest_addr = low_addr;
-
-	if (ordered_vector_init(&c->contract) != ERROR_OK)
-		return ERROR_OCCUR;
+	c->root = 0;
+	c->count = 0;
+	c->version = vm_contract_next_version();
 
 	// set guard non removable areas
 	vm_area area;
@@ -24,14 +315,55 @@ error_t vm_contract_init(vm_contract* c, uint32 low_addr, uint32 high_addr)
 
 	// TODO: Check some errors here for the set bounds function
 	vm_area_set_bounds(&area, low_addr, 4096);
-	if (ordered_vector_insert(&c->contract, area) != ERROR_OK)
+	vm_area_node* low = vm_area_node_create(&area);
+	if (low == 0)
 		return ERROR_OCCUR;
 
 	// TODO: Check some errors here for the set bounds function
 	vm_area_set_bounds(&area, high_addr - 4096, 4096);
-	if (ordered_vector_insert(&c->contract, area) != ERROR_OK)
+	vm_area_node* high = vm_area_node_create(&area);
+	if (high == 0)
+	{
+		kmem_free(low);
+		return ERROR_OCCUR;
+	}
+
+	c->root = vm_area_node_insert(vm_area_node_insert(0, low), high);
+	c->count = 2;
+
+	return ERROR_OK;
+}
+
+void vm_contract_uninit(vm_contract* c)
+{
+	vm_area_node_free(c->root);
+
+	c->root = 0;
+	c->count = 0;
+	c->version = vm_contract_next_version();
+}
+
+error_t vm_contract_clone(vm_contract* dest, vm_contract* src)
+{
+	if (dest == 0 || src == 0 || src->count == 0)
+	{
+		set_last_error(EINVAL, VM_CONTRACT_BAD_ARGUMENTS, EO_VM_CONTRACT);
 		return ERROR_OCCUR;
+	}
+
+	dest->lowest_addr = src->lowest_addr;
+	dest->highest_addr = src->highest_addr;
+	dest->version = vm_contract_next_version();
 
+	// copy the tree shape as a whole, so the balance and the subtree bounds remain valid
+	dest->root = vm_area_node_clone(src->root);
+	if (dest->root == 0)
+	{
+		dest->count = 0;
+		return ERROR_OCCUR;
+	}
+
+	dest->count = src->count;
 	return ERROR_OK;
 }
 
@@ -51,56 +383,40 @@ error_t vm_contract_add_area(vm_contract* c, vm_area* new_area)
 		return ERROR_OCCUR;
 	}
 
-	if (c->contract.count == 0)		// on zero count insert immediatelly. This should never happen as of init
+	if (c->count == 0)		// on zero count insert immediatelly. This should never happen as of init
 	{
 		PANIC("Heavy problem! vm_contract is not initialized");		// in release mode can be ommited
-		//ordered_vector_insert(&c->contract, *new_area);
 		// TODO: Add set_last_error
 		return ERROR_OCCUR;
 	}
 
-	// crazy binary search to get smallest closest starting address
-	uint32 first = 0, last = c->contract.count - 1;
-	uint32 mid;
-
-	uint32 target = new_area->start_addr;
-	bool found = false;
-
-	while (first <= last)
-	{
-		mid = (first + last) / 2;
-
-		if (c->contract.data[mid].start_addr < target)
-			first = mid + 1;
-		else if (c->contract.data[mid].start_addr > target)
-			last = mid - 1;
-		else
-		{
-			found = true;
-			break;
-		}
-	}
-
-	if (found)		// found another area with the SAME start address so definitely fail
+	if (vm_area_node_find(c->root, new_area->start_addr) != 0)		// found another area with the SAME start address so definitely fail
 	{
 		set_last_error(EINVAL, VM_CONTRACT_AREA_EXISTS, EO_VM_CONTRACT);
 		return ERROR_OCCUR;
 	}
 
-	if (last + 1 == c->contract.count)		// this means we found the last-guard area
+	vm_area_node* prev, *next;
+	vm_area_node_find_neighbours(c->root, new_area->start_addr, &prev, &next);
+
+	if (next == 0)		// this means we passed the last-guard area
 		PANIC("SOMETHING IS REALLY WRONG");
 
-	// do intersection check. Consider first > last as found == false => data[last] points to the smallest start address
-	if (vm_area_intersects(&c->contract.data[last], new_area) == false &&
-		vm_area_intersects(&c->contract.data[last + 1], new_area) == false)
+	// the areas do not overlap, so only the neighbours can intersect with the new one
+	if ((prev != 0 && vm_area_intersects(&prev->area, new_area)) || vm_area_intersects(&next->area, new_area))
 	{
-		printfln("new area: %h", new_area->start_addr);
-		ordered_vector_insert(&c->contract, *new_area);
-		return ERROR_OK;
+		set_last_error(EINVAL, VM_CONTRACT_OVERLAPS, EO_VM_CONTRACT);
+		return ERROR_OCCUR;
 	}
 
-	set_last_error(EINVAL, VM_CONTRACT_OVERLAPS, EO_VM_CONTRACT);
-	return ERROR_OCCUR;
+	vm_area_node* n = vm_area_node_create(new_area);
+	if (n == 0)
+		return ERROR_OCCUR;
+
+	c->root = vm_area_node_insert(c->root, n);
+	c->count++;
+
+	return ERROR_OK;
 }
 
 error_t vm_contract_remove_area(vm_contract* c, vm_area* area)
@@ -112,12 +428,19 @@ error_t vm_contract_remove_area(vm_contract* c, vm_area* area)
 		return ERROR_OCCUR;
 	}
 
-	if (ordered_vector_remove(&c->contract, ordered_vector_find(&c->contract, *area)) == false)
+	vm_area_node* removed = 0;
+	c->root = vm_area_node_remove(c->root, area->start_addr, &removed);
+
+	if (removed == 0)
 	{
 		set_last_error(EINVAL, VM_CONTRACT_NOT_FOUND, EO_VM_CONTRACT);
 		return ERROR_OCCUR;
 	}
 
+	kmem_free(removed);
+	c->count--;
+	c->version = vm_contract_next_version();
+
 	return ERROR_OK;
 }
 
@@ -137,97 +460,121 @@ error_t vm_contract_expand_area(vm_contract* c, vm_area* area, uint32 length)
 		return ERROR_OCCUR;
 	}
 
-	uint32 index = ordered_vector_find(&c->contract, *area);
-	if (index >= c->contract.count)		// area was not found
+	if (vm_area_node_find(c->root, area->start_addr) == 0)		// area was not found
 	{
 		set_last_error(EINVAL, VM_CONTRACT_NOT_FOUND, EO_VM_CONTRACT);
 		return ERROR_OCCUR;
 	}
 
-	// no need to test index - 1 and index + 1 validity as both 0 and count - 1 areas are non-removable. See above if
+	// no need to test prev and next validity as both the lowest and the highest areas are non-removable. See above if
+	vm_area_node* prev, *next;
+	vm_area_node_find_neighbours(c->root, area->start_addr, &prev, &next);
+
 	vm_area* adjacent;
 	vm_area temp = *area;
 
 	if (vm_area_grows_down(area))
 	{
-		adjacent = &c->contract.data[index - 1];
+		adjacent = &prev->area;
 		temp.start_addr -= length;
 	}
 	else
 	{
-		adjacent = &c->contract.data[index + 1];
+		adjacent = &next->area;
 		temp.end_addr += length;
 	}
 
-	// sanity check before altering stucture data
-	/*if (vm_area_is_ok(&temp) == false)
-	{
-		return false;
-	}*/
-
 	if (vm_area_intersects(adjacent, &temp))		// on intersection leave the original area unaffected and fail
 	{
 		set_last_error(EINVAL, VM_CONTRACT_OVERLAPS, EO_VM_CONTRACT);
 		return ERROR_OCCUR;
-	}		
+	}
+
+	if (vm_area_grows_down(area))
+	{
+		// the start address is the tree key, so relink the area under its new start
+		vm_area_node* n = 0;
+		c->root = vm_area_node_remove(c->root, area->start_addr, &n);
+
+		n->area = temp;
+		n->left = n->right = 0;
+		vm_area_node_update(n);
+
+		c->root = vm_area_node_insert(c->root, n);
+		return ERROR_OK;
+	}
 
 	*area = temp;				// expansion is possible so do it
+
+	// the end address changed, so refresh the subtree bounds on the path down to the area
+	vm_area_node* path[64];
+	uint32 depth = 0;
+
+	for (vm_area_node* n = c->root; n != 0; n = temp.start_addr < n->area.start_addr ? n->left : n->right)
+	{
+		path[depth++] = n;
+		if (n->area.start_addr == temp.start_addr)
+			break;
+	}
+
+	while (depth > 0)
+		vm_area_node_update(path[--depth]);
+
 	return ERROR_OK;
 }
 
 vm_area* vm_contract_find_area(vm_contract* c, uint32 address)
 {
-	if (c == 0 || c->contract.count == 0 || address < c->lowest_addr || address >= c->highest_addr)	// this should never happen
+	if (c == 0 || c->count == 0 || address < c->lowest_addr || address >= c->highest_addr)	// this should never happen
 	{
 		set_last_error(EINVAL, VM_CONTRACT_BAD_ARGUMENTS, EO_VM_CONTRACT);
 		return 0;
 	}
 
-	uint32 first = 0, last = c->contract.count - 1, mid;
-	bool found = false;
+	vm_area_node* n = c->root;
 
-	while (first <= last)
+	while (n)
 	{
-		mid = (first + last) / 2;
-
-		if (c->contract.data[mid].start_addr < address)
-			first = mid + 1;
-		else if (c->contract.data[mid].start_addr > address)
-			last = mid - 1;
+		if (address < n->area.start_addr)
+			n = n->left;
+		else if (address > vm_area_get_end_address(&n->area))
+			n = n->right;
 		else
-		{
-			found = true;
-			break;
-		}
+			return &n->area;
 	}
 
-	if (found)
-		return &c->contract.data[mid];
-
-	if (address <= vm_area_get_end_address(&c->contract.data[last]))
-		return &c->contract.data[last];
-
 	set_last_error(EINVAL, VM_CONTRACT_NOT_FOUND, EO_VM_CONTRACT);
 	return 0;
 }
 
+vm_area* vm_contract_find_area_hint(vm_contract* c, uint32 address, vm_contract_hint* hint)
+{
+	if (hint->area != 0 && hint->version == c->version &&
+		address >= hint->area->start_addr && address <= vm_area_get_end_address(hint->area))
+		return hint->area;
+
+	vm_area* area = vm_contract_find_area(c, address);
+	if (area != 0)
+	{
+		hint->area = area;
+		hint->version = c->version;
+	}
+
+	return area;
+}
+
 virtual_addr vm_contract_get_area_for_length(vm_contract* c, uint32 length)
 {
-	if (c == 0 || c->contract.count == 0)
+	if (c == 0 || c->count == 0)
 	{
 		set_last_error(EINVAL, VM_CONTRACT_BAD_ARGUMENTS, EO_VM_CONTRACT);
 		return 0;
 	}
 
-	for (uint32 i = 0; i < c->contract.count - 1; i++)
-	{
-		// test two successive area for in-between empty length
-		uint32 start = vm_area_get_start_address(&c->contract.data[i + 1]);
-		uint32 end = vm_area_get_end_address(&c->contract.data[i]) + 1;
-
-		if (start - end >= length)
-			return end;
-	}
+	// first fit, the subtree gaps lead to the lowest suitable gap
+	virtual_addr addr = vm_area_node_find_gap(c->root, length);
+	if (addr != 0)
+		return addr;
 
 	set_last_error(EINVAL, VM_CONTRACT_NOT_FOUND, EO_VM_CONTRACT);
 	return 0;
@@ -235,6 +582,5 @@ virtual_addr vm_contract_get_area_for_length(vm_contract* c, uint32 length)
 
 void vm_contract_print(vm_contract* c)
 {
-	for (int i = 0; i < c->contract.count; i++)
-		vm_area_print(&c->contract.data[i]);
-}
\ No newline at end of file
+	vm_area_node_print(c->root);
+}
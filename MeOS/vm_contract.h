@@ -7,7 +7,6 @@
 #include "utility.h"
 #include "system.h"
 #include "vm_area.h"
-#include "ordered_vector.h"
 
 enum VM_CONTRACT_ERROR
 {
@@ -20,16 +19,44 @@ enum VM_CONTRACT_ERROR
 	VM_CONTRACT_AREA_EXISTS
 };
 
+// AVL tree node keyed by the area start address. Areas never overlap, so the subtree bounds also give the free gaps.
+struct vm_area_node
+{
+	vm_area area;
+	vm_area_node* left;
+	vm_area_node* right;
+	int32 height;
+
+	uint32 min_start;						// lowest start address in the subtree
+	uint32 max_end;							// highest end address in the subtree
+	uint32 max_gap;							// largest free gap between two successive areas of the subtree
+};
+
 struct vm_contract
 {
-	ordered_vector<vm_area> contract;		// vitrual memory areas of the process - kenrel contract
+	vm_area_node* root;						// vitrual memory areas of the process - kenrel contract
+	uint32 count;							// number of areas
+	uint32 version;							// unique, renewed when an area is removed (invalidates the per-thread hints)
 	uint32 lowest_addr;						// lowest valid address for this space
 	uint32 highest_addr;					// highest valid address for this space
 };
 
+// per-thread cache of the last area found by a lookup
+struct vm_contract_hint
+{
+	vm_area* area;
+	uint32 version;
+};
+
 // initializes a virtual memory contract. low is inclusive, high is exclusive
 error_t vm_contract_init(vm_contract* c, uint32 low, uint32 high);
 
+// releases all the areas of the contract
+void vm_contract_uninit(vm_contract* c);
+
+// initializes dest as a copy of the src contract (same bounds and areas)
+error_t vm_contract_clone(vm_contract* dest, vm_contract* src);
+
 // inserts a new memory area that does not overlap with any other
 error_t vm_contract_add_area(vm_contract* c, vm_area* new_area);
 
@@ -42,6 +69,9 @@ error_t vm_contract_expand_area(vm_contract* c, vm_area* area, uint32 length);
 // returns the vm_area that contains the 'address'
 vm_area* vm_contract_find_area(vm_contract* c, uint32 address);
 
+// same as above but first tries the area remembered by the hint and updates it on a tree lookup
+vm_area* vm_contract_find_area_hint(vm_contract* c, uint32 address, vm_contract_hint* hint);
+
 // returns a starting address that has 'length' length available. Caller constructs vm_area
 virtual_addr vm_contract_get_area_for_length(vm_contract* c, uint32 length);
 
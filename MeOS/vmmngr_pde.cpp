@@ -45,4 +45,9 @@ inline bool pd_entry_is_4mb(pd_entry e)
 inline physical_addr pd_entry_get_frame(pd_entry e)
 {
 	return e & I86_PDE_FRAME;
+}
+
+inline physical_addr pd_entry_get_large_frame(pd_entry e)
+{
+	return e & I86_PDE_LARGE_FRAME;
 }
\ No newline at end of file
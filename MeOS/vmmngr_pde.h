@@ -22,7 +22,8 @@ extern "C" {
 		I86_PDE_4MB = 0x80,
 		I86_PDE_CPU_GLOBAL = 0x100,
 		I86_PDE_LV4_GLOBAL = 0x200,
-		I86_PDE_FRAME = 0xFFFFF000		// here the first digit was 7 instead of F (0x7FFF) by brokenthorn...
+		I86_PDE_FRAME = 0xFFFFF000,		// here the first digit was 7 instead of F (0x7FFF) by brokenthorn...
+		I86_PDE_LARGE_FRAME = 0xFFC00000	// frame of a 4MB page (bits 12-21 are reserved/PAT for large pages)
 	};
 
 	typedef uint32 pd_entry;
@@ -56,6 +57,9 @@ extern "C" {
 	// get page table entry frame address
 	extern physical_addr pd_entry_get_frame(pd_entry entry);
 
+	// get the 4MB frame address of a large page entry
+	extern physical_addr pd_entry_get_large_frame(pd_entry entry);
+
 #ifdef __cplusplus
 }
 #endif
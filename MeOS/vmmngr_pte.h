@@ -22,6 +22,8 @@ extern "C" {
 		I86_PTE_PAT = 0x80,
 		I86_PTE_CPU_GLOBAL = 0x100,
 		I86_PTE_LV4_GLOBAL = 0x200,
+		I86_PTE_COPY_ON_WRITE = 0x400,	// available to the os. Page is shared read-only after a fork and is copied on the first write
+		I86_PTE_SWAPPED = 0x800,		// available to the os. Page is not present and the frame bits hold its swap slot
 		I86_PTE_FRAME = 0xFFFFF000		// here the first digit was 7 instead of F (0x7FFF) by brokenthorn...
 	};
 
@@ -0,0 +1,244 @@
+#include "writeback.h"
+#include "page_cache.h"
+#include "open_file_table.h"
+#include "thread_sched.h"
+#include "kernel_stack.h"
+#include "semaphore.h"
+#include "print_utility.h"
+
+#define WRITEBACK_PAGE_SECTORS		(PAGE_SIZE / 512)
+
+// a dirty page of the batch and where it lives on disk
+struct writeback_page
+{
+	vfs_node* device;			// 0 => the file could not locate the page, so it is written with vfs_sync
+	uint32 lba;
+	uint32 gfd;
+	uint32 page;
+	virtual_addr buffer;
+};
+
+// private data
+
+static TCB_node* writeback_daemon = 0;
+static semaphore writeback_sem = { 1 };						// one pass at a time (the daemon or a throttled writer)
+static writeback_stats writeback_info;
+
+// private functions
+
+// asks the file system for the device sectors of the page
+void writeback_locate(vfs_node* file, writeback_page* p)
+{
+	vfs_node* device = 0;
+	uint32 lba = 0;
+
+	// file systems that do not know the command leave the device unset
+	if (file->fs_ops->fs_ioctl != 0 && file->fs_ops->fs_ioctl(file, VFS_IOCTL_BMAP, p->page, &device, &lba) == ERROR_OK)
+	{
+		p->device = device;
+		p->lba = lba;
+	}
+	else
+		p->device = 0;
+}
+
+// gathers up to max dirty pages starting at the cursor (file and page), which is advanced past them. The page cache
+// cleans and locks them in the same step, so none is evicted or reused before its write ends
+uint32 writeback_collect(writeback_page* list, uint32 max, uint32* next_gfd, uint32* next_page)
+{
+	uint32 pages[WRITEBACK_BATCH];
+	virtual_addr buffers[WRITEBACK_BATCH];
+	uint32 count = 0;
+
+	while (count < max && *next_gfd < gft_get_table()->count)
+	{
+		gfe* entry = &gft_get_table()->data[*next_gfd];
+		uint32 wanted = max - count;
+		uint32 found = 0;
+
+		if (entry->file_node != 0 && entry->pages.count != 0)
+			found = page_cache_begin_writeback(*next_gfd, *next_page, 0xFFFFFFFF, pages, buffers, wanted);
+
+		for (uint32 i = 0; i < found; i++, count++)
+		{
+			list[count].gfd = *next_gfd;
+			list[count].page = pages[i];
+			list[count].buffer = buffers[i];
+
+			writeback_locate(entry->file_node, &list[count]);
+		}
+
+		// the file may have more dirty pages past the batch
+		if (found == wanted && pages[found - 1] != 0xFFFFFFFF)
+			*next_page = pages[found - 1] + 1;
+		else
+		{
+			(*next_gfd)++;
+			*next_page = 0;
+		}
+	}
+
+	return count;
+}
+
+// sorts the batch by device and sector (insertion sort, the batch is small and mostly in order already)
+void writeback_sort(writeback_page* list, uint32 count)
+{
+	for (uint32 i = 1; i < count; i++)
+	{
+		writeback_page p = list[i];
+		uint32 j = i;
+
+		while (j > 0 && (list[j - 1].device > p.device || (list[j - 1].device == p.device && list[j - 1].lba > p.lba)))
+		{
+			list[j] = list[j - 1];
+			j--;
+		}
+
+		list[j] = p;
+	}
+}
+
+// returns the length of the run of pages at the start of the list that one request can write
+uint32 writeback_run_length(writeback_page* list, uint32 count)
+{
+	if (list[0].device == 0)
+		return 1;
+
+	uint32 length = 1;
+	while (length < count && length < WRITEBACK_MAX_RUN && list[length].device == list[0].device &&
+		list[length].lba == list[length - 1].lba + WRITEBACK_PAGE_SECTORS)
+		length++;
+
+	return length;
+}
+
+// writes a run of pages to consecutive sectors of its device
+error_t writeback_write_run(writeback_page* run, uint32 count)
+{
+	vfs_node* device = run[0].device;
+
+	if (device == 0)
+	{
+		writeback_info.requests++;
+		return vfs_sync(run[0].gfd, gft_get(run[0].gfd)->file_node, run[0].page, run[0].page);
+	}
+
+	virtual_addr buffers[WRITEBACK_MAX_RUN];
+	for (uint32 i = 0; i < count; i++)
+		buffers[i] = run[i].buffer;
+
+	uint32 written = 0;
+	if (device->fs_ops->fs_ioctl != 0 &&
+		device->fs_ops->fs_ioctl(device, MASS_STORAGE_IOCTL_WRITE_PAGES, run[0].lba, count, buffers, &written) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	if (written == count)
+	{
+		writeback_info.requests++;
+		return ERROR_OK;
+	}
+
+	// the device does not take page vectors
+	for (uint32 i = written; i < count; i++)
+	{
+		if (vfs_write_file(0, device, run[i].lba, WRITEBACK_PAGE_SECTORS, run[i].buffer) != WRITEBACK_PAGE_SECTORS)
+			return set_last_error(EIO, WRITEBACK_IO_ERROR, EO_WRITEBACK);
+
+		writeback_info.requests++;
+	}
+
+	return ERROR_OK;
+}
+
+// writes back a sorted batch of collected (clean and locked) pages without the page cache lock and returns the pages
+// that failed
+uint32 writeback_write_batch(writeback_page* list, uint32 count)
+{
+	uint32 failed = 0;
+
+	for (uint32 i = 0; i < count; )
+	{
+		uint32 length = writeback_run_length(list + i, count - i);
+		error_t result = writeback_write_run(list + i, length);
+
+		for (uint32 j = i; j < i + length; j++)
+			page_cache_end_writeback(list[j].gfd, list[j].page, list[j].buffer, result == ERROR_OK);
+
+		if (result != ERROR_OK)
+		{
+			serial_printf("writeback: could not write gfd %u page %u: %e\n", list[i].gfd, list[i].page, get_last_error());
+			failed += length;
+		}
+
+		i += length;
+	}
+
+	writeback_info.pages += count - failed;
+	writeback_info.errors += failed;
+
+	return failed;
+}
+
+void writeback_thread()
+{
+	while (true)
+	{
+		thread_sleep(thread_get_current_node(), WRITEBACK_INTERVAL);
+
+		writeback_run(0xFFFFFFFF);
+		writeback_info.passes++;
+	}
+}
+
+// public functions
+
+error_t init_writeback()
+{
+	virtual_addr krnl_stack = kernel_stack_reserve();
+	if (krnl_stack == 0)
+		return set_last_error(ENOMEM, WRITEBACK_NO_STACK, EO_WRITEBACK);
+
+	// parent is the kernel init thread. It runs below the interactive threads
+	writeback_daemon = thread_insert(thread_create(thread_get_current()->parent, (uint32)writeback_thread, krnl_stack, 4 KB, 5, 0));
+	return ERROR_OK;
+}
+
+uint32 writeback_run(uint32 max)
+{
+	writeback_page list[WRITEBACK_BATCH];
+	uint32 next_gfd = 0, next_page = 0;
+	uint32 written = 0;
+
+	semaphore_wait(&writeback_sem);
+
+	// the cursor only moves forward, so pages that fail are not retried before the next pass
+	while (written < max)
+	{
+		uint32 count = writeback_collect(list, min(max - written, WRITEBACK_BATCH), &next_gfd, &next_page);
+		if (count == 0)
+			break;
+
+		writeback_sort(list, count);
+		written += count - writeback_write_batch(list, count);
+	}
+
+	semaphore_signal(&writeback_sem);
+	return written;
+}
+
+void writeback_balance_dirty()
+{
+	page_cache_stats stats = page_cache_get_stats();
+
+	if (stats.dirty * 100 <= stats.buffers * WRITEBACK_DIRTY_RATIO)
+		return;
+
+	writeback_info.throttled++;
+	writeback_run(stats.dirty - stats.buffers * WRITEBACK_BACKGROUND_RATIO / 100);
+}
+
+writeback_stats writeback_get_stats()
+{
+	return writeback_info;
+}
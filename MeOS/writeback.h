@@ -0,0 +1,58 @@
+#ifndef WRITEBACK_H_16102026
+#define WRITEBACK_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Background writeback of dirty page cache pages.
+
+	A kernel thread wakes every WRITEBACK_INTERVAL milliseconds and writes back the dirty pages of every open file. Each
+	batch of pages is located on disk with the VFS_IOCTL_BMAP ioctl of the file, sorted by device and sector, and written
+	as runs of adjacent pages with a single MASS_STORAGE_IOCTL_WRITE_PAGES request per run (one scatter-gather command on
+	AHCI). Files that cannot locate their pages are written with vfs_sync, and devices that ignore the request get one
+	write per page.
+
+	A page is marked clean and its frame locked under the page cache lock as it is collected, and the lock is dropped for
+	the writes: the page cache does not evict it under the transfer, and a write to it in the meantime dirties it again.
+	A failed write dirties it again too.
+
+	Writers are throttled. Once more than WRITEBACK_DIRTY_RATIO percent of the cache is dirty, the thread that dirties a
+	page writes back itself until WRITEBACK_BACKGROUND_RATIO percent is left.
+*/
+
+#define WRITEBACK_INTERVAL			500		// milliseconds between two passes of the daemon
+#define WRITEBACK_BATCH				32		// dirty pages located, sorted and written at a time
+#define WRITEBACK_MAX_RUN			16		// adjacent pages written with one request
+#define WRITEBACK_DIRTY_RATIO		50		// percent of the page cache that may be dirty before writers are throttled
+#define WRITEBACK_BACKGROUND_RATIO	25		// percent of dirty pages a throttled writer brings the cache down to
+
+enum WRITEBACK_ERROR
+{
+	WRITEBACK_NONE,
+	WRITEBACK_NO_STACK,
+	WRITEBACK_IO_ERROR
+};
+
+struct writeback_stats
+{
+	uint32 passes;				// daemon passes so far
+	uint32 pages;				// pages written back
+	uint32 requests;			// device requests that wrote them (pages / requests is the mean run length)
+	uint32 throttled;			// writes that had to write back before returning
+	uint32 errors;				// pages dirtied again after a failed write
+};
+
+// starts the writeback daemon. The scheduler must be running and the page cache ready
+error_t init_writeback();
+
+// writes back up to max dirty pages of the open files in sector order, and returns the number written
+uint32 writeback_run(uint32 max);
+
+// called after pages are dirtied. Writes back in the caller's context while the cache is over the dirty ratio
+void writeback_balance_dirty();
+
+// returns the writeback statistics
+writeback_stats writeback_get_stats();
+
+#endif
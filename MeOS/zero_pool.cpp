@@ -0,0 +1,148 @@
+#include "zero_pool.h"
+#include "mmngr_phys.h"
+#include "mmngr_virtual.h"
+#include "critlock.h"
+#include "page_frame.h"
+#include "spinlock.h"
+
+// private data
+
+static physical_addr zero_pool_frames[ZERO_POOL_MAX_FRAMES];		// stack of zeroed frames
+static zero_pool_stats zero_pool_info;
+static bool zero_pool_filled = false;								// the pool has been full at least once (low_mark is meaningful)
+static pt_entry* zero_pool_window_page = 0;							// page table entry of the zeroing window
+static spinlock zero_pool_window_lock = 0;							// one zeroing through the window at a time
+static physical_addr zero_pool_zero_page = 0;						// shared read-only zero frame
+
+// private functions
+
+// zeroes the frame through the window. The window is shared by every refill caller (idle thread, tests) and is not counted as
+// a mapping
+void zero_pool_clear_frame(physical_addr frame)
+{
+	spinlock_acquire(&zero_pool_window_lock);
+
+	*zero_pool_window_page = 0;
+	pt_entry_set_frame(zero_pool_window_page, frame);
+	pt_entry_add_attrib(zero_pool_window_page, I86_PTE_PRESENT | I86_PTE_WRITABLE);
+	vmmngr_flush_TLB_entry(ZERO_POOL_WINDOW);
+
+	memset((void*)ZERO_POOL_WINDOW, 0, PAGE_SIZE);
+
+	*zero_pool_window_page = 0;
+	vmmngr_flush_TLB_entry(ZERO_POOL_WINDOW);
+
+	spinlock_release(&zero_pool_window_lock);
+}
+
+// public functions
+
+error_t init_zero_pool()
+{
+	pdirectory* dir = vmmngr_get_directory();
+	pd_entry* e = vmmngr_pdirectory_lookup_entry(dir, ZERO_POOL_WINDOW);
+
+	// the table is created now, in the kernel directory, so that every address space shares it
+	if (pd_entry_is_present(*e) == false && vmmngr_create_table(dir, ZERO_POOL_WINDOW, DEFAULT_FLAGS) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	zero_pool_window_page = vmmngr_ptable_lookup_entry((ptable*)pd_entry_get_frame(*e), ZERO_POOL_WINDOW);
+	if (zero_pool_window_page == 0)
+		return ERROR_OCCUR;
+
+	memset(&zero_pool_info, 0, sizeof(zero_pool_stats));
+	zero_pool_info.capacity = ZERO_POOL_MAX_FRAMES;
+
+	zero_pool_zero_page = (physical_addr)pmmngr_alloc_block();
+	if (zero_pool_zero_page == 0)
+		return ERROR_OCCUR;
+
+	zero_pool_clear_frame(zero_pool_zero_page);
+	page_frame_set_flags(zero_pool_zero_page, PAGE_FRAME_PINNED | PAGE_FRAME_UNCOUNTED);
+
+	return ERROR_OK;
+}
+
+uint32 zero_pool_refill(uint32 max)
+{
+	if (zero_pool_window_page == 0)
+		return 0;
+
+	uint32 added = 0;
+
+	while (added < max && zero_pool_info.count < ZERO_POOL_MAX_FRAMES)
+	{
+		critlock_acquire();
+		physical_addr frame = (physical_addr)pmmngr_alloc_block();
+		critlock_release();
+
+		if (frame == 0)
+			break;
+
+		// the zeroing itself runs with interrupts on
+		zero_pool_clear_frame(frame);
+
+		critlock_acquire();
+
+		// another refill may have filled the pool while this frame was zeroed
+		if (zero_pool_info.count == ZERO_POOL_MAX_FRAMES)
+		{
+			pmmngr_free_block((void*)frame);
+			critlock_release();
+			break;
+		}
+
+		zero_pool_frames[zero_pool_info.count++] = frame;
+		zero_pool_info.zeroed++;
+
+		if (zero_pool_info.count == ZERO_POOL_MAX_FRAMES && zero_pool_filled == false)
+		{
+			zero_pool_filled = true;
+			zero_pool_info.low_mark = ZERO_POOL_MAX_FRAMES;
+		}
+
+		critlock_release();
+		added++;
+	}
+
+	return added;
+}
+
+physical_addr zero_pool_alloc_frame()
+{
+	physical_addr frame = 0;
+
+	critlock_acquire();
+
+	if (zero_pool_info.count > 0)
+	{
+		frame = zero_pool_frames[--zero_pool_info.count];
+		zero_pool_info.hits++;
+
+		if (zero_pool_filled && zero_pool_info.count < zero_pool_info.low_mark)
+			zero_pool_info.low_mark = zero_pool_info.count;
+	}
+	else
+	{
+		zero_pool_info.misses++;
+		zero_pool_info.low_mark = 0;
+	}
+
+	critlock_release();
+
+	return frame;
+}
+
+physical_addr zero_pool_get_zero_page()
+{
+	return zero_pool_zero_page;
+}
+
+zero_pool_stats zero_pool_get_stats()
+{
+	critlock_acquire();
+	zero_pool_stats stats = zero_pool_info;
+	critlock_release();
+
+	return stats;
+}
@@ -0,0 +1,46 @@
+#ifndef ZERO_POOL_H_16102026
+#define ZERO_POOL_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Pool of pre-zeroed physical frames for anonymous page faults.
+	The idle thread allocates frames, zeroes them through a private kernel window and stacks them here, so a fault
+	only pops a frame instead of clearing a page on its critical path. Frames in the pool keep their allocation reference,
+	which the mapping takes over.
+
+	The module also owns the shared zero page: a single read-only zeroed frame that read faults on untouched anonymous
+	memory map until the first write.
+*/
+
+#define ZERO_POOL_MAX_FRAMES	256				// pool capacity (1MB of zeroed memory)
+#define ZERO_POOL_BATCH			8				// frames zeroed by a single refill call
+#define ZERO_POOL_WINDOW		0xDA000000		// kernel virtual page through which the frames are zeroed
+
+struct zero_pool_stats
+{
+	uint32 count;			// zeroed frames currently in the pool
+	uint32 capacity;		// maximum frames in the pool
+	uint32 low_mark;		// lowest count seen since the pool was filled for the first time
+	uint32 hits;			// frames handed out from the pool
+	uint32 misses;			// requests that found the pool empty
+	uint32 zeroed;			// frames zeroed by the refill thread
+};
+
+// prepares the zeroing window and the shared zero page. Must be called once paging and the page frame database are ready, before any process is created
+error_t init_zero_pool();
+
+// zeroes up to 'max' frames and adds them to the pool. Returns the number of frames added (0 when the pool is full or memory is out)
+uint32 zero_pool_refill(uint32 max);
+
+// pops a zeroed frame in O(1). Returns 0 if the pool is empty
+physical_addr zero_pool_alloc_frame();
+
+// returns the frame of the shared zero page (0 before init_zero_pool)
+physical_addr zero_pool_get_zero_page();
+
+// returns the pool statistics
+zero_pool_stats zero_pool_get_stats();
+
+#endif
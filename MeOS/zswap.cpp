@@ -0,0 +1,293 @@
+#include "zswap.h"
+#include "lz4.h"
+#include "mmngr_phys.h"
+#include "mmngr_virtual.h"
+#include "error.h"
+
+// private data
+
+#define ZSWAP_POOL_UNITS		(ZSWAP_POOL_PAGES * PAGE_SIZE / ZSWAP_UNIT)
+
+struct zswap_entry
+{
+	uint16 unit;			// first pool unit of the compressed page
+	uint16 size;			// compressed size in bytes (0 => the slot is not in the pool)
+	uint32 prev;			// newer slot in the LRU list (INVALID_FD at the head)
+	uint32 next;			// older slot in the LRU list (INVALID_FD at the tail)
+};
+
+static zswap_entry* zswap_index = (zswap_entry*)ZSWAP_INDEX_BASE;
+static uint32 zswap_slots = 0;										// slots covered by the index (0 => not initialized)
+static uint32 zswap_bitmap[ZSWAP_POOL_UNITS / 32];					// set bit => unit in use
+static uint32 zswap_lru_head = INVALID_FD;							// most recently stored slot
+static uint32 zswap_lru_tail = INVALID_FD;							// least recently stored slot
+static zswap_stats zswap_info;
+
+static uint16 zswap_hash[LZ4_HASH_SIZE];							// compressor work table
+static uint8 zswap_buffer[ZSWAP_MAX_STORE];							// compressed page before it is placed in the pool
+static uint32 zswap_pending_slot = INVALID_FD;						// slot whose page zswap_buffer holds (retried after a demotion)
+static uint32 zswap_pending_size = 0;
+
+// private functions
+
+inline bool zswap_unit_test(uint32 unit)
+{
+	return zswap_bitmap[unit / 32] & (1 << (unit % 32));
+}
+
+inline void zswap_unit_set(uint32 unit, bool used)
+{
+	if (used)
+		zswap_bitmap[unit / 32] |= 1 << (unit % 32);
+	else
+		zswap_bitmap[unit / 32] &= ~(1 << (unit % 32));
+}
+
+inline uint32 zswap_units(uint32 size)
+{
+	return (size + ZSWAP_UNIT - 1) / ZSWAP_UNIT;
+}
+
+inline uint8* zswap_unit_address(uint32 unit)
+{
+	return (uint8*)(ZSWAP_POOL_BASE + unit * ZSWAP_UNIT);
+}
+
+// first fit search for count contiguous free units. Returns the first unit or INVALID_FD
+uint32 zswap_pool_alloc(uint32 count)
+{
+	uint32 run = 0;
+
+	for (uint32 unit = 0; unit < ZSWAP_POOL_UNITS; unit++)
+	{
+		// skip fully used words
+		if (unit % 32 == 0 && zswap_bitmap[unit / 32] == 0xFFFFFFFF)
+		{
+			unit += 31;
+			run = 0;
+			continue;
+		}
+
+		if (zswap_unit_test(unit))
+		{
+			run = 0;
+			continue;
+		}
+
+		if (++run == count)
+		{
+			uint32 first = unit + 1 - count;
+
+			for (uint32 i = first; i <= unit; i++)
+				zswap_unit_set(i, true);
+
+			zswap_info.pool_used += count * ZSWAP_UNIT;
+			return first;
+		}
+	}
+
+	return INVALID_FD;
+}
+
+void zswap_pool_free(uint32 first, uint32 count)
+{
+	for (uint32 i = first; i < first + count; i++)
+		zswap_unit_set(i, false);
+
+	zswap_info.pool_used -= count * ZSWAP_UNIT;
+}
+
+// inserts the slot at the head (newest end) of the LRU list
+void zswap_lru_push(uint32 slot)
+{
+	zswap_entry* e = &zswap_index[slot];
+	e->prev = INVALID_FD;
+	e->next = zswap_lru_head;
+
+	if (zswap_lru_head != INVALID_FD)
+		zswap_index[zswap_lru_head].prev = slot;
+	else
+		zswap_lru_tail = slot;
+
+	zswap_lru_head = slot;
+}
+
+void zswap_lru_unlink(uint32 slot)
+{
+	zswap_entry* e = &zswap_index[slot];
+
+	if (e->prev != INVALID_FD)
+		zswap_index[e->prev].next = e->next;
+	else
+		zswap_lru_head = e->next;
+
+	if (e->next != INVALID_FD)
+		zswap_index[e->next].prev = e->prev;
+	else
+		zswap_lru_tail = e->prev;
+}
+
+error_t zswap_decompress(uint32 slot, virtual_addr page)
+{
+	zswap_entry* e = &zswap_index[slot];
+
+	if (lz4_decompress(zswap_unit_address(e->unit), e->size, (uint8*)page, PAGE_SIZE) != PAGE_SIZE)
+	{
+		set_last_error(EIO, ZSWAP_CORRUPTED, EO_ZSWAP);
+		return ERROR_OCCUR;
+	}
+
+	return ERROR_OK;
+}
+
+// maps the not yet present pages of the kernel range
+error_t zswap_map_range(virtual_addr base, uint32 size)
+{
+	for (virtual_addr addr = base; addr < base + size; addr += PAGE_SIZE)
+	{
+		if (vmmngr_is_page_present(addr) == false && vmmngr_alloc_page(addr) != ERROR_OK)
+		{
+			set_last_error(ENOMEM, ZSWAP_OUT_OF_MEM, EO_ZSWAP);
+			return ERROR_OCCUR;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+// public functions
+
+error_t init_zswap(uint32 slots)
+{
+	if (slots == 0 || slots > ZSWAP_MAX_SLOTS)
+	{
+		set_last_error(EINVAL, ZSWAP_BAD_ARGUMENT, EO_ZSWAP);
+		return ERROR_OCCUR;
+	}
+
+	uint32 index_size = pmmngr_get_next_align(slots * sizeof(zswap_entry));
+
+	if (zswap_map_range(ZSWAP_POOL_BASE, ZSWAP_POOL_PAGES * PAGE_SIZE) != ERROR_OK ||
+		zswap_map_range(ZSWAP_INDEX_BASE, index_size) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	memset(zswap_index, 0, index_size);
+	memset(zswap_bitmap, 0, sizeof(zswap_bitmap));
+	memset(&zswap_info, 0, sizeof(zswap_stats));
+	zswap_info.pool_size = ZSWAP_POOL_PAGES * PAGE_SIZE;
+
+	zswap_lru_head = zswap_lru_tail = INVALID_FD;
+	zswap_pending_slot = INVALID_FD;
+	zswap_slots = slots;
+
+	return ERROR_OK;
+}
+
+bool zswap_enabled()
+{
+	return zswap_slots != 0;
+}
+
+error_t zswap_store(uint32 slot, virtual_addr page)
+{
+	if (zswap_slots == 0)
+	{
+		set_last_error(EINVAL, ZSWAP_NOT_INITIALIZED, EO_ZSWAP);
+		return ERROR_OCCUR;
+	}
+
+	if (slot >= zswap_slots)
+	{
+		set_last_error(EINVAL, ZSWAP_BAD_ARGUMENT, EO_ZSWAP);
+		return ERROR_OCCUR;
+	}
+
+	// a retry after the pool was full reuses the compressed page
+	if (zswap_pending_slot != slot)
+	{
+		zswap_invalidate(slot);
+
+		zswap_pending_size = lz4_compress((uint8*)page, PAGE_SIZE, zswap_buffer, ZSWAP_MAX_STORE, zswap_hash);
+		if (zswap_pending_size == 0)
+		{
+			zswap_info.rejected++;
+			set_last_error(EFBIG, ZSWAP_INCOMPRESSIBLE, EO_ZSWAP);
+			return ERROR_OCCUR;
+		}
+
+		zswap_pending_slot = slot;
+	}
+
+	uint32 unit = zswap_pool_alloc(zswap_units(zswap_pending_size));
+	if (unit == INVALID_FD)
+	{
+		set_last_error(ENOSPC, ZSWAP_POOL_FULL, EO_ZSWAP);
+		return ERROR_OCCUR;
+	}
+
+	memcpy(zswap_unit_address(unit), zswap_buffer, zswap_pending_size);
+
+	zswap_entry* e = &zswap_index[slot];
+	e->unit = (uint16)unit;
+	e->size = (uint16)zswap_pending_size;
+	zswap_lru_push(slot);
+
+	zswap_info.stored++;
+	zswap_info.stores++;
+	zswap_info.compressed_bytes += zswap_pending_size;
+	zswap_pending_slot = INVALID_FD;
+
+	return ERROR_OK;
+}
+
+error_t zswap_load(uint32 slot, virtual_addr page)
+{
+	if (zswap_is_stored(slot) == false)
+	{
+		zswap_info.misses++;
+		set_last_error(ENOENT, ZSWAP_BAD_ARGUMENT, EO_ZSWAP);
+		return ERROR_OCCUR;
+	}
+
+	if (zswap_decompress(slot, page) != ERROR_OK)
+		return ERROR_OCCUR;
+
+	zswap_info.hits++;
+	return ERROR_OK;
+}
+
+bool zswap_is_stored(uint32 slot)
+{
+	return slot < zswap_slots && zswap_index[slot].size != 0;
+}
+
+uint32 zswap_demote(virtual_addr page)
+{
+	if (zswap_lru_tail == INVALID_FD || zswap_decompress(zswap_lru_tail, page) != ERROR_OK)
+		return INVALID_FD;
+
+	return zswap_lru_tail;
+}
+
+void zswap_invalidate(uint32 slot)
+{
+	if (slot == zswap_pending_slot)
+		zswap_pending_slot = INVALID_FD;
+
+	if (zswap_is_stored(slot) == false)
+		return;
+
+	zswap_entry* e = &zswap_index[slot];
+
+	zswap_lru_unlink(slot);
+	zswap_pool_free(e->unit, zswap_units(e->size));
+
+	zswap_info.stored--;
+	zswap_info.compressed_bytes -= e->size;
+	e->size = 0;
+}
+
+zswap_stats zswap_get_stats()
+{
+	return zswap_info;
+}
@@ -0,0 +1,71 @@
+#ifndef ZSWAP_H_16102026
+#define ZSWAP_H_16102026
+
+#include "types.h"
+#include "utility.h"
+
+/*
+	Compressed in-memory swap tier that sits in front of the swap file.
+
+	An evicted page is LZ4 compressed into a fixed pool of kernel memory, carved in ZSWAP_UNIT sized units, and indexed by
+	its swap slot. Only pages that do not compress well, or that the pool cannot hold even after demotion, go to disk.
+	Stored pages form an LRU list: when the pool is full the swap manager demotes the oldest ones to their slot of the
+	swap file. The tier is driven by the swap manager, which serializes every call with its lock.
+*/
+
+#define ZSWAP_POOL_BASE			0xDA100000		// kernel virtual address of the compressed pool
+#define ZSWAP_POOL_PAGES		256				// pool size in pages (1MB)
+#define ZSWAP_UNIT				64				// pool allocation granularity in bytes
+#define ZSWAP_MAX_STORE			3072			// pages compressing to more bytes go straight to disk
+#define ZSWAP_INDEX_BASE		0xDA200000		// kernel virtual address of the per-slot index
+#define ZSWAP_MAX_SLOTS			131072			// slots the index can describe (1.5MB of index)
+
+enum ZSWAP_ERROR
+{
+	ZSWAP_NONE,
+	ZSWAP_NOT_INITIALIZED,
+	ZSWAP_BAD_ARGUMENT,
+	ZSWAP_INCOMPRESSIBLE,
+	ZSWAP_POOL_FULL,
+	ZSWAP_CORRUPTED,
+	ZSWAP_OUT_OF_MEM
+};
+
+struct zswap_stats
+{
+	uint32 pool_size;			// bytes of the pool
+	uint32 pool_used;			// bytes of the pool holding compressed pages (unit rounded)
+	uint32 stored;				// pages currently in the pool
+	uint32 compressed_bytes;	// exact compressed size of the stored pages
+	uint32 stores;				// pages compressed into the pool so far
+	uint32 rejected;			// pages that compressed to more than ZSWAP_MAX_STORE bytes
+	uint32 hits;				// swap ins served from the pool
+	uint32 misses;				// swap ins that found their page on disk
+};
+
+// maps the pool and an index for 'slots' swap slots. Must be called before any process other than process 0 is created
+error_t init_zswap(uint32 slots);
+
+// returns true once the pool is ready
+bool zswap_enabled();
+
+// compresses the page at 'page' into the pool for the slot. Fails with ZSWAP_INCOMPRESSIBLE or ZSWAP_POOL_FULL
+error_t zswap_store(uint32 slot, virtual_addr page);
+
+// decompresses the page of the slot to 'page', keeping it in the pool. Fails if the slot is not in the pool (a miss)
+error_t zswap_load(uint32 slot, virtual_addr page);
+
+// returns true if the page of the slot is in the pool
+bool zswap_is_stored(uint32 slot);
+
+// decompresses the least recently stored page to 'page' and returns its slot, or INVALID_FD if the pool is empty.
+// The page stays in the pool until the caller, having written it elsewhere, invalidates the slot
+uint32 zswap_demote(virtual_addr page);
+
+// drops the page of the slot from the pool (if there)
+void zswap_invalidate(uint32 slot);
+
+// returns the pool statistics
+zswap_stats zswap_get_stats();
+
+#endif